@@ -0,0 +1,252 @@
+/*!
+ * \file axiom-ethtap-rdma.c
+ *
+ * \version     v1.2
+ *
+ * RDMA data path of axiom-ethtap for large (GSO) frames.
+ *
+ * The RDMA zone of every node is split in num_nodes equal areas: the area of
+ * node i is the receive ring of the frames sent by node i, while the area of
+ * the local node holds the staging slots of the tap queues. A frame is read
+ * from the tap directly in a staging slot, written with one RDMA write in the
+ * ring of the destination and announced by a small raw doorbell; the
+ * destination writes it from the ring to its tap and returns the free slots
+ * (credits) in batches.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "axiom_nic_api_user.h"
+#include "axiom_nic_limits.h"
+
+#include "axiom_common.h"
+#include "axiom-ethtap.h"
+
+/** Head room of a slot: the frame after the virtio header is aligned. */
+#define SLOT_HEAD 16
+/** Size of a ring slot. */
+#define SLOT_SIZE (((SLOT_HEAD + FRAME_MAX) + 4095) & ~(size_t)4095)
+/** Max slots of a ring (the completion bitmap is 64 bits). */
+#define MAX_SLOTS 64
+
+/** Transmit side of the ring in a peer. */
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t head;      /**< next slot to write */
+    uint32_t credits;   /**< free slots */
+} rdma_tx_t;
+
+/** Receive side of the ring of a peer. */
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t tail;      /**< oldest slot in use */
+    uint64_t done;      /**< slots written to the tap, not yet retired */
+    uint32_t pending;   /**< retired slots, credits not yet returned */
+} rdma_rx_t;
+
+static axiom_dev_t *rdma_dev;
+static int rdma_port;
+static int rdma_node;
+/** Local RDMA zone (NULL if the RDMA data path is disabled). */
+static uint8_t *zone;
+static uint64_t zone_size;
+/** Size of the area of every node. */
+static size_t area_size;
+/** Slots of every ring. */
+static uint32_t num_slots;
+/** Credits returned in a single message. */
+static uint32_t credit_batch;
+static int staging_queues;
+static rdma_tx_t rdma_tx[AXIOM_NODES_NUM];
+static rdma_rx_t rdma_rx[AXIOM_NODES_NUM];
+
+int ethtap_rdma_init(axiom_dev_t *dev, int port, int my_node, int num_nodes,
+        int num_queues) {
+    int i;
+
+    if (num_nodes < 2) return -1;
+
+    zone = axiom_rdma_mmap(dev, &zone_size);
+    if (zone == NULL) {
+        elogmsg("axiom_rdma_mmap()");
+        return -1;
+    }
+
+    /* every node computes the same layout from the size of the zone */
+    area_size = (zone_size / num_nodes) & ~(size_t)4095;
+    num_slots = area_size / SLOT_SIZE;
+    if (num_slots > MAX_SLOTS) num_slots = MAX_SLOTS;
+    if (num_slots < 2 || num_slots < (uint32_t)num_queues) {
+        logmsg(LOG_WARN, "RDMA zone too small (%lu bytes): RDMA data path disabled",
+                (unsigned long)zone_size);
+        axiom_rdma_munmap(dev);
+        zone = NULL;
+        return -1;
+    }
+    credit_batch = num_slots / 4 > 0 ? num_slots / 4 : 1;
+
+    rdma_dev = dev;
+    rdma_port = port;
+    rdma_node = my_node;
+    staging_queues = num_queues;
+    for (i = 0; i < AXIOM_NODES_NUM; i++) {
+        pthread_mutex_init(&rdma_tx[i].lock, NULL);
+        rdma_tx[i].credits = num_slots;
+        pthread_mutex_init(&rdma_rx[i].lock, NULL);
+    }
+
+    logmsg(LOG_INFO, "RDMA data path: %u slots of %lu bytes for each peer",
+            num_slots, (unsigned long)SLOT_SIZE);
+
+    return 0;
+}
+
+/* offset of a slot in the RDMA zone of a node */
+static inline size_t slot_offset(int area_node, uint32_t slot) {
+    return (area_node - 1) * area_size + slot * SLOT_SIZE;
+}
+
+uint8_t *ethtap_rdma_staging(int queue) {
+    if (zone == NULL || queue >= staging_queues) return NULL;
+    return zone + slot_offset(rdma_node, queue) + SLOT_HEAD -
+        sizeof(struct virtio_net_hdr);
+}
+
+/*
+ * Give back a slot whose frame was not delivered: if no other frame took a
+ * slot after it, the slot is reused by the next frame, otherwise a skip
+ * doorbell asks the destination to retire it (the ring is retired in order).
+ */
+static void drop_slot(int node, frag_hdr_t *hdr, uint32_t slot) {
+    rdma_tx_t *tx = &rdma_tx[node];
+    frag_hdr_t skip;
+    axiom_err_t ret;
+
+    pthread_mutex_lock(&tx->lock);
+    if (tx->head == (slot + 1) % num_slots) {
+        tx->head = slot;
+        tx->credits++;
+        pthread_mutex_unlock(&tx->lock);
+        return;
+    }
+    pthread_mutex_unlock(&tx->lock);
+
+    memset(&skip, 0, sizeof(skip));
+    skip.flags = FRAG_RDMA | FRAG_SKIP;
+    skip.offset = slot;
+    skip.queue = hdr->queue;
+    skip.origin = hdr->origin;
+    ret = axiom_send(rdma_dev, node, rdma_port, sizeof(skip), &skip);
+    if (!AXIOM_RET_IS_OK(ret)) {
+        elogmsg("axiom_send() skip doorbell");
+    }
+}
+
+int ethtap_rdma_send(int node, frag_hdr_t *hdr, uint8_t *data, size_t len) {
+    rdma_tx_t *tx = &rdma_tx[node];
+    uint8_t *frame = data + sizeof(struct virtio_net_hdr);
+    size_t frame_len = len - sizeof(struct virtio_net_hdr);
+    struct iovec iov[2];
+    uint32_t slot;
+    axiom_err_t ret;
+
+    if (zone == NULL || data != ethtap_rdma_staging(hdr->queue)) return -1;
+
+    pthread_mutex_lock(&tx->lock);
+    if (tx->credits == 0) {
+        pthread_mutex_unlock(&tx->lock);
+        return -1;
+    }
+    tx->credits--;
+    slot = tx->head;
+    tx->head = (tx->head + 1) % num_slots;
+    pthread_mutex_unlock(&tx->lock);
+
+    /* the ring of the destination for our frames is in our area */
+    ret = axiom_rdma_write_sync(rdma_dev, node,
+            (frame_len + AXIOM_RDMA_ADDRESS_ALIGNMENT - 1) &
+            ~((size_t)AXIOM_RDMA_ADDRESS_ALIGNMENT - 1),
+            (void *)(frame - zone),
+            (void *)(slot_offset(rdma_node, slot) + SLOT_HEAD), NULL);
+    if (!AXIOM_RET_IS_OK(ret)) {
+        elogmsg("axiom_rdma_write_sync()");
+        drop_slot(node, hdr, slot);
+        return -2;
+    }
+
+    /* doorbell: header and virtio header only */
+    hdr->flags |= FRAG_RDMA;
+    hdr->offset = slot;
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(*hdr);
+    iov[1].iov_base = data;
+    iov[1].iov_len = sizeof(struct virtio_net_hdr);
+    ret = axiom_send_iov(rdma_dev, node, rdma_port,
+            iov[0].iov_len + iov[1].iov_len, iov, 2);
+    hdr->flags &= ~FRAG_RDMA;
+    if (!AXIOM_RET_IS_OK(ret)) {
+        elogmsg("axiom_send_iov() doorbell");
+        drop_slot(node, hdr, slot);
+        return -2;
+    }
+
+    return 0;
+}
+
+uint8_t *ethtap_rdma_slot(int origin, uint32_t slot, size_t len) {
+    if (zone == NULL || origin < 1 || origin == rdma_node ||
+            slot >= num_slots || len > FRAME_MAX ||
+            slot_offset(origin, slot) + SLOT_SIZE > zone_size) {
+        return NULL;
+    }
+    return zone + slot_offset(origin, slot) + SLOT_HEAD;
+}
+
+void ethtap_rdma_release(int origin, uint32_t slot) {
+    rdma_rx_t *rx = &rdma_rx[origin];
+    frag_hdr_t hdr;
+    uint32_t credits = 0;
+    axiom_err_t ret;
+
+    /* slots are retired in order, so the sender can reuse them in order */
+    pthread_mutex_lock(&rx->lock);
+    rx->done |= (uint64_t)1 << slot;
+    while (rx->done & ((uint64_t)1 << rx->tail)) {
+        rx->done &= ~((uint64_t)1 << rx->tail);
+        rx->tail = (rx->tail + 1) % num_slots;
+        rx->pending++;
+    }
+    if (rx->pending >= credit_batch) {
+        credits = rx->pending;
+        rx->pending = 0;
+    }
+    pthread_mutex_unlock(&rx->lock);
+
+    if (credits == 0) return;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.flags = FRAG_CREDIT;
+    hdr.offset = credits;
+    hdr.origin = rdma_node;
+    ret = axiom_send(rdma_dev, origin, rdma_port, sizeof(hdr), &hdr);
+    if (!AXIOM_RET_IS_OK(ret)) {
+        elogmsg("axiom_send() credits");
+    }
+}
+
+void ethtap_rdma_credit(int node, uint32_t credits) {
+    rdma_tx_t *tx = &rdma_tx[node];
+
+    if (zone == NULL) return;
+    pthread_mutex_lock(&tx->lock);
+    tx->credits += credits;
+    if (tx->credits > num_slots) tx->credits = num_slots;
+    pthread_mutex_unlock(&tx->lock);
+}
@@ -0,0 +1,481 @@
+/*!
+ * \file axiom-ethtap-stats.c
+ *
+ * \version     v1.2
+ *
+ * Statistics of axiom-ethtap: per-destination counters, per-thread counters
+ * (drops, broadcast fan-out, send latency), event loop costs and a capture
+ * ring of the last frames.
+ *
+ * The statistics are dumped (with the neighbour and multicast tables) on a
+ * file when the daemon receives SIGUSR1, and they are served on a unix
+ * socket: a client sends "stats" (or nothing) to get the text dump or "pcap"
+ * to get the captured frames in pcap format.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "axiom_nic_limits.h"
+
+#include "axiom_common.h"
+#include "axiom-ethtap.h"
+
+/** Max number of registered threads. */
+#define MAX_STATS_THREADS 160
+/** Bytes of every captured frame. */
+#define PCAP_SNAPLEN 256
+/** Wait of the request of a socket client (msec). */
+#define REQUEST_TIMEOUT_MS 100
+/** Max time to send the reply to a socket client (msec). */
+#define REPLY_TIMEOUT_MS 1000
+
+ethtap_node_stats_t ethtap_stats[AXIOM_NODES_NUM];
+ethtap_loop_stats_t ethtap_loop_stats;
+__thread ethtap_thread_stats_t *ethtap_tstats;
+
+/** Counters of the registered threads. */
+static ethtap_thread_stats_t *tstats[MAX_STATS_THREADS];
+/** Number of registered threads. */
+static int tstats_num;
+
+/** File where the statistics are dumped. */
+static const char *stats_filename;
+/** Unix socket where the statistics are served. */
+static const char *stats_sockname;
+
+static const char *drop_names[DROP_NUM] = {
+    "short", "no_route", "bad_dest", "send_error", "tap_write",
+    "bad_fragment", "incomplete", "no_memory"
+};
+
+/** Captured frame. */
+typedef struct {
+    uint32_t seq;       /**< odd while the slot is written */
+    uint32_t sec;
+    uint32_t usec;
+    uint32_t len;       /**< original length */
+    uint8_t data[PCAP_SNAPLEN];
+} pcap_slot_t;
+
+/** Ring of the captured frames (NULL if the capture is disabled). */
+static pcap_slot_t *pcap_ring;
+static uint32_t pcap_size;
+/** Next slot of the ring (never wraps). */
+static uint64_t pcap_next;
+static int pcap_linktype;
+
+int ethtap_stats_thread(const char *name) {
+    ethtap_thread_stats_t *st;
+    int idx;
+
+    st = calloc(1, sizeof(*st));
+    if (st == NULL) {
+        elogmsg("calloc()");
+        return -1;
+    }
+    snprintf(st->name, sizeof(st->name), "%s", name);
+
+    idx = __atomic_fetch_add(&tstats_num, 1, __ATOMIC_RELAXED);
+    if (idx >= MAX_STATS_THREADS) {
+        logmsg(LOG_ERROR, "too many threads for the statistics");
+        free(st);
+        return -1;
+    }
+    __atomic_store_n(&tstats[idx], st, __ATOMIC_RELEASE);
+    ethtap_tstats = st;
+
+    return 0;
+}
+
+static void node_stats_dump(FILE *out) {
+    ethtap_node_stats_t st;
+    int n;
+
+    fprintf(out, "%4s %12s %14s %10s %12s %14s %12s\n", "node", "tx_frames",
+            "tx_bytes", "tx_errors", "rx_frames", "rx_bytes", "relayed");
+    for (n = 0; n < AXIOM_NODES_NUM; n++) {
+        st.tx_frames = __atomic_load_n(&ethtap_stats[n].tx_frames, __ATOMIC_RELAXED);
+        st.tx_bytes = __atomic_load_n(&ethtap_stats[n].tx_bytes, __ATOMIC_RELAXED);
+        st.tx_errors = __atomic_load_n(&ethtap_stats[n].tx_errors, __ATOMIC_RELAXED);
+        st.rx_frames = __atomic_load_n(&ethtap_stats[n].rx_frames, __ATOMIC_RELAXED);
+        st.rx_bytes = __atomic_load_n(&ethtap_stats[n].rx_bytes, __ATOMIC_RELAXED);
+        st.relayed = __atomic_load_n(&ethtap_stats[n].relayed, __ATOMIC_RELAXED);
+        if (!st.tx_frames && !st.tx_errors && !st.rx_frames && !st.relayed) {
+            continue;
+        }
+        fprintf(out, "%4d %12" PRIu64 " %14" PRIu64 " %10" PRIu64 " %12" PRIu64
+                " %14" PRIu64 " %12" PRIu64 "\n", n, st.tx_frames, st.tx_bytes,
+                st.tx_errors, st.rx_frames, st.rx_bytes, st.relayed);
+    }
+}
+
+/* add the counters of a thread to sum */
+static void thread_stats_sum(ethtap_thread_stats_t *sum, ethtap_thread_stats_t *st) {
+    int i;
+
+    sum->tx_frames += __atomic_load_n(&st->tx_frames, __ATOMIC_RELAXED);
+    sum->tx_bytes += __atomic_load_n(&st->tx_bytes, __ATOMIC_RELAXED);
+    sum->rx_frames += __atomic_load_n(&st->rx_frames, __ATOMIC_RELAXED);
+    sum->rx_bytes += __atomic_load_n(&st->rx_bytes, __ATOMIC_RELAXED);
+    for (i = 0; i < DROP_NUM; i++) {
+        sum->drops[i] += __atomic_load_n(&st->drops[i], __ATOMIC_RELAXED);
+    }
+    sum->floods += __atomic_load_n(&st->floods, __ATOMIC_RELAXED);
+    sum->flood_msgs += __atomic_load_n(&st->flood_msgs, __ATOMIC_RELAXED);
+    sum->flood_ns += __atomic_load_n(&st->flood_ns, __ATOMIC_RELAXED);
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        sum->send_lat[i] += __atomic_load_n(&st->send_lat[i], __ATOMIC_RELAXED);
+    }
+}
+
+static void thread_stats_dump(FILE *out) {
+    ethtap_thread_stats_t sum, one;
+    int i, t, num;
+
+    num = __atomic_load_n(&tstats_num, __ATOMIC_RELAXED);
+    if (num > MAX_STATS_THREADS) num = MAX_STATS_THREADS;
+    if (num == 0) return;
+
+    memset(&sum, 0, sizeof(sum));
+    fprintf(out, "%-16s %12s %14s %12s %14s %10s\n", "thread", "tx_frames",
+            "tx_bytes", "rx_frames", "rx_bytes", "drops");
+    for (t = 0; t < num; t++) {
+        ethtap_thread_stats_t *st = __atomic_load_n(&tstats[t], __ATOMIC_ACQUIRE);
+        uint64_t drops = 0;
+
+        if (st == NULL) continue;
+        memset(&one, 0, sizeof(one));
+        thread_stats_sum(&one, st);
+        thread_stats_sum(&sum, st);
+        for (i = 0; i < DROP_NUM; i++) drops += one.drops[i];
+        fprintf(out, "%-16s %12" PRIu64 " %14" PRIu64 " %12" PRIu64 " %14" PRIu64
+                " %10" PRIu64 "\n", st->name, one.tx_frames, one.tx_bytes,
+                one.rx_frames, one.rx_bytes, drops);
+    }
+    fprintf(out, "%-16s %12" PRIu64 " %14" PRIu64 " %12" PRIu64 " %14" PRIu64 "\n",
+            "total", sum.tx_frames, sum.tx_bytes, sum.rx_frames, sum.rx_bytes);
+
+    fprintf(out, "drops:");
+    for (i = 0; i < DROP_NUM; i++) {
+        fprintf(out, " %s=%" PRIu64, drop_names[i], sum.drops[i]);
+    }
+    fputc('\n', out);
+
+    if (sum.floods > 0) {
+        fprintf(out, "floods: %" PRIu64 " frames, %.2f copies/frame, %.2f usec/frame\n",
+                sum.floods, (double)sum.flood_msgs / sum.floods,
+                sum.flood_ns / 1000.0 / sum.floods);
+    }
+
+    fprintf(out, "send latency (usec):");
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        if (sum.send_lat[i] == 0) continue;
+        if (i == 0) {
+            fprintf(out, " <1:%" PRIu64, sum.send_lat[i]);
+        } else if (i == LAT_BUCKETS - 1) {
+            fprintf(out, " >=%u:%" PRIu64, 1u << (i - 1), sum.send_lat[i]);
+        } else {
+            fprintf(out, " %u-%u:%" PRIu64, 1u << (i - 1), (1u << i) - 1, sum.send_lat[i]);
+        }
+    }
+    fputc('\n', out);
+}
+
+static void loop_stats_dump(FILE *out) {
+    ethtap_loop_stats_t st;
+
+    st.frames = __atomic_load_n(&ethtap_loop_stats.frames, __ATOMIC_RELAXED);
+    if (st.frames == 0) return;
+    st.latency_ns = __atomic_load_n(&ethtap_loop_stats.latency_ns, __ATOMIC_RELAXED);
+    st.latency_max_ns = __atomic_load_n(&ethtap_loop_stats.latency_max_ns, __ATOMIC_RELAXED);
+    st.cpu_ns = __atomic_load_n(&ethtap_loop_stats.cpu_ns, __ATOMIC_RELAXED);
+    st.polled = __atomic_load_n(&ethtap_loop_stats.polled, __ATOMIC_RELAXED);
+    st.slept = __atomic_load_n(&ethtap_loop_stats.slept, __ATOMIC_RELAXED);
+    st.busy_poll_ns = __atomic_load_n(&ethtap_loop_stats.busy_poll_ns, __ATOMIC_RELAXED);
+
+    fprintf(out, "event loop: %" PRIu64 " frames, latency avg %.2f usec max %.2f usec, "
+            "cpu %.2f usec/frame\n", st.frames,
+            st.latency_ns / 1000.0 / st.frames, st.latency_max_ns / 1000.0,
+            st.cpu_ns / 1000.0 / st.frames);
+    fprintf(out, "event loop: %" PRIu64 " wakeups by polling, %" PRIu64
+            " after sleeping, busy-poll %.2f usec\n", st.polled, st.slept,
+            st.busy_poll_ns / 1000.0);
+}
+
+void ethtap_stats_dump(FILE *out) {
+    node_stats_dump(out);
+    thread_stats_dump(out);
+    loop_stats_dump(out);
+    ethtap_neigh_dump(out);
+}
+
+int ethtap_pcap_init(int frames, int linktype) {
+    pcap_ring = calloc(frames, sizeof(pcap_slot_t));
+    if (pcap_ring == NULL) {
+        elogmsg("calloc()");
+        return -1;
+    }
+    pcap_linktype = linktype;
+    pcap_size = frames;
+    return 0;
+}
+
+void ethtap_pcap_add(const uint8_t *frame, size_t len) {
+    struct timespec ts;
+    pcap_slot_t *slot;
+    uint32_t seq;
+
+    if (pcap_ring == NULL) return;
+    slot = &pcap_ring[__atomic_fetch_add(&pcap_next, 1, __ATOMIC_RELAXED) % pcap_size];
+
+    /* seqlock: the reader discards the slots changed while it copies them */
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) || !__atomic_compare_exchange_n(&slot->seq, &seq, seq + 1, 0,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        /* another writer lapped the ring on this slot: drop */
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    slot->sec = ts.tv_sec;
+    slot->usec = ts.tv_nsec / 1000;
+    slot->len = len;
+    memcpy(slot->data, frame, len < PCAP_SNAPLEN ? len : PCAP_SNAPLEN);
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int ethtap_pcap_dump(FILE *out) {
+    struct {
+        uint32_t magic;
+        uint16_t major, minor;
+        int32_t zone;
+        uint32_t sigfigs, snaplen, linktype;
+    } fhdr = { 0xa1b2c3d4, 2, 4, 0, 0, PCAP_SNAPLEN, 0 };
+    struct {
+        uint32_t sec, usec, caplen, len;
+    } rhdr;
+    pcap_slot_t *copy;
+    uint64_t next, i;
+    uint32_t seq;
+    int n = 0;
+
+    fhdr.linktype = pcap_linktype;
+    fwrite(&fhdr, sizeof(fhdr), 1, out);
+    if (pcap_ring == NULL) return 0;
+
+    copy = malloc(sizeof(*copy));
+    if (copy == NULL) return 0;
+
+    next = __atomic_load_n(&pcap_next, __ATOMIC_RELAXED);
+    for (i = next > pcap_size ? next - pcap_size : 0; i < next; i++) {
+        pcap_slot_t *slot = &pcap_ring[i % pcap_size];
+
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == 0 || (seq & 1)) continue;
+        memcpy(copy, slot, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) continue;
+
+        rhdr.sec = copy->sec;
+        rhdr.usec = copy->usec;
+        rhdr.len = copy->len;
+        rhdr.caplen = copy->len < PCAP_SNAPLEN ? copy->len : PCAP_SNAPLEN;
+        fwrite(&rhdr, sizeof(rhdr), 1, out);
+        fwrite(copy->data, rhdr.caplen, 1, out);
+        n++;
+    }
+    free(copy);
+
+    return n;
+}
+
+static void *stats_thread(void *data) {
+    sigset_t *set = (sigset_t *)data;
+    FILE *out;
+    int sig;
+
+    for (;;) {
+        if (sigwait(set, &sig) != 0) continue;
+
+        out = fopen(stats_filename, "w");
+        if (out == NULL) {
+            elogmsg("fopen() %s", stats_filename);
+            continue;
+        }
+        ethtap_stats_dump(out);
+        fclose(out);
+        logmsg(LOG_INFO, "statistics dumped on %s", stats_filename);
+    }
+
+    return NULL;
+}
+
+/*
+ * Send the reply to a socket client: a client that does not read it in
+ * REPLY_TIMEOUT_MS is dropped, so it can not stall the next clients.
+ */
+static void socket_reply(int fd, const char *buf, size_t len) {
+    /* the deadline is checked at least ten times */
+    struct timeval tv = { 0, REPLY_TIMEOUT_MS / 10 * 1000 };
+    struct timespec now, end;
+    size_t off;
+    ssize_t n;
+
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += REPLY_TIMEOUT_MS / 1000;
+    end.tv_nsec += (REPLY_TIMEOUT_MS % 1000) * 1000000L;
+    if (end.tv_nsec >= 1000000000L) {
+        end.tv_sec++;
+        end.tv_nsec -= 1000000000L;
+    }
+
+    for (off = 0; off < len; off += n) {
+        n = send(fd, buf + off, len - off, MSG_NOSIGNAL);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            return;
+        }
+        if (now.tv_sec > end.tv_sec ||
+                (now.tv_sec == end.tv_sec && now.tv_nsec >= end.tv_nsec)) {
+            logmsg(LOG_WARN, "statistics client too slow: dropped");
+            return;
+        }
+        if (n < 0) n = 0;
+    }
+}
+
+static void *socket_thread(void *data) {
+    int sock = (int)(intptr_t)data;
+    struct pollfd pfd;
+    char req[16];
+    char *buf;
+    size_t len;
+    ssize_t n;
+    FILE *out;
+    int fd;
+
+    for (;;) {
+        fd = accept(sock, NULL, NULL);
+        if (fd < 0) {
+            elogmsg("accept()");
+            continue;
+        }
+
+        /*
+         * the request is optional: a client that only reads gets the stats
+         * (it is waited for a while, the client can write after connect())
+         */
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        n = 0;
+        if (poll(&pfd, 1, REQUEST_TIMEOUT_MS) > 0) {
+            n = recv(fd, req, sizeof(req) - 1, MSG_DONTWAIT);
+        }
+        req[n > 0 ? n : 0] = '\0';
+
+        /* the reply is built in memory, then sent with a deadline */
+        buf = NULL;
+        len = 0;
+        out = open_memstream(&buf, &len);
+        if (out == NULL) {
+            elogmsg("open_memstream()");
+            close(fd);
+            continue;
+        }
+        if (strncmp(req, "pcap", 4) == 0) {
+            ethtap_pcap_dump(out);
+        } else {
+            ethtap_stats_dump(out);
+        }
+        fclose(out);
+        socket_reply(fd, buf, len);
+        free(buf);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static int socket_start(const char *sockname) {
+    struct sockaddr_un addr;
+    pthread_t th;
+    int sock, err;
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        elogmsg("socket()");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sockname);
+    unlink(sockname);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            listen(sock, 4) < 0) {
+        elogmsg("bind() %s", sockname);
+        close(sock);
+        return -1;
+    }
+
+    err = pthread_create(&th, NULL, socket_thread, (void *)(intptr_t)sock);
+    if (err != 0) {
+        elogmsg("pthread_create()");
+        close(sock);
+        unlink(sockname);
+        return -1;
+    }
+    pthread_detach(th);
+
+    logmsg(LOG_INFO, "statistics served on %s", sockname);
+    return 0;
+}
+
+int ethtap_stats_start(const char *filename, const char *sockname) {
+    static sigset_t set;
+    pthread_t th;
+    int err;
+
+    stats_filename = filename;
+    stats_sockname = sockname;
+
+    /* all the threads created later inherit the mask; SIGPIPE is blocked
+     * too, so a client that closes the socket early does not kill us */
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGPIPE);
+    err = pthread_sigmask(SIG_BLOCK, &set, NULL);
+    if (err != 0) {
+        elogmsg("pthread_sigmask()");
+        return -1;
+    }
+    sigdelset(&set, SIGPIPE);
+
+    err = pthread_create(&th, NULL, stats_thread, &set);
+    if (err != 0) {
+        elogmsg("pthread_create()");
+        return -1;
+    }
+    pthread_detach(th);
+
+    /* the statistics are still available on SIGUSR1 */
+    if (stats_sockname != NULL && socket_start(stats_sockname) < 0) {
+        logmsg(LOG_WARN, "statistics socket disabled");
+    }
+
+    return 0;
+}
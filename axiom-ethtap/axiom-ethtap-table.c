@@ -0,0 +1,231 @@
+/*!
+ * \file axiom-ethtap-table.c
+ *
+ * \version     v1.2
+ *
+ * Neighbour table (MAC address -> node) and multicast group table of
+ * axiom-ethtap.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <linux/if_ether.h>
+
+#include "axiom_nic_limits.h"
+
+#include "axiom_common.h"
+#include "axiom-ethtap.h"
+
+/** Size of the neighbour table (power of two). */
+#define NEIGH_SIZE 1024
+/** Max number of multicast groups. */
+#define MCAST_SIZE 64
+
+/** Neighbour table entry. */
+typedef struct {
+    uint8_t mac[ETH_ALEN];
+    uint8_t used;
+    uint8_t fixed;      /**< loaded from file: never replaced */
+    int node;
+} neigh_entry_t;
+
+/** Multicast group. */
+typedef struct {
+    uint8_t mac[ETH_ALEN];
+    ethtap_nodeset_t members;
+} mcast_entry_t;
+
+/** Neighbour table (open addressing). */
+static neigh_entry_t neigh[NEIGH_SIZE];
+/** Number of used entries of the neighbour table. */
+static int neigh_used;
+/** Multicast groups. */
+static mcast_entry_t mcast[MCAST_SIZE];
+/** Number of multicast groups. */
+static int mcast_used;
+/** Protect the tables. */
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static unsigned neigh_hash(const uint8_t *mac) {
+    unsigned h = 2166136261u;
+    int i;
+    for (i = 0; i < ETH_ALEN; i++) {
+        h = (h ^ mac[i]) * 16777619u;
+    }
+    return h & (NEIGH_SIZE - 1);
+}
+
+/* find the entry of mac or the free entry where it must be inserted */
+static neigh_entry_t *neigh_find(const uint8_t *mac) {
+    unsigned i, h = neigh_hash(mac);
+
+    for (i = 0; i < NEIGH_SIZE; i++) {
+        neigh_entry_t *e = &neigh[(h + i) & (NEIGH_SIZE - 1)];
+        if (!e->used || memcmp(e->mac, mac, ETH_ALEN) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void neigh_set(const uint8_t *mac, int node, int fixed) {
+    neigh_entry_t *e;
+
+    e = neigh_find(mac);
+    if (e == NULL) return;
+    if (!e->used) {
+        /* keep some free entries: lookups of unknown MACs must end */
+        if (neigh_used >= NEIGH_SIZE * 3 / 4) return;
+        neigh_used++;
+        memcpy(e->mac, mac, ETH_ALEN);
+        e->used = 1;
+    } else if (e->fixed && !fixed) {
+        return;
+    }
+    e->fixed = fixed;
+    e->node = node;
+}
+
+void ethtap_neigh_learn(const uint8_t *mac, int node) {
+    neigh_entry_t *e;
+    int known;
+
+    /* fast path: already known */
+    pthread_rwlock_rdlock(&table_lock);
+    e = neigh_find(mac);
+    known = e != NULL && e->used && (e->node == node || e->fixed);
+    pthread_rwlock_unlock(&table_lock);
+    if (known) return;
+
+    pthread_rwlock_wrlock(&table_lock);
+    neigh_set(mac, node, 0);
+    pthread_rwlock_unlock(&table_lock);
+
+    logmsg(LOG_DEBUG, "neighbour " MACSTR " -> node %d", MACVAL(mac), node);
+}
+
+int ethtap_neigh_lookup(const uint8_t *mac) {
+    neigh_entry_t *e;
+    int node = -1;
+
+    pthread_rwlock_rdlock(&table_lock);
+    e = neigh_find(mac);
+    if (e != NULL && e->used) {
+        node = e->node;
+    }
+    pthread_rwlock_unlock(&table_lock);
+
+    return node;
+}
+
+int ethtap_mcast_lookup(const uint8_t *mac, ethtap_nodeset_t *members) {
+    int i, ret = -1;
+
+    pthread_rwlock_rdlock(&table_lock);
+    for (i = 0; i < mcast_used; i++) {
+        if (memcmp(mcast[i].mac, mac, ETH_ALEN) == 0) {
+            *members = mcast[i].members;
+            ret = 0;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&table_lock);
+
+    return ret;
+}
+
+int ethtap_neigh_load(const char *filename) {
+    FILE *file;
+    char *line = NULL, *p, *tok, *save;
+    size_t len = 0;
+    unsigned int m[ETH_ALEN];
+    uint8_t mac[ETH_ALEN];
+    ethtap_nodeset_t members;
+    int i, n, node, lineno = 0, ret = 0;
+
+    file = fopen(filename, "r");
+    if (file == NULL) {
+        elogmsg("fopen() %s", filename);
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&table_lock);
+    while (getline(&line, &len, file) != -1) {
+        lineno++;
+        if ((p = strchr(line, '#')) != NULL) *p = '\0';
+        if (sscanf(line, " %x:%x:%x:%x:%x:%x %n", &m[0], &m[1], &m[2], &m[3],
+                    &m[4], &m[5], &n) != ETH_ALEN) {
+            if (strspn(line, " \t\r\n") != strlen(line)) {
+                logmsg(LOG_ERROR, "%s:%d: bad MAC address", filename, lineno);
+                ret = -1;
+            }
+            continue;
+        }
+        for (i = 0; i < ETH_ALEN; i++) mac[i] = m[i];
+
+        memset(&members, 0, sizeof(members));
+        node = -1;
+        for (tok = strtok_r(line + n, ", \t\r\n", &save); tok != NULL;
+                tok = strtok_r(NULL, ", \t\r\n", &save)) {
+            node = atoi(tok);
+            if (node < 0 || node >= AXIOM_NODES_NUM) {
+                logmsg(LOG_ERROR, "%s:%d: bad node %s", filename, lineno, tok);
+                ret = -1;
+                node = -1;
+                break;
+            }
+            nodeset_add(&members, node);
+        }
+        if (node < 0) continue;
+
+        if (mac[0] & 1) {
+            /* multicast group */
+            for (i = 0; i < mcast_used; i++) {
+                if (memcmp(mcast[i].mac, mac, ETH_ALEN) == 0) break;
+            }
+            if (i == MCAST_SIZE) {
+                logmsg(LOG_ERROR, "%s:%d: too many multicast groups", filename, lineno);
+                ret = -1;
+                continue;
+            }
+            memcpy(mcast[i].mac, mac, ETH_ALEN);
+            mcast[i].members = members;
+            if (i == mcast_used) mcast_used++;
+        } else {
+            neigh_set(mac, node, 1);
+        }
+    }
+    pthread_rwlock_unlock(&table_lock);
+
+    free(line);
+    fclose(file);
+
+    return ret;
+}
+
+void ethtap_neigh_dump(FILE *out) {
+    int i, n;
+
+    pthread_rwlock_rdlock(&table_lock);
+    fprintf(out, "neighbours (%d):\n", neigh_used);
+    for (i = 0; i < NEIGH_SIZE; i++) {
+        if (!neigh[i].used) continue;
+        fprintf(out, "  " MACSTR " node %3d%s\n", MACVAL(neigh[i].mac),
+                neigh[i].node, neigh[i].fixed ? " static" : "");
+    }
+    fprintf(out, "multicast groups (%d):\n", mcast_used);
+    for (i = 0; i < mcast_used; i++) {
+        fprintf(out, "  " MACSTR " nodes", MACVAL(mcast[i].mac));
+        for (n = 0; n < AXIOM_NODES_NUM; n++) {
+            if (nodeset_has(&mcast[i].members, n)) fprintf(out, " %d", n);
+        }
+        fputc('\n', out);
+    }
+    pthread_rwlock_unlock(&table_lock);
+}
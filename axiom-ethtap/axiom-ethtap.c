@@ -12,6 +12,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
 
 #include <stdarg.h>
 #include <getopt.h>
@@ -21,20 +24,31 @@
 #include <string.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <time.h>
 
 #include <net/if.h>
 #include <net/if_arp.h>
 #include <linux/if_tun.h>
 #include <linux/if_ether.h>
+#include <linux/virtio_net.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
 #include <ifaddrs.h>
 
 #include "axiom_nic_api_user.h"
 #include "axiom_nic_limits.h"
 
 #include "axiom_common.h"
+#include "axiom_counters.h"
+#include "axiom_reactor.h"
+#include "axiom-ethtap.h"
 
 /*
- * 
+ * Default mode: TAP_MODE (ethernet frames) or TUN_MODE (IP packets).
+ * The TUN mode can be selected at run time too (--tun).
  */
 //#define TUN_MODE
 #define TAP_MODE
@@ -54,18 +68,39 @@
  * Constants
  */
 
-#ifdef TUN_MODE
-#error No implementation yet
-#endif
-
 static char const MAC[]={0x42,0xD9,0xAF,0x86,0x0B,0x34};
 static char const BROADCAST[]={0xff,0xff,0xff,0xff,0xff,0xff};
 #define PORT 2
 #define MAX_THREADS 64
 
+/** Reassembly slots for each (source node, source queue). */
+#define REASM_SLOTS 4
+
+/** Max frames read from the tap for each event loop wakeup. */
+#define EVENT_BATCH 32
+
+/** Default file of the statistics dump. */
+#define DEF_STATS_FILE "/tmp/axiom-ethtap.stats"
+/** Default unix socket of the statistics. */
+#define DEF_STATS_SOCKET "/run/axiom-ethtap.sock"
+
+/** Largest fragment carried by an axiom message. */
+#define FRAG_MAX (AXIOM_LONG_PAYLOAD_MAX_SIZE - sizeof(frag_hdr_t))
+/** Default MTU: an ethernet frame fills a long message. */
+#define DEF_MTU (FRAG_MAX - sizeof(struct virtio_net_hdr) - ETH_HLEN)
+/** Default MTU in TUN mode: an IP packet fills a long message. */
+#define DEF_TUN_MTU (FRAG_MAX - sizeof(struct virtio_net_hdr))
+/** Default TUN subnet: node N has address 10.42.0.N. */
+#define DEF_TUN_NET "10.42.0.0/24"
 
-#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
-#define MACVAL(p) *(p),*((p)+1),*((p)+2),*((p)+3),*((p)+4),*((p)+5)
+/** Frame being reassembled. */
+typedef struct {
+    pthread_mutex_t lock;
+    uint16_t seq;
+    uint32_t len;       /**< 0 if the slot is free */
+    uint32_t received;
+    uint8_t *data;
+} reasm_slot_t;
 
 /*
  * Global variables
@@ -73,8 +108,15 @@ static char const BROADCAST[]={0xff,0xff,0xff,0xff,0xff,0xff};
 
 /** Axiom device. */
 static axiom_dev_t *dev = NULL;
-/** File handle to tun/tap driver. */
-static int tunh = -1;
+/** File handles to tun/tap driver (one for each queue). */
+static int tunh[MAX_THREADS];
+/** Number of tun/tap queues (one for each sender/receiver thread pair). */
+static int num_queues = 1;
+/** Counters and dispatch latency of frames and messages (axiom-stat). */
+static int stat_tap_frames = -1, stat_ax_msgs = -1;
+static int stat_tap_dispatch = -1, stat_ax_dispatch = -1;
+/** First cpu used to pin the queue threads (-1 no pinning). */
+static int first_cpu = -1;
 /** Number of axiom nodes. */
 static int num_nodes;
 /** My node number (ONE-based).*/
@@ -83,6 +125,41 @@ static int my_node;
 static char mymac[]={0x00,0x00,0x00,0x00,0x00,0x00};
 /** Axiom port used for comunication. */
 static int port = PORT;
+/** Interface MTU (0 default of the mode). */
+static int mtu = 0;
+#ifdef TUN_MODE
+/** IP packets (TUN) instead of ethernet frames (TAP). */
+static int tun_mode = 1;
+#else
+/** IP packets (TUN) instead of ethernet frames (TAP). */
+static int tun_mode = 0;
+#endif
+/** TUN mode: subnet of the nodes (host byte order). */
+static uint32_t tun_net;
+/** TUN mode: netmask of the subnet (host byte order). */
+static uint32_t tun_mask;
+/** TUN mode: host part of the address of node N is N + tun_offset. */
+static int tun_offset = 0;
+/** Enable checksum and TSO/GSO offload. */
+static int offload = 1;
+/** Send the frames larger than a long message through RDMA rings. */
+static int rdma = 0;
+/** Reassembly slots indexed by source node and source queue. */
+static reasm_slot_t *reasm[AXIOM_NODES_NUM][MAX_THREADS];
+/** Protect the allocation of the reassembly slots. */
+static pthread_mutex_t reasm_mutex = PTHREAD_MUTEX_INITIALIZER;
+/** File of the static neighbours and multicast groups (NULL none). */
+static char *table_filename = NULL;
+/** File of the statistics dump. */
+static char *stats_filename = DEF_STATS_FILE;
+/** Unix socket of the statistics (NULL none). */
+static char *stats_sockname = DEF_STATS_SOCKET;
+/** Number of captured frames (0 no capture). */
+static int pcap_frames = 0;
+/** Single thread event loop instead of the sender/receiver threads. */
+static int event_mode = 0;
+/** Event loop: max busy-poll time before sleeping (usec, 0 never spin). */
+static int busy_poll = 0;
 
 /**
  * Emit program usage on stderr.
@@ -111,6 +188,35 @@ static void _usage(char *msg, ...) {
     fprintf(stderr, "    use axiom raw port NUM for comunication (default: %d)\n",PORT);
     fprintf(stderr, "-n, --num_threads NUM\n");
     fprintf(stderr, "    number of threads (max: %d)\n", MAX_THREADS);
+    fprintf(stderr, "    every sender/receiver thread pair uses its own tap queue\n");
+    fprintf(stderr, "-m, --mtu NUM\n");
+    fprintf(stderr, "    interface MTU (default: %d, TUN mode: %d)\n", (int)DEF_MTU, (int)DEF_TUN_MTU);
+    fprintf(stderr, "-u, --tun [NET/PREFIX[+OFFSET]]\n");
+    fprintf(stderr, "    TUN mode: carry IP packets without ethernet header and ARP; node N\n");
+    fprintf(stderr, "    has the address NET + N + OFFSET (default: %s)\n", DEF_TUN_NET);
+    fprintf(stderr, "-O, --no-offload\n");
+    fprintf(stderr, "    disable checksum and TSO/GSO offload\n");
+    fprintf(stderr, "-r, --rdma\n");
+    fprintf(stderr, "    send large frames through RDMA rings (all nodes must use it)\n");
+    fprintf(stderr, "-t, --table FILE\n");
+    fprintf(stderr, "    load static neighbours and multicast groups from FILE\n");
+    fprintf(stderr, "    (lines: 'MAC node' or 'MULTICAST_MAC node[,node]*')\n");
+    fprintf(stderr, "-s, --stats FILE\n");
+    fprintf(stderr, "    dump the statistics on FILE on SIGUSR1 (default: %s)\n", DEF_STATS_FILE);
+    fprintf(stderr, "-U, --socket PATH\n");
+    fprintf(stderr, "    serve the statistics on the unix socket PATH ('' none, default: %s)\n", DEF_STATS_SOCKET);
+    fprintf(stderr, "    request 'stats' (or nothing) for the counters, 'pcap' for the captured frames\n");
+    fprintf(stderr, "-P, --pcap NUM\n");
+    fprintf(stderr, "    keep the first bytes of the last NUM frames for the 'pcap' request\n");
+    fprintf(stderr, "-c, --cpu NUM\n");
+    fprintf(stderr, "    pin the threads of queue i on cpu NUM+i (default: no pinning)\n");
+    fprintf(stderr, "-e, --event\n");
+    fprintf(stderr, "    handle the tap and the axiom device in a single thread with an\n");
+    fprintf(stderr, "    epoll loop (one tap queue, -n is ignored)\n");
+    fprintf(stderr, "-b, --busy-poll USEC\n");
+    fprintf(stderr, "    event loop: poll up to USEC microseconds before sleeping; the\n");
+    fprintf(stderr, "    polling time adapts to the traffic (default: 0, never poll)\n");
+    sch_usage(stderr);
 #ifndef NLOG
     fprintf(stderr, "-d, --debug\n");
     fprintf(stderr, "    override environment AXIOM_LOG_LEVEL settng it to DEBUG log level\n");
@@ -129,6 +235,18 @@ static struct option long_options[] = {
     {"foreground", no_argument, 0, 'f'},
     {"port", required_argument, 0, 'p'},
     {"num_threads", required_argument, 0, 'n'},
+    {"cpu", required_argument, 0, 'c'},
+    {"mtu", required_argument, 0, 'm'},
+    {"table", required_argument, 0, 't'},
+    {"rdma", no_argument, 0, 'r'},
+    {"tun", optional_argument, 0, 'u'},
+    {"stats", required_argument, 0, 's'},
+    {"socket", required_argument, 0, 'U'},
+    {"pcap", required_argument, 0, 'P'},
+    {"no-offload", no_argument, 0, 'O'},
+    {"event", no_argument, 0, 'e'},
+    {"busy-poll", required_argument, 0, 'b'},
+    {"sched", required_argument, 0, 'S'},
     {"help", no_argument, 0, 'h'},
 #ifndef NLOG
     {"debug", no_argument, 0, 'd'},
@@ -138,51 +256,562 @@ static struct option long_options[] = {
 };
 
 #ifdef NLOG
-static char const *options="p:n:hfV";
+static char const *options="p:n:c:m:t:s:U:P:ru::eb:S:OhfV";
 #else
-static char const *options="p:n:hfdV";
+static char const *options="p:n:c:m:t:s:U:P:ru::eb:S:OhfdV";
 #endif
 
-void  *sender(void *d) {
-    uint8_t buf[AXIOM_LONG_PAYLOAD_MAX_SIZE];
-    int sz,ret,no;
+/**
+ * Compute the flow hash of an ethernet frame (or of an IP packet in TUN mode).
+ * IPv4 frames are hashed on addresses and protocol (plus ports for TCP/UDP),
+ * the other frames on the mac addresses; so all the frames of a flow are
+ * always handled by the same queue.
+ * @param buf the ethernet frame
+ * @param sz size of the frame
+ * @return the flow hash
+ */
+static uint32_t flow_hash(uint8_t *buf, size_t sz) {
+    uint32_t h = 2166136261u;
+    size_t i, l3, start = 0, end = 2 * ETH_ALEN;
+    int ipv4;
 
-    logmsg(LOG_INFO,"sender (eth -> axiom) starting");
-    for (;;) {
-        sz=read(tunh,buf,sizeof(buf));
-        if (sz>0) {
-            if (logmsg_is_enabled(LOG_DEBUG)) {
-                if (sz>=12) {
-                    logmsg(LOG_DEBUG,"eth recv: dmac=" MACSTR " smac=" MACSTR " sz=%d", MACVAL(buf), MACVAL(buf+ETH_ALEN), sz);
-                } else {
-                    logmsg(LOG_DEBUG,"eth recv: sz<12 error???");
-                }
+    if (tun_mode) {
+        l3 = 0;
+        end = sz;
+        ipv4 = sz >= sizeof(struct iphdr) && (buf[0] >> 4) == 4;
+    } else {
+        l3 = ETH_HLEN;
+        ipv4 = sz >= ETH_HLEN + sizeof(struct iphdr) &&
+            buf[2 * ETH_ALEN] == (ETH_P_IP >> 8) &&
+            buf[2 * ETH_ALEN + 1] == (ETH_P_IP & 0xff);
+    }
+
+    if (ipv4) {
+        struct iphdr *ip = (struct iphdr *)(buf + l3);
+        size_t ihl = ip->ihl * 4;
+
+        /* protocol, source and destination addresses */
+        start = l3 + 9;
+        end = l3 + 20;
+        if ((ip->protocol == IPPROTO_TCP || ip->protocol == IPPROTO_UDP) &&
+                !(ip->frag_off & htons(0x3fff)) && ihl >= 20 &&
+                sz >= l3 + ihl + 4) {
+            /* source and destination ports */
+            for (i = l3 + ihl; i < l3 + ihl + 4; i++) {
+                h = (h ^ buf[i]) * 16777619u;
             }
-            if (memcmp(buf,MAC,ETH_ALEN-1)==0) {
-                ret=axiom_send(dev,buf[ETH_ALEN-1],PORT,sz,buf);
-                if (!AXIOM_RET_IS_OK(ret)) {
-                    elogmsg("axiom_send_raw()");
-                }
-            } else if (memcmp(buf,BROADCAST,ETH_ALEN)==0) {
-                for (no=1; no<=num_nodes; no++) {
-                    if (no==my_node) continue;
-                    ret=axiom_send(dev,no,PORT,sz,buf);
-                    if (!AXIOM_RET_IS_OK(ret)) {
-                        elogmsg("axiom_send_raw()");
-                    }
-                }
-            } else {
-                logmsg(LOG_DEBUG,"discarded eth frame (bad destination mac)");
+        }
+    } else if (tun_mode && end > 40) {
+        /* IPv6: addresses */
+        start = 8;
+        end = 40;
+    }
+    if (end > sz) {
+        end = sz;
+    }
+    for (i = start; i < end; i++) {
+        h = (h ^ buf[i]) * 16777619u;
+    }
+
+    return h;
+}
+
+static inline uint64_t clock_ns(clockid_t clk) {
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Pin the calling thread on the cpu of a queue.
+ * @param queue the queue handled by the thread
+ */
+static void pin_queue_thread(int queue) {
+    cpu_set_t set;
+    long ncpu;
+    int cpu, err;
+
+    if (first_cpu < 0) return;
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu <= 0) return;
+    cpu = (first_cpu + queue) % ncpu;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+        logmsg(LOG_WARN, "queue %d: can not pin thread on cpu %d", queue, cpu);
+        return;
+    }
+    logmsg(LOG_DEBUG, "queue %d: thread pinned on cpu %d", queue, cpu);
+}
+
+/**
+ * Set the scheduling parameters and the placement (--sched) or the cpu
+ * (--cpu) of a queue thread, and register its counters.
+ * @param role name of the thread
+ * @param queue the queue handled by the thread
+ */
+static void queue_thread_init(const char *role, int queue) {
+    char name[16];
+
+    snprintf(name, sizeof(name), "%s%d", role, queue);
+    if (ethtap_stats_thread(name) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (sch_setsched_role(role) != 0) {
+        elogmsg("sch_setsched_role()");
+    }
+    // a placement of --sched takes the place of --cpu
+    if (!sch_hasplacement(role)) {
+        pin_queue_thread(queue);
+    }
+}
+
+/**
+ * Send a frame to a node: through the RDMA ring if it is large, otherwise
+ * split in fragments if it does not fit a long message.
+ * @param node destination node
+ * @param hdr message header (offset is set here)
+ * @param data virtio header followed by the frame
+ * @param len length of data
+ */
+static void send_frame(int node, frag_hdr_t *hdr, uint8_t *data, size_t len) {
+    struct iovec iov[2];
+    size_t off, chunk;
+    uint64_t start = clock_ns(CLOCK_MONOTONIC);
+    int ret;
+
+    if (rdma && len > FRAG_MAX && !(hdr->flags & FRAG_TREE)) {
+        ret = ethtap_rdma_send(node, hdr, data, len);
+        if (ret == 0) {
+            goto sent;
+        } else if (ret != -1) {
+            stats_add(&ethtap_stats[node].tx_errors, 1);
+            stats_drop(DROP_SEND_ERROR);
+            return;
+        }
+        /* no free slot in the ring: use long messages */
+    }
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(*hdr);
+    for (off = 0; off < len; off += chunk) {
+        chunk = len - off < FRAG_MAX ? len - off : FRAG_MAX;
+        hdr->offset = off;
+        iov[1].iov_base = data + off;
+        iov[1].iov_len = chunk;
+        ret=axiom_send_iov(dev,node,PORT,sizeof(*hdr)+chunk,iov,2);
+        if (!AXIOM_RET_IS_OK(ret)) {
+            stats_add(&ethtap_stats[node].tx_errors, 1);
+            stats_drop(DROP_SEND_ERROR);
+            elogmsg("axiom_send_iov()");
+            return;
+        }
+    }
+sent:
+    stats_send_latency(clock_ns(CLOCK_MONOTONIC) - start);
+    stats_add(&ethtap_stats[node].tx_frames, 1);
+    stats_add(&ethtap_stats[node].tx_bytes, len);
+    tstats_add(&ethtap_tstats->tx_frames, 1);
+    tstats_add(&ethtap_tstats->tx_bytes, len);
+}
+
+/**
+ * Get the children of this node in the spanning tree rooted at a node.
+ * The tree is a binary tree over the node ids, rotated so that the origin
+ * is the root: every node sends at most two copies of a broadcast frame.
+ * @param origin root of the tree
+ * @param children[out] the children
+ * @return the number of children
+ */
+static int tree_children(int origin, int children[2]) {
+    int rank, child, n = 0;
+
+    if (origin < 1 || origin > num_nodes) return 0;
+    rank = (my_node - origin + num_nodes) % num_nodes;
+    for (child = 2 * rank + 1; child <= 2 * rank + 2; child++) {
+        if (child >= num_nodes) break;
+        children[n++] = (origin - 1 + child) % num_nodes + 1;
+    }
+    return n;
+}
+
+/**
+ * Get the node of an IPv4 destination in TUN mode.
+ * @param packet the IP packet
+ * @param sz size of the packet
+ * @return the node, 0 for broadcast/multicast or -1 if it is not reachable
+ */
+static int tun_dest_node(uint8_t *packet, size_t sz) {
+    struct iphdr *ip = (struct iphdr *)packet;
+    uint32_t dst, host;
+    int node;
+
+    if (sz < sizeof(struct iphdr) || ip->version != 4) {
+        /* IPv6 and other protocols: no mapping to nodes */
+        return -1;
+    }
+    dst = ntohl(ip->daddr);
+    if (IN_MULTICAST(dst) || dst == INADDR_BROADCAST) return 0;
+    if ((dst & tun_mask) != tun_net) return -1;
+    host = dst & ~tun_mask;
+    if (host == ~tun_mask) return 0;
+    node = (int)host - tun_offset;
+    if (node < 1 || node > num_nodes) return -1;
+    return node;
+}
+
+/**
+ * Route a frame read from the tap interface.
+ * @param hdr message header
+ * @param data virtio header followed by the frame
+ * @param len length of data
+ */
+static void route_frame(frag_hdr_t *hdr, uint8_t *data, size_t len) {
+    uint8_t *frame = data + sizeof(struct virtio_net_hdr);
+    ethtap_nodeset_t members;
+    uint64_t start;
+    int children[2];
+    int node, n, i;
+
+    if (tun_mode) {
+        /* the destination address gives the node: no ARP, no MAC */
+        node = tun_dest_node(frame, len - sizeof(struct virtio_net_hdr));
+        if (node < 0 || node == my_node) {
+            logmsg(LOG_DEBUG,"discarded ip packet (destination not on axiom)");
+            stats_drop(DROP_NO_ROUTE);
+            return;
+        }
+        if (node > 0) {
+            send_frame(node,hdr,data,len);
+            return;
+        }
+    } else if (frame[0] & 1) {
+        /* multicast group with known members: send to them only */
+        if (memcmp(frame,BROADCAST,ETH_ALEN)!=0 &&
+                ethtap_mcast_lookup(frame,&members)==0) {
+            for (node=1; node<=num_nodes; node++) {
+                if (node==my_node || !nodeset_has(&members,node)) continue;
+                send_frame(node,hdr,data,len);
             }
+            return;
+        }
+    } else {
+        node = ethtap_neigh_lookup(frame);
+        if (node < 0 && memcmp(frame,MAC,ETH_ALEN-1)==0) {
+            node = frame[ETH_ALEN-1];
+        }
+        if (node == my_node) {
+            logmsg(LOG_DEBUG,"discarded eth frame (destination is local)");
+            stats_drop(DROP_NO_ROUTE);
+            return;
+        }
+        if (node > 0) {
+            send_frame(node,hdr,data,len);
+            return;
+        }
+    }
+
+    /* broadcast, unknown multicast or unknown unicast: flood */
+    start = clock_ns(CLOCK_MONOTONIC);
+    hdr->flags |= FRAG_TREE;
+    n = tree_children(my_node, children);
+    for (i = 0; i < n; i++) {
+        send_frame(children[i],hdr,data,len);
+    }
+    tstats_add(&ethtap_tstats->floods, 1);
+    tstats_add(&ethtap_tstats->flood_msgs, n);
+    tstats_add(&ethtap_tstats->flood_ns, clock_ns(CLOCK_MONOTONIC) - start);
+}
+
+/**
+ * Handle a frame read from a tap queue.
+ * @param queue the tap queue
+ * @param hdr message header of the queue
+ * @param data virtio header followed by the frame
+ * @param sz length of data
+ */
+static void tap_frame(int queue, frag_hdr_t *hdr, uint8_t *data, ssize_t sz) {
+    uint8_t *frame = data + sizeof(struct virtio_net_hdr);
+    AXSTAT_SCOPE(stat_tap_dispatch);
+
+    axstat_add(stat_tap_frames, 1);
+    if (sz<=(ssize_t)sizeof(struct virtio_net_hdr)) {
+        logmsg(LOG_DEBUG,"eth recv: sz<=0 error???");
+        stats_drop(DROP_SHORT);
+        return;
+    }
+    ethtap_pcap_add(frame, sz - sizeof(struct virtio_net_hdr));
+    if (logmsg_is_enabled(LOG_DEBUG) && !tun_mode) {
+        if (sz>=(ssize_t)sizeof(struct virtio_net_hdr)+12) {
+            logmsg(LOG_DEBUG,"eth recv: dmac=" MACSTR " smac=" MACSTR " sz=%ld", MACVAL(frame), MACVAL(frame+ETH_ALEN), (long)sz);
         } else {
-            logmsg(LOG_DEBUG,"eth recv: sz<=0 error???");
+            logmsg(LOG_DEBUG,"eth recv: sz<12 error???");
         }
     }
+    hdr->len = sz;
+    hdr->offset = 0;
+    hdr->seq++;
+    hdr->queue = queue;
+    hdr->origin = my_node;
+    hdr->flags = 0;
+    route_frame(hdr,data,sz);
+}
 
+/**
+ * Get the buffer where the frames of a tap queue are read.
+ * @param queue the tap queue
+ * @param buf[out] buffer to free (NULL if the RDMA staging slot is used)
+ * @return the buffer (virtio header followed by the frame)
+ */
+static uint8_t *tap_buffer(int queue, uint8_t **buf) {
+    uint8_t *data;
+
+    /* RDMA: read the frames directly in the staging slot of the queue */
+    *buf = NULL;
+    data = rdma ? ethtap_rdma_staging(queue) : NULL;
+    if (data == NULL) {
+        data = *buf = malloc(FRAME_MAX);
+        if (data == NULL) {
+            elogmsg("malloc()");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return data;
+}
+
+void  *sender(void *d) {
+    uint8_t *data, *buf;
+    ssize_t sz;
+    int queue = (int)(intptr_t)d;
+    frag_hdr_t hdr;
+
+    queue_thread_init("sender", queue);
+
+    data = tap_buffer(queue, &buf);
+    memset(&hdr, 0, sizeof(hdr));
+
+    logmsg(LOG_INFO,"sender (eth -> axiom) queue %d starting", queue);
+    for (;;) {
+        /* the kernel steers all the frames of a flow on the same queue */
+        sz=read(tunh[queue],data,FRAME_MAX);
+        tap_frame(queue,&hdr,data,sz);
+    }
+
+    free(buf);
     logmsg(LOG_INFO,"sender end");
     return NULL;
 }
 
+/**
+ * Write a frame received from axiom on the tap interface.
+ * @param vnet virtio header
+ * @param frame the frame (it may be not contiguous to the virtio header)
+ * @param sz length of virtio header and frame
+ * @param queue default queue
+ * @param origin node that sent the frame
+ */
+static void write_frame(uint8_t *vnet, uint8_t *frame, size_t sz, int queue, int origin) {
+    struct iovec iov[2];
+    ssize_t msz;
+
+    if (sz<sizeof(struct virtio_net_hdr)+12) {
+        logmsg(LOG_DEBUG,"ax  recv: sz<12 error???");
+        stats_drop(DROP_SHORT);
+        return;
+    }
+    if (tun_mode) {
+        logmsg(LOG_DEBUG, "ax  recv: ip packet sz=%ld", sz);
+    } else {
+        logmsg(LOG_DEBUG, "ax  recv: dmac=" MACSTR " smac=" MACSTR " sz=%ld", MACVAL(frame), MACVAL(frame+ETH_ALEN), sz);
+
+        /* the source MAC is behind the origin node */
+        if (!(frame[ETH_ALEN] & 1)) {
+            ethtap_neigh_learn(frame+ETH_ALEN, origin);
+        }
+    }
+
+    if (tun_mode||memcmp(frame,mymac,ETH_ALEN)==0||(frame[0] & 1)) {
+        stats_add(&ethtap_stats[origin].rx_frames, 1);
+        stats_add(&ethtap_stats[origin].rx_bytes, sz);
+        /* same flow, same queue: keep the kernel processing in order */
+        if (num_queues > 1) {
+            queue = flow_hash(frame, sz - sizeof(struct virtio_net_hdr)) % num_queues;
+        }
+        /* GSO frames are passed whole: the kernel resegments them if needed */
+        iov[0].iov_base = vnet;
+        iov[0].iov_len = sizeof(struct virtio_net_hdr);
+        iov[1].iov_base = frame;
+        iov[1].iov_len = sz - sizeof(struct virtio_net_hdr);
+        msz=writev(tunh[queue],iov,2);
+        if (msz!=(ssize_t)sz) {
+            stats_drop(DROP_TAP_WRITE);
+            elogmsg("write()");
+            return;
+        }
+        tstats_add(&ethtap_tstats->rx_frames, 1);
+        tstats_add(&ethtap_tstats->rx_bytes, sz);
+        ethtap_pcap_add(frame, sz - sizeof(struct virtio_net_hdr));
+    } else {
+        logmsg(LOG_DEBUG,"discarded ax  packet (bad destination mac)");
+        stats_drop(DROP_BAD_DEST);
+    }
+}
+
+/**
+ * Get the reassembly slot of a fragment.
+ * @param src source node
+ * @param hdr fragment header
+ * @return the slot (locked) or NULL on error
+ */
+static reasm_slot_t *reasm_get(axiom_node_id_t src, frag_hdr_t *hdr) {
+    reasm_slot_t *slots, *slot;
+    int i;
+
+    if (hdr->queue >= MAX_THREADS) {
+        stats_drop(DROP_BAD_FRAGMENT);
+        return NULL;
+    }
+    slots = reasm[src][hdr->queue];
+    if (slots == NULL) {
+        pthread_mutex_lock(&reasm_mutex);
+        slots = reasm[src][hdr->queue];
+        if (slots == NULL) {
+            slots = calloc(REASM_SLOTS, sizeof(reasm_slot_t));
+            for (i = 0; slots != NULL && i < REASM_SLOTS; i++) {
+                pthread_mutex_init(&slots[i].lock, NULL);
+                slots[i].data = malloc(FRAME_MAX);
+                if (slots[i].data == NULL) {
+                    while (i-- > 0) free(slots[i].data);
+                    free(slots);
+                    slots = NULL;
+                }
+            }
+            reasm[src][hdr->queue] = slots;
+        }
+        pthread_mutex_unlock(&reasm_mutex);
+        if (slots == NULL) {
+            elogmsg("malloc()");
+            stats_drop(DROP_NO_MEMORY);
+            return NULL;
+        }
+    }
+
+    slot = &slots[hdr->seq % REASM_SLOTS];
+    pthread_mutex_lock(&slot->lock);
+    if (slot->len == 0 || slot->seq != hdr->seq) {
+        if (slot->len != 0) {
+            logmsg(LOG_DEBUG,"ax  recv: incomplete frame %u from node %u discarded", slot->seq, src);
+            stats_drop(DROP_INCOMPLETE);
+        }
+        slot->seq = hdr->seq;
+        slot->len = hdr->len;
+        slot->received = 0;
+    }
+    return slot;
+}
+
+/**
+ * Handle a message received from axiom.
+ * @param queue default tap queue
+ * @param buf the message
+ * @param sz size of the message
+ */
+static void ax_message(int queue, uint8_t *buf, size_t sz) {
+    frag_hdr_t *hdr = (frag_hdr_t *)buf;
+    uint8_t *payload = buf + sizeof(frag_hdr_t);
+    reasm_slot_t *slot;
+    size_t chunk;
+    int children[2],n,i,ret;
+    AXSTAT_SCOPE(stat_ax_dispatch);
+
+    axstat_add(stat_ax_msgs, 1);
+    if (sz<sizeof(frag_hdr_t)) {
+        logmsg(LOG_DEBUG,"ax  recv: sz<header error???");
+        stats_drop(DROP_SHORT);
+        return;
+    }
+    chunk = sz - sizeof(frag_hdr_t);
+
+    /* RDMA ring credits returned by a peer */
+    if (hdr->flags & FRAG_CREDIT) {
+        ethtap_rdma_credit(hdr->origin, hdr->offset);
+        return;
+    }
+
+    /* RDMA doorbell: the frame is in the ring of the origin */
+    if (hdr->flags & FRAG_RDMA) {
+        uint8_t *frame;
+
+        /* the sender could not write the slot: retire it only */
+        if (hdr->flags & FRAG_SKIP) {
+            if (ethtap_rdma_slot(hdr->origin, hdr->offset, 0) != NULL) {
+                ethtap_rdma_release(hdr->origin, hdr->offset);
+            }
+            return;
+        }
+        frame = ethtap_rdma_slot(hdr->origin, hdr->offset,
+                hdr->len - sizeof(struct virtio_net_hdr));
+        if (frame == NULL || chunk != sizeof(struct virtio_net_hdr)) {
+            logmsg(LOG_DEBUG,"ax  recv: bad doorbell (slot=%u)", hdr->offset);
+            stats_drop(DROP_BAD_FRAGMENT);
+            return;
+        }
+        write_frame(payload, frame, hdr->len, queue, hdr->origin);
+        ethtap_rdma_release(hdr->origin, hdr->offset);
+        return;
+    }
+    if (chunk == 0) {
+        logmsg(LOG_DEBUG,"ax  recv: empty message");
+        stats_drop(DROP_SHORT);
+        return;
+    }
+
+    /* flooded frame: forward every message to our children first */
+    if (hdr->flags & FRAG_TREE) {
+        uint64_t start = clock_ns(CLOCK_MONOTONIC);
+
+        n = tree_children(hdr->origin, children);
+        for (i = 0; i < n; i++) {
+            ret=axiom_send(dev,children[i],PORT,sz,buf);
+            if (!AXIOM_RET_IS_OK(ret)) {
+                stats_add(&ethtap_stats[children[i]].tx_errors, 1);
+                stats_drop(DROP_SEND_ERROR);
+                elogmsg("axiom_send()");
+            }
+        }
+        if (n > 0) {
+            stats_add(&ethtap_stats[hdr->origin].relayed, 1);
+            tstats_add(&ethtap_tstats->floods, 1);
+            tstats_add(&ethtap_tstats->flood_msgs, n);
+            tstats_add(&ethtap_tstats->flood_ns, clock_ns(CLOCK_MONOTONIC) - start);
+        }
+    }
+
+    /* whole frame */
+    if (hdr->offset == 0 && hdr->len == chunk) {
+        write_frame(payload, payload + sizeof(struct virtio_net_hdr), chunk, queue, hdr->origin);
+        return;
+    }
+
+    /* fragment of a GSO frame */
+    if (hdr->len > FRAME_MAX || hdr->offset + chunk > hdr->len) {
+        logmsg(LOG_DEBUG,"ax  recv: bad fragment (len=%u offset=%u)", hdr->len, hdr->offset);
+        stats_drop(DROP_BAD_FRAGMENT);
+        return;
+    }
+    slot = reasm_get(hdr->origin, hdr);
+    if (slot == NULL) return;
+    memcpy(slot->data + hdr->offset, payload, chunk);
+    slot->received += chunk;
+    if (slot->received >= slot->len) {
+        write_frame(slot->data, slot->data + sizeof(struct virtio_net_hdr), slot->len, queue, hdr->origin);
+        slot->len = 0;
+    }
+    pthread_mutex_unlock(&slot->lock);
+}
+
 void  *receiver(void *data) {
 
     axiom_node_id_t mit;
@@ -190,10 +819,12 @@ void  *receiver(void *data) {
     axiom_type_t type;
 
     uint8_t buf[AXIOM_LONG_PAYLOAD_MAX_SIZE];
-    size_t sz,msz;
-    int ret;
+    size_t sz;
+    int ret,queue = (int)(intptr_t)data;
 
-    logmsg(LOG_INFO,"receiver (axiom -> eht) starting");
+    queue_thread_init("receiver", queue);
+
+    logmsg(LOG_INFO,"receiver (axiom -> eht) queue %d starting", queue);
     for (;;) {
 
         sz=sizeof(buf);
@@ -202,35 +833,147 @@ void  *receiver(void *data) {
             elogmsg("axiom_recv");
             continue;
         }
-        if (sz<12) {
-            logmsg(LOG_DEBUG,"ax  recv: sz<12 error???");
-            continue;
-        }
-        logmsg(LOG_DEBUG, "ax  recv: dmac=" MACSTR " smac=" MACSTR " sz=%ld", MACVAL(buf), MACVAL(buf+ETH_ALEN), sz);
-
-        if (memcmp(buf,mymac,ETH_ALEN)==0||memcmp(buf,BROADCAST,ETH_ALEN)==0) {
-            msz=write(tunh,buf,sz);
-            if (msz!=sz) {
-                elogmsg("write()");
-            }
-        } else {
-            logmsg(LOG_DEBUG,"discarded ax  packet (bad destination mac)");
-        }
+        ax_message(queue,buf,sz);
     }
 
     logmsg(LOG_INFO,"receiver end");
     return NULL;
 }
 
+/** Account the latency of the frames handled in a wakeup of the event loop. */
+static void event_account(uint64_t woke, uint64_t frames) {
+    uint64_t lat, max;
+
+    if (frames == 0) return;
+    /* from the wakeup to the end of the forwarding of every frame */
+    lat = clock_ns(CLOCK_MONOTONIC) - woke;
+    stats_add(&ethtap_loop_stats.frames, frames);
+    stats_add(&ethtap_loop_stats.latency_ns, lat * frames);
+    max = __atomic_load_n(&ethtap_loop_stats.latency_max_ns, __ATOMIC_RELAXED);
+    if (lat > max) {
+        __atomic_store_n(&ethtap_loop_stats.latency_max_ns, lat, __ATOMIC_RELAXED);
+    }
+}
+
+/** State of the event loop (shared by its callbacks). */
+typedef struct {
+    frag_hdr_t hdr;
+    uint8_t *data;
+    uint8_t *msg;
+    /* frames handled in the current wakeup */
+    uint64_t frames;
+} event_ctx_t;
+
+/** The tap queue is readable: forward a batch of frames. */
+static void event_tap(reactor_t *r, int fd, uint32_t events, void *arg) {
+    event_ctx_t *ctx = arg;
+    ssize_t rsz;
+    int j;
+
+    for (j = 0; j < EVENT_BATCH; j++) {
+        rsz = read(fd, ctx->data, FRAME_MAX);
+        if (rsz < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        tap_frame(0, &ctx->hdr, ctx->data, rsz);
+        ctx->frames++;
+    }
+}
+
+/** The axiom device is readable: forward one message. */
+static void event_axiom(reactor_t *r, int fd, uint32_t events, void *arg) {
+    event_ctx_t *ctx = arg;
+    axiom_node_id_t mit;
+    axiom_port_t aport;
+    axiom_type_t type;
+    size_t sz;
+    int ret;
+
+    /* the fd is ready: axiom_recv() does not block */
+    sz = AXIOM_LONG_PAYLOAD_MAX_SIZE;
+    ret = axiom_recv(dev, &mit, &aport, &type, &sz, ctx->msg);
+    if (!AXIOM_RET_IS_OK(ret)) {
+        elogmsg("axiom_recv");
+        return;
+    }
+    ax_message(0, ctx->msg, sz);
+    ctx->frames++;
+}
+
 /**
- * Allocate a tun/tap interface.
+ * Single thread event loop: the tap queue and the axiom device are watched
+ * by a reactor (see axiom_reactor.h) that polls for a while before sleeping.
+ */
+static void event_loop(void) {
+    event_ctx_t ctx;
+    reactor_stats_t rst;
+    reactor_t *r;
+    uint8_t *buf;
+    uint64_t cpu0;
+    int fd_raw, fd_long, ret;
+
+    queue_thread_init("event", 0);
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.data = tap_buffer(0, &buf);
+    ctx.msg = malloc(AXIOM_LONG_PAYLOAD_MAX_SIZE);
+    if (ctx.msg == NULL) {
+        elogmsg("malloc()");
+        exit(EXIT_FAILURE);
+    }
+
+    ret = axiom_get_fds(dev, &fd_raw, &fd_long, NULL);
+    if (!AXIOM_RET_IS_OK(ret)) {
+        elogmsg("axiom_get_fds()");
+        exit(EXIT_FAILURE);
+    }
+    if (fcntl(tunh[0], F_SETFL, fcntl(tunh[0], F_GETFL) | O_NONBLOCK) < 0) {
+        elogmsg("fcntl() O_NONBLOCK");
+        exit(EXIT_FAILURE);
+    }
+    r = reactor_create();
+    if (r == NULL) {
+        elogmsg("reactor_create()");
+        exit(EXIT_FAILURE);
+    }
+    ret = reactor_add_fd(r, tunh[0], EPOLLIN, 0, event_tap, &ctx);
+    ret |= reactor_add_fd(r, fd_raw, EPOLLIN, 0, event_axiom, &ctx);
+    ret |= reactor_add_fd(r, fd_long, EPOLLIN, 0, event_axiom, &ctx);
+    if (ret < 0) {
+        elogmsg("reactor_add_fd()");
+        exit(EXIT_FAILURE);
+    }
+    reactor_set_busypoll(r, busy_poll);
+
+    logmsg(LOG_INFO,"event loop starting (busy-poll %d usec)", busy_poll);
+    cpu0 = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    for (;;) {
+        ctx.frames = 0;
+        if (reactor_run_once(r) <= 0) {
+            elogmsg("reactor_run_once()");
+            break;
+        }
+        event_account(reactor_woke(r), ctx.frames);
+
+        reactor_get_stats(r, &rst);
+        __atomic_store_n(&ethtap_loop_stats.polled, rst.polled, __ATOMIC_RELAXED);
+        __atomic_store_n(&ethtap_loop_stats.slept, rst.slept, __ATOMIC_RELAXED);
+        __atomic_store_n(&ethtap_loop_stats.busy_poll_ns, rst.poll_ns, __ATOMIC_RELAXED);
+        __atomic_store_n(&ethtap_loop_stats.cpu_ns, clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu0, __ATOMIC_RELAXED);
+    }
+
+    reactor_destroy(r);
+    free(ctx.msg);
+    free(buf);
+    logmsg(LOG_INFO,"event loop end");
+}
+
+/**
+ * Attach a new queue to a tun/tap interface.
  * @param idx Interface number (i.e. 0 -> "ax0")
- * @param mac Last byte of mac address to set.
  * @return File handle or -1 on error.
  */
-static int ethtap_alloc(int idx, int mac) {
+static int ethtap_alloc_queue(int idx) {
     struct ifreq ifr;
-    int fd, err;
+    int fd, err, hdrsz;
 
     if ((fd = open("/dev/net/tun", O_RDWR)) < 0) {
         elogmsg("open() tun/tap");
@@ -241,16 +984,16 @@ static int ethtap_alloc(int idx, int mac) {
      *        IFF_TAP   - TAP device
      *
      *        IFF_NO_PI - Do not provide packet information
+     *        IFF_MULTI_QUEUE - every open() attaches a new queue
+     *        IFF_VNET_HDR - every frame starts with a virtio_net_hdr
+     *                       (checksum and GSO informations)
      *
      * TAP -> ethernet
      * TUN -> ip
      */
     memset(&ifr, 0, sizeof (ifr));
-#ifdef TUN_MODE
-    ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
-#else
-    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
-#endif
+    ifr.ifr_flags = (tun_mode ? IFF_TUN : IFF_TAP) | IFF_NO_PI |
+        IFF_MULTI_QUEUE | IFF_VNET_HDR;
     snprintf(ifr.ifr_name,IFNAMSIZ,"ax%d",idx);
 
     err = ioctl(fd, TUNSETIFF, (void *) &ifr);
@@ -260,7 +1003,167 @@ static int ethtap_alloc(int idx, int mac) {
         return -1;
     }
 
-    logmsg(LOG_INFO,"interface name = %s",ifr.ifr_name);
+    hdrsz = sizeof(struct virtio_net_hdr);
+    err = ioctl(fd, TUNSETVNETHDRSZ, &hdrsz);
+    if (err< 0) {
+        elogmsg("ioctl() TUNSETVNETHDRSZ");
+        close(fd);
+        return -1;
+    }
+
+    /* the axiom link is reliable: no checksum is needed, and super-frames
+     * up to 64 KB are carried as they are */
+    if (offload) {
+        err = ioctl(fd, TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6);
+        if (err< 0) {
+            logmsg(LOG_WARN,"ioctl() TUNSETOFFLOAD failed: offload disabled");
+        }
+    }
+
+    return fd;
+}
+
+/**
+ * Set the MTU of a tun/tap interface.
+ * @param idx Interface number (i.e. 0 -> "ax0")
+ * @param mtu the MTU
+ * @return 0 or -1 on error.
+ */
+static int ethtap_set_mtu(int idx, int mtu) {
+    struct ifreq ifr;
+    int sock, err;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        elogmsg("socket()");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof (ifr));
+    snprintf(ifr.ifr_name,IFNAMSIZ,"ax%d",idx);
+    ifr.ifr_mtu = mtu;
+    err = ioctl(sock, SIOCSIFMTU, (void *) &ifr);
+    close(sock);
+    if (err< 0) {
+        elogmsg("ioctl() SIOCSIFMTU");
+        return -1;
+    }
+
+    logmsg(LOG_INFO,"MTU = %d",mtu);
+
+    return 0;
+}
+
+/**
+ * Set the IPv4 address of a tun interface and bring it up.
+ * @param idx Interface number (i.e. 0 -> "ax0")
+ * @param addr the address (host byte order)
+ * @param mask the netmask (host byte order)
+ * @return 0 or -1 on error.
+ */
+static int ethtap_set_addr(int idx, uint32_t addr, uint32_t mask) {
+    struct ifreq ifr;
+    struct sockaddr_in *sin = (struct sockaddr_in *)&ifr.ifr_addr;
+    int sock, err;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        elogmsg("socket()");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof (ifr));
+    snprintf(ifr.ifr_name,IFNAMSIZ,"ax%d",idx);
+    sin->sin_family = AF_INET;
+    sin->sin_addr.s_addr = htonl(addr);
+    err = ioctl(sock, SIOCSIFADDR, (void *) &ifr);
+    if (err< 0) {
+        elogmsg("ioctl() SIOCSIFADDR");
+        close(sock);
+        return -1;
+    }
+
+    sin->sin_addr.s_addr = htonl(mask);
+    err = ioctl(sock, SIOCSIFNETMASK, (void *) &ifr);
+    if (err< 0) {
+        elogmsg("ioctl() SIOCSIFNETMASK");
+        close(sock);
+        return -1;
+    }
+
+    err = ioctl(sock, SIOCGIFFLAGS, (void *) &ifr);
+    if (err == 0) {
+        ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+        err = ioctl(sock, SIOCSIFFLAGS, (void *) &ifr);
+    }
+    close(sock);
+    if (err< 0) {
+        elogmsg("ioctl() SIOCSIFFLAGS");
+        return -1;
+    }
+
+    sin->sin_addr.s_addr = htonl(addr);
+    logmsg(LOG_INFO,"IP address = %s/%d",inet_ntoa(sin->sin_addr),__builtin_popcount(mask));
+
+    return 0;
+}
+
+/**
+ * Parse the TUN subnet rule "NET/PREFIX[+OFFSET]".
+ * @param rule the rule
+ * @return 0 or -1 on error.
+ */
+static int tun_parse(const char *rule) {
+    char net[32];
+    struct in_addr in;
+    int prefix, n;
+
+    tun_offset = 0;
+    n = sscanf(rule, "%31[0-9.]/%d+%d", net, &prefix, &tun_offset);
+    if (n < 2 || prefix < 8 || prefix > 30 || inet_aton(net, &in) == 0) {
+        return -1;
+    }
+    tun_mask = ~(uint32_t)0 << (32 - prefix);
+    tun_net = ntohl(in.s_addr) & tun_mask;
+    if (tun_offset < 0 || (uint32_t)tun_offset >= ~tun_mask) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Allocate a tun/tap interface.
+ * @param idx Interface number (i.e. 0 -> "ax0")
+ * @param mac Last byte of mac address to set.
+ * @param queues Number of queues to allocate
+ * @param fds[out] File handles of the queues
+ * @return 0 or -1 on error.
+ */
+static int ethtap_alloc(int idx, int mac, int queues, int *fds) {
+    struct ifreq ifr;
+    int fd, err, q;
+
+    for (q = 0; q < queues; q++) {
+        fds[q] = ethtap_alloc_queue(idx);
+        if (fds[q] < 0) {
+            while (q-- > 0) close(fds[q]);
+            return -1;
+        }
+    }
+    fd = fds[0];
+
+    logmsg(LOG_INFO,"interface name = ax%d (%d queues, %s mode)",idx,queues,tun_mode?"tun":"tap");
+
+    if (tun_mode) {
+        if (ethtap_set_mtu(idx, mtu) < 0) {
+            logmsg(LOG_WARN,"can not set the MTU of ax%d",idx);
+        }
+        if (ethtap_set_addr(idx, tun_net | (mac + tun_offset), tun_mask) < 0) {
+            for (q = 0; q < queues; q++) close(fds[q]);
+            return -1;
+        }
+        return 0;
+    }
 
     memset(&ifr, 0, sizeof (ifr));
     ifr.ifr_hwaddr.sa_family = ARPHRD_ETHER;
@@ -281,13 +1184,17 @@ static int ethtap_alloc(int idx, int mac) {
     err = ioctl(fd, SIOCSIFHWADDR, (void *) &ifr);
     if (err< 0) {
         elogmsg("ioctl() SIOCSIFHWADDR (set mac)");
-        close(fd);
+        for (q = 0; q < queues; q++) close(fds[q]);
         return -1;
     }
 
     logmsg(LOG_INFO,"MAC address = " MACSTR, MACVAL(ifr.ifr_hwaddr.sa_data));
+
+    if (ethtap_set_mtu(idx, mtu) < 0) {
+        logmsg(LOG_WARN,"can not set the MTU of ax%d",idx);
+    }
     
-    return fd;
+    return 0;
 }
 
 static void ethtap_prepare(int axiom_port) {
@@ -304,15 +1211,14 @@ static void ethtap_prepare(int axiom_port) {
         elogmsg("axiom_bind()");
         exit(EXIT_FAILURE);
     }
-    tunh=ethtap_alloc(0,(int) axiom_get_node_id(dev));
-    if (tunh<=0) {
+    if (ethtap_alloc(0,(int) axiom_get_node_id(dev),num_queues,tunh)<0) {
         exit(EXIT_FAILURE);
     }
 }
 
 /*
 static void ethtap_deinit() {
-    close(tunh);
+    for (int q=0; q<num_queues; q++) close(tunh[q]);
     axiom_close(dev);
 }
 */
@@ -340,6 +1246,64 @@ int main(int argc, char **argv)
                 break;
             case 'n':
                 num_threads = atoi(optarg);
+                if (num_threads < 1 || num_threads > MAX_THREADS) {
+                    _usage("number of threads must be between 1 and %d\n", MAX_THREADS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                first_cpu = atoi(optarg);
+                break;
+            case 'm':
+                mtu = atoi(optarg);
+                if (mtu < 68 || mtu > 65535) {
+                    _usage("MTU must be between 68 and 65535\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'O':
+                offload = 0;
+                break;
+            case 't':
+                table_filename = optarg;
+                break;
+            case 'r':
+                rdma = 1;
+                break;
+            case 'u':
+                tun_mode = 1;
+                if (optarg != NULL && tun_parse(optarg) < 0) {
+                    _usage("bad TUN subnet rule '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                stats_filename = optarg;
+                break;
+            case 'U':
+                stats_sockname = *optarg != '\0' ? optarg : NULL;
+                break;
+            case 'P':
+                pcap_frames = atoi(optarg);
+                if (pcap_frames < 0) {
+                    _usage("number of captured frames must be positive\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'e':
+                event_mode = 1;
+                break;
+            case 'b':
+                busy_poll = atoi(optarg);
+                if (busy_poll < 0) {
+                    _usage("busy-poll time must be positive\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'S':
+                if (sch_decodeopt(optarg, _usage) < 0) {
+                    exit(EXIT_FAILURE);
+                }
                 break;
 #ifndef NLOG
             case 'd':
@@ -368,20 +1332,53 @@ int main(int argc, char **argv)
 
     /* initialization */
 
+    if (event_mode) {
+        num_threads = 1;
+    }
+    num_queues = num_threads;
+    if (tun_mode && tun_mask == 0) {
+        tun_parse(DEF_TUN_NET);
+    }
+    if (mtu == 0) {
+        mtu = tun_mode ? DEF_TUN_MTU : DEF_MTU;
+    }
     ethtap_prepare(port);
 
+    if (table_filename != NULL && ethtap_neigh_load(table_filename) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (pcap_frames > 0 && ethtap_pcap_init(pcap_frames, tun_mode ? 101 : 1) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (ethtap_stats_start(stats_filename, stats_sockname) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    axstat_init("axiom-ethtap");
+    stat_tap_frames = axstat_counter("ethtap.tap_frames");
+    stat_ax_msgs = axstat_counter("ethtap.ax_msgs");
+    stat_tap_dispatch = axstat_histogram("ethtap.tap_dispatch");
+    stat_ax_dispatch = axstat_histogram("ethtap.ax_dispatch");
+    if (rdma && ethtap_rdma_init(dev, PORT, my_node, num_nodes, num_queues) < 0) {
+        rdma = 0;
+    }
+
     logmsg(LOG_INFO,"axiom port = %d",PORT);
 
+    if (event_mode) {
+        event_loop();
+        return 0;
+    }
+
     /* threads */
     
     for (i = 0; i < num_threads; i++) {
-        err = pthread_create(&threcv[i], NULL, receiver, NULL);
+        err = pthread_create(&threcv[i], NULL, receiver, (void *)(intptr_t)i);
         if (err != 0) {
             elogmsg("pthread_create()");
             exit(EXIT_FAILURE);
         }
 
-        err = pthread_create(&thsend[i], NULL, sender, NULL);
+        err = pthread_create(&thsend[i], NULL, sender, (void *)(intptr_t)i);
         if (err != 0) {
             elogmsg("pthread_create()");
             exit(EXIT_FAILURE);
@@ -0,0 +1,314 @@
+/*!
+ * \file axiom-ethtap.h
+ *
+ * \version     v1.2
+ *
+ * Functions shared by the modules of axiom-ethtap.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#ifndef AXIOM_ETHTAP_h
+#define AXIOM_ETHTAP_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <linux/if_ether.h>
+#include <linux/virtio_net.h>
+
+#include "axiom_nic_api_user.h"
+#include "axiom_nic_limits.h"
+
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MACVAL(p) *(p),*((p)+1),*((p)+2),*((p)+3),*((p)+4),*((p)+5)
+
+/** Largest GSO frame handed over by the kernel (plus the virtio header). */
+#define FRAME_MAX (sizeof(struct virtio_net_hdr) + ETH_HLEN + 65535)
+
+/**
+ * Header of every axiom message: a frame larger than a long message is split
+ * in fragments that share len and seq.
+ */
+typedef struct {
+    uint32_t len;       /**< length of virtio header + frame */
+    uint32_t offset;    /**< offset of this fragment (RDMA: ring slot) */
+    uint16_t seq;       /**< frame sequence number of the source queue */
+    uint8_t queue;      /**< source queue */
+    uint8_t origin;     /**< node that sent the frame first */
+    uint8_t flags;      /**< FRAG_* flags */
+    uint8_t spare[3];
+} frag_hdr_t;
+
+/** The frame is flooded along the spanning tree rooted at the origin. */
+#define FRAG_TREE 0x01
+/** Doorbell: the frame is in the RDMA ring slot 'offset'. */
+#define FRAG_RDMA 0x02
+/** Credits: 'offset' slots of the RDMA ring are free again. */
+#define FRAG_CREDIT 0x04
+/** With FRAG_RDMA: the slot holds no frame and is only retired. */
+#define FRAG_SKIP 0x08
+
+/** Set of axiom nodes. */
+typedef struct {
+    uint64_t bits[(AXIOM_NODES_NUM + 63) / 64];
+} ethtap_nodeset_t;
+
+static inline void nodeset_add(ethtap_nodeset_t *set, int node) {
+    set->bits[node / 64] |= (uint64_t)1 << (node % 64);
+}
+
+static inline int nodeset_has(const ethtap_nodeset_t *set, int node) {
+    return (set->bits[node / 64] >> (node % 64)) & 1;
+}
+
+/*
+ * Neighbour table (axiom-ethtap-table.c)
+ */
+
+/**
+ * Learn the node that owns a unicast MAC address.
+ * Static entries (loaded from file) are never replaced.
+ * @param mac the MAC address
+ * @param node the node
+ */
+void ethtap_neigh_learn(const uint8_t *mac, int node);
+
+/**
+ * Get the node that owns a unicast MAC address.
+ * @param mac the MAC address
+ * @return the node or -1 if it is unknown
+ */
+int ethtap_neigh_lookup(const uint8_t *mac);
+
+/**
+ * Get the members of a multicast group.
+ * @param mac the multicast MAC address
+ * @param members[out] nodes that joined the group
+ * @return 0 or -1 if the group is unknown
+ */
+int ethtap_mcast_lookup(const uint8_t *mac, ethtap_nodeset_t *members);
+
+/**
+ * Load static neighbours and multicast groups from a file.
+ * Every line contains a MAC address followed by a node (unicast MAC) or by
+ * a comma separated list of nodes (multicast MAC); '#' starts a comment.
+ * @param filename the file
+ * @return 0 or -1 on error
+ */
+int ethtap_neigh_load(const char *filename);
+
+/**
+ * Dump the neighbour and the multicast tables.
+ * @param out output stream
+ */
+void ethtap_neigh_dump(FILE *out);
+
+/*
+ * Per-destination statistics (axiom-ethtap-stats.c)
+ */
+
+/** Counters of the traffic exchanged with a node. */
+typedef struct {
+    uint64_t tx_frames;     /**< frames sent to the node */
+    uint64_t tx_bytes;
+    uint64_t tx_errors;     /**< axiom_send() errors */
+    uint64_t rx_frames;     /**< frames received from the node */
+    uint64_t rx_bytes;
+    uint64_t relayed;       /**< messages of the node relayed on the tree */
+} ethtap_node_stats_t;
+
+/** Per-destination counters, indexed by node. */
+extern ethtap_node_stats_t ethtap_stats[AXIOM_NODES_NUM];
+
+/** Counters of the event loop (--event). */
+typedef struct {
+    uint64_t frames;        /**< frames and messages handled */
+    uint64_t latency_ns;    /**< sum of the latencies (wakeup -> forwarded) */
+    uint64_t latency_max_ns;
+    uint64_t cpu_ns;        /**< cpu time used by the loop */
+    uint64_t polled;        /**< wakeups found by busy polling */
+    uint64_t slept;         /**< wakeups after sleeping in epoll_wait() */
+    uint64_t busy_poll_ns;  /**< current busy-poll time */
+} ethtap_loop_stats_t;
+
+/** Event loop counters. */
+extern ethtap_loop_stats_t ethtap_loop_stats;
+
+static inline void stats_add(uint64_t *counter, uint64_t value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+/** Reasons of the dropped frames. */
+typedef enum {
+    DROP_SHORT,         /**< frame or message too short */
+    DROP_NO_ROUTE,      /**< destination is local or not on axiom */
+    DROP_BAD_DEST,      /**< received frame not for this node (MAC) */
+    DROP_SEND_ERROR,    /**< axiom send or RDMA write error */
+    DROP_TAP_WRITE,     /**< write on the tap failed */
+    DROP_BAD_FRAGMENT,  /**< invalid fragment or RDMA doorbell */
+    DROP_INCOMPLETE,    /**< reassembly overwritten by a newer frame */
+    DROP_NO_MEMORY,     /**< reassembly buffers not allocated */
+    DROP_NUM
+} ethtap_drop_t;
+
+/** Buckets of the send latency histogram: [2^(i-1), 2^i) usec. */
+#define LAT_BUCKETS 16
+
+/**
+ * Counters of a data path thread: written only by the thread, so they are
+ * updated without atomic read-modify-write and aggregated on request.
+ */
+typedef struct {
+    char name[16];
+    uint64_t tx_frames;     /**< frames sent on axiom */
+    uint64_t tx_bytes;
+    uint64_t rx_frames;     /**< frames written on the tap */
+    uint64_t rx_bytes;
+    uint64_t drops[DROP_NUM];
+    uint64_t floods;        /**< frames flooded or relayed on the tree */
+    uint64_t flood_msgs;    /**< copies sent for the floods (fan-out) */
+    uint64_t flood_ns;      /**< time spent sending the copies */
+    uint64_t send_lat[LAT_BUCKETS]; /**< time to send a frame to a node */
+} ethtap_thread_stats_t;
+
+/** Counters of the calling thread (NULL before ethtap_stats_thread()). */
+extern __thread ethtap_thread_stats_t *ethtap_tstats;
+
+static inline void tstats_add(uint64_t *counter, uint64_t value) {
+    /* single writer: the readers only need untorn values */
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Account a dropped frame of the calling thread.
+ * @param reason why the frame was dropped
+ */
+static inline void stats_drop(ethtap_drop_t reason) {
+    if (ethtap_tstats != NULL) tstats_add(&ethtap_tstats->drops[reason], 1);
+}
+
+/**
+ * Account the time spent sending a frame to a node.
+ * @param ns the time in nanoseconds
+ */
+static inline void stats_send_latency(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    int b = us == 0 ? 0 : 64 - __builtin_clzll(us);
+
+    if (ethtap_tstats == NULL) return;
+    if (b >= LAT_BUCKETS) b = LAT_BUCKETS - 1;
+    tstats_add(&ethtap_tstats->send_lat[b], 1);
+}
+
+/**
+ * Register the counters of the calling (data path) thread.
+ * @param name name of the thread in the dumps
+ * @return 0 or -1 if there are too many threads
+ */
+int ethtap_stats_thread(const char *name);
+
+/**
+ * Dump the per-destination and per-thread counters and the tables.
+ * @param out output stream
+ */
+void ethtap_stats_dump(FILE *out);
+
+/**
+ * Start a thread that dumps the statistics when SIGUSR1 is received, and a
+ * thread that serves the statistics ("stats" request) and the captured
+ * frames ("pcap" request) on a unix socket.
+ * Must be called before creating the other threads.
+ * @param filename file where the statistics are written
+ * @param sockname unix socket (NULL none)
+ * @return 0 or -1 on error
+ */
+int ethtap_stats_start(const char *filename, const char *sockname);
+
+/*
+ * Capture of the last frames (axiom-ethtap-stats.c)
+ */
+
+/**
+ * Allocate the ring of the captured frames.
+ * @param frames number of frames kept (the oldest are overwritten)
+ * @param linktype pcap link type (1 ethernet, 101 raw IP)
+ * @return 0 or -1 on error
+ */
+int ethtap_pcap_init(int frames, int linktype);
+
+/**
+ * Capture a frame (lock free); only the first bytes are kept.
+ * Does nothing if the capture is disabled.
+ * @param frame the frame
+ * @param len length of the frame
+ */
+void ethtap_pcap_add(const uint8_t *frame, size_t len);
+
+/**
+ * Write the captured frames in pcap format, oldest first.
+ * @param out output stream
+ * @return number of frames written
+ */
+int ethtap_pcap_dump(FILE *out);
+
+/*
+ * RDMA data path for large frames (axiom-ethtap-rdma.c)
+ */
+
+/**
+ * Map the RDMA zone and split it in one ring for each peer.
+ * @param dev axiom device
+ * @param port axiom port of the doorbells
+ * @param my_node local node
+ * @param num_nodes number of nodes
+ * @param num_queues number of tap queues (one staging slot each)
+ * @return 0 or -1 if the RDMA data path can not be used
+ */
+int ethtap_rdma_init(axiom_dev_t *dev, int port, int my_node, int num_nodes,
+        int num_queues);
+
+/**
+ * Get the staging buffer of a tap queue, in the local RDMA zone.
+ * The buffer can hold the virtio header followed by FRAME_MAX bytes.
+ * @param queue the tap queue
+ * @return the buffer or NULL if the RDMA data path is disabled
+ */
+uint8_t *ethtap_rdma_staging(int queue);
+
+/**
+ * Send a frame through the RDMA ring of a peer.
+ * The frame must be in the staging buffer of the queue of hdr.
+ * @param node destination node
+ * @param hdr message header
+ * @param data virtio header followed by the frame (staging buffer)
+ * @param len length of data
+ * @return 0, -1 if the frame must be sent with long messages or -2 if the
+ *         frame is dropped on a send error
+ */
+int ethtap_rdma_send(int node, frag_hdr_t *hdr, uint8_t *data, size_t len);
+
+/**
+ * Get a frame received in a ring slot.
+ * @param origin sender of the frame
+ * @param slot ring slot
+ * @param len length of the frame
+ * @return the frame or NULL if the slot is invalid
+ */
+uint8_t *ethtap_rdma_slot(int origin, uint32_t slot, size_t len);
+
+/**
+ * Release a ring slot; the credits are returned in batches.
+ * @param origin sender of the frame
+ * @param slot ring slot
+ */
+void ethtap_rdma_release(int origin, uint32_t slot);
+
+/**
+ * Handle the credits returned by a peer.
+ * @param node the peer
+ * @param credits number of free slots
+ */
+void ethtap_rdma_credit(int node, uint32_t credits);
+
+#endif /* !AXIOM_ETHTAP_h */
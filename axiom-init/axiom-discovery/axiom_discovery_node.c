@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
@@ -222,6 +223,11 @@ notify_end_of_discovery() {
             }
             if (pid2==0) {
                 // CHILD of CHILD
+                // the reactor of axiom-init blocks SIGTERM/SIGINT
+                // and the mask is inherited across execl()
+                sigset_t mask;
+                sigemptyset(&mask);
+                sigprocmask(SIG_SETMASK, &mask, NULL);
                 // exec notify script!!!
                 execl(NOTIFY_SCRIPT,NOTIFY_SCRIPT_NAME,NULL);
                 EPRINTF("execl() error");
@@ -23,6 +23,7 @@
 #include <getopt.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <signal.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -35,6 +36,8 @@
 #include "axiom_nic_init.h"
 #include "axiom-init.h"
 #include "axiom_common.h"
+#include "axiom_counters.h"
+#include "axiom_reactor.h"
 
 int verbose = 0;
 
@@ -50,6 +53,8 @@ usage(void)
     printf("-n, --nodeid    id     set node id\n");
     printf("-r, --routing   file   load routing table from file (each row (X) must contain the interface to reach node X)\n");
     printf("-s, --save      file   save routing table to file (after discovery)\n");
+    printf("-N, --netperf   port   handle axiom-netperf messages in dedicated threads bound to port\n");
+    printf("-T, --nthreads  num    number of dedicated axiom-netperf threads [def. 1]\n");
     sch_usage(stdout);
     printf("-v, --verbose          verbose output\n");
     printf("-V, --version          print version\n");
@@ -142,10 +147,142 @@ axiom_rt_to_file(axiom_dev_t *dev, char *filename)
     return 0;
 }
 
+/* state of the message loop of main() */
+typedef struct {
+    axiom_dev_t *dev;
+    axiom_node_id_t (*topology)[AXIOM_INTERFACES_NUM];
+    axiom_if_id_t *final_routing_table;
+    int save_rt;
+    char *rt_filename;
+    /* source of the last raw message (used also for the socket ones) */
+    axiom_node_id_t src;
+    int stat_raw, stat_sock, stat_discarded, stat_dispatch;
+} init_loop_t;
+
+/* handle a control message */
+static void
+dispatch_message(init_loop_t *loop, axiom_init_cmd_t cmd, size_t payload_size,
+        axiom_long_payload_t *payload)
+{
+    axiom_dev_t *dev = loop->dev;
+    axiom_node_id_t src = loop->src;
+
+    /* time to the end of this message */
+    AXSTAT_SCOPE(loop->stat_dispatch);
+    switch (cmd) {
+        case AXIOM_DSCV_CMD_REQ_ID:
+            axiom_discovery_slave(dev, src, payload, loop->topology,
+                    loop->final_routing_table);
+            if (loop->save_rt) {
+                if (axiom_rt_to_file(dev, loop->rt_filename)) {
+                    EPRINTF("error writing routing-table file");
+                }
+            }
+            break;
+
+        case AXIOM_CMD_START_DISCOVERY:
+            axiom_discovery_master(dev, loop->topology, loop->final_routing_table);
+            if (loop->save_rt) {
+                if (axiom_rt_to_file(dev, loop->rt_filename)) {
+                    EPRINTF("error writing routing-table file");
+                }
+            }
+            break;
+
+        case AXIOM_CMD_PING:
+            axiom_pong(dev, src, payload, verbose);
+            break;
+
+        case AXIOM_CMD_TRACEROUTE:
+            axiom_traceroute_reply(dev, src, payload_size, payload, verbose);
+            break;
+
+        case AXIOM_CMD_SPAWN_REQ:
+            axiom_spawn_req(dev, src, payload_size, payload, verbose);
+            break;
+
+        case AXIOM_CMD_NETPERF:
+        case AXIOM_CMD_NETPERF_START:
+        case AXIOM_CMD_NETPERF_END:
+            axiom_netperf_reply(dev, src, payload_size, payload, verbose);
+            break;
+
+        case AXIOM_CMD_SESSION_REQ:
+            axiom_session(dev, src, payload_size, payload, verbose);
+            break;
+
+        case AXIOM_CMD_ALLOC:
+        case AXIOM_CMD_ALLOC_APPID:
+        case AXIOM_CMD_ALLOC_RELEASE:
+            axiom_allocator_l1(dev, src, payload_size, payload, verbose);
+            break;
+
+        default:
+            axstat_add(loop->stat_discarded, 1);
+            EPRINTF("message discarded - cmd: 0x%x", cmd);
+    }
+}
+
+/* a message on the unix domain socket */
+static void
+sock_message(reactor_t *r, int sock, uint32_t events, void *arg)
+{
+    init_loop_t *loop = (init_loop_t *) arg;
+    axiom_long_payload_t payload;
+    struct msghdr msg;
+    struct iovec iov;
+    int res;
+
+    iov.iov_base=&payload;
+    iov.iov_len=sizeof(payload);
+    memset(&msg,0,sizeof(msg));
+    msg.msg_iov=&iov;
+    msg.msg_iovlen=1;
+    res=recvmsg(sock,&msg,0);
+    if (res<=0) {
+        EPRINTF("error during recvmsg() from unix domain socket");
+        reactor_stop(r);
+        return;
+    }
+    axstat_add(loop->stat_sock, 1);
+    dispatch_message(loop, ((axiom_init_payload_t*)&payload)->command, res, &payload);
+}
+
+/* a message on the axiom raw port */
+static void
+raw_message(reactor_t *r, int fd, uint32_t events, void *arg)
+{
+    init_loop_t *loop = (init_loop_t *) arg;
+    axiom_type_t type;
+    axiom_init_cmd_t cmd;
+    axiom_long_payload_t payload;
+    size_t payload_size = sizeof(payload);
+    axiom_err_t ret;
+
+    ret = axiom_recv_init(loop->dev, &loop->src, &type, &cmd, &payload_size,
+            &payload);
+    if (!AXIOM_RET_IS_OK(ret)) {
+        EPRINTF("error receiving message");
+        reactor_stop(r);
+        return;
+    }
+    axstat_add(loop->stat_raw, 1);
+    dispatch_message(loop, cmd, payload_size, &payload);
+}
+
+/* termination signal: the loop ends and the socket is removed */
+static void
+quit_signal(reactor_t *r, const struct signalfd_siginfo *si, void *arg)
+{
+    IPRINTF(verbose, "signal %d received: exiting", (int) si->ssi_signo);
+    reactor_stop(r);
+}
+
 int
 main(int argc, char **argv)
 {
-    int master = 0, run = 1, set_nodeid = 0, set_rt = 0, save_rt=0;
+    int master = 0, set_nodeid = 0, set_rt = 0, save_rt=0;
+    int netperf_port = -1, netperf_threads = 1;
     char rt_filename[1024];
     char rt_save_filename[1024];
     axiom_dev_t *dev = NULL;
@@ -156,8 +293,9 @@ main(int argc, char **argv)
     axiom_err_t ret;
     int sock;
     struct sockaddr_un myaddr;
-    int result, maxfd,fd_raw;
-    fd_set set;
+    int result, fd_raw;
+    init_loop_t loop;
+    reactor_t *r;
 
     int long_index =0;
     int opt = 0;
@@ -166,6 +304,8 @@ main(int argc, char **argv)
         {"nodeid", required_argument, 0, 'n'},
         {"routing", required_argument, 0, 'r'},
         {"save", required_argument, 0, 's'},
+        {"netperf", required_argument, 0, 'N'},
+        {"nthreads", required_argument, 0, 'T'},
         {"sched", optional_argument, 0, 'S'},
         {"verbose", no_argument, 0, 'v'},
         {"version", no_argument, 0, 'V'},
@@ -173,7 +313,7 @@ main(int argc, char **argv)
         {0, 0, 0, 0}
     };
 
-    while ((opt = getopt_long(argc, argv,"hvmn:r:s:VS:",
+    while ((opt = getopt_long(argc, argv,"hvmn:r:s:N:T:VS:",
                          long_options, &long_index )) != -1) {
         switch (opt) {
             case 'S':
@@ -208,6 +348,23 @@ main(int argc, char **argv)
                 }
                 save_rt = 1;
                 break;
+            case 'N':
+                if ((sscanf(optarg, "%d", &netperf_port) != 1) ||
+                        netperf_port <= AXIOM_RAW_PORT_INIT ||
+                        netperf_port > AXIOM_PORT_MAX) {
+                    EPRINTF("wrong netperf port");
+                    usage();
+                    exit(-1);
+                }
+                break;
+            case 'T':
+                if ((sscanf(optarg, "%d", &netperf_threads) != 1) ||
+                        netperf_threads <= 0) {
+                    EPRINTF("wrong number of netperf threads");
+                    usage();
+                    exit(-1);
+                }
+                break;
             case 'v':
                 verbose = 1;
                 break;
@@ -221,11 +378,19 @@ main(int argc, char **argv)
         }
     }
 
-    if (sch_setsched()!=0) {
+    if (sch_setsched_role("main")!=0) {
         EPRINTF("can't set scheduler parameters");
         exit(-1);
     }
 
+    /* before any thread: the quit signals are blocked in all of them */
+    r = reactor_create();
+    if (r == NULL || reactor_add_signal(r, SIGTERM, quit_signal, NULL)
+            || reactor_add_signal(r, SIGINT, quit_signal, NULL)) {
+        EPRINTF("can't create the message loop");
+        exit(-1);
+    }
+
     /* avoid the flush of previous packets */
     axiom_args.flags = AXIOM_FLAG_NOFLUSH;
 
@@ -245,6 +410,10 @@ main(int argc, char **argv)
 
     axiom_spawn_init();
     axiom_allocator_l1_init();
+    if (axiom_netperf_init(dev, netperf_port, netperf_threads, verbose)) {
+        axiom_close(dev);
+        exit(-1);
+    }
 
     if (set_nodeid) {
         axiom_set_node_id(dev, node_id);
@@ -307,95 +476,29 @@ main(int argc, char **argv)
         axiom_close(dev);
         exit(-1);
     }
-    maxfd=fd_raw>sock?fd_raw+1:sock+1;
-
-    while(run) {
-        axiom_node_id_t src;
-        axiom_type_t type;
-        axiom_init_cmd_t cmd;
-        axiom_long_payload_t payload;
-        size_t payload_size = sizeof(payload);
-        int res;
-       
-        FD_ZERO(&set);
-        FD_SET(sock,&set);
-        FD_SET(fd_raw,&set);
-        res=select(maxfd,&set,NULL,NULL,NULL);
-        if (res==-1) {
-            if (errno == EINTR) continue; // paranoia
-            EPRINTF("select() error");
-            break;
-        }
-        if (FD_ISSET(sock,&set)) {
-            struct msghdr msg;
-            struct iovec iov;
-            iov.iov_base=&payload;
-            iov.iov_len=sizeof(payload);
-            memset(&msg,0,sizeof(msg));
-            msg.msg_iov=&iov;
-            msg.msg_iovlen=1;
-            res=recvmsg(sock,&msg,0);
-            if (res<=0) {
-                EPRINTF("error during recvmsg() from unix domain socket");
-                break;
-            }
-            cmd = ((axiom_init_payload_t*)&payload)->command;
-            payload_size=res;
-        } else {
-            ret = axiom_recv_init(dev, &src, &type, &cmd, &payload_size,
-                    &payload);
-            if (!AXIOM_RET_IS_OK(ret)) {
-                EPRINTF("error receiving message");
-                break;
-            }
-        }
-        switch (cmd) {
-            case AXIOM_DSCV_CMD_REQ_ID:
-                axiom_discovery_slave(dev, src, &payload, topology,
-                        final_routing_table);
-                if (save_rt) {
-                    if (axiom_rt_to_file(dev, rt_filename)) {
-                        EPRINTF("error writing routing-table file");
-                    }
-                }
-                break;
-
-            case AXIOM_CMD_START_DISCOVERY:
-                axiom_discovery_master(dev, topology, final_routing_table);
-                if (save_rt) {
-                    if (axiom_rt_to_file(dev, rt_filename)) {
-                        EPRINTF("error writing routing-table file");
-                    }
-                }
-                break;
-
-            case AXIOM_CMD_PING:
-                axiom_pong(dev, src, &payload, verbose);
-                break;
 
-            case AXIOM_CMD_TRACEROUTE:
-                axiom_traceroute_reply(dev, src, &payload, verbose);
-                break;
-
-            case AXIOM_CMD_SPAWN_REQ:
-                axiom_spawn_req(dev, src, payload_size, &payload, verbose);
-                break;
-
-            case AXIOM_CMD_SESSION_REQ:
-                axiom_session(dev, src, payload_size, &payload, verbose);
-                break;
-
-            case AXIOM_CMD_ALLOC:
-            case AXIOM_CMD_ALLOC_APPID:
-            case AXIOM_CMD_ALLOC_RELEASE:
-                axiom_allocator_l1(dev, src, payload_size, &payload, verbose);
-                break;
-
-            default:
-                EPRINTF("message discarded - cmd: 0x%x", cmd);
-        }
+    /* counters and dispatch latency, read by axiom-stat */
+    axstat_init("axiom-init");
+    memset(&loop, 0, sizeof(loop));
+    loop.dev = dev;
+    loop.topology = topology;
+    loop.final_routing_table = final_routing_table;
+    loop.save_rt = save_rt;
+    loop.rt_filename = rt_filename;
+    loop.stat_raw = axstat_counter("init.raw_msgs");
+    loop.stat_sock = axstat_counter("init.sock_msgs");
+    loop.stat_discarded = axstat_counter("init.discarded");
+    loop.stat_dispatch = axstat_histogram("init.dispatch");
+
+    if (reactor_add_fd(r, sock, EPOLLIN, 0, sock_message, &loop)
+            || reactor_add_fd(r, fd_raw, EPOLLIN, 0, raw_message, &loop)) {
+        EPRINTF("can't watch the message file descriptors");
+    } else if (reactor_run(r)) {
+        EPRINTF("reactor_run() error");
     }
+    reactor_destroy(r);
 
+    axiom_netperf_release();
     close(sock);
     unlink(AXIOM_INIT_SOCKET_PATHNAME);
     axiom_close(dev);
@@ -60,12 +60,13 @@ axiom_pong(axiom_dev_t *dev, axiom_if_id_t first_src, void *first_payload,
  *
  * \param dev                   The axiom device private data pointer
  * \param if_src                Source interface of traceroute message
+ * \param payload_size          Size of payload of traceroute message
  * \param payload               Payload of traceroute message
  * \param verbose               Enable verbose output
  */
 void
 axiom_traceroute_reply(axiom_dev_t *dev, axiom_if_id_t src,
-        void *payload, int verbose);
+        size_t payload_size, void *payload, int verbose);
 
 /*!
  * \brief This function initialize the internal structures used by the spawn
@@ -114,4 +115,35 @@ void axiom_allocator_l1_init();
 void axiom_allocator_l1(axiom_dev_t *dev, axiom_node_id_t src,
         size_t payload_size, void *payload, int verbose);
 
+/*!
+ * \brief This function initialize the axiom-netperf server core.
+ *
+ * \param dev                   The axiom device private data pointer
+ * \param port                  Port of the dedicated netperf threads
+ *                              (-1 to handle netperf messages on port 0)
+ * \param num_threads           Number of dedicated netperf threads
+ * \param verbose               Enable verbose output
+ *
+ * \return 0 on success, -1 otherwise
+ */
+int axiom_netperf_init(axiom_dev_t *dev, int port, int num_threads,
+        int verbose);
+
+/*!
+ * \brief This function releases the axiom-netperf server core.
+ */
+void axiom_netperf_release(void);
+
+/*!
+ * \brief This function implements the reply to the axiom-netperf messages.
+ *
+ * \param dev                   The axiom device private data pointer
+ * \param src                   Source node of message
+ * \param payload_size          Size of payload
+ * \param payload               Payload of message
+ * \param verbose               Enable verbose output
+ */
+void axiom_netperf_reply(axiom_dev_t *dev, axiom_node_id_t src,
+        size_t payload_size, void *payload, int verbose);
+
 #endif /*! AXIOM_INIT_h*/
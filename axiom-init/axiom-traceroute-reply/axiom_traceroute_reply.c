@@ -13,6 +13,8 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "axiom_nic_types.h"
 #include "axiom_nic_packets.h"
@@ -20,35 +22,53 @@
 #include "axiom_nic_api_user.h"
 #include "axiom_nic_init.h"
 #include "dprintf.h"
+#include "axiom_init_api.h"
 
 #include "../axiom-init.h"
 
 void
 axiom_traceroute_reply(axiom_dev_t *dev, axiom_if_id_t src,
-        void *payload, int verbose) {
+        size_t payload_size, void *payload, int verbose) {
     axiom_err_t ret;
     axiom_if_id_t if_id;
     axiom_err_t msg_err;
     axiom_node_id_t node_id;
-    axiom_traceroute_payload_t send_payload;
-    axiom_traceroute_payload_t *recv_payload =
-            ((axiom_traceroute_payload_t *) payload);
+    axinit_traceroute_payload_t send_payload;
+    axinit_traceroute_payload_t *recv_payload =
+            ((axinit_traceroute_payload_t *) payload);
+    struct timespec now;
+
+    /* receive time of the timed probes: comparable among synced nodes */
+    clock_gettime(CLOCK_REALTIME, &now);
 
     if (recv_payload->command != AXIOM_CMD_TRACEROUTE) {
         EPRINTF("receive a not AXIOM_CMD_TRACEROUTE message");
         return;
     }
 
+    /* the old traceroute carries only axiom_traceroute_payload_t */
+    if (payload_size < sizeof(axinit_traceroute_payload_t)) {
+        payload_size = sizeof(axiom_traceroute_payload_t);
+    } else {
+        payload_size = sizeof(axinit_traceroute_payload_t);
+    }
+
     IPRINTF(verbose, "TRACEROUTE message received from: %u node step: %u",
             recv_payload->src_id, recv_payload->step);
 
+    node_id = axiom_get_node_id(dev);
+
     recv_payload->step++;
-    send_payload = *recv_payload;
+    memcpy(&send_payload, recv_payload, payload_size);
 
     /* send reply to the node who has started the traceroute */
     recv_payload->command = AXIOM_CMD_TRACEROUTE_REPLY;
+    if (payload_size == sizeof(axinit_traceroute_payload_t)) {
+        recv_payload->hop_id = node_id;
+        recv_payload->hop_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    }
     ret = axiom_send_raw(dev, recv_payload->src_id, AXIOM_RAW_PORT_NETUTILS,
-            AXIOM_TYPE_RAW_DATA, sizeof(*recv_payload), recv_payload);
+            AXIOM_TYPE_RAW_DATA, payload_size, recv_payload);
     if (!AXIOM_RET_IS_OK(ret)) {
         EPRINTF("send error");
         return;
@@ -57,7 +77,6 @@ axiom_traceroute_reply(axiom_dev_t *dev, axiom_if_id_t src,
             recv_payload->step);
 
 
-    node_id = axiom_get_node_id(dev);
     if (node_id != recv_payload->dst_id) {
         /* get interface to reach next hop for recv_payload->dst_id node */
         ret = axiom_next_hop(dev, recv_payload->dst_id, &if_id);
@@ -68,7 +87,7 @@ axiom_traceroute_reply(axiom_dev_t *dev, axiom_if_id_t src,
 
         /* send raw neighbour traceroute message */
         msg_err = axiom_send_raw(dev, if_id, AXIOM_RAW_PORT_INIT,
-                AXIOM_TYPE_RAW_NEIGHBOUR, sizeof(send_payload), &send_payload);
+                AXIOM_TYPE_RAW_NEIGHBOUR, payload_size, &send_payload);
         if (!AXIOM_RET_IS_OK(msg_err)) {
             EPRINTF("send raw init error");
             return;
@@ -0,0 +1,274 @@
+/*!
+ * \file axiom-logdecode.c
+ *
+ * \version     v1.2
+ * \date        2017-09-12
+ *
+ * This file contains the implementation of axiom-logdecode application.
+ *
+ * axiom-logdecode formats the binary trace files written by the logging
+ * subsystem when AXIOM_LOG_TRACE is set (see axiom_logtrace.h), with the same
+ * layout of the text log messages.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "axiom_nic_types.h"
+#include "axiom_common.h"
+#include "axiom_logtrace.h"
+
+typedef struct {
+    const char *types;
+    const char *msg;
+} fmt_t;
+
+int verbose = 0;
+
+static void usage(void) {
+    printf("usage: axiom-logdecode [arguments] tracefile...\n");
+    printf("Format the binary trace files recorded with AXIOM_LOG_TRACE\n");
+    printf("Version: %s\n", AXIOM_API_VERSION_STR);
+    printf("\n\n");
+    printf("Arguments:\n");
+    printf("-l, --level LEVEL  print only the messages up to LEVEL (FATAL ... TRACE)\n");
+    printf("-t, --tid TID      print only the messages of thread TID\n");
+    printf("-v, --verbose      print the number of messages and of the dropped ones\n");
+    printf("-V, --version      print version\n");
+    printf("-h, --help         print this help\n\n");
+}
+
+static inline int32_t get_i32(const char **p) {
+    int32_t v;
+    memcpy(&v, *p, 4);
+    *p += 4;
+    return v;
+}
+
+static inline int64_t get_i64(const char **p) {
+    int64_t v;
+    memcpy(&v, *p, 8);
+    *p += 8;
+    return v;
+}
+
+/* print a conversion: spec is one printf conversion, args the raw arguments */
+static void print_conv(const char *spec, const char *types, int ntypes, const char **args) {
+    int star[2], nstar = 0, i;
+    char value = ntypes > 0 ? types[ntypes - 1] : 0;
+    double d;
+    int64_t i64;
+    uint16_t len;
+
+    for (i = 0; i < ntypes - 1; i++) star[nstar++] = get_i32(args);
+
+    switch (value) {
+        case 0:
+            /* "%%" or "%m" */
+            fputs(spec[1] == '%' ? "%" : spec, stdout);
+            break;
+        case 'i':
+            i = get_i32(args);
+            if (nstar == 0) printf(spec, i);
+            else if (nstar == 1) printf(spec, star[0], i);
+            else printf(spec, star[0], star[1], i);
+            break;
+        case 'l':
+            i64 = get_i64(args);
+            if (nstar == 0) printf(spec, (long long) i64);
+            else if (nstar == 1) printf(spec, star[0], (long long) i64);
+            else printf(spec, star[0], star[1], (long long) i64);
+            break;
+        case 'f':
+        case 'F':
+            i64 = get_i64(args);
+            memcpy(&d, &i64, 8);
+            if (value == 'F') {
+                long double ld = d;
+                if (nstar == 0) printf(spec, ld);
+                else if (nstar == 1) printf(spec, star[0], ld);
+                else printf(spec, star[0], star[1], ld);
+            } else {
+                if (nstar == 0) printf(spec, d);
+                else if (nstar == 1) printf(spec, star[0], d);
+                else printf(spec, star[0], star[1], d);
+            }
+            break;
+        case 'p':
+            /* pointers and wide strings: only the address is recorded */
+            printf("%p", (void *) (intptr_t) get_i64(args));
+            break;
+        case 's': {
+            char buf[LOGTRACE_MAX_STR + 1];
+            memcpy(&len, *args, 2);
+            if (len > LOGTRACE_MAX_STR) len = LOGTRACE_MAX_STR;
+            memcpy(buf, *args + 2, len);
+            buf[len] = '\0';
+            *args += 2 + len;
+            if (nstar == 0) printf(spec, buf);
+            else if (nstar == 1) printf(spec, star[0], buf);
+            else printf(spec, star[0], star[1], buf);
+            break;
+        }
+        default:
+            /* %n */
+            break;
+    }
+}
+
+static void print_msg(logtrace_rec_t *rec, fmt_t *fmt) {
+    const char *p = fmt->msg, *next, *spec, *args = (const char *) (rec + 1);
+    char types[3], conv[64];
+    int ntypes;
+
+    printf("[%5d.%06d] %5s{%d}: ", (int) (rec->ts / 1000000000ULL % 10000),
+            (int) (rec->ts % 1000000000ULL / 1000),
+            rec->level <= LOG_TRACE ? logmsg_name[rec->level] : "?", (int) rec->tid);
+    while ((next = logtrace_conv(p, &spec, types, &ntypes)) != NULL) {
+        fwrite(p, 1, spec - p, stdout);
+        if (next - spec >= (int) sizeof (conv)) {
+            fwrite(spec, 1, next - spec, stdout);
+        } else {
+            memcpy(conv, spec, next - spec);
+            conv[next - spec] = '\0';
+            print_conv(conv, types, ntypes, &args);
+        }
+        p = next;
+    }
+    fputs(p, stdout);
+}
+
+static int decode(const char *filename, int level, int tid) {
+    logtrace_hdr_t *hdr;
+    logtrace_rec_t *rec;
+    fmt_t *fmts = NULL;
+    struct stat st;
+    uint64_t off, end, msgs = 0;
+    uint32_t nfmts = 0;
+    char *map, *data;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror(filename);
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap()");
+        return -1;
+    }
+
+    hdr = (logtrace_hdr_t *) map;
+    if (st.st_size < LOGTRACE_HEADER_SIZE || memcmp(hdr->magic, LOGTRACE_MAGIC,
+            sizeof (LOGTRACE_MAGIC)) != 0 || hdr->version != LOGTRACE_VERSION ||
+            hdr->header_size + hdr->size > (uint64_t) st.st_size) {
+        fprintf(stderr, "%s: not an axiom trace file\n", filename);
+        munmap(map, st.st_size);
+        return -1;
+    }
+    data = map + hdr->header_size;
+    end = hdr->used < hdr->size ? hdr->used : hdr->size;
+
+    for (off = 0; off + sizeof (*rec) <= end; off += rec->size) {
+        rec = (logtrace_rec_t *) (data + off);
+        /* reserved by a thread that has not completed it */
+        if (rec->size < sizeof (*rec)) break;
+
+        if (rec->type == LOGTRACE_FMT) {
+            if (rec->fid >= nfmts) {
+                fmts = realloc(fmts, (rec->fid + 1) * sizeof (fmt_t));
+                if (fmts == NULL) {
+                    perror("realloc()");
+                    exit(-1);
+                }
+                memset(fmts + nfmts, 0, (rec->fid + 1 - nfmts) * sizeof (fmt_t));
+                nfmts = rec->fid + 1;
+            }
+            fmts[rec->fid].types = (const char *) (rec + 1);
+            fmts[rec->fid].msg = fmts[rec->fid].types + strlen(fmts[rec->fid].types) + 1;
+        } else if (rec->type == LOGTRACE_MSG) {
+            if (rec->fid >= nfmts || fmts[rec->fid].msg == NULL) {
+                fprintf(stderr, "%s: unknown format %u\n", filename, rec->fid);
+                continue;
+            }
+            if (rec->level > level || (tid != 0 && rec->tid != tid)) continue;
+            print_msg(rec, &fmts[rec->fid]);
+            msgs++;
+        }
+    }
+
+    if (verbose) {
+        fprintf(stderr, "%s: pid %d, %lu messages, %lu formats, %lu dropped (%lu of %lu bytes)\n",
+                filename, hdr->pid, (unsigned long) msgs, (unsigned long) nfmts,
+                (unsigned long) hdr->dropped, (unsigned long) end, (unsigned long) hdr->size);
+    }
+
+    free(fmts);
+    munmap(map, st.st_size);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int level = LOG_TRACE, tid = 0, ret = 0, i;
+    int long_index = 0;
+    int opt = 0;
+    static struct option long_options[] = {
+        {"level", required_argument, 0, 'l'},
+        {"tid", required_argument, 0, 't'},
+        {"verbose", no_argument, 0, 'v'},
+        {"version", no_argument, 0, 'V'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "l:t:vVh", long_options, &long_index)) != -1) {
+        switch (opt) {
+            case 'l':
+                for (i = LOG_FATAL; i <= LOG_TRACE; i++) {
+                    if (strcasecmp(logmsg_name[i], optarg) == 0) break;
+                }
+                if (i > LOG_TRACE) {
+                    fprintf(stderr, "unknown level %s\n", optarg);
+                    exit(-1);
+                }
+                level = i;
+                break;
+            case 't':
+                tid = atoi(optarg);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'V':
+                printf("Version: %s\n", AXIOM_API_VERSION_STR);
+                exit(0);
+            case 'h':
+            default:
+                usage();
+                exit(-1);
+        }
+    }
+
+    if (optind >= argc) {
+        usage();
+        exit(-1);
+    }
+    for (i = optind; i < argc; i++) {
+        if (decode(argv[i], level, tid)) ret = -1;
+    }
+
+    return ret;
+}
@@ -33,6 +33,8 @@
 #include "axiom_utility.h"
 #include "dprintf.h"
 
+#include "axiom_common.h"
+
 #include "axiom-netperf.h"
 
 extern int verbose;
@@ -197,9 +199,33 @@ axnetperf_rdma_init(axnetperf_status_t *s)
         return -1;
     }
 
-    /* fill the rdma zone with magic value */
-    for (int i = 0; i < s->client.total_bytes; i += 8) {
-        *(uint64_t *)(((uint8_t *)s->client.rdma_zone) + i) = s->client.magic;
+    if (s->client.rdma_window < 1 ||
+            s->client.rdma_window > AXNP_MAX_RDMA_WINDOW) {
+        EPRINTF("RDMA window must be between 1 and %d",
+                AXNP_MAX_RDMA_WINDOW);
+        return -1;
+    }
+
+    if (!s->client.rdma_sync) {
+        s->client.rdma_hist = malloc(sizeof(*s->client.rdma_hist));
+        if (!s->client.rdma_hist) {
+            EPRINTF("RDMA histogram allocation failed");
+            return -1;
+        }
+        axnetperf_hist_reset(s->client.rdma_hist);
+    }
+
+    /* fill the rdma zone that will be written to the remote node: with the
+     * digest check the data is a sequence and the digest is sent instead
+     * of the magic */
+    if (!s->client.rdma_read && s->client.rdma_digest) {
+        axmem_fill_seq64(s->client.rdma_zone, s->client.magic,
+                s->client.total_bytes, 0);
+        s->client.magic = axmem_digest(s->client.rdma_zone,
+                s->client.total_bytes, 0, 0);
+    } else if (!s->client.rdma_read) {
+        axmem_fill64(s->client.rdma_zone, s->client.magic,
+                s->client.total_bytes, 0);
     }
 
     IPRINTF(verbose, "rdma_mmap - addr: %p size: %" PRIu64,
@@ -207,17 +233,61 @@ axnetperf_rdma_init(axnetperf_status_t *s)
     return 0;
 }
 
-#define TOKEN_LEN 2048
+/*
+ * Poll the completion of the oldest RDMA operation in flight and record its
+ * latency. If 'block' is set, spin until the operation is completed.
+ * Returns 1 if completed, 0 if still pending, an error otherwise.
+ */
+static inline int
+axnetperf_rdma_retire(axiom_dev_t *dev, axiom_token_t *token,
+        uint64_t issue_ts, axnetperf_hist_t *hist, int block)
+{
+    int ret;
+
+    do {
+        ret = axiom_rdma_check(dev, token, 1);
+        if (ret == 1) {
+            axnetperf_hist_record(hist, axnetperf_now() - issue_ts);
+            return 1;
+        }
+
+        if (unlikely(ret != 0 && ret != AXIOM_RET_NOTAVAIL)) {
+            EPRINTF("axiom_rdma_check error %d", ret);
+            return ret;
+        }
+    } while (block);
 
+    return 0;
+}
+
+/*
+ * Sliding window of asynchronous RDMA operations: a new operation is issued
+ * as soon as the oldest one in flight is completed, so up to rdma_window
+ * operations are always pending in the NIC.
+ */
 static axiom_err_t
 axnetperf_rdma_async(axnetperf_status_t *s)
 {
     size_t payload_size = s->client.payload_size;
+    unsigned int window = s->client.rdma_window;
+    unsigned int head = 0, inflight = 0, slot;
     axiom_err_t err = AXIOM_RET_OK;
-    axiom_token_t tokens[TOKEN_LEN];
     uint64_t packets = 0, bytes = 0;
+    axiom_token_t *tokens;
+    uint64_t *issue_ts;
+    axnetperf_hist_t *hist;
     void *addr;
-    int i = 0;
+    int ret;
+
+    tokens = calloc(window, sizeof(*tokens));
+    issue_ts = calloc(window, sizeof(*issue_ts));
+    hist = malloc(sizeof(*hist));
+    if (!tokens || !issue_ts || !hist) {
+        EPRINTF("RDMA window allocation failed");
+        err = AXIOM_RET_ERROR;
+        goto free;
+    }
+    axnetperf_hist_reset(hist);
 
     pthread_mutex_lock(&s->mutex);
     while (s->client.sent_bytes < s->client.total_bytes) {
@@ -230,52 +300,78 @@ axnetperf_rdma_async(axnetperf_status_t *s)
         s->client.sent_bytes += payload_size;
         pthread_mutex_unlock(&s->mutex);
 
-        /* write payload to remote node */
-        err = axiom_rdma_write(s->dev, s->server_id, payload_size,
-                addr, addr, &tokens[i]);
+        /* window full: wait the oldest operation */
+        if (inflight == window) {
+            ret = axnetperf_rdma_retire(s->dev, &tokens[head], issue_ts[head],
+                    hist, 1);
+            if (unlikely(ret != 1)) {
+                err = ret;
+                goto drain;
+            }
+            head = (head + 1) % window;
+            inflight--;
+        }
+
+        slot = (head + inflight) % window;
+        issue_ts[slot] = axnetperf_now();
+
+        if (s->client.rdma_read) {
+            /* read payload from remote node */
+            err = axiom_rdma_read(s->dev, s->server_id, payload_size,
+                    addr, addr, &tokens[slot]);
+        } else {
+            /* write payload to remote node */
+            err = axiom_rdma_write(s->dev, s->server_id, payload_size,
+                    addr, addr, &tokens[slot]);
+        }
         if (unlikely(!AXIOM_RET_IS_OK(err))) {
             pthread_mutex_lock(&s->mutex);
             s->client.total_packets--;
             s->client.sent_bytes -= payload_size;
             pthread_mutex_unlock(&s->mutex);
-            return err;
+            goto drain;
+        }
+        inflight++;
+
+        /* retire the operations already completed without waiting */
+        while (inflight > 0 && axnetperf_rdma_retire(s->dev, &tokens[head],
+                    issue_ts[head], hist, 0) == 1) {
+            head = (head + 1) % window;
+            inflight--;
         }
 
         packets++;
         bytes += payload_size;
 
-        i++;
-        if (i == TOKEN_LEN) {
-            axiom_rdma_wait(s->dev, tokens, i);
-            i = 0;
-        }
-
         pthread_mutex_lock(&s->mutex);
     }
 
-    if ((s->client.total_bytes - s->client.sent_bytes) > 0) {
-        payload_size = s->client.total_bytes - s->client.sent_bytes;
+    IPRINTF(verbose, "[TID %ld] sent_bytes: %" PRIu64
+            " sent_packets: %" PRIu64, gettid(), bytes, packets);
+    pthread_mutex_unlock(&s->mutex);
 
-        /* write payload to remote node */
-        err = axiom_rdma_write(s->dev, s->server_id, payload_size,
-                (void *) s->client.sent_bytes,
-                (void *) s->client.sent_bytes, &tokens[i]);
-        if (unlikely(!AXIOM_RET_IS_OK(err))) {
-            return err;
+drain:
+    while (inflight > 0) {
+        ret = axnetperf_rdma_retire(s->dev, &tokens[head], issue_ts[head],
+                hist, 1);
+        if (unlikely(ret != 1)) {
+            err = ret;
+            break;
         }
-
-        s->client.sent_bytes += payload_size;
-        s->client.total_packets++;
-        packets++;
-        bytes += payload_size;
-        i++;
+        head = (head + 1) % window;
+        inflight--;
     }
 
-    IPRINTF(verbose, "[TID %ld] sent_bytes: %" PRIu64
-            " sent_packets: %" PRIu64, gettid(), bytes, packets);
+    pthread_mutex_lock(&s->mutex);
+    if (s->client.rdma_hist) {
+        axnetperf_hist_merge(s->client.rdma_hist, hist);
+    }
     pthread_mutex_unlock(&s->mutex);
 
-    err = axiom_rdma_wait(s->dev, tokens, i);
+free:
+    free(hist);
+    free(issue_ts);
+    free(tokens);
 
     return err;
 }
@@ -299,9 +395,15 @@ axnetperf_rdma_sync(axnetperf_status_t *s)
         s->client.sent_bytes += payload_size;
         pthread_mutex_unlock(&s->mutex);
 
-        /* write payload to remote node */
-        err = axiom_rdma_write_sync(s->dev, s->server_id, payload_size,
-                addr, addr, NULL);
+        if (s->client.rdma_read) {
+            /* read payload from remote node */
+            err = axiom_rdma_read_sync(s->dev, s->server_id, payload_size,
+                    addr, addr, NULL);
+        } else {
+            /* write payload to remote node */
+            err = axiom_rdma_write_sync(s->dev, s->server_id, payload_size,
+                    addr, addr, NULL);
+        }
         if (unlikely(!AXIOM_RET_IS_OK(err))) {
             pthread_mutex_lock(&s->mutex);
             s->client.total_packets--;
@@ -365,12 +467,16 @@ axnetperf_rdma(axnetperf_status_t *s)
 
     if (unlikely(!AXIOM_RET_IS_OK(err))) {
         EPRINTF("send error");
-        return err;
     }
 
+    /*
+     * the last thread ends the test: all the operations are completed and
+     * all the latency histograms are merged
+     */
     pthread_mutex_lock(&s->mutex);
-    if (s->state == AXN_STATE_START) {
-        /* get time of the first sent netperf message */
+    if (++s->client.done_threads == s->num_threads &&
+            s->state == AXN_STATE_START) {
+        /* get time of the last completed operation */
         axnetperf_end_time(s);
         s->state = AXN_STATE_END;
 
@@ -383,6 +489,10 @@ axnetperf_rdma(axnetperf_status_t *s)
         payload.total_bytes = s->client.sent_bytes;
         payload.type = s->np_type;
         payload.magic = s->client.magic;
+        payload.mode = s->client.rdma_read ? AXNP_MODE_RDMA_READ :
+            AXNP_MODE_STREAM;
+        payload.check = s->client.rdma_digest ? AXNP_CHECK_DIGEST :
+            AXNP_CHECK_MAGIC;
 
         err = axiom_send_raw(s->dev, s->server_id, s->server_port,
                 AXIOM_TYPE_RAW_DATA, sizeof(payload), &payload);
@@ -397,7 +507,7 @@ axnetperf_rdma(axnetperf_status_t *s)
     }
     pthread_mutex_unlock(&s->mutex);
 
-    return 0;
+    return err;
 }
 
 static int
@@ -410,6 +520,8 @@ axnetperf_start(axnetperf_status_t *s)
     payload.total_bytes = s->client.total_bytes;
     payload.type = s->np_type;
     payload.reply_port = s->client_port;
+    payload.mode = (s->np_type == AXNP_RDMA && s->client.rdma_read) ?
+        AXNP_MODE_RDMA_READ : AXNP_MODE_STREAM;
     payload.magic = s->client.magic;
 
     err = axiom_send_raw(s->dev, s->server_id, s->server_port,
@@ -427,9 +539,13 @@ axnetperf_start(axnetperf_status_t *s)
     if (s->np_type == AXNP_RAW)
         printf("   message type: RAW\n");
     else if (s->np_type == AXNP_RDMA)
-        printf("   message type: RDMA\n");
+        printf("   message type: RDMA %s %s\n",
+                s->client.rdma_read ? "read" : "write",
+                s->client.rdma_sync ? "sync" : "async");
     else if (s->np_type == AXNP_LONG)
         printf("   message type: LONG\n");
+    if (s->np_type == AXNP_RDMA && !s->client.rdma_sync)
+        printf("   RDMA window: %u\n", s->client.rdma_window);
     printf("   payload size: %zu bytes\n", s->client.payload_size);
     printf("   total bytes: %" PRIu64 " bytes\n", s->client.total_bytes);
     printf("   magic number: %" PRIu64 "\n", s->client.magic);
@@ -495,6 +611,19 @@ axnetperf_stop(axnetperf_status_t *s)
             rx_th * 8 / AXNP_RES_BYTE_SCALE, rx_raw_th * 8 / AXNP_RES_BYTE_SCALE,
             rx_pps / AXNP_RES_PKT_SCALE);
 
+    if (s->client.rdma_hist && s->client.rdma_hist->count) {
+        axnetperf_hist_t *h = s->client.rdma_hist;
+
+        printf("RDMA %s latency usec  min %3.3f - avg %3.3f - p50 %3.3f - "
+                "p99 %3.3f - p99.9 %3.3f - max %3.3f\n",
+                s->client.rdma_read ? "read" : "write", h->min / 1000.0,
+                (double)h->sum / h->count / 1000.0,
+                axnetperf_hist_percentile(h, 50.0) / 1000.0,
+                axnetperf_hist_percentile(h, 99.0) / 1000.0,
+                axnetperf_hist_percentile(h, 99.9) / 1000.0,
+                h->max / 1000.0);
+    }
+
     if (payload.error) {
         printf("\n Remote node reports some ERRORS [%u]\n", payload.error);
     }
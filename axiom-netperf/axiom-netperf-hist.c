@@ -0,0 +1,86 @@
+/*!
+ * \file axiom-netperf-hist.c
+ *
+ * \version     v1.2
+ * \date        2017-09-05
+ *
+ * This file contains the log-linear latency histograms of axiom-netperf.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "axiom_nic_types.h"
+#include "axiom_nic_api_user.h"
+#include "axiom_utility.h"
+
+#include "axiom-netperf.h"
+
+/* highest value that falls in the bucket 'idx' */
+static uint64_t
+axnetperf_hist_upper(int idx)
+{
+    uint64_t low;
+    int shift;
+
+    if (idx < AXNP_HIST_SUB_COUNT)
+        return idx;
+
+    shift = idx / AXNP_HIST_SUB_COUNT - 1;
+    low = ((uint64_t)AXNP_HIST_SUB_COUNT + idx % AXNP_HIST_SUB_COUNT) << shift;
+
+    return low + ((uint64_t)1 << shift) - 1;
+}
+
+void
+axnetperf_hist_reset(axnetperf_hist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void
+axnetperf_hist_merge(axnetperf_hist_t *dst, axnetperf_hist_t *src)
+{
+    int i;
+
+    for (i = 0; i < AXNP_HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+uint64_t
+axnetperf_hist_percentile(axnetperf_hist_t *h, double percentile)
+{
+    uint64_t target, cumulative = 0;
+    int i;
+
+    if (h->count == 0)
+        return 0;
+
+    target = (uint64_t)((percentile / 100.0) * h->count + 0.5);
+    if (target == 0)
+        target = 1;
+
+    for (i = 0; i < AXNP_HIST_BUCKETS; i++) {
+        cumulative += h->buckets[i];
+        if (cumulative >= target) {
+            uint64_t value = axnetperf_hist_upper(i);
+            return (value > h->max) ? h->max : value;
+        }
+    }
+
+    return h->max;
+}
@@ -0,0 +1,329 @@
+/*!
+ * \file axiom-netperf-latency.c
+ *
+ * \version     v1.2
+ * \date        2017-09-05
+ *
+ * This file contains the implementation of the axiom-netperf latency mode.
+ *
+ * The client exchanges ping-pong messages with a server running in echo mode,
+ * records every round trip in a log-linear histogram and reports the latency
+ * distribution for each payload size.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "axiom_nic_types.h"
+#include "axiom_nic_api_user.h"
+#include "axiom_nic_packets.h"
+#include "axiom_nic_init.h"
+#include "axiom_utility.h"
+#include "dprintf.h"
+
+#include "axiom-netperf.h"
+
+extern int verbose;
+
+static const char *
+axnetperf_type_str(axnetperf_status_t *s)
+{
+    switch (s->np_type) {
+        case AXNP_RAW:
+            return "raw";
+        case AXNP_LONG:
+            return "long";
+        case AXNP_RDMA:
+            return s->client.rdma_read ? "rrdma" : "rdma";
+        default:
+            return "unknown";
+    }
+}
+
+static void
+axnetperf_lat_report(axnetperf_status_t *s, size_t size, axnetperf_hist_t *h,
+        int first)
+{
+    uint64_t avg = h->count ? h->sum / h->count : 0;
+    uint64_t min = h->count ? h->min : 0;
+    uint64_t p50, p90, p99, p999;
+
+    p50 = axnetperf_hist_percentile(h, 50.0);
+    p90 = axnetperf_hist_percentile(h, 90.0);
+    p99 = axnetperf_hist_percentile(h, 99.0);
+    p999 = axnetperf_hist_percentile(h, 99.9);
+
+    switch (s->client.output) {
+        case AXNP_OUT_CSV:
+            if (first)
+                printf("type,size,iterations,min_ns,avg_ns,p50_ns,p90_ns,"
+                        "p99_ns,p999_ns,max_ns\n");
+            printf("%s,%zu,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+                    ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+                    axnetperf_type_str(s), size, h->count, min, avg,
+                    p50, p90, p99, p999, h->max);
+            break;
+
+        case AXNP_OUT_JSON:
+            printf("%s\n  {\"type\": \"%s\", \"size\": %zu, \"iterations\": %"
+                    PRIu64 ", \"min_ns\": %" PRIu64 ", \"avg_ns\": %" PRIu64
+                    ", \"p50_ns\": %" PRIu64 ", \"p90_ns\": %" PRIu64
+                    ", \"p99_ns\": %" PRIu64 ", \"p999_ns\": %" PRIu64
+                    ", \"max_ns\": %" PRIu64 "}", first ? "[" : ",",
+                    axnetperf_type_str(s), size, h->count, min, avg,
+                    p50, p90, p99, p999, h->max);
+            break;
+
+        default:
+            if (first)
+                printf("%10s %10s %10s %10s %10s %10s %10s %10s %10s\n",
+                        "size[B]", "iter", "min[us]", "avg[us]", "p50[us]",
+                        "p90[us]", "p99[us]", "p99.9[us]", "max[us]");
+            printf("%10zu %10" PRIu64 " %10.3f %10.3f %10.3f %10.3f %10.3f "
+                    "%10.3f %10.3f\n", size, h->count, min / 1000.0,
+                    avg / 1000.0, p50 / 1000.0, p90 / 1000.0, p99 / 1000.0,
+                    p999 / 1000.0, h->max / 1000.0);
+    }
+}
+
+static int
+axnetperf_lat_session(axnetperf_status_t *s, uint8_t command)
+{
+    axiom_netperf_payload_t payload;
+    axiom_err_t err;
+
+    memset(&payload, 0, sizeof(payload));
+    payload.command = command;
+    payload.type = s->np_type;
+    payload.reply_port = s->client_port;
+    payload.mode = AXNP_MODE_ECHO;
+    payload.magic = s->client.magic;
+
+    err = axiom_send_raw(s->dev, s->server_id, s->server_port,
+            AXIOM_TYPE_RAW_DATA, sizeof(payload), &payload);
+    if (unlikely(!AXIOM_RET_IS_OK(err))) {
+        EPRINTF("send error");
+        if (err == AXIOM_RET_NOTREACH) {
+            printf("Destination node id not reachable [%u]\n", s->server_id);
+        }
+        return err;
+    }
+
+    return 0;
+}
+
+/* send one message of 'size' bytes and wait for the echo of the server */
+static int
+axnetperf_lat_roundtrip(axnetperf_status_t *s, size_t size,
+        axiom_long_payload_t *buf)
+{
+    axiom_netperf_payload_t *payload = (axiom_netperf_payload_t *)buf;
+    axiom_node_id_t src;
+    axiom_port_t port;
+    axiom_type_t type;
+    axiom_err_t err;
+    size_t recv_size;
+
+    payload->command = AXIOM_CMD_NETPERF;
+
+    switch (s->np_type) {
+        case AXNP_RAW:
+            err = axiom_send_raw(s->dev, s->server_id, s->server_port,
+                    AXIOM_TYPE_RAW_DATA, size, buf);
+            break;
+
+        case AXNP_LONG:
+            err = axiom_send_long(s->dev, s->server_id, s->server_port,
+                    size, buf);
+            break;
+
+        case AXNP_RDMA:
+            /* the completion of a read is already a round trip */
+            if (s->client.rdma_read) {
+                err = axiom_rdma_read_sync(s->dev, s->server_id, size,
+                        (void *)0, (void *)0, NULL);
+                if (unlikely(!AXIOM_RET_IS_OK(err))) {
+                    EPRINTF("rdma read error");
+                    return err;
+                }
+                return 0;
+            }
+
+            /* write the payload, then ring the server with a raw message */
+            err = axiom_rdma_write_sync(s->dev, s->server_id, size,
+                    (void *)0, (void *)0, NULL);
+            if (unlikely(!AXIOM_RET_IS_OK(err)))
+                break;
+
+            payload->total_bytes = size;
+            err = axiom_send_raw(s->dev, s->server_id, s->server_port,
+                    AXIOM_TYPE_RAW_DATA, sizeof(*payload), payload);
+            break;
+
+        default:
+            return -1;
+    }
+
+    if (unlikely(!AXIOM_RET_IS_OK(err))) {
+        EPRINTF("send error");
+        return err;
+    }
+
+    do {
+        recv_size = sizeof(*buf);
+        err = axiom_recv(s->dev, &src, &port, &type, &recv_size, buf);
+        if (unlikely(!AXIOM_RET_IS_OK(err))) {
+            EPRINTF("recv error");
+            return err;
+        }
+    } while (src != s->server_id || payload->command != AXIOM_CMD_NETPERF);
+
+    return 0;
+}
+
+static int
+axnetperf_lat_size(axnetperf_status_t *s, size_t size, axnetperf_hist_t *h,
+        axiom_long_payload_t *buf)
+{
+    uint64_t i, start;
+    int ret;
+
+    axnetperf_hist_reset(h);
+
+    for (i = 0; i < AXNP_LAT_WARMUP; i++) {
+        ret = axnetperf_lat_roundtrip(s, size, buf);
+        if (ret)
+            return ret;
+    }
+
+    for (i = 0; i < s->client.iterations; i++) {
+        start = axnetperf_now();
+        ret = axnetperf_lat_roundtrip(s, size, buf);
+        if (ret)
+            return ret;
+        axnetperf_hist_record(h, axnetperf_now() - start);
+    }
+
+    return 0;
+}
+
+void *
+axnetperf_latency(void *arg)
+{
+    axnetperf_status_t *s = ((axnetperf_status_t *) arg);
+    axiom_long_payload_t buf;
+    axnetperf_hist_t *hist;
+    size_t size, min_size = 1, max_size;
+    int ret = 0, first = 1;
+
+    switch (s->np_type) {
+        case AXNP_RAW:
+            max_size = AXIOM_RAW_PAYLOAD_MAX_SIZE;
+            break;
+
+        case AXNP_LONG:
+            max_size = AXIOM_LONG_PAYLOAD_MAX_SIZE;
+            break;
+
+        case AXNP_RDMA:
+            s->client.rdma_zone = axiom_rdma_mmap(s->dev, &s->client.rdma_size);
+            if (!s->client.rdma_zone) {
+                EPRINTF("rdma map failed");
+                return (void *)AXIOM_RET_ERROR;
+            }
+            max_size = AXIOM_RDMA_PAYLOAD_MAX_SIZE;
+            if (max_size > s->client.rdma_size)
+                max_size = s->client.rdma_size;
+
+            /* RDMA transfers are multiple of the address alignment */
+            min_size = AXIOM_RDMA_ADDRESS_ALIGNMENT;
+            max_size &= ~((size_t)AXIOM_RDMA_ADDRESS_ALIGNMENT - 1);
+            s->client.payload_size = (s->client.payload_size +
+                    AXIOM_RDMA_ADDRESS_ALIGNMENT - 1) &
+                ~((size_t)AXIOM_RDMA_ADDRESS_ALIGNMENT - 1);
+            break;
+
+        default:
+            EPRINTF("axiom-netperf type invalid");
+            return (void *)AXIOM_RET_ERROR;
+    }
+
+    if (s->client.payload_size > max_size) {
+        EPRINTF("%s payload size must be between %zu and %zu bytes",
+                axnetperf_type_str(s), min_size, max_size);
+        return (void *)AXIOM_RET_ERROR;
+    }
+
+    hist = malloc(sizeof(*hist));
+    if (!hist) {
+        EPRINTF("histogram allocation failed");
+        return (void *)AXIOM_RET_ERROR;
+    }
+
+    memset(&buf, 0, sizeof(buf));
+    srand(time(NULL));
+    s->client.magic = rand();
+
+    if (axnetperf_lat_session(s, AXIOM_CMD_NETPERF_START)) {
+        free(hist);
+        return (void *)AXIOM_RET_ERROR;
+    }
+
+    if (s->client.output == AXNP_OUT_TEXT) {
+        printf("Starting axiom-netperf latency test with node %u\n",
+                s->server_id);
+        printf("   message type: %s\n", axnetperf_type_str(s));
+        printf("   iterations: %" PRIu64 "\n", s->client.iterations);
+    }
+
+    if (s->client.payload_size) {
+        /* single payload size specified by the user */
+        ret = axnetperf_lat_size(s, s->client.payload_size, hist, &buf);
+        if (!ret) {
+            axnetperf_lat_report(s, s->client.payload_size, hist, first);
+            first = 0;
+        }
+    } else {
+        /* sweep all powers of two up to the maximum payload size */
+        for (size = min_size; !ret; size <<= 1) {
+            if (size > max_size)
+                size = max_size;
+
+            ret = axnetperf_lat_size(s, size, hist, &buf);
+            if (ret)
+                break;
+
+            axnetperf_lat_report(s, size, hist, first);
+            first = 0;
+
+            if (size == max_size)
+                break;
+        }
+    }
+
+    if (s->client.output == AXNP_OUT_JSON && !first)
+        printf("\n]\n");
+
+    free(hist);
+
+    if (ret) {
+        EPRINTF("latency test failed");
+        return (void *)AXIOM_RET_ERROR;
+    }
+
+    if (axnetperf_lat_session(s, AXIOM_CMD_NETPERF_END))
+        return (void *)AXIOM_RET_ERROR;
+
+    return (void *)AXIOM_RET_OK;
+}
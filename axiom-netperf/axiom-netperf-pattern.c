@@ -0,0 +1,564 @@
+/*!
+ * \file axiom-netperf-pattern.c
+ *
+ * \version     v1.2
+ * \date        2017-09-05
+ *
+ * This file contains the implementation of the axiom-netperf traffic patterns.
+ *
+ * axiom-netperf is started through axiom-run on all nodes involved in the
+ * test. Every node is at the same time a server (receiving streams) and a
+ * client (sending streams) according to the pattern selected. All nodes
+ * start streaming after a barrier, and the results of every pair are
+ * collected by the master node (the lowest node involved), which prints them.
+ * A stream with no traffic for AXNP_PATTERN_IDLE_MS is reported as failed.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "axiom_nic_types.h"
+#include "axiom_nic_api_user.h"
+#include "axiom_nic_packets.h"
+#include "axiom_nic_init.h"
+#include "axiom_utility.h"
+#include "dprintf.h"
+
+#include "axiom_run_api.h"
+
+#include "axiom-netperf.h"
+
+extern int verbose;
+
+typedef struct {
+    axnetperf_status_t *s;
+    axiom_node_id_t root_id;    /*!< \brief incast sink or outcast source */
+    uint64_t tx_mask;           /*!< \brief destinations of this node */
+    uint64_t rx_mask;           /*!< \brief sources streaming to this node */
+    int rx_pending;             /*!< \brief streams not yet completed */
+    int reports_pending;        /*!< \brief remote reports (master only) */
+} axnetperf_pattern_t;
+
+typedef struct {
+    axnetperf_pattern_t *p;
+    axiom_node_id_t dst_id;
+} axnetperf_sender_t;
+
+static const char *pattern_names[] = {
+    [AXNP_PATTERN_BIDIR] = "bidir",
+    [AXNP_PATTERN_INCAST] = "incast",
+    [AXNP_PATTERN_OUTCAST] = "outcast",
+    [AXNP_PATTERN_ALLTOALL] = "alltoall",
+};
+
+/* return 1 if the node 'src' streams to the node 'dst' in this pattern */
+static int
+axnetperf_pattern_is_pair(axnetperf_pattern_t *p, int src, int dst)
+{
+    uint64_t nodes = p->s->nodes;
+
+    if (src == dst || !(nodes & (1ULL << src)) || !(nodes & (1ULL << dst)))
+        return 0;
+
+    switch (p->s->pattern) {
+        case AXNP_PATTERN_BIDIR:
+        case AXNP_PATTERN_ALLTOALL:
+            return 1;
+
+        case AXNP_PATTERN_INCAST:
+            return dst == p->root_id;
+
+        case AXNP_PATTERN_OUTCAST:
+            return src == p->root_id;
+    }
+
+    return 0;
+}
+
+static void
+axnetperf_pattern_record(axnetperf_pattern_t *p, axiom_netperf_payload_t *r)
+{
+    axnetperf_pair_t *pair;
+
+    if (r->src_id >= AXNP_PATTERN_MAX_NODES ||
+            r->dst_id >= AXNP_PATTERN_MAX_NODES) {
+        EPRINTF("invalid report %u -> %u", r->src_id, r->dst_id);
+        return;
+    }
+
+    pair = &p->s->pairs[r->src_id * AXNP_PATTERN_MAX_NODES + r->dst_id];
+
+    pthread_mutex_lock(&p->s->mutex);
+    if (r->mode == AXNP_MODE_REPORT_TX) {
+        pair->tx_bytes = r->total_bytes;
+        pair->tx_nsec = r->elapsed_time;
+        pair->tx_done = 1;
+    } else {
+        pair->rx_bytes = r->total_bytes;
+        pair->rx_nsec = r->elapsed_time;
+        pair->rx_done = 1;
+    }
+    pair->error |= r->error;
+    pthread_mutex_unlock(&p->s->mutex);
+}
+
+/* send the result of a stream to the master node */
+static void
+axnetperf_pattern_report(axnetperf_pattern_t *p, uint8_t mode,
+        axiom_node_id_t src_id, axiom_node_id_t dst_id, uint64_t bytes,
+        uint64_t nsec, uint8_t error)
+{
+    axiom_netperf_payload_t report;
+    axiom_err_t err;
+
+    memset(&report, 0, sizeof(report));
+    report.command = AXIOM_CMD_NETPERF_END;
+    report.mode = mode;
+    report.type = p->s->np_type;
+    report.src_id = src_id;
+    report.dst_id = dst_id;
+    report.total_bytes = bytes;
+    report.elapsed_time = nsec;
+    report.error = error;
+
+    if (p->s->local_id == p->s->master_id) {
+        axnetperf_pattern_record(p, &report);
+        return;
+    }
+
+    err = axiom_send_raw(p->s->dev, p->s->master_id, p->s->server_port,
+            AXIOM_TYPE_RAW_DATA, sizeof(report), &report);
+    if (!AXIOM_RET_IS_OK(err)) {
+        EPRINTF("report send error to master %u", p->s->master_id);
+    }
+}
+
+/* tell the destination that the stream is aborted and report it */
+static void
+axnetperf_pattern_abort(axnetperf_pattern_t *p, axiom_node_id_t dst_id,
+        uint64_t sent_bytes)
+{
+    axiom_netperf_payload_t payload;
+
+    memset(&payload, 0, sizeof(payload));
+    payload.command = AXIOM_CMD_NETPERF_END;
+    payload.type = p->s->np_type;
+    payload.mode = AXNP_MODE_STREAM;
+    payload.error = 1;
+    axiom_send_raw(p->s->dev, dst_id, p->s->server_port,
+            AXIOM_TYPE_RAW_DATA, sizeof(payload), &payload);
+
+    axnetperf_pattern_report(p, AXNP_MODE_REPORT_TX, p->s->local_id, dst_id,
+            sent_bytes, 0, 1);
+}
+
+static void *
+axnetperf_pattern_sender(void *arg)
+{
+    axnetperf_sender_t *snd = ((axnetperf_sender_t *) arg);
+    axnetperf_pattern_t *p = snd->p;
+    axnetperf_status_t *s = p->s;
+    axiom_long_payload_t long_payload;
+    axiom_netperf_payload_t *payload =
+            ((axiom_netperf_payload_t *) &long_payload);
+    size_t payload_size = s->client.payload_size;
+    uint64_t sent_bytes = 0, start;
+    axiom_err_t err;
+    uint8_t error = 0;
+
+    memset(&long_payload, 0, sizeof(long_payload));
+    payload->command = AXIOM_CMD_NETPERF_START;
+    payload->total_bytes = s->client.total_bytes;
+    payload->type = s->np_type;
+    payload->reply_port = s->server_port;
+    payload->mode = AXNP_MODE_STREAM;
+
+    err = axiom_send_raw(s->dev, snd->dst_id, s->server_port,
+            AXIOM_TYPE_RAW_DATA, sizeof(*payload), payload);
+    if (unlikely(!AXIOM_RET_IS_OK(err))) {
+        EPRINTF("start send error to node %u", snd->dst_id);
+        error = 1;
+        goto report;
+    }
+
+    payload->command = AXIOM_CMD_NETPERF;
+    start = axnetperf_now();
+
+    while (sent_bytes < s->client.total_bytes) {
+        if ((s->client.total_bytes - sent_bytes) < payload_size) {
+            payload_size = s->client.total_bytes - sent_bytes;
+        }
+
+        if (s->np_type == AXNP_RAW) {
+            err = axiom_send_raw(s->dev, snd->dst_id, s->server_port,
+                    AXIOM_TYPE_RAW_DATA, payload_size, payload);
+        } else {
+            err = axiom_send_long(s->dev, snd->dst_id, s->server_port,
+                    payload_size, &long_payload);
+        }
+
+        if (unlikely(!AXIOM_RET_IS_OK(err))) {
+            EPRINTF("send error to node %u", snd->dst_id);
+            error = 1;
+            break;
+        }
+
+        sent_bytes += payload_size;
+    }
+
+    IPRINTF(verbose, "[TID %ld] sent %" PRIu64 " bytes to node %u", gettid(),
+            sent_bytes, snd->dst_id);
+
+report:
+    if (error) {
+        axnetperf_pattern_abort(p, snd->dst_id, sent_bytes);
+        return NULL;
+    }
+
+    axnetperf_pattern_report(p, AXNP_MODE_REPORT_TX, s->local_id, snd->dst_id,
+            sent_bytes, axnetperf_now() - start, 0);
+
+    return NULL;
+}
+
+static void
+axnetperf_pattern_rx_end(axnetperf_pattern_t *p, axiom_node_id_t src,
+        uint8_t error)
+{
+    axnetperf_server_t *server = &p->s->server[src];
+    struct timespec elapsed_ts;
+
+    p->rx_mask &= ~(1ULL << src);
+    p->rx_pending--;
+    server->active = 0;
+
+    elapsed_ts = timespec_sub(server->cur_ts, server->start_ts);
+    axnetperf_pattern_report(p, AXNP_MODE_REPORT_RX, src, p->s->local_id,
+            server->received_bytes, timespec2nsec(elapsed_ts), error);
+}
+
+/* report the streams and the reports that never completed */
+static void
+axnetperf_pattern_timeout(axnetperf_pattern_t *p)
+{
+    int src;
+
+    for (src = 0; src < AXNP_PATTERN_MAX_NODES; src++) {
+        if (!(p->rx_mask & (1ULL << src)))
+            continue;
+
+        EPRINTF("stream from node %d timed out", src);
+        clock_gettime(CLOCK_REALTIME, &p->s->server[src].cur_ts);
+        if (p->s->server[src].received_bytes == 0)
+            p->s->server[src].start_ts = p->s->server[src].cur_ts;
+        axnetperf_pattern_rx_end(p, src, 1);
+    }
+
+    if (p->reports_pending > 0) {
+        EPRINTF("%d reports not received", p->reports_pending);
+    }
+}
+
+static void *
+axnetperf_pattern_receiver(void *arg)
+{
+    axnetperf_pattern_t *p = ((axnetperf_pattern_t *) arg);
+    axnetperf_status_t *s = p->s;
+    axiom_netperf_payload_t *recv_payload;
+    axiom_long_payload_t payload;
+    axnetperf_server_t *server;
+    axiom_node_id_t src;
+    axiom_port_t port;
+    axiom_type_t type;
+    struct pollfd fds[2];
+    axiom_err_t err;
+    int ret;
+
+    recv_payload = ((axiom_netperf_payload_t *) &payload);
+
+    err = axiom_get_fds(s->dev, &fds[0].fd, &fds[1].fd, NULL);
+    if (!AXIOM_RET_IS_OK(err)) {
+        EPRINTF("axiom_get_fds error");
+        return (void *)AXIOM_RET_ERROR;
+    }
+    fds[0].events = fds[1].events = POLLIN;
+
+    while (p->rx_pending > 0 || p->reports_pending > 0) {
+        size_t payload_size = sizeof(payload);
+
+        /* a failed sender or a dead node must not block the test */
+        ret = poll(fds, 2, AXNP_PATTERN_IDLE_MS);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            EPRINTF("poll error");
+            return (void *)AXIOM_RET_ERROR;
+        }
+        if (ret == 0) {
+            axnetperf_pattern_timeout(p);
+            break;
+        }
+
+        err = axiom_recv(s->dev, &src, &port, &type, &payload_size, &payload);
+        if (!AXIOM_RET_IS_OK(err)) {
+            EPRINTF("error receiving message");
+            return (void *)AXIOM_RET_ERROR;
+        }
+
+        server = &s->server[src];
+
+        if (recv_payload->command == AXIOM_CMD_NETPERF) {
+            if (!(p->rx_mask & (1ULL << src)))
+                continue;
+
+            /*
+             * long messages are not ordered with the START (raw queue):
+             * the bytes that precede it are counted from their arrival
+             */
+            if (server->received_bytes == 0 && !server->active)
+                clock_gettime(CLOCK_REALTIME, &server->start_ts);
+            server->received_bytes += payload_size;
+            if (server->active &&
+                    server->received_bytes >= server->expected_bytes) {
+                clock_gettime(CLOCK_REALTIME, &server->cur_ts);
+                axnetperf_pattern_rx_end(p, src, 0);
+            }
+        } else if (recv_payload->command == AXIOM_CMD_NETPERF_START) {
+            if (!(p->rx_mask & (1ULL << src)) || server->active)
+                continue;
+
+            server->expected_bytes = recv_payload->total_bytes;
+            server->reply_port = recv_payload->reply_port;
+            server->type = recv_payload->type;
+            server->mode = recv_payload->mode;
+            server->active = 1;
+            if (server->received_bytes == 0) {
+                clock_gettime(CLOCK_REALTIME, &server->start_ts);
+            } else if (server->received_bytes >= server->expected_bytes) {
+                /* the whole stream arrived before the START */
+                clock_gettime(CLOCK_REALTIME, &server->cur_ts);
+                axnetperf_pattern_rx_end(p, src, 0);
+            }
+        } else if (recv_payload->command == AXIOM_CMD_NETPERF_END) {
+            if (recv_payload->mode == AXNP_MODE_REPORT_TX ||
+                    recv_payload->mode == AXNP_MODE_REPORT_RX) {
+                axnetperf_pattern_record(p, recv_payload);
+                p->reports_pending--;
+            } else if (p->rx_mask & (1ULL << src)) {
+                /* stream aborted by the source */
+                clock_gettime(CLOCK_REALTIME, &server->cur_ts);
+                axnetperf_pattern_rx_end(p, src, recv_payload->error);
+            }
+        } else {
+            EPRINTF("receive a not AXIOM_CMD_NETPERF message");
+        }
+    }
+
+    return (void *)AXIOM_RET_OK;
+}
+
+static double
+axnetperf_pattern_gbps(uint64_t bytes, uint64_t nsec)
+{
+    if (nsec == 0)
+        return 0;
+
+    return (double)bytes * 8 / nsec2sec(nsec) / AXNP_RES_BYTE_SCALE;
+}
+
+static void
+axnetperf_pattern_print(axnetperf_pattern_t *p)
+{
+    axnetperf_status_t *s = p->s;
+    uint64_t rx_bytes = 0, rx_nsec = 0;
+    int src, dst, errors = 0;
+
+    printf("Traffic pattern: %s - nodes: 0x%" PRIx64 " - total bytes per "
+            "stream: %" PRIu64 "\n", pattern_names[s->pattern], s->nodes,
+            s->client.total_bytes);
+    printf("%6s %6s %14s %14s %14s\n", "src", "dst", "bytes",
+            "TX[Gbps]", "RX[Gbps]");
+
+    for (src = 0; src < AXNP_PATTERN_MAX_NODES; src++) {
+        for (dst = 0; dst < AXNP_PATTERN_MAX_NODES; dst++) {
+            axnetperf_pair_t *pair;
+
+            if (!axnetperf_pattern_is_pair(p, src, dst))
+                continue;
+
+            pair = &s->pairs[src * AXNP_PATTERN_MAX_NODES + dst];
+
+            printf("%6d %6d %14" PRIu64 " %14.3f %14.3f%s\n", src, dst,
+                    pair->rx_bytes,
+                    axnetperf_pattern_gbps(pair->tx_bytes, pair->tx_nsec),
+                    axnetperf_pattern_gbps(pair->rx_bytes, pair->rx_nsec),
+                    (pair->error || !pair->tx_done || !pair->rx_done) ?
+                    " ERROR" : "");
+
+            if (pair->error || !pair->tx_done || !pair->rx_done)
+                errors++;
+
+            rx_bytes += pair->rx_bytes;
+            if (pair->rx_nsec > rx_nsec)
+                rx_nsec = pair->rx_nsec;
+        }
+    }
+
+    printf("Aggregate RX throughput: %3.3f Gbps\n",
+            axnetperf_pattern_gbps(rx_bytes, rx_nsec));
+
+    if (errors) {
+        printf("\n %d streams report ERRORS\n", errors);
+    }
+}
+
+/* run the traffic pattern selected on all nodes started by axiom-run */
+int
+axnetperf_pattern(axnetperf_status_t *s)
+{
+    axnetperf_pattern_t p = { .s = s };
+    axnetperf_sender_t senders[AXNP_PATTERN_MAX_NODES];
+    pthread_t threads[AXNP_PATTERN_MAX_NODES], receiver;
+    int i, num_senders = 0, ret = -1, num_nodes;
+    axiom_err_t err;
+
+    if (s->np_type != AXNP_RAW && s->np_type != AXNP_LONG) {
+        EPRINTF("traffic patterns support only raw and long messages");
+        return -1;
+    }
+
+    if (s->client.payload_size == 0) {
+        s->client.payload_size = (s->np_type == AXNP_RAW) ?
+            AXIOM_NETPERF_DEF_RAW_PSIZE : AXIOM_NETPERF_DEF_LONG_PSIZE;
+    }
+
+    if ((s->np_type == AXNP_RAW &&
+                s->client.payload_size > AXIOM_RAW_PAYLOAD_MAX_SIZE) ||
+            s->client.payload_size > AXIOM_LONG_PAYLOAD_MAX_SIZE) {
+        EPRINTF("payload size too big [%zu]", s->client.payload_size);
+        return -1;
+    }
+
+    s->nodes = axrun_get_nodes();
+    num_nodes = axrun_get_num_nodes();
+    if (s->nodes == 0 || num_nodes < 2) {
+        EPRINTF("You must run traffic patterns through axiom-run on 2 or "
+                "more nodes");
+        return -1;
+    }
+
+    if (s->pattern == AXNP_PATTERN_BIDIR && num_nodes != 2) {
+        EPRINTF("bidir pattern requires 2 nodes - nodes: %d", num_nodes);
+        return -1;
+    }
+
+    s->local_id = axiom_get_node_id(s->dev);
+    s->master_id = __builtin_ctzll(s->nodes);
+
+    p.root_id = (s->server_id == AXIOM_NULL_NODE) ? s->master_id : s->server_id;
+    if (p.root_id >= AXNP_PATTERN_MAX_NODES ||
+            !(s->nodes & (1ULL << p.root_id))) {
+        EPRINTF("node %u is not involved in the test", p.root_id);
+        return -1;
+    }
+
+    err = axiom_bind(s->dev, s->server_port);
+    if (err != s->server_port) {
+        EPRINTF("axiom_bind error");
+        return -1;
+    }
+
+    for (i = 0; i < AXNP_PATTERN_MAX_NODES; i++) {
+        if (axnetperf_pattern_is_pair(&p, s->local_id, i))
+            p.tx_mask |= (1ULL << i);
+        if (axnetperf_pattern_is_pair(&p, i, s->local_id)) {
+            p.rx_mask |= (1ULL << i);
+            p.rx_pending++;
+            /* the data can arrive before the START of the stream */
+            s->server[i].received_bytes = 0;
+            s->server[i].active = 0;
+        }
+    }
+
+    if (s->local_id == s->master_id) {
+        int src, dst;
+
+        s->pairs = calloc(AXNP_PATTERN_MAX_NODES * AXNP_PATTERN_MAX_NODES,
+                sizeof(*s->pairs));
+        if (!s->pairs) {
+            EPRINTF("pairs allocation failed");
+            return -1;
+        }
+
+        /* reports of the remote nodes */
+        for (src = 0; src < AXNP_PATTERN_MAX_NODES; src++) {
+            for (dst = 0; dst < AXNP_PATTERN_MAX_NODES; dst++) {
+                if (!axnetperf_pattern_is_pair(&p, src, dst))
+                    continue;
+                p.reports_pending += (src != s->master_id);
+                p.reports_pending += (dst != s->master_id);
+            }
+        }
+    }
+
+    IPRINTF(verbose, "node %u - master %u - tx_mask 0x%" PRIx64 " rx_mask 0x%"
+            PRIx64, s->local_id, s->master_id, p.tx_mask, p.rx_mask);
+
+    if (pthread_create(&receiver, NULL, axnetperf_pattern_receiver, &p)) {
+        EPRINTF("pthread_create error");
+        goto err;
+    }
+
+    /* wait all receivers before streaming */
+    if (axrun_sync(AXNP_PATTERN_SYNC_ID, verbose) < 0) {
+        EPRINTF("axrun_sync error");
+        pthread_cancel(receiver);
+        pthread_join(receiver, NULL);
+        goto err;
+    }
+
+    for (i = 0; i < AXNP_PATTERN_MAX_NODES; i++) {
+        if (!(p.tx_mask & (1ULL << i)))
+            continue;
+
+        senders[num_senders].p = &p;
+        senders[num_senders].dst_id = i;
+        if (pthread_create(&threads[num_senders], NULL,
+                    axnetperf_pattern_sender, &senders[num_senders])) {
+            /* the destination must not wait for this stream */
+            EPRINTF("pthread_create error - stream to node %d aborted", i);
+            axnetperf_pattern_abort(&p, i, 0);
+            continue;
+        }
+        num_senders++;
+    }
+
+    for (i = 0; i < num_senders; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_join(receiver, NULL);
+
+    if (s->local_id == s->master_id) {
+        axnetperf_pattern_print(&p);
+    }
+
+    ret = 0;
+err:
+    free(s->pairs);
+    s->pairs = NULL;
+
+    return ret;
+}
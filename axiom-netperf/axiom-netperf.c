@@ -41,13 +41,21 @@ static void
 usage(void)
 {
     printf("usage: axiom-netperf [arguments] -d server_id \n");
-    printf("AXIOM netperf: estimate the throughput between this node and the\n");
-    printf("               specified server_id\n");
+    printf("AXIOM netperf: estimate the throughput (or the latency) between this\n");
+    printf("               node and the specified server_id\n");
     printf("Version: %s\n", AXIOM_API_VERSION_STR);
     printf("\n\n");
     printf("Arguments:\n");
     printf("client-mode:\n");
-    printf("   -t, --type      raw|long|rdma|srdma message type to use [default: long]\n");
+    printf("   -t, --type      raw|long|rdma|srdma|rrdma|srrdma\n");
+    printf("                                       message type to use [default: long]\n");
+    printf("                                       (srdma: synchronous RDMA write,\n");
+    printf("                                        rrdma/srrdma: async/sync RDMA read)\n");
+    printf("   -D, --digest                        check RDMA data with a digest of\n");
+    printf("                                       pseudo random data instead of a magic\n");
+    printf("   -w, --window    depth               asynchronous RDMA operations in flight\n");
+    printf("                                       [def. %d, max %d]\n",
+            AXIOM_NETPERF_DEF_RDMA_WINDOW, AXNP_MAX_RDMA_WINDOW);
     printf("   -d, --dest      server_id           node id of axiom-netperf server\n");
     printf("   -p, --sport     server_port         port of axiom-netperf server[def. %d]\n",
             AXIOM_NETPERF_DEF_PORT);
@@ -59,6 +67,24 @@ usage(void)
             "raw - %d rdma - %d long - %d]\n",
             AXIOM_NETPERF_DEF_RAW_PSIZE, AXIOM_NETPERF_DEF_RDMA_PSIZE,
             AXIOM_NETPERF_DEF_LONG_PSIZE);
+    printf("   -T, --latency                       ping-pong latency mode: measure the\n");
+    printf("                                       round trip distribution for each\n");
+    printf("                                       power of two payload size (or only\n");
+    printf("                                       for the size specified with -L)\n");
+    printf("                                       RDMA reads are timed up to their\n");
+    printf("                                       completion, without the echo\n");
+    printf("   -i, --iterations  iter              round trips for each size in latency\n");
+    printf("                                       mode [def. %d]\n",
+            AXIOM_NETPERF_DEF_LAT_ITER);
+    printf("   -o, --output    text|csv|json       latency report format [def. text]\n");
+    printf("pattern-mode (start through axiom-run on all nodes involved):\n");
+    printf("   -m, --pattern   bidir|incast|outcast|alltoall\n");
+    printf("                                       every node streams -l bytes with raw or\n");
+    printf("                                       long messages according to the pattern;\n");
+    printf("                                       -d selects the incast sink or the\n");
+    printf("                                       outcast source [def. first node]\n");
+    printf("   -p, --sport     port                port used by all nodes [def. %d]\n",
+            AXIOM_NETPERF_DEF_PORT);
     printf("server-mode:\n");
     printf("   -s, --server                        enable server mode\n");
     printf("   -p, --port      server_port         server port [def. %d]\n",
@@ -109,8 +135,12 @@ main(int argc, char **argv)
         .client_port = AXIOM_NETPERF_DEF_PORT,
         .np_type = AXIOM_NETPERF_DEF_TYPE,
         .client.payload_size = 0,
+        .client.iterations = AXIOM_NETPERF_DEF_LAT_ITER,
+        .client.output = AXNP_OUT_TEXT,
+        .client.rdma_window = AXIOM_NETPERF_DEF_RDMA_WINDOW,
         .num_threads = 1,
         .mutex = PTHREAD_MUTEX_INITIALIZER,
+        .pattern = AXNP_PATTERN_NONE,
     };
     int i;
     axiom_err_t err;
@@ -124,6 +154,12 @@ main(int argc, char **argv)
         {"length", required_argument, 0, 'l'},
         {"payload", required_argument, 0, 'L'},
         {"num_threads", required_argument, 0, 'n'},
+        {"latency", no_argument, 0, 'T'},
+        {"iterations", required_argument, 0, 'i'},
+        {"output", required_argument, 0, 'o'},
+        {"pattern", required_argument, 0, 'm'},
+        {"window", required_argument, 0, 'w'},
+        {"digest", no_argument, 0, 'D'},
         {"server", no_argument, 0, 's'},
         {"verbose", no_argument, 0, 'v'},
         {"version", no_argument, 0, 'V'},
@@ -132,7 +168,7 @@ main(int argc, char **argv)
     };
 
 
-    while ((opt = getopt_long(argc, argv,"svhd:l:L:p:P:t:n:V",
+    while ((opt = getopt_long(argc, argv,"svhTDd:l:L:p:P:t:n:i:o:m:w:V",
                          long_options, &long_index )) != -1) {
         char *type_string = NULL;
         char char_scale = AXIOM_NETPERF_DEF_CHAR_SCALE;
@@ -170,7 +206,15 @@ main(int argc, char **argv)
                     exit(-1);
                 }
 
-                if (strncmp(type_string, "rdma", 4) == 0) {
+                if (strncmp(type_string, "rrdma", 5) == 0) {
+                    s.np_type = AXNP_RDMA;
+                    s.client.rdma_sync = 0;
+                    s.client.rdma_read = 1;
+                } else if (strncmp(type_string, "srrdma", 6) == 0) {
+                    s.np_type = AXNP_RDMA;
+                    s.client.rdma_sync = 1;
+                    s.client.rdma_read = 1;
+                } else if (strncmp(type_string, "rdma", 4) == 0) {
                     s.np_type = AXNP_RDMA;
                     s.client.rdma_sync = 0;
                 } else if (strncmp(type_string, "srdma", 4) == 0) {
@@ -215,6 +259,61 @@ main(int argc, char **argv)
                 }
                 break;
 
+            case 'T':
+                s.client.latency = 1;
+                break;
+
+            case 'i' :
+                if (sscanf(optarg, "%" SCNu64, &s.client.iterations) != 1 ||
+                        s.client.iterations == 0) {
+                    EPRINTF("wrong number of iterations");
+                    usage();
+                    exit(-1);
+                }
+                break;
+
+            case 'o':
+                if (strcmp(optarg, "text") == 0) {
+                    s.client.output = AXNP_OUT_TEXT;
+                } else if (strcmp(optarg, "csv") == 0) {
+                    s.client.output = AXNP_OUT_CSV;
+                } else if (strcmp(optarg, "json") == 0) {
+                    s.client.output = AXNP_OUT_JSON;
+                } else {
+                    EPRINTF("wrong output format");
+                    usage();
+                    exit(-1);
+                }
+                break;
+
+            case 'D':
+                s.client.rdma_digest = 1;
+                break;
+
+            case 'w' :
+                if (sscanf(optarg, "%u", &s.client.rdma_window) != 1) {
+                    EPRINTF("wrong RDMA window");
+                    usage();
+                    exit(-1);
+                }
+                break;
+
+            case 'm':
+                if (strcmp(optarg, "bidir") == 0) {
+                    s.pattern = AXNP_PATTERN_BIDIR;
+                } else if (strcmp(optarg, "incast") == 0) {
+                    s.pattern = AXNP_PATTERN_INCAST;
+                } else if (strcmp(optarg, "outcast") == 0) {
+                    s.pattern = AXNP_PATTERN_OUTCAST;
+                } else if (strcmp(optarg, "alltoall") == 0) {
+                    s.pattern = AXNP_PATTERN_ALLTOALL;
+                } else {
+                    EPRINTF("wrong traffic pattern");
+                    usage();
+                    exit(-1);
+                }
+                break;
+
             case 's':
                 s.np_type = 0;
                 break;
@@ -249,6 +348,18 @@ main(int argc, char **argv)
 
     s.state = AXN_STATE_NULL;
 
+    /* traffic pattern mode: every node is both client and server */
+    if (s.pattern != AXNP_PATTERN_NONE) {
+        if (s.np_type == 0) {
+            EPRINTF("server mode and traffic patterns are exclusive");
+            goto err;
+        }
+
+        s.client.total_bytes = data_length << data_scale;
+        axnetperf_pattern(&s);
+        goto err;
+    }
+
 
     /* server mode */
     if (s.np_type == 0) {
@@ -258,8 +369,12 @@ main(int argc, char **argv)
             goto err;
         }
 
+        axnetperf_core_init(&s.core, s.dev, verbose);
+        s.core.port = s.server_port;
+        s.core.log_sessions = 1;
+
         for (i = 0; i < s.num_threads; i++) {
-            pthread_create(&s.threads[i], NULL, axnetperf_server, &s);
+            pthread_create(&s.threads[i], NULL, axnetperf_core_loop, &s.core);
         }
     } else {
         err = axiom_bind(s.dev, s.client_port);
@@ -276,6 +391,12 @@ main(int argc, char **argv)
 
         s.client.total_bytes = data_length << data_scale;
 
+        /* latency mode: one ping-pong at a time */
+        if (s.client.latency) {
+            axnetperf_latency(&s);
+            goto err;
+        }
+
         for (i = 0; i < s.num_threads; i++) {
             pthread_create(&s.threads[i], NULL, axnetperf_client, &s);
         }
@@ -286,6 +407,7 @@ main(int argc, char **argv)
     }
 
 err:
+    free(s.client.rdma_hist);
     axiom_close(s.dev);
 
     return 0;
@@ -11,6 +11,8 @@
 #define AXIOM_NETPERF_h
 #include <sys/syscall.h>
 
+#include "axiom_netperf_server.h"
+
 #define AXIOM_NETPERF_DEF_CHAR_SCALE    'B'
 #define AXIOM_NETPERF_DEF_DATA_SCALE    10
 #define AXIOM_NETPERF_DEF_DATA_LENGTH   1024
@@ -25,6 +27,33 @@
 #define AXNP_RES_PKT_SCALE              1000
 #define AXNP_MAX_THREADS                64
 
+#define AXIOM_NETPERF_DEF_LAT_ITER      1000
+#define AXIOM_NETPERF_DEF_RDMA_WINDOW   64
+#define AXNP_MAX_RDMA_WINDOW            2048
+#define AXNP_LAT_WARMUP                 16
+
+/* traffic patterns (run through axiom-run) */
+#define AXNP_PATTERN_NONE               0
+#define AXNP_PATTERN_BIDIR              1
+#define AXNP_PATTERN_INCAST             2
+#define AXNP_PATTERN_OUTCAST            3
+#define AXNP_PATTERN_ALLTOALL           4
+#define AXNP_PATTERN_MAX_NODES          64
+#define AXNP_PATTERN_SYNC_ID            11
+#define AXNP_PATTERN_IDLE_MS            10000
+
+/* latency report formats */
+#define AXNP_OUT_TEXT                   0
+#define AXNP_OUT_CSV                    1
+#define AXNP_OUT_JSON                   2
+
+/* log-linear (HDR-style) histogram: 2^AXNP_HIST_SUB_BITS linear sub-buckets
+ * for each power of two, so the relative error is below 1/32 */
+#define AXNP_HIST_SUB_BITS              5
+#define AXNP_HIST_SUB_COUNT             (1 << AXNP_HIST_SUB_BITS)
+#define AXNP_HIST_BUCKETS               ((64 - AXNP_HIST_SUB_BITS + 1) * \
+                                                AXNP_HIST_SUB_COUNT)
+
 typedef enum {
     AXN_STATE_NULL,
     AXN_STATE_INIT,
@@ -34,18 +63,14 @@ typedef enum {
     AXN_STATE_ERROR
 } axnetperf_state_t;
 
-/*! \brief Message payload for the axiom-netperf application */
-typedef struct axiom_netperf_payload {
-    uint8_t  command;           /*!< \brief Command of netperf messages */
-    uint8_t  padding[7];
-    uint64_t total_bytes;       /*!< \brief Total bytes of the stream */
-    uint64_t elapsed_time;      /*!< \brief Time elapsed to receive data */
-    uint8_t  type;              /*!< \brief Type of message used in the test */
-    uint64_t magic;            /*!< \brief Magic byte written in the payload */
-    uint8_t  error;             /*!< \brief Error report */
-    uint8_t  reply_port;
-    uint8_t  spare[93];
-} axiom_netperf_payload_t;
+/*! \brief Latency histogram (values in nanoseconds) */
+typedef struct {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint64_t buckets[AXNP_HIST_BUCKETS];
+} axnetperf_hist_t;
 
 typedef struct {
     struct timespec start_ts;
@@ -59,15 +84,26 @@ typedef struct {
     uint64_t rdma_size;
     uint64_t magic;
     int rdma_sync;
+    int rdma_read;              /*!< \brief RDMA read instead of write */
+    int rdma_digest;            /*!< \brief check RDMA data with a digest */
+    unsigned int rdma_window;   /*!< \brief RDMA operations in flight */
+    axnetperf_hist_t *rdma_hist; /*!< \brief latency of RDMA operations */
+    unsigned int done_threads;  /*!< \brief RDMA threads finished */
+    int latency;                /*!< \brief ping-pong latency mode */
+    uint64_t iterations;        /*!< \brief round trips for each size */
+    int output;                 /*!< \brief latency report format */
 } axnetperf_client_t;
 
+/*! \brief Results of a stream between two nodes (traffic patterns) */
 typedef struct {
-    struct timespec start_ts;   /*!< \brief timestamp of the first byte */
-    struct timespec cur_ts;     /*!< \brief current timestamp */
-    uint64_t expected_bytes;    /*!< \brief total bytes that will be received */
-    uint64_t received_bytes;    /*!< \brief number of bytes received */
-    uint8_t reply_port;
-} axnetperf_server_t;
+    uint64_t tx_bytes;          /*!< \brief bytes sent by the source */
+    uint64_t tx_nsec;           /*!< \brief time spent by the source */
+    uint64_t rx_bytes;          /*!< \brief bytes received by the destination */
+    uint64_t rx_nsec;           /*!< \brief time spent by the destination */
+    uint8_t tx_done;
+    uint8_t rx_done;
+    uint8_t error;
+} axnetperf_pair_t;
 
 typedef struct {
     axiom_dev_t *dev;
@@ -81,10 +117,21 @@ typedef struct {
     pthread_mutex_t mutex;
     axnetperf_client_t client;
     axnetperf_server_t server[AXIOM_NODES_NUM];
+    axnetperf_core_t core;      /*!< \brief server core (server mode) */
+    int pattern;                /*!< \brief traffic pattern */
+    uint64_t nodes;             /*!< \brief nodes involved in the pattern */
+    axiom_node_id_t local_id;
+    axiom_node_id_t master_id;  /*!< \brief node that collects the results */
+    axnetperf_pair_t *pairs;    /*!< \brief per-pair results (master only) */
 } axnetperf_status_t;
 
+void axnetperf_hist_reset(axnetperf_hist_t *h);
+void axnetperf_hist_merge(axnetperf_hist_t *dst, axnetperf_hist_t *src);
+uint64_t axnetperf_hist_percentile(axnetperf_hist_t *h, double percentile);
+
 void *axnetperf_client(void *s);
-void *axnetperf_server(void *s);
+void *axnetperf_latency(void *s);
+int axnetperf_pattern(axnetperf_status_t *s);
 
 static inline long
 gettid(void)
@@ -92,4 +139,41 @@ gettid(void)
     return syscall(SYS_gettid);
 }
 
+/* monotonic timestamp in nanoseconds */
+static inline uint64_t
+axnetperf_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec2nsec(ts);
+}
+
+static inline int
+axnetperf_hist_index(uint64_t value)
+{
+    int msb, shift;
+
+    if (value < AXNP_HIST_SUB_COUNT)
+        return value;
+
+    msb = 63 - __builtin_clzll(value);
+    shift = msb - AXNP_HIST_SUB_BITS;
+
+    return (shift + 1) * AXNP_HIST_SUB_COUNT +
+        (int)((value >> shift) - AXNP_HIST_SUB_COUNT);
+}
+
+static inline void
+axnetperf_hist_record(axnetperf_hist_t *h, uint64_t value)
+{
+    h->buckets[axnetperf_hist_index(value)]++;
+    h->count++;
+    h->sum += value;
+    if (value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+}
+
 #endif /* !AXIOM_NETPERF_h */
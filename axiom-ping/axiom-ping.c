@@ -8,6 +8,12 @@
  *
  * axiom-ping estimate the round trip time (RTT) between two axiom nodes.
  *
+ * In flood mode up to K pings are kept in flight: the replies are matched
+ * by sequence number (so they can arrive out of order) and the pings
+ * without a reply within a timeout are counted as lost. The adaptive mode
+ * searches the highest ping rate that the destination sustains without
+ * losses and without queueing (RTT growth).
+ *
  * Copyright (C) 2016, Evidence Srl.
  * Terms of use are as specified in COPYING
  */
@@ -16,12 +22,14 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <inttypes.h>
 #include <signal.h>
 #include <time.h>
 #include <pthread.h>
+#include <sched.h>
 
 #include <sys/types.h>
 #include <sys/time.h>
@@ -44,6 +52,38 @@ struct sender_param {
     double interval;
 };
 
+/* max pings in flight in flood mode */
+#define MAX_WINDOW 4096
+/* default pings in flight in flood mode */
+#define DEF_WINDOW 64
+/* pings sent in every step of the adaptive mode */
+#define ADAPTIVE_STEP 1000
+/* first rate (pings/sec) of the adaptive mode */
+#define ADAPTIVE_RATE 1000
+/* bisection steps of the adaptive mode */
+#define ADAPTIVE_BISECT 6
+
+/* RTT samples and ordering counters */
+struct rtt_stats {
+    uint64_t *samples;
+    size_t num, size;
+    uint64_t min, max;
+    double mean, m2;            /* Welford running mean and variance */
+    int sent;
+    int recv;
+    int reordered;              /* replies older than the newest received */
+    int late;                   /* duplicated or after the timeout */
+    uint32_t max_seq;
+    uint64_t start_ns, end_ns;  /* duration of the run */
+};
+
+/* ping in flight (flood mode) */
+struct inflight {
+    uint32_t seq;
+    uint64_t sent_ns;
+    int pending;
+};
+
 int verbose = 0;
 
 static void
@@ -58,13 +98,20 @@ usage(void)
     printf("-d, --dest       dest_node   destination node id of axiom-ping\n");
     printf("-i, --interval   interval    sec between two ping messagges \n");
     printf("-c, --count      count       number of ping messagges to send \n");
+    printf("-f, --flood      [K]         flood mode: keep K pings in flight \n");
+    printf("                             (default %d, max %d); -i paces the\n", DEF_WINDOW, MAX_WINDOW);
+    printf("                             pings (default: as fast as possible)\n");
+    printf("-a, --adaptive               find the max ping rate sustained by\n");
+    printf("                             dest_node (no losses, no RTT growth)\n");
+    printf("-W, --timeout    timeout     sec to wait for a reply in flood and\n");
+    printf("                             adaptive mode (default 1)\n");
     printf("-v, --verbose                verbose output\n");
     printf("-V, --version                print version\n");
     printf("-h, --help                   print this help\n\n");
 }
 
 static volatile sig_atomic_t sigint_received = 0;
-static int sent_packets = 0, recv_packets = 0;
+static int sent_packets = 0;
 
 /* control-C handler */
 static void
@@ -73,6 +120,286 @@ sigint_handler(int sig)
     sigint_received = 1;
 }
 
+/* monotonic timestamp in nanoseconds, not slewed by NTP */
+static inline uint64_t
+ping_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return timespec2nsec(ts);
+}
+
+static void
+rtt_reset(struct rtt_stats *st)
+{
+    uint64_t *samples = st->samples;
+    size_t size = st->size;
+
+    memset(st, 0, sizeof(*st));
+    st->samples = samples;
+    st->size = size;
+    st->min = UINT64_MAX;
+}
+
+static void
+rtt_add(struct rtt_stats *st, uint32_t seq, uint64_t rtt_ns)
+{
+    double delta;
+
+    if (st->num == st->size) {
+        size_t size = st->size ? st->size * 2 : 1024;
+        uint64_t *samples = realloc(st->samples, size * sizeof(uint64_t));
+        if (samples != NULL) {
+            st->samples = samples;
+            st->size = size;
+        }
+    }
+    if (st->num < st->size) {
+        st->samples[st->num++] = rtt_ns;
+    }
+
+    st->recv++;
+    if (rtt_ns < st->min)
+        st->min = rtt_ns;
+    if (rtt_ns > st->max)
+        st->max = rtt_ns;
+    delta = rtt_ns - st->mean;
+    st->mean += delta / st->recv;
+    st->m2 += delta * (rtt_ns - st->mean);
+
+    if (st->recv > 1 && seq < st->max_seq) {
+        st->reordered++;
+    } else {
+        st->max_seq = seq;
+    }
+}
+
+static int
+rtt_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* nearest-rank percentile (the samples must be sorted) */
+static uint64_t
+rtt_percentile(struct rtt_stats *st, double percentile)
+{
+    size_t rank;
+
+    if (st->num == 0)
+        return 0;
+    rank = (size_t)ceil(percentile / 100.0 * st->num);
+    if (rank == 0)
+        rank = 1;
+    return st->samples[rank - 1];
+}
+
+static void
+rtt_print(struct rtt_stats *st, axiom_node_id_t dst_id)
+{
+    double packet_loss = 0, elapsed;
+
+    if (st->sent)
+        packet_loss = (1 - ((double)(st->recv) / st->sent)) * 100;
+
+    printf("\n--- node %d ping statistics ---\n", dst_id);
+    printf("%d packets transmitted, %d received, %2.2f%% packet loss",
+           st->sent, st->recv, packet_loss);
+    if (st->end_ns > st->start_ns) {
+        elapsed = (st->end_ns - st->start_ns) / 1e9;
+        printf(", time %.0f ms, rate %.0f pings/s", elapsed * 1000,
+                st->sent / elapsed);
+    }
+    printf("\n");
+    if (st->reordered || st->late) {
+        printf("%d reordered, %d duplicated or late\n", st->reordered,
+                st->late);
+    }
+    if (st->recv == 0)
+        return;
+
+    qsort(st->samples, st->num, sizeof(uint64_t), rtt_cmp);
+    printf("rtt min/avg/max/stddev = %3.3f/%3.3f/%3.3f/%3.3f ms\n",
+            nsec2msec(st->min), st->mean / 1e6, nsec2msec(st->max),
+            st->recv > 1 ? sqrt(st->m2 / (st->recv - 1)) / 1e6 : 0.0);
+    printf("rtt p50/p90/p99/p99.9 = %3.3f/%3.3f/%3.3f/%3.3f ms\n",
+            nsec2msec(rtt_percentile(st, 50.0)),
+            nsec2msec(rtt_percentile(st, 90.0)),
+            nsec2msec(rtt_percentile(st, 99.0)),
+            nsec2msec(rtt_percentile(st, 99.9)));
+}
+
+/*
+ * Flood run: send 'count' pings (-1 until SIGINT) paced by 'interval_ns'
+ * (0 as fast as possible) with at most 'window' pings in flight.
+ * The device must be opened in no blocking mode.
+ */
+static int
+ping_flood(axiom_dev_t *dev, axiom_node_id_t dst_id, uint32_t unique_id,
+        uint32_t *seq, int window, uint64_t interval_ns, int count,
+        uint64_t timeout_ns, struct rtt_stats *st)
+{
+    static struct inflight ring[MAX_WINDOW];
+    axiom_ping_payload_t payload, recv_payload;
+    axiom_node_id_t src_id;
+    axiom_port_t recv_port;
+    axiom_type_t type;
+    axiom_raw_payload_size_t payload_size;
+    axiom_err_t ret;
+    uint64_t now, next_send;
+    uint32_t oldest;
+    int inflight = 0, idle;
+    struct inflight *e;
+
+    payload.command = AXIOM_CMD_PING;
+    payload.unique_id = unique_id;
+
+    oldest = *seq + 1;
+    st->start_ns = next_send = ping_now();
+    while (!sigint_received && (count != 0 || inflight > 0)) {
+        idle = 1;
+        now = ping_now();
+
+        /* send a new ping if the window and the pace allow it */
+        if (count != 0 && inflight < window && now >= next_send &&
+                *seq + 1 - oldest < MAX_WINDOW) {
+            payload.seq_num = *seq + 1;
+            payload.timestamp = now;
+            ret = axiom_send_raw(dev, dst_id, AXIOM_RAW_PORT_INIT,
+                    AXIOM_TYPE_RAW_DATA, sizeof(payload), &payload);
+            if (AXIOM_RET_IS_OK(ret)) {
+                (*seq)++;
+                e = &ring[*seq % MAX_WINDOW];
+                e->seq = *seq;
+                e->sent_ns = now;
+                e->pending = 1;
+                inflight++;
+                st->sent++;
+                if (count > 0)
+                    count--;
+                next_send = interval_ns ? next_send + interval_ns : now;
+                idle = 0;
+            } else if (ret == AXIOM_RET_NOTREACH) {
+                printf("Destination node id not reachable [%u]\n", dst_id);
+                return -1;
+            } else if (ret != AXIOM_RET_NOTAVAIL) {
+                EPRINTF("send error");
+                return -1;
+            }
+        }
+
+        /* receive the replies, in any order */
+        payload_size = sizeof(recv_payload);
+        type = AXIOM_TYPE_RAW_DATA;
+        ret = axiom_recv_raw(dev, &src_id, &recv_port, &type, &payload_size,
+                &recv_payload);
+        if (AXIOM_RET_IS_OK(ret)) {
+            now = ping_now();
+            idle = 0;
+            if (recv_payload.command == AXIOM_CMD_PONG &&
+                    recv_payload.unique_id == unique_id) {
+                e = &ring[recv_payload.seq_num % MAX_WINDOW];
+                if (e->seq == recv_payload.seq_num && e->pending) {
+                    e->pending = 0;
+                    inflight--;
+                    rtt_add(st, recv_payload.seq_num,
+                            now - recv_payload.timestamp);
+                } else {
+                    st->late++;
+                }
+            }
+        } else if (ret == AXIOM_RET_INTR) {
+            break;
+        } else if (ret != AXIOM_RET_NOTAVAIL) {
+            EPRINTF("receive error");
+            return -1;
+        }
+
+        /* the pings without reply within the timeout are lost */
+        while (oldest <= *seq) {
+            e = &ring[oldest % MAX_WINDOW];
+            if (e->pending) {
+                if (now - e->sent_ns < timeout_ns)
+                    break;
+                e->pending = 0;
+                inflight--;
+            }
+            oldest++;
+        }
+
+        if (idle)
+            sched_yield();
+    }
+    st->end_ns = ping_now();
+
+    return 0;
+}
+
+/*
+ * Adaptive mode: double the ping rate until the destination does not keep
+ * up (losses, or median RTT twice the one at the lowest rate), then bisect
+ * between the last sustained rate and the first failed one.
+ */
+static void
+ping_adaptive(axiom_dev_t *dev, axiom_node_id_t dst_id, uint32_t unique_id,
+        int count, uint64_t timeout_ns, struct rtt_stats *st)
+{
+    double rate = ADAPTIVE_RATE, good = 0, bad = 0;
+    uint64_t base_p50 = 0, p50;
+    uint32_t seq = 0;
+    int step, ok;
+
+    if (count <= 0)
+        count = ADAPTIVE_STEP;
+
+    for (step = 0; !sigint_received; step++) {
+        rtt_reset(st);
+        if (ping_flood(dev, dst_id, unique_id, &seq, MAX_WINDOW,
+                    (uint64_t)(1e9 / rate), count, timeout_ns, st))
+            return;
+        if (sigint_received || st->recv == 0)
+            break;
+
+        qsort(st->samples, st->num, sizeof(uint64_t), rtt_cmp);
+        p50 = rtt_percentile(st, 50.0);
+        if (step == 0)
+            base_p50 = p50;
+        ok = st->recv == st->sent && p50 <= 2 * base_p50 &&
+            st->sent * 1e9 / (st->end_ns - st->start_ns) >= 0.9 * rate;
+
+        printf("rate %10.0f pings/s: %d sent, %d received, rtt p50 %3.3f ms "
+                "p99 %3.3f ms -> %s\n", rate, st->sent, st->recv,
+                nsec2msec(p50), nsec2msec(rtt_percentile(st, 99.0)),
+                ok ? "sustained" : "saturated");
+
+        if (ok) {
+            good = rate;
+        } else {
+            bad = rate;
+        }
+        if (bad == 0) {
+            rate *= 2;
+        } else if (step < 64 && bad - good > good / (1 << ADAPTIVE_BISECT) &&
+                good > 0) {
+            rate = (good + bad) / 2;
+        } else {
+            break;
+        }
+    }
+
+    if (good > 0) {
+        printf("\nmax sustainable ping rate to node %d: %.0f pings/s "
+                "(base rtt p50 %3.3f ms)\n", dst_id, good,
+                nsec2msec(base_p50));
+    } else {
+        printf("\nnode %d does not sustain %d pings/s\n", dst_id,
+                ADAPTIVE_RATE);
+    }
+}
+
 void *
 sender_body(void *opaque)
 {
@@ -87,21 +414,12 @@ sender_body(void *opaque)
     while (!sigint_received && (p->num_ping > 0)) {
         axiom_type_t type = AXIOM_TYPE_RAW_DATA;
         axiom_err_t send_ret;
-        struct timespec start_ts;
-        int ret;
 
         IPRINTF(verbose,"[node %u] sending ping message...\n", p->node_id);
 
-        /* get actual time */
-        ret = clock_gettime(CLOCK_REALTIME, &start_ts);
-        if (ret == -1) {
-            EPRINTF("gettime error");
-            goto err;
-        }
-
         /* send a raw ping  message*/
         payload.seq_num = payload.seq_num + 1;
-        payload.timestamp = timespec2nsec(start_ts);
+        payload.timestamp = ping_now();
         send_ret =  axiom_send_raw(p->dev, (axiom_node_id_t)p->dst_id,
                 remote_port, type, sizeof(payload), &payload);
         if (!AXIOM_RET_IS_OK(send_ret)) {
@@ -143,14 +461,15 @@ main(int argc, char **argv)
     axiom_node_id_t dst_id, src_id, node_id;
     axiom_ping_payload_t recv_payload;
     axiom_err_t err, recv_ret;
+    axiom_args_t axiom_args;
     struct sigaction sig;
     double interval = 1; /* default interval 1 sec */
+    double timeout = 1; /* default flood timeout 1 sec */
     unsigned int num_ping = 1;
-    int dst_ok = 0, num_ping_set = 0;
-    uint32_t unique_id;
-    uint64_t sum_nsec = 0, max_nsec = 0, min_nsec = -1;
-    double avg_nsec, packet_loss;
-    int ret;
+    int dst_ok = 0, num_ping_set = 0, interval_set = 0;
+    int window = 0, adaptive = 0;
+    uint32_t unique_id, seq = 0;
+    struct rtt_stats st;
     struct sender_param sender_param;
     pthread_t sender_thread;
 
@@ -160,6 +479,9 @@ main(int argc, char **argv)
         {"dest", required_argument, 0, 'd'},
         {"interval", required_argument, 0, 'i'},
         {"count", required_argument, 0, 'c'},
+        {"flood", optional_argument, 0, 'f'},
+        {"adaptive", no_argument, 0, 'a'},
+        {"timeout", required_argument, 0, 'W'},
         {"verbose", no_argument, 0, 'v'},
         {"version", no_argument, 0, 'V'},
         {"help", no_argument, 0, 'h'},
@@ -171,7 +493,7 @@ main(int argc, char **argv)
     sig.sa_handler = sigint_handler;
     sigaction(SIGINT, &sig, NULL);
 
-    while ((opt = getopt_long(argc, argv,"vhd:i:c:V",
+    while ((opt = getopt_long(argc, argv,"vhd:i:c:f::aW:V",
                          long_options, &long_index )) != -1) {
         switch (opt) {
             case 'd' :
@@ -189,6 +511,29 @@ main(int argc, char **argv)
                     usage();
                     exit(-1);
                 }
+                interval_set = 1;
+                break;
+
+            case 'f':
+                window = DEF_WINDOW;
+                if (optarg && (sscanf(optarg, "%d", &window) != 1 ||
+                            window < 1 || window > MAX_WINDOW)) {
+                    EPRINTF("wrong number of pings in flight");
+                    usage();
+                    exit(-1);
+                }
+                break;
+
+            case 'a':
+                adaptive = 1;
+                break;
+
+            case 'W':
+                if (sscanf(optarg, "%lf", &timeout) != 1 || timeout <= 0) {
+                    EPRINTF("wrong timeout");
+                    usage();
+                    exit(-1);
+                }
                 break;
 
             case 'c':
@@ -228,8 +573,11 @@ main(int argc, char **argv)
         exit(-1);
     }
 
+    /* flood and adaptive modes poll the device */
+    axiom_args.flags = (window || adaptive) ? AXIOM_FLAG_NOBLOCK : 0;
+
     /* open the axiom device */
-    dev = axiom_open(NULL);
+    dev = axiom_open(&axiom_args);
     if (dev == NULL) {
         perror("axiom_open()");
         exit(-1);
@@ -250,6 +598,22 @@ main(int argc, char **argv)
 
     printf("PING node %d.\n", dst_id);
 
+    memset(&st, 0, sizeof(st));
+    rtt_reset(&st);
+
+    if (adaptive) {
+        ping_adaptive(dev, dst_id, unique_id, num_ping_set ? num_ping : 0,
+                timeout * 1e9, &st);
+        goto err;
+    }
+    if (window) {
+        ping_flood(dev, dst_id, unique_id, &seq, window,
+                interval_set ? interval * 1e9 : 0,
+                num_ping_set ? (int)num_ping : -1, timeout * 1e9, &st);
+        rtt_print(&st, dst_id);
+        goto err;
+    }
+
     sender_param.dev = dev;
     sender_param.node_id = node_id;
     sender_param.dst_id = dst_id;
@@ -264,8 +628,8 @@ main(int argc, char **argv)
         goto err;
     }
 
+    st.start_ns = ping_now();
     while (!sigint_received &&  (num_ping > 0)) {
-        struct timespec end_ts;
         axiom_type_t type = AXIOM_TYPE_RAW_DATA;
         uint64_t diff_ns, start_ns, end_ns;
         int retry;
@@ -283,11 +647,7 @@ main(int argc, char **argv)
                     &type, &payload_size, &recv_payload);
 
             /* get actual time */
-            ret = clock_gettime(CLOCK_REALTIME, &end_ts);
-            if (ret == -1) {
-                EPRINTF("gettime error");
-                goto err;
-            }
+            end_ns = ping_now();
 
             if (!AXIOM_RET_IS_OK(recv_ret)) {
                 /* recv interrupted by the SIGINT signal */
@@ -316,31 +676,22 @@ main(int argc, char **argv)
             break;
         }
 
-        recv_packets++;
         IPRINTF(verbose,"[node %u] reply received on port %u\n", node_id,
                 recv_port);
         IPRINTF(verbose,"\t- source_node_id = %u\n", src_id);
         IPRINTF(verbose,"\t- message index = %u\n", recv_payload.unique_id);
 
         start_ns = recv_payload.timestamp;
-        end_ns = timespec2nsec(end_ts);
 
         /* ********************** statiscs ***************************** */
         /* difference computation */
         diff_ns = end_ns - start_ns;
 
-        sum_nsec += diff_ns;
+        rtt_add(&st, recv_payload.seq_num, diff_ns);
 
         printf("from node %d: seq_num=%d time=%3.3f ms\n", src_id,
                 recv_payload.seq_num, nsec2msec(diff_ns));
 
-        if (diff_ns > max_nsec) {
-            max_nsec = diff_ns;
-        }
-        if (diff_ns < min_nsec) {
-            min_nsec = diff_ns;
-        }
-
         if (sigint_received) {
             break;
         }
@@ -358,19 +709,11 @@ exit:
         goto err;
     }
 
-    /* average computation */
-    avg_nsec = ((double)(sum_nsec) / recv_packets);
-    packet_loss = (1 - ((double)(recv_packets) / sent_packets)) * 100;
-
-    printf("\n--- node %d ping statistics ---\n", dst_id);
-    printf("%d packets transmitted, %d received, %2.2f%% packet loss\n",
-           sent_packets, recv_packets, packet_loss);
-    if (recv_packets) {
-        printf("rtt min/avg/max = %3.3f/%3.3f/%3.3f ms\n", nsec2msec(min_nsec),
-                nsec2msec(avg_nsec), nsec2msec(max_nsec));
-    }
+    st.sent = sent_packets;
+    rtt_print(&st, dst_id);
 
 err:
+    free(st.samples);
     axiom_close(dev);
 
 
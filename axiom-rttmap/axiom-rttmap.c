@@ -0,0 +1,849 @@
+/*!
+ * \file axiom-rttmap.c
+ *
+ * \version     v1.2
+ * \date        2017-09-05
+ *
+ * This file contains the implementation of axiom-rttmap application.
+ *
+ * axiom-rttmap measures the round trip time (RTT) between every pair of the
+ * nodes where it is started by axiom-run. All the nodes at the same time
+ * trace the path towards every other node (axiom-traceroute messages) and
+ * ping every other node (axiom-ping messages, answered by axiom-init); the
+ * results are collected by the master node (the lowest node involved), which
+ * prints the NxN RTT matrix and the latency of every link inferred from the
+ * paths, and flags the outliers against a baseline.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "axiom_nic_types.h"
+#include "axiom_nic_api_user.h"
+#include "axiom_nic_packets.h"
+#include "axiom_nic_init.h"
+#include "axiom_utility.h"
+#include "dprintf.h"
+
+#include "axiom_run_api.h"
+
+/* nodes addressable by axiom-run */
+#define AXRTT_MAX_NODES         64
+/* max hops of a path */
+#define AXRTT_MAX_HOPS          16
+/* default pings for every pair */
+#define AXRTT_DEF_COUNT         100
+/* default outlier tolerance (percent over the baseline) */
+#define AXRTT_DEF_TOLERANCE     50
+/* time to wait for the reports of the other nodes (sec) */
+#define AXRTT_REPORT_TIMEOUT    5
+/* iterations of the link latency fit */
+#define AXRTT_FIT_ITERATIONS    500
+
+/* reports sent to the master node (only between axiom-rttmap instances) */
+#define AXRTT_CMD_REPORT_RTT    0xE0
+#define AXRTT_CMD_REPORT_HOP    0xE1
+
+/* axiom-run barriers */
+#define AXRTT_BARRIER_START     0
+#define AXRTT_BARRIER_PING      1
+#define AXRTT_BARRIER_REPORT    2
+
+typedef struct {
+    uint8_t command;
+    axiom_node_id_t src_id;
+    axiom_node_id_t dst_id;
+    uint8_t step;               /*!< \brief hop report: index of the hop */
+    axiom_node_id_t node_id;    /*!< \brief hop report: node of the hop */
+    uint8_t hops;               /*!< \brief hops of the path */
+    uint16_t count;             /*!< \brief rtt report: replies received */
+    uint64_t min_ns;
+    uint64_t p50_ns;
+    uint64_t max_ns;
+} axrtt_report_t;
+
+typedef struct {
+    uint32_t count;             /*!< \brief replies received */
+    uint64_t min_ns;
+    uint64_t p50_ns;
+    uint64_t max_ns;
+    uint8_t done;               /*!< \brief rtt report received */
+    uint8_t hops;               /*!< \brief hops of the path (0 unknown) */
+    uint8_t hops_seen;          /*!< \brief hops received */
+    axiom_node_id_t path[AXRTT_MAX_HOPS + 1]; /*!< \brief path[0] = src */
+    double base_us;             /*!< \brief baseline (0 none) */
+} axrtt_pair_t;
+
+typedef struct {
+    axiom_node_id_t a, b;       /*!< \brief a < b */
+    int paths;                  /*!< \brief paths through the link */
+    double lat_us;              /*!< \brief inferred one-way latency */
+    double base_us;             /*!< \brief baseline (0 none) */
+} axrtt_link_t;
+
+typedef struct {
+    axiom_dev_t *dev;
+    uint64_t nodes;
+    axiom_node_id_t local_id;
+    axiom_node_id_t master_id;
+    uint32_t unique_id;
+    int count;
+    uint64_t timeout_ns;
+    uint32_t round;             /*!< \brief current ping round */
+    uint64_t *samples;          /*!< \brief [dst][round] RTT (0 lost) */
+    axrtt_pair_t pairs[AXRTT_MAX_NODES][AXRTT_MAX_NODES];
+    axrtt_link_t *links;
+    int num_links;
+    double overhead_us;         /*!< \brief fitted endpoint overhead */
+} axrtt_status_t;
+
+int verbose = 0;
+
+static axrtt_status_t status;
+
+static void
+usage(void)
+{
+    printf("usage: axiom-run [axiom-run args] axiom-rttmap [arguments]\n");
+    printf("AXIOM rttmap: measure the RTT between all the nodes started by\n");
+    printf("              axiom-run and infer the latency of every link\n");
+    printf("Version: %s\n", AXIOM_API_VERSION_STR);
+    printf("\n\n");
+    printf("Arguments:\n");
+    printf("-c, --count      count       pings for every pair [default: %d]\n",
+            AXRTT_DEF_COUNT);
+    printf("-W, --timeout    timeout     sec to wait for the replies [default: 1]\n");
+    printf("-b, --baseline   file        flag the pairs and the links slower\n");
+    printf("                             than the baseline in file\n");
+    printf("-t, --tolerance  percent     outlier threshold over the baseline\n");
+    printf("                             [default: %d]\n", AXRTT_DEF_TOLERANCE);
+    printf("-o, --output     file        save the results (baseline format)\n");
+    printf("-v, --verbose                verbose output\n");
+    printf("-V, --version                print version\n");
+    printf("-h, --help                   print this help\n\n");
+}
+
+static inline uint64_t
+axrtt_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return timespec2nsec(ts);
+}
+
+static inline int
+axrtt_is_node(axrtt_status_t *s, int node)
+{
+    return node < AXRTT_MAX_NODES && (s->nodes & (1ULL << node));
+}
+
+static void
+axrtt_record_hop(axrtt_status_t *s, axiom_node_id_t src, axiom_node_id_t dst,
+        uint8_t step, axiom_node_id_t node)
+{
+    axrtt_pair_t *pair = &s->pairs[src][dst];
+
+    if (step == 0 || step > AXRTT_MAX_HOPS || pair->path[step] != 0)
+        return;
+
+    pair->path[0] = src;
+    pair->path[step] = node;
+    pair->hops_seen++;
+    if (node == dst)
+        pair->hops = step;
+}
+
+static void
+axrtt_record(axrtt_status_t *s, axrtt_report_t *r)
+{
+    axrtt_pair_t *pair;
+
+    if (!axrtt_is_node(s, r->src_id) || !axrtt_is_node(s, r->dst_id)) {
+        EPRINTF("invalid report %u -> %u", r->src_id, r->dst_id);
+        return;
+    }
+    pair = &s->pairs[r->src_id][r->dst_id];
+
+    if (r->command == AXRTT_CMD_REPORT_HOP) {
+        /* the hops may be received out of order */
+        if (r->hops <= AXRTT_MAX_HOPS)
+            pair->hops = r->hops;
+        axrtt_record_hop(s, r->src_id, r->dst_id, r->step, r->node_id);
+    } else {
+        pair->count = r->count;
+        pair->min_ns = r->min_ns;
+        pair->p50_ns = r->p50_ns;
+        pair->max_ns = r->max_ns;
+        pair->done = 1;
+    }
+}
+
+/* receive and handle a message; return 0 if no message is available */
+static int
+axrtt_recv(axrtt_status_t *s)
+{
+    axiom_raw_payload_t payload;
+    axiom_raw_payload_size_t payload_size = sizeof(payload);
+    axiom_ping_payload_t *ping = (axiom_ping_payload_t *)&payload;
+    axiom_traceroute_payload_t *trace = (axiom_traceroute_payload_t *)&payload;
+    axiom_node_id_t src;
+    axiom_port_t port;
+    axiom_type_t type;
+    axiom_err_t err;
+    uint64_t now;
+
+    err = axiom_recv_raw(s->dev, &src, &port, &type, &payload_size, &payload);
+    if (err == AXIOM_RET_NOTAVAIL)
+        return 0;
+    if (!AXIOM_RET_IS_OK(err)) {
+        EPRINTF("receive error");
+        return -1;
+    }
+    now = axrtt_now();
+
+    switch (ping->command) {
+        case AXIOM_CMD_PONG:
+            /* late replies of the previous rounds are lost */
+            if (ping->unique_id != s->unique_id || ping->seq_num != s->round ||
+                    !axrtt_is_node(s, src))
+                break;
+            if (s->samples[src * s->count + s->round] == 0)
+                s->samples[src * s->count + s->round] = now - ping->timestamp;
+            break;
+
+        case AXIOM_CMD_TRACEROUTE_REPLY:
+            if (trace->src_id != s->local_id || !axrtt_is_node(s, src) ||
+                    !axrtt_is_node(s, trace->dst_id))
+                break;
+            axrtt_record_hop(s, s->local_id, trace->dst_id, trace->step, src);
+            break;
+
+        case AXRTT_CMD_REPORT_RTT:
+        case AXRTT_CMD_REPORT_HOP:
+            axrtt_record(s, (axrtt_report_t *)&payload);
+            break;
+
+        default:
+            IPRINTF(verbose, "unexpected message 0x%x from node %u",
+                    ping->command, src);
+    }
+
+    return 1;
+}
+
+/* trace the path towards all the other nodes at the same time */
+static int
+axrtt_trace(axrtt_status_t *s)
+{
+    axiom_traceroute_payload_t payload;
+    axiom_if_id_t if_id;
+    axiom_err_t err;
+    uint64_t deadline;
+    int dst, pending, ret;
+
+    for (dst = 0; dst < AXRTT_MAX_NODES; dst++) {
+        if (!axrtt_is_node(s, dst) || dst == s->local_id)
+            continue;
+
+        /* get interface to reach next hop for dst */
+        err = axiom_next_hop(s->dev, dst, &if_id);
+        if (!AXIOM_RET_IS_OK(err)) {
+            EPRINTF("node[%u] is unreachable", dst);
+            continue;
+        }
+
+        payload.command = AXIOM_CMD_TRACEROUTE;
+        payload.src_id = s->local_id;
+        payload.dst_id = dst;
+        payload.step = 0;
+        err = axiom_send_raw(s->dev, if_id, AXIOM_RAW_PORT_INIT,
+                AXIOM_TYPE_RAW_NEIGHBOUR, sizeof(payload), &payload);
+        if (!AXIOM_RET_IS_OK(err)) {
+            EPRINTF("traceroute send error to node %u", dst);
+        }
+    }
+
+    deadline = axrtt_now() + s->timeout_ns;
+    do {
+        ret = axrtt_recv(s);
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
+            sched_yield();
+
+        pending = 0;
+        for (dst = 0; dst < AXRTT_MAX_NODES; dst++) {
+            axrtt_pair_t *pair = &s->pairs[s->local_id][dst];
+            if (axrtt_is_node(s, dst) && dst != s->local_id &&
+                    (pair->hops == 0 || pair->hops_seen < pair->hops))
+                pending++;
+        }
+    } while (pending > 0 && axrtt_now() < deadline);
+
+    if (pending > 0) {
+        printf("node %u: path to %d nodes not traced\n", s->local_id, pending);
+    }
+
+    return 0;
+}
+
+/* every round pings all the other nodes at the same time */
+static int
+axrtt_ping(axrtt_status_t *s)
+{
+    axiom_ping_payload_t payload;
+    axiom_err_t err;
+    uint64_t deadline;
+    int dst, pending, ret;
+
+    payload.command = AXIOM_CMD_PING;
+    payload.unique_id = s->unique_id;
+
+    for (s->round = 0; s->round < (uint32_t)s->count; s->round++) {
+        for (dst = 0; dst < AXRTT_MAX_NODES; dst++) {
+            if (!axrtt_is_node(s, dst) || dst == s->local_id)
+                continue;
+
+            payload.seq_num = s->round;
+            payload.timestamp = axrtt_now();
+            err = axiom_send_raw(s->dev, dst, AXIOM_RAW_PORT_INIT,
+                    AXIOM_TYPE_RAW_DATA, sizeof(payload), &payload);
+            while (err == AXIOM_RET_NOTAVAIL) {
+                /* no blocking mode: the send queue is full */
+                sched_yield();
+                payload.timestamp = axrtt_now();
+                err = axiom_send_raw(s->dev, dst, AXIOM_RAW_PORT_INIT,
+                        AXIOM_TYPE_RAW_DATA, sizeof(payload), &payload);
+            }
+            if (!AXIOM_RET_IS_OK(err)) {
+                EPRINTF("ping send error to node %u", dst);
+            }
+        }
+
+        deadline = axrtt_now() + s->timeout_ns;
+        do {
+            ret = axrtt_recv(s);
+            if (ret < 0)
+                return -1;
+            if (ret == 0)
+                sched_yield();
+
+            pending = 0;
+            for (dst = 0; dst < AXRTT_MAX_NODES; dst++) {
+                if (axrtt_is_node(s, dst) && dst != s->local_id &&
+                        s->samples[dst * s->count + s->round] == 0)
+                    pending++;
+            }
+        } while (pending > 0 && axrtt_now() < deadline);
+    }
+
+    return 0;
+}
+
+static int
+axrtt_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* send the results of this node to the master */
+static void
+axrtt_report(axrtt_status_t *s)
+{
+    axrtt_report_t report;
+    axrtt_pair_t *pair;
+    uint64_t *samples;
+    axiom_err_t err;
+    int dst, i, n;
+
+    for (dst = 0; dst < AXRTT_MAX_NODES; dst++) {
+        if (!axrtt_is_node(s, dst) || dst == s->local_id)
+            continue;
+
+        samples = &s->samples[dst * s->count];
+        qsort(samples, s->count, sizeof(uint64_t), axrtt_cmp);
+        for (n = 0; n < s->count && samples[n] == 0; n++)
+            ;
+
+        memset(&report, 0, sizeof(report));
+        report.command = AXRTT_CMD_REPORT_RTT;
+        report.src_id = s->local_id;
+        report.dst_id = dst;
+        report.count = s->count - n;
+        if (report.count > 0) {
+            report.min_ns = samples[n];
+            report.p50_ns = samples[n + report.count / 2];
+            report.max_ns = samples[s->count - 1];
+        }
+
+        pair = &s->pairs[s->local_id][dst];
+        for (i = 0; i <= pair->hops; i++) {
+            if (s->local_id == s->master_id) {
+                if (i > 0)
+                    continue;
+                axrtt_record(s, &report);
+                continue;
+            }
+
+            if (i > 0) {
+                report.command = AXRTT_CMD_REPORT_HOP;
+                report.step = i;
+                report.node_id = pair->path[i];
+                report.hops = pair->hops;
+            }
+            err = axiom_send_raw(s->dev, s->master_id, AXIOM_RAW_PORT_NETUTILS,
+                    AXIOM_TYPE_RAW_DATA, sizeof(report), &report);
+            while (err == AXIOM_RET_NOTAVAIL) {
+                /* all the nodes report to the master at the same time */
+                sched_yield();
+                err = axiom_send_raw(s->dev, s->master_id,
+                        AXIOM_RAW_PORT_NETUTILS, AXIOM_TYPE_RAW_DATA,
+                        sizeof(report), &report);
+            }
+            if (!AXIOM_RET_IS_OK(err)) {
+                EPRINTF("report send error to master %u", s->master_id);
+            }
+        }
+    }
+}
+
+static int
+axrtt_reports_pending(axrtt_status_t *s)
+{
+    int src, dst, pending = 0;
+
+    for (src = 0; src < AXRTT_MAX_NODES; src++) {
+        for (dst = 0; dst < AXRTT_MAX_NODES; dst++) {
+            axrtt_pair_t *pair = &s->pairs[src][dst];
+
+            if (src == dst || !axrtt_is_node(s, src) || !axrtt_is_node(s, dst))
+                continue;
+            if (!pair->done || (pair->hops > 0 && pair->hops_seen < pair->hops))
+                pending++;
+        }
+    }
+
+    return pending;
+}
+
+static axrtt_link_t *
+axrtt_link(axrtt_status_t *s, axiom_node_id_t a, axiom_node_id_t b, int add)
+{
+    axrtt_link_t *link;
+    int i;
+
+    if (a > b) {
+        axiom_node_id_t t = a;
+        a = b;
+        b = t;
+    }
+    for (i = 0; i < s->num_links; i++) {
+        if (s->links[i].a == a && s->links[i].b == b)
+            return &s->links[i];
+    }
+    if (!add)
+        return NULL;
+
+    link = &s->links[s->num_links++];
+    memset(link, 0, sizeof(*link));
+    link->a = a;
+    link->b = b;
+    return link;
+}
+
+/* the pair has a median RTT and a complete path */
+static inline int
+axrtt_pair_usable(axrtt_pair_t *pair)
+{
+    return pair->done && pair->count > 0 && pair->hops > 0 &&
+        pair->hops_seen >= pair->hops;
+}
+
+/*
+ * Infer the one-way latency of every link from the median RTT of the pairs:
+ * RTT(path) = overhead + 2 * sum(latency of the links of the path), fitted
+ * with non negative least squares (coordinate descent).
+ */
+static void
+axrtt_fit_links(axrtt_status_t *s)
+{
+    axrtt_pair_t *pair;
+    axrtt_link_t *link;
+    double *resid, num, den, x;
+    int *first, *users, *next;
+    int src, dst, j, k, it, p, n = 0, num_pairs = 0;
+    int max_links = AXRTT_MAX_NODES * AXRTT_MAX_HOPS;
+    int max_users = AXRTT_MAX_NODES * AXRTT_MAX_NODES * AXRTT_MAX_HOPS;
+
+    s->links = calloc(max_links, sizeof(axrtt_link_t));
+    resid = calloc(AXRTT_MAX_NODES * AXRTT_MAX_NODES, sizeof(double));
+    first = malloc(max_links * sizeof(int));
+    users = malloc(max_users * sizeof(int));
+    next = malloc(max_users * sizeof(int));
+    if (s->links == NULL || resid == NULL || first == NULL || users == NULL ||
+            next == NULL) {
+        EPRINTF("links allocation failed");
+        goto out;
+    }
+    memset(first, -1, max_links * sizeof(int));
+
+    /*
+     * links of the paths and, for every link, the list of the pairs that
+     * cross it; residuals start from the measured RTT
+     */
+    for (src = 0; src < AXRTT_MAX_NODES; src++) {
+        for (dst = 0; dst < AXRTT_MAX_NODES; dst++) {
+            pair = &s->pairs[src][dst];
+            if (src == dst || !axrtt_pair_usable(pair))
+                continue;
+            p = src * AXRTT_MAX_NODES + dst;
+            for (k = 0; k < pair->hops && s->num_links < max_links; k++) {
+                link = axrtt_link(s, pair->path[k], pair->path[k + 1], 1);
+                link->paths++;
+                j = link - s->links;
+                users[n] = p;
+                next[n] = first[j];
+                first[j] = n++;
+            }
+            resid[p] = pair->p50_ns / 1000.0;
+            num_pairs++;
+        }
+    }
+
+    s->overhead_us = 0;
+    for (it = 0; it < AXRTT_FIT_ITERATIONS && num_pairs > 0; it++) {
+        /* overhead: coefficient 1 in every equation */
+        num = 0;
+        for (p = 0; p < AXRTT_MAX_NODES * AXRTT_MAX_NODES; p++)
+            num += resid[p];
+        x = s->overhead_us + num / num_pairs;
+        if (x < 0)
+            x = 0;
+        for (p = 0; p < AXRTT_MAX_NODES * AXRTT_MAX_NODES; p++) {
+            if (axrtt_pair_usable(
+                        &s->pairs[p / AXRTT_MAX_NODES][p % AXRTT_MAX_NODES]))
+                resid[p] -= x - s->overhead_us;
+        }
+        s->overhead_us = x;
+
+        /* links: coefficient 2 for every crossing of the link */
+        for (j = 0; j < s->num_links; j++) {
+            link = &s->links[j];
+            num = den = 0;
+            for (k = first[j]; k >= 0; k = next[k]) {
+                num += 2 * resid[users[k]];
+                den += 4;
+            }
+            x = link->lat_us + num / den;
+            if (x < 0)
+                x = 0;
+            for (k = first[j]; k >= 0; k = next[k])
+                resid[users[k]] -= 2 * (x - link->lat_us);
+            link->lat_us = x;
+        }
+    }
+
+out:
+    free(next);
+    free(users);
+    free(first);
+    free(resid);
+}
+
+static int
+axrtt_is_outlier(double value, double base, int tolerance)
+{
+    return base > 0 && value > base * (1 + tolerance / 100.0);
+}
+
+static int
+axrtt_load_baseline(axrtt_status_t *s, const char *filename)
+{
+    char *line = NULL, kind[8];
+    size_t len = 0;
+    unsigned a, b;
+    double us;
+    axrtt_link_t *link;
+    FILE *file;
+
+    file = fopen(filename, "r");
+    if (file == NULL) {
+        EPRINTF("unable to open baseline %s", filename);
+        return -1;
+    }
+
+    while (getline(&line, &len, file) != -1) {
+        if (sscanf(line, "%7s %u %u %lf", kind, &a, &b, &us) != 4 ||
+                a >= AXRTT_MAX_NODES || b >= AXRTT_MAX_NODES)
+            continue;
+        if (strcmp(kind, "pair") == 0) {
+            s->pairs[a][b].base_us = us;
+        } else if (strcmp(kind, "link") == 0) {
+            link = axrtt_link(s, a, b, 0);
+            if (link != NULL)
+                link->base_us = us;
+        }
+    }
+
+    free(line);
+    fclose(file);
+    return 0;
+}
+
+static void
+axrtt_print(axrtt_status_t *s, int tolerance, FILE *out)
+{
+    axrtt_pair_t *pair;
+    int src, dst, i, outliers = 0;
+    double us;
+
+    printf("RTT matrix - median [us] (rows: source, columns: destination)\n");
+    printf("%6s", "");
+    for (dst = 0; dst < AXRTT_MAX_NODES; dst++) {
+        if (axrtt_is_node(s, dst))
+            printf(" %9d", dst);
+    }
+    printf("\n");
+
+    for (src = 0; src < AXRTT_MAX_NODES; src++) {
+        if (!axrtt_is_node(s, src))
+            continue;
+        printf("%6d", src);
+        for (dst = 0; dst < AXRTT_MAX_NODES; dst++) {
+            if (!axrtt_is_node(s, dst))
+                continue;
+            pair = &s->pairs[src][dst];
+            if (src == dst) {
+                printf(" %9s", "-");
+            } else if (!pair->done || pair->count == 0) {
+                printf(" %9s", "lost");
+                outliers++;
+            } else {
+                us = pair->p50_ns / 1000.0;
+                if (axrtt_is_outlier(us, pair->base_us, tolerance))
+                    outliers++;
+                printf(" %8.1f%c", us,
+                        axrtt_is_outlier(us, pair->base_us, tolerance) ?
+                        '*' : ' ');
+                if (out)
+                    fprintf(out, "pair %d %d %.3f\n", src, dst, us);
+            }
+        }
+        printf("\n");
+    }
+
+    printf("\nPairs with losses or a path not traced:\n");
+    for (src = 0; src < AXRTT_MAX_NODES; src++) {
+        for (dst = 0; dst < AXRTT_MAX_NODES; dst++) {
+            pair = &s->pairs[src][dst];
+            if (src == dst || !axrtt_is_node(s, src) || !axrtt_is_node(s, dst))
+                continue;
+            if ((pair->done && pair->count < (uint32_t)s->count) ||
+                    pair->hops == 0 || pair->hops_seen < pair->hops) {
+                printf("  %d -> %d: %u/%d replies, %s\n", src, dst,
+                        pair->count, s->count, (pair->hops &&
+                            pair->hops_seen >= pair->hops) ?
+                        "path traced" : "path unknown");
+            }
+        }
+    }
+
+    printf("\nInferred link latency (one way, endpoint overhead %.1f us):\n",
+            s->overhead_us);
+    printf("%6s %6s %8s %12s %12s\n", "node", "node", "paths", "latency[us]",
+            "baseline[us]");
+    for (i = 0; i < s->num_links; i++) {
+        axrtt_link_t *link = &s->links[i];
+        int outlier = axrtt_is_outlier(link->lat_us, link->base_us, tolerance);
+
+        if (outlier)
+            outliers++;
+        printf("%6u %6u %8d %12.2f %12.2f%s\n", link->a, link->b, link->paths,
+                link->lat_us, link->base_us, outlier ? " OUTLIER" : "");
+        if (out)
+            fprintf(out, "link %u %u %.3f\n", link->a, link->b, link->lat_us);
+    }
+
+    printf("\n%d outliers (pairs marked with '*' and links slower than "
+            "baseline + %d%%, lost pairs)\n", outliers, tolerance);
+}
+
+int
+main(int argc, char **argv)
+{
+    axrtt_status_t *s = &status;
+    axiom_args_t axiom_args;
+    axiom_err_t err;
+    char *baseline = NULL, *output = NULL;
+    double timeout = 1;
+    int tolerance = AXRTT_DEF_TOLERANCE, ret = -1;
+    uint64_t deadline;
+    FILE *out = NULL;
+
+    int long_index = 0;
+    int opt = 0;
+    static struct option long_options[] = {
+        {"count", required_argument, 0, 'c'},
+        {"timeout", required_argument, 0, 'W'},
+        {"baseline", required_argument, 0, 'b'},
+        {"tolerance", required_argument, 0, 't'},
+        {"output", required_argument, 0, 'o'},
+        {"verbose", no_argument, 0, 'v'},
+        {"version", no_argument, 0, 'V'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    s->count = AXRTT_DEF_COUNT;
+
+    while ((opt = getopt_long(argc, argv, "vhc:W:b:t:o:V",
+                         long_options, &long_index)) != -1) {
+        switch (opt) {
+            case 'c':
+                if (sscanf(optarg, "%d", &s->count) != 1 || s->count < 1 ||
+                        s->count > UINT16_MAX) {
+                    EPRINTF("wrong count");
+                    usage();
+                    exit(-1);
+                }
+                break;
+
+            case 'W':
+                if (sscanf(optarg, "%lf", &timeout) != 1 || timeout <= 0) {
+                    EPRINTF("wrong timeout");
+                    usage();
+                    exit(-1);
+                }
+                break;
+
+            case 'b':
+                baseline = optarg;
+                break;
+
+            case 't':
+                if (sscanf(optarg, "%d", &tolerance) != 1 || tolerance < 0) {
+                    EPRINTF("wrong tolerance");
+                    usage();
+                    exit(-1);
+                }
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            case 'v':
+                verbose = 1;
+                break;
+
+            case 'V':
+                printf("Version: %s\n", AXIOM_API_VERSION_STR);
+                exit(0);
+
+            case 'h':
+            default:
+                usage();
+                exit(-1);
+        }
+    }
+
+    s->nodes = axrun_get_nodes();
+    if (s->nodes == 0 || axrun_get_num_nodes() < 2) {
+        EPRINTF("You must run axiom-rttmap through axiom-run on 2 or more nodes");
+        exit(-1);
+    }
+    s->master_id = __builtin_ctzll(s->nodes);
+    s->timeout_ns = timeout * 1e9;
+
+    /* all the phases poll the device */
+    axiom_args.flags = AXIOM_FLAG_NOBLOCK;
+    s->dev = axiom_open(&axiom_args);
+    if (s->dev == NULL) {
+        perror("axiom_open()");
+        exit(-1);
+    }
+    s->local_id = axiom_get_node_id(s->dev);
+
+    /* the pongs and the traceroute replies are sent to this port */
+    err = axiom_bind(s->dev, AXIOM_RAW_PORT_NETUTILS);
+    if (err != AXIOM_RAW_PORT_NETUTILS) {
+        EPRINTF("axiom_bind error");
+        goto err;
+    }
+
+    s->samples = calloc((size_t)AXRTT_MAX_NODES * s->count, sizeof(uint64_t));
+    if (s->samples == NULL) {
+        EPRINTF("samples allocation failed");
+        goto err;
+    }
+    srand(time(NULL) ^ s->local_id);
+    s->unique_id = rand();
+
+    if (axrun_sync(AXRTT_BARRIER_START, verbose)) {
+        EPRINTF("axrun_sync error");
+        goto err;
+    }
+    if (axrtt_trace(s))
+        goto err;
+
+    if (axrun_sync(AXRTT_BARRIER_PING, verbose)) {
+        EPRINTF("axrun_sync error");
+        goto err;
+    }
+    if (axrtt_ping(s))
+        goto err;
+
+    /* the late replies of the other nodes are over */
+    if (axrun_sync(AXRTT_BARRIER_REPORT, verbose)) {
+        EPRINTF("axrun_sync error");
+        goto err;
+    }
+    axrtt_report(s);
+
+    ret = 0;
+    if (s->local_id != s->master_id)
+        goto err;
+
+    deadline = axrtt_now() + AXRTT_REPORT_TIMEOUT * 1000000000ULL;
+    while (axrtt_reports_pending(s) > 0 && axrtt_now() < deadline) {
+        if (axrtt_recv(s) == 0)
+            sched_yield();
+    }
+
+    axrtt_fit_links(s);
+    if (baseline && axrtt_load_baseline(s, baseline)) {
+        ret = -1;
+        goto err;
+    }
+    if (output) {
+        out = fopen(output, "w");
+        if (out == NULL) {
+            EPRINTF("unable to open %s", output);
+        }
+    }
+    axrtt_print(s, tolerance, out);
+    if (out)
+        fclose(out);
+
+err:
+    free(s->samples);
+    free(s->links);
+    axiom_close(s->dev);
+
+    return ret;
+}
@@ -19,6 +19,7 @@
 #include <regex.h>
 
 #include "axiom-run.h"
+#include "axiom_counters.h"
 
 /** Table to convert command code to command name. */
 char *cmd_to_name[] = {"CMD_EXIT", "CMD_KILL", "CMD_SEND_TO_STDOUT", "CMD_SEND_TO_STDERR", "CMD_RECV_FROM_STDIN", "CMD_BARRIER", "CMD_RPC", "CMD_START"};
@@ -322,6 +323,28 @@ void restore_signals_and_set_quit_handler(sigset_t *oldset, void (*myhandler)(in
     }
 }
 
+/* termination request of a service thread */
+static void end_request(reactor_t *r, int fd, uint32_t events, void *arg) {
+    eventfd_t value;
+    eventfd_read(fd, &value); // not really needed
+    zlogmsg(LOG_DEBUG, LOGZ_SLAVE, "%s: received termination request", (char *) arg);
+    reactor_stop(r);
+}
+
+/* see axiom-run.h */
+reactor_t *thread_reactor(int endfd, char *logheader) {
+    reactor_t *r = reactor_create();
+    if (r == NULL) {
+        elogmsg("reactor_create()");
+        exit(EXIT_FAILURE);
+    }
+    if (endfd != -1 && reactor_add_fd(r, endfd, EPOLLIN, 0, end_request, logheader) != 0) {
+        elogmsg("reactor_add_fd()");
+        exit(EXIT_FAILURE);
+    }
+    return r;
+}
+
 /* see axiom-run.h */
 void terminate_thread(pthread_t th, int endfd, char *logheader) {
     int res;
@@ -943,6 +966,9 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
+    /* counters of the master/slave threads, read by axiom-stat */
+    axstat_init(slave ? "axiom-run-slave" : "axiom-run");
+
     //
     // open/bind axiom device
     //
@@ -1113,8 +1139,12 @@ int main(int argc, char **argv) {
         // wait initiali barrier synchronization prior to run child....
         wait_on_barrier(dev, magic);
         
-        // fork/exec the child...
+        // fork/exec the child (the cpus and memory nodes are inherited)...
+        if (sch_setplacement("child") != 0) {
+            zlogmsg(LOG_ERROR, LOGZ_MAIN, "can't set the placement of the child process");
+        }
         pid = daemonize(NULL, myexec, myargv, sl_get(&env), (services & REDIRECT_SERVICE) ? fd : NULL, 0, 1, &sync);
+        sch_setplacement("main");
         
         // release resources...
         if (rungdb) {
@@ -1151,7 +1181,7 @@ int main(int argc, char **argv) {
             //
             strlist_t list;
             char **args = argv + optind;
-            char buf[64];
+            char buf[320];
             if (magic==0)
                 magic=time(NULL);
 
@@ -29,6 +29,7 @@ extern "C" {
 #include "axiom_nic_init.h"
 #include "axiom_init_api.h"
 #include "axiom_common.h"
+#include "axiom_reactor.h"
 #include "axiom_run_api.h"
 #include "axiom_allocator_protocol.h"
 #include "axiom_allocator_l2.h"
@@ -115,6 +116,15 @@ extern "C" {
      */
 #define terminate_thread_master(th, endfd) terminate_thread(th, endfd, "MASTER");
 
+    /**
+     * Create the event loop of a service thread.
+     * The termination request of terminate_thread() (on endfd) stops it.
+     * @param endfd the eventfd of the termination request
+     * @param logheader a header to prefix all message log (can't be null)
+     * @return the reactor (exit on failure)
+     */
+    reactor_t *thread_reactor(int endfd, char *logheader);
+
     /* service bitwise */
 
     /** barrier service*/
@@ -175,6 +185,122 @@ extern "C" {
     /** port number of the slave */
     extern int slave_port;
 
+    /* command dispatch */
+
+    /** number of entries of a dispatch table (one for every command byte) */
+#define DISPATCH_NUM_CMDS 256
+    /** one message every DISPATCH_SAMPLE (power of two) has its latency recorded */
+#define DISPATCH_SAMPLE 16
+    /** dispatch_message() result: wait the next message */
+#define DISPATCH_CONTINUE 0
+    /** dispatch_message() result: end of the receiver loop */
+#define DISPATCH_STOP 1
+
+    /**
+     * Handler of a command.
+     * @param ctx the context of dispatch_message()
+     * @param node the source node
+     * @param size the size of the message (header included)
+     * @param buffer the message
+     * @return DISPATCH_CONTINUE or DISPATCH_STOP
+     */
+    typedef int (*dispatch_handler_t)(void *ctx, axiom_node_id_t node, axiom_raw_payload_size_t size, buffer_t *buffer);
+
+    /**
+     * Entry of a dispatch table.
+     */
+    typedef struct {
+        /** handler (NULL if the command is unknown) */
+        dispatch_handler_t handler;
+        /** services required by the command (0 always served) */
+        int services;
+        /** name of the command (for the log messages) */
+        const char *name;
+        /** messages counter id */
+        int stat_msgs;
+        /** latency histogram id */
+        int stat_latency;
+        /** messages received (for the latency sampling) */
+        unsigned count;
+    } dispatch_entry_t;
+
+    /**
+     * Dispatch table of a receiver thread, indexed by command byte.
+     */
+    typedef struct {
+        /** the entries */
+        dispatch_entry_t cmd[DISPATCH_NUM_CMDS];
+        /** enabled services (can change while running) */
+        int *services;
+        /** prefix of the metric names */
+        const char *name;
+        /** header of the log messages */
+        const char *logheader;
+        /** zone of the log messages */
+        int logzone;
+        /** unknown commands counter id */
+        int stat_unknown;
+        /** not served commands counter id */
+        int stat_unserved;
+    } dispatch_table_t;
+
+    /**
+     * Initialize an empty dispatch table.
+     * @param t the table
+     * @param name prefix of the metric names (i.e. "master")
+     * @param logheader a header to prefix all message log (can't be null)
+     * @param logzone zone of the log messages
+     * @param services the enabled services
+     */
+    void dispatch_init(dispatch_table_t *t, const char *name, const char *logheader, int logzone, int *services);
+
+    /**
+     * Register the handler of a command.
+     * A command registered again replaces the previous handler.
+     * @param t the table
+     * @param cmd the command
+     * @param name the command name (metrics NAME.name and NAME.name.lat)
+     * @param services the services required (0 always served)
+     * @param handler the handler
+     */
+    void dispatch_register(dispatch_table_t *t, uint8_t cmd, const char *name, int services, dispatch_handler_t handler);
+
+    /**
+     * Call the handler of a message.
+     * @param t the table
+     * @param ctx the context for the handler
+     * @param node the source node
+     * @param size the size of the message
+     * @param buffer the message
+     * @return the result of the handler (DISPATCH_CONTINUE for the not served
+     *         and unknown commands)
+     */
+    int dispatch_message(dispatch_table_t *t, void *ctx, axiom_node_id_t node, axiom_raw_payload_size_t size, buffer_t *buffer);
+
+    /* rpc */
+
+    /** number of RPC functions */
+#define RPC_NUM_FUNCTIONS 64
+
+    /**
+     * Handler of a RPC function (master side).
+     * @param dev axiom device
+     * @param src_node the node of the request
+     * @param size the size of the request (header included)
+     * @param inmsg the request (it is also the reply)
+     * @return 1 to send back inmsg to src_node, 0 otherwise
+     */
+    typedef int (*rpc_handler_t)(axiom_dev_t *dev, axiom_node_id_t src_node, size_t size, buffer_t *inmsg);
+
+    /**
+     * Register a RPC function (user defined collective services).
+     * The applications call it with axrun_rpc().
+     * @param function the function number (< RPC_NUM_FUNCTIONS)
+     * @param handler the handler
+     * @return 0 on success, -1 if function is out of range
+     */
+    int rpc_register(uint32_t function, rpc_handler_t handler);
+
     int rpc_init(axiom_app_id_t app_id);
     int rpc_service(axiom_dev_t *dev, axiom_node_id_t src_node, size_t size, buffer_t *inmsg);
     void rpc_release(axiom_dev_t *dev);
@@ -0,0 +1,85 @@
+/*!
+ * \file dispatch.c
+ *
+ * \version     v1.2
+ *
+ * Command dispatch tables of the axiom-run receiver threads.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "axiom-run.h"
+
+#include "axiom_common.h"
+#include "axiom_counters.h"
+
+/* see axiom-run.h */
+void dispatch_init(dispatch_table_t *t, const char *name, const char *logheader, int logzone, int *services) {
+    char buf[AXSTAT_NAME_SIZE];
+
+    memset(t->cmd, 0, sizeof (t->cmd));
+    t->services = services;
+    t->name = name;
+    t->logheader = logheader;
+    t->logzone = logzone;
+    snprintf(buf, sizeof (buf), "%s.unknown", name);
+    t->stat_unknown = axstat_counter(buf);
+    snprintf(buf, sizeof (buf), "%s.unserved", name);
+    t->stat_unserved = axstat_counter(buf);
+}
+
+/* see axiom-run.h */
+void dispatch_register(dispatch_table_t *t, uint8_t cmd, const char *name, int services, dispatch_handler_t handler) {
+    dispatch_entry_t *e = &t->cmd[cmd];
+    char buf[AXSTAT_NAME_SIZE];
+
+    e->handler = handler;
+    e->services = services;
+    e->name = name;
+    e->count = 0;
+    snprintf(buf, sizeof (buf), "%s.%s", t->name, name);
+    e->stat_msgs = axstat_counter(buf);
+    snprintf(buf, sizeof (buf), "%s.%s.lat", t->name, name);
+    e->stat_latency = axstat_histogram(buf);
+    zlogmsg(LOG_DEBUG, t->logzone, "%s: command 0x%02x '%s' registered (services=0x%02x)", t->logheader, cmd, name, services);
+}
+
+/* see axiom-run.h */
+int dispatch_message(dispatch_table_t *t, void *ctx, axiom_node_id_t node, axiom_raw_payload_size_t size, buffer_t *buffer) {
+    dispatch_entry_t *e = &t->cmd[buffer->header.command];
+
+    if (unlikely(e->handler == NULL)) {
+        zlogmsg(LOG_WARN, t->logzone, "%s: unknown message command 0x%02x from node %d", t->logheader, buffer->header.command, node);
+        axstat_add(t->stat_unknown, 1);
+        return DISPATCH_CONTINUE;
+    }
+    if (logmsg_is_zenabled(LOG_TRACE, t->logzone)) {
+        if (buffer->header.command == CMD_RPC) {
+            zlogmsg(LOG_TRACE, t->logzone, "%s: received %d bytes command 0x%02x '%s' function 0x%02x '%s'",
+                    t->logheader, size, buffer->header.command, e->name, buffer->header.rpc.function, RPCFUNC_TO_NAME(buffer->header.rpc.function));
+        } else {
+            zlogmsg(LOG_TRACE, t->logzone, "%s: received %d bytes command 0x%02x '%s'",
+                    t->logheader, size, buffer->header.command, e->name);
+        }
+    }
+    axstat_add(e->stat_msgs, 1);
+    if (e->services != 0 && !(*t->services & e->services)) {
+        zlogmsg(LOG_WARN, t->logzone, "%s: received not served '%s' message from node %d", t->logheader, e->name, node);
+        axstat_add(t->stat_unserved, 1);
+        return DISPATCH_CONTINUE;
+    }
+
+#ifndef NSTAT
+    /* the clock is read only for the sampled messages */
+    if (e->stat_latency >= 0 && (e->count++ & (DISPATCH_SAMPLE - 1)) == 0) {
+        uint64_t start = axstat_now();
+        int res = e->handler(ctx, node, size, buffer);
+        axstat_record(e->stat_latency, axstat_now() - start);
+        return res;
+    }
+#endif
+    return e->handler(ctx, node, size, buffer);
+}
@@ -8,8 +8,8 @@
  * Copyright (C) 2016, Evidence Srl.
  * Terms of use are as specified in COPYING
  */
-#include <sys/select.h>
 #include <sys/eventfd.h>
+#include <poll.h>
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -24,6 +24,7 @@
 #include "axiom_nic_raw_commands.h"
 
 #include "axiom_common.h"
+#include "axiom_counters.h"
 
 /**
  * Some information for the threads.
@@ -232,6 +233,140 @@ static void emit(axiom_node_id_t node, uint8_t *buffer, int size, output_info_t
 
 static int exit_status=0;
 
+/**
+ * State of master_receiver() (the context of its command handlers).
+ */
+typedef struct {
+    /** thread information */
+    thread_info_t *info;
+    /** pending stdout of the nodes */
+    output_info_t *infoout;
+    /** pending stderr of the nodes */
+    output_info_t *infoerr;
+    /** barriers */
+    barrier_info_t *barrier;
+    /** number of nodes not yet exited */
+    int exit_counter;
+} receiver_t;
+
+/** CMD_SEND_TO_STDERR: redirect stderr service. */
+static int cmd_stderr(void *ctx, axiom_node_id_t node, axiom_raw_payload_size_t size, buffer_t *buffer) {
+    receiver_t *rcv = (receiver_t*) ctx;
+    emit(node, buffer->raw, size - sizeof (header_t), rcv->infoerr, stderr, rcv->info->flags);
+    return DISPATCH_CONTINUE;
+}
+
+/** CMD_SEND_TO_STDOUT: redirect stdout service. */
+static int cmd_stdout(void *ctx, axiom_node_id_t node, axiom_raw_payload_size_t size, buffer_t *buffer) {
+    receiver_t *rcv = (receiver_t*) ctx;
+    emit(node, buffer->raw, size - sizeof (header_t), rcv->infoout, stdout, rcv->info->flags);
+    return DISPATCH_CONTINUE;
+}
+
+/** CMD_EXIT: exit service/information (always served). */
+static int cmd_exit(void *ctx, axiom_node_id_t node, axiom_raw_payload_size_t size, buffer_t *buffer) {
+    receiver_t *rcv = (receiver_t*) ctx;
+    thread_info_t *info = rcv->info;
+
+    zlogmsg(LOG_INFO, LOGZ_MASTER, "MASTER: received EXIT message from %d with status 0x%08x", node, buffer->header.status);
+#if 1
+    if (logmsg_is_zenabled(LOG_DEBUG, LOGZ_MASTER)) {
+        logbufferstatus(rcv->infoout, MAX_NUM_NODES, "STDOUT");
+        logbufferstatus(rcv->infoerr, MAX_NUM_NODES, "STDERR");
+    }
+#endif
+    if (info->services & EXIT_SERVICE) {
+        exit_status=buffer->header.status;
+        zlogmsg(LOG_DEBUG, LOGZ_MASTER, "MASTER: send CMD_KILL to all");
+        buffer->header.command=CMD_KILL;
+        my_axiom_send_raw(info->dev, info->nodes, slave_port, sizeof (header_t), (axiom_raw_payload_t *) buffer);
+        info->services &= ~EXIT_SERVICE;
+    } else {
+        if (WIFEXITED(buffer->header.status)) {
+            if (WIFEXITED(exit_status)) {
+                // PREV normal RECV normal
+                switch (info->flags&EXIT_FLAG_MASK) {
+                    case FIRST_EXIT_FLAG:
+                    case FIRST_ABS_EXIT_FLAG:
+                        // nothing
+                        break;
+                    case LAST_EXIT_FLAG:
+                        exit_status=buffer->header.status;
+                        break;
+                    case GREATHER_EXIT_FLAG:
+                        if (WEXITSTATUS(buffer->header.status)>WEXITSTATUS(exit_status)) {
+                            exit_status=buffer->header.status;
+                        }
+                        break;
+                    case LESSER_EXIT_FLAG:
+                        if (WEXITSTATUS(buffer->header.status)<WEXITSTATUS(exit_status)) {
+                            exit_status=buffer->header.status;
+                        }
+                        break;
+                }
+            } else {
+                // PREV singnaled RECV normal
+                // nothing
+            }
+        } else {
+            if (WIFEXITED(exit_status)) {
+                // PREV normal RECV signaled
+                switch (info->flags&EXIT_FLAG_MASK) {
+                    case FIRST_ABS_EXIT_FLAG:
+                        // nothing
+                        break;
+                    default:
+                        exit_status=buffer->header.status;
+                    break;
+                }
+            } else {
+                // PREV singnaled RECV signaled
+                // nothing
+            }
+
+        }
+    }
+    if ((info->flags&EXIT_FLAG_MASK)==NOFAIL_EXIT_FLAG) exit_status=0;
+    rcv->exit_counter--;
+    zlogmsg(LOG_DEBUG, LOGZ_MASTER, "exit_counter now is %d", rcv->exit_counter);
+    if (rcv->exit_counter == 0) {
+        zlogmsg(LOG_DEBUG, LOGZ_MASTER, "MASTER: exit_counter reach zero... exiting...");
+        return DISPATCH_STOP;
+    }
+    return DISPATCH_CONTINUE;
+}
+
+/** CMD_BARRIER: barrier service. */
+static int cmd_barrier(void *ctx, axiom_node_id_t node, axiom_raw_payload_size_t size, buffer_t *buffer) {
+    receiver_t *rcv = (receiver_t*) ctx;
+    unsigned id = buffer->header.barrier.barrier_id;
+
+    zlogmsg(LOG_INFO, LOGZ_MASTER, "MASTER: received BARRIER message from %d (barrier=%d)", node, id);
+    if (id > AXRUN_MAX_BARRIER_ID) {
+        zlogmsg(LOG_WARN, LOGZ_MASTER, "MASTER: BARRIER message from node %d with id=%d out of bound", node, id);
+        return DISPATCH_CONTINUE;
+    }
+    if (rcv->barrier[id].counter == 0) {
+        rcv->barrier[id].counter = rcv->info->nnodes;
+    }
+    rcv->barrier[id].counter--;
+    if (rcv->barrier[id].counter == 0) {
+        // SEND SYNC TO SLAVES
+        zlogmsg(LOG_INFO, LOGZ_MASTER, "MASTER: sending BARRIER unlock to all slaves");
+        my_axiom_send_raw(rcv->info->dev, rcv->info->nodes, slave_port, sizeof (header_t), (axiom_raw_payload_t*) buffer);
+    }
+    return DISPATCH_CONTINUE;
+}
+
+/** CMD_RPC and AXIOM_CMD_ALLOC_REPLY: rpc service. */
+static int cmd_rpc(void *ctx, axiom_node_id_t node, axiom_raw_payload_size_t size, buffer_t *buffer) {
+    receiver_t *rcv = (receiver_t*) ctx;
+
+    zlogmsg(LOG_INFO, LOGZ_MASTER, "MASTER: received RPC message from %d (function=%d)", node, buffer->header.rpc.function);
+    rpc_service(rcv->info->dev, node, size, buffer);
+    return DISPATCH_CONTINUE;
+}
+
 /**
  * Thread that receive messaged from slaves.
  *
@@ -247,32 +382,49 @@ static void *master_receiver(void *data) {
     axiom_msg_id_t msg;
     axiom_raw_payload_size_t size;
     int i;
-    int exit_counter = info->nnodes;
-    output_info_t *infoout, *infoerr;
-    barrier_info_t *barrier;
+    receiver_t rcv;
+    dispatch_table_t *table;
+    int stat_msgs, stat_bytes, stat_errors, stat_dispatch;
 
-    if (sch_setsched()!=0) {
+    if (sch_setsched_role("receiver")!=0) {
         zlogmsg(LOG_ERROR, LOGZ_MASTER, "MASTER: can't set scheduling parameters (thread=%ld) on master_receiver()", (long) pthread_self());
     }
+    stat_msgs = axstat_counter("master.msgs");
+    stat_bytes = axstat_counter("master.bytes");
+    stat_errors = axstat_counter("master.recv_errors");
+    stat_dispatch = axstat_histogram("master.dispatch");
 
     //
     // initialization
     //
-    infoout = malloc(sizeof (output_info_t) * MAX_NUM_NODES);
-    lassert(infoout != NULL);
-    infoerr = malloc(sizeof (output_info_t) * MAX_NUM_NODES);
-    lassert(infoerr != NULL);
+    rcv.info = info;
+    rcv.exit_counter = info->nnodes;
+    rcv.infoout = malloc(sizeof (output_info_t) * MAX_NUM_NODES);
+    lassert(rcv.infoout != NULL);
+    rcv.infoerr = malloc(sizeof (output_info_t) * MAX_NUM_NODES);
+    lassert(rcv.infoerr != NULL);
     for (i = 0; i < MAX_NUM_NODES; i++) {
-        infoout[i].sz = 0;
-        infoout[i].buffer = malloc(MAX_BUFFER_SIZE);
-        lassert(infoout[i].buffer != NULL);
-        infoerr[i].sz = 0;
-        infoerr[i].buffer = malloc(MAX_BUFFER_SIZE);
-        lassert(infoerr[i].buffer != NULL);
+        rcv.infoout[i].sz = 0;
+        rcv.infoout[i].buffer = malloc(MAX_BUFFER_SIZE);
+        lassert(rcv.infoout[i].buffer != NULL);
+        rcv.infoerr[i].sz = 0;
+        rcv.infoerr[i].buffer = malloc(MAX_BUFFER_SIZE);
+        lassert(rcv.infoerr[i].buffer != NULL);
     }
-    barrier = malloc(sizeof (barrier_info_t)*(AXRUN_MAX_BARRIER_ID + 1));
-    lassert(barrier != NULL);
-    memset(barrier, 0, sizeof (barrier_info_t)*(AXRUN_MAX_BARRIER_ID + 1));
+    rcv.barrier = malloc(sizeof (barrier_info_t)*(AXRUN_MAX_BARRIER_ID + 1));
+    lassert(rcv.barrier != NULL);
+    memset(rcv.barrier, 0, sizeof (barrier_info_t)*(AXRUN_MAX_BARRIER_ID + 1));
+
+    /* the commands served */
+    table = malloc(sizeof (dispatch_table_t));
+    lassert(table != NULL);
+    dispatch_init(table, "master", "MASTER: RECV_THREAD", LOGZ_MASTER, &info->services);
+    dispatch_register(table, CMD_SEND_TO_STDERR, "stderr", REDIRECT_SERVICE, cmd_stderr);
+    dispatch_register(table, CMD_SEND_TO_STDOUT, "stdout", REDIRECT_SERVICE, cmd_stdout);
+    dispatch_register(table, CMD_EXIT, "exit", 0, cmd_exit);
+    dispatch_register(table, CMD_BARRIER, "barrier", BARRIER_SERVICE, cmd_barrier);
+    dispatch_register(table, CMD_RPC, "rpc", RPC_SERVICE, cmd_rpc);
+    dispatch_register(table, AXIOM_CMD_ALLOC_REPLY, "alloc_reply", RPC_SERVICE, cmd_rpc);
 
     /* init the RPC */
     if (rpc_init(info->app_id)) {
@@ -293,159 +445,76 @@ static void *master_receiver(void *data) {
         msg = axiom_recv_raw(info->dev, &node, &port, &type, &size, &buffer);
         if (!AXIOM_RET_IS_OK(msg)) {
             zlogmsg(LOG_WARN, LOGZ_MASTER, "MASTER: axiom_recv_raw() error %d", msg);
+            axstat_add(stat_errors, 1);
             continue;
         }
-       if (logmsg_is_zenabled(LOG_TRACE, LOGZ_MASTER)) {
-            if (buffer.header.command==CMD_RPC) {
-                zlogmsg(LOG_TRACE, LOGZ_MASTER, "MASTER: RECV_THREAD: received %d bytes command 0x%02x '%s' function 0x%02x '%s'",
-                        size, buffer.header.command, CMD_TO_NAME(buffer.header.command),buffer.header.rpc.function,RPCFUNC_TO_NAME(buffer.header.rpc.function));
-            } else {
-                zlogmsg(LOG_TRACE, LOGZ_MASTER, "MASTER: RECV_THREAD: received %d bytes command 0x%02x '%s'",
-                        size, buffer.header.command, CMD_TO_NAME(buffer.header.command));
-            }
-        }
-        if (buffer.header.command == CMD_SEND_TO_STDERR) {
-            //
-            // redirect stderr service...
-            //
-            if (info->services & REDIRECT_SERVICE) {
-                size -= sizeof (header_t);
-                emit(node, buffer.raw, size, infoerr, stderr, info->flags);
-            } else {
-                zlogmsg(LOG_WARN, LOGZ_MASTER, "MASTER: received not served CMD_SET_TO_STDOUT message from node %d", node);
-            }
-        } else if (buffer.header.command == CMD_SEND_TO_STDOUT) {
-            //
-            // redirect stdout service...
-            //
-            if (info->services & REDIRECT_SERVICE) {
-                size -= sizeof (header_t);
-                emit(node, buffer.raw, size, infoout, stdout, info->flags);
-            } else {
-                zlogmsg(LOG_WARN, LOGZ_MASTER, "MASTER: received not served CMD_SEND_TO_STDOUT message from node %d", node);
-            }
-        } else if (buffer.header.command == CMD_EXIT) {
-            //
-            // exit service/information...
-            //
-            zlogmsg(LOG_INFO, LOGZ_MASTER, "MASTER: received EXIT message from %d with status 0x%08x", node, buffer.header.status);
-#if 1
-            if (logmsg_is_zenabled(LOG_DEBUG, LOGZ_MASTER)) {
-                logbufferstatus(infoout, MAX_NUM_NODES, "STDOUT");
-                logbufferstatus(infoerr, MAX_NUM_NODES, "STDERR");
-            }
-#endif
-            if (info->services & EXIT_SERVICE) {
-                exit_status=buffer.header.status;
-                zlogmsg(LOG_DEBUG, LOGZ_MASTER, "MASTER: send CMD_KILL to all");
-                buffer.header.command=CMD_KILL;
-                my_axiom_send_raw(info->dev, info->nodes, slave_port, sizeof (header_t), (axiom_raw_payload_t *) & buffer);
-                info->services &= ~EXIT_SERVICE;
-            } else {
-                if (WIFEXITED(buffer.header.status)) {
-                    if (WIFEXITED(exit_status)) {
-                        // PREV normal RECV normal
-                        switch (info->flags&EXIT_FLAG_MASK) {
-                            case FIRST_EXIT_FLAG:
-                            case FIRST_ABS_EXIT_FLAG:
-                                // nothing
-                                break;
-                            case LAST_EXIT_FLAG:
-                                exit_status=buffer.header.status;
-                                break;
-                            case GREATHER_EXIT_FLAG:
-                                if (WEXITSTATUS(buffer.header.status)>WEXITSTATUS(exit_status)) {
-                                    exit_status=buffer.header.status;
-                                }
-                                break;
-                            case LESSER_EXIT_FLAG:
-                                if (WEXITSTATUS(buffer.header.status)<WEXITSTATUS(exit_status)) {
-                                    exit_status=buffer.header.status;
-                                }
-                                break;
-                        }
-                    } else {
-                        // PREV singnaled RECV normal
-                        // nothing
-                    }
-                } else {
-                    if (WIFEXITED(exit_status)) {
-                        // PREV normal RECV signaled
-                        switch (info->flags&EXIT_FLAG_MASK) {
-                            case FIRST_ABS_EXIT_FLAG:
-                                // nothing
-                                break;
-                            default:
-                                exit_status=buffer.header.status;
-                            break;
-                        }
-                    } else {
-                        // PREV singnaled RECV signaled
-                        // nothing
-                    }
-                    
-                }
-            }
-            if ((info->flags&EXIT_FLAG_MASK)==NOFAIL_EXIT_FLAG) exit_status=0;
-            exit_counter--;
-            zlogmsg(LOG_DEBUG, LOGZ_MASTER, "exit_counter now is %d", exit_counter);
-            if (exit_counter == 0) {
-                zlogmsg(LOG_DEBUG, LOGZ_MASTER, "MASTER: exit_counter reach zero... exiting...");
-                break;
-            }
-        } else if (buffer.header.command == CMD_BARRIER) {
-            //
-            // barrier service...
-            //
-            zlogmsg(LOG_INFO, LOGZ_MASTER, "MASTER: received BARRIER message from %d (barrier=%d)", node,(unsigned)buffer.header.barrier.barrier_id);
-            if (info->services & BARRIER_SERVICE) {
-                if (buffer.header.barrier.barrier_id <= AXRUN_MAX_BARRIER_ID) {
-                    unsigned id = buffer.header.barrier.barrier_id;
-                    if (barrier[id].counter == 0) {
-                        barrier[id].counter = info->nnodes;
-                    }
-                    barrier[id].counter--;
-                    if (barrier[id].counter == 0) {
-                        // SEND SYNC TO SLAVES
-                        zlogmsg(LOG_INFO, LOGZ_MASTER, "MASTER: sending BARRIER unlock to all slaves");
-                        my_axiom_send_raw(info->dev, info->nodes, slave_port, sizeof (header_t), (axiom_raw_payload_t*) & buffer);
-                    }
-                } else {
-                    zlogmsg(LOG_WARN, LOGZ_MASTER, "MASTER: BARRIER message from node %d with id=%d out of bound", node, buffer.header.barrier.barrier_id);
-                }
-            } else {
-                zlogmsg(LOG_WARN, LOGZ_MASTER, "MASTER: received not served BARRIER message from node %d", node);
-            }
-        } else if (buffer.header.command == CMD_RPC || buffer.header.command == AXIOM_CMD_ALLOC_REPLY) {
-            //
-            // rpc service...
-            //
-            zlogmsg(LOG_INFO, LOGZ_MASTER, "MASTER: received RPC message from %d (function=%d)", node,buffer.header.rpc.function);
-            if (info->services & RPC_SERVICE) {
-                rpc_service(info->dev, node, size, &buffer);
-            } else {
-                zlogmsg(LOG_WARN, LOGZ_MASTER, "MASTER: received not served RPC message from node %d", node);
-            }
-        } else {
-            zlogmsg(LOG_ERROR, LOGZ_MASTER, "unknown message command 0x%02x", buffer.header.command);
-        }
+        axstat_add(stat_msgs, 1);
+        axstat_add(stat_bytes, size);
+        /* time to the end of this iteration */
+        AXSTAT_SCOPE(stat_dispatch);
+        if (dispatch_message(table, &rcv, node, size, &buffer) == DISPATCH_STOP) break;
     }
-    flush(infoout, MAX_NUM_NODES, stdout, info->flags);
-    flush(infoerr, MAX_NUM_NODES, stderr, info->flags);
+    flush(rcv.infoout, MAX_NUM_NODES, stdout, info->flags);
+    flush(rcv.infoerr, MAX_NUM_NODES, stderr, info->flags);
     zlogmsg(LOG_INFO, LOGZ_MASTER, "MASTER: exiting receiver thread");
 
     // release resources
-    free(barrier);
+    free(table);
+    free(rcv.barrier);
     for (i = 0; i < MAX_NUM_NODES; i++) {
-        free(infoout[i].buffer);
-        free(infoerr[i].buffer);
+        free(rcv.infoout[i].buffer);
+        free(rcv.infoerr[i].buffer);
     }
-    free(infoout);
-    free(infoerr);
+    free(rcv.infoout);
+    free(rcv.infoerr);
 
     return NULL;
 }
 
+/**
+ * Read stdin and send this data to all slaves.
+ *
+ * @param info information required
+ * @return the size read (0 on end of file, -1 on error)
+ */
+static ssize_t send_stdin(thread_info_t *info) {
+    buffer_t buffer;
+    ssize_t sz;
+
+    do {
+        sz = read(STDIN_FILENO, buffer.raw, sizeof (buffer.raw));
+    } while (sz == -1 && errno == EINTR);
+    if (sz == -1) {
+        zlogmsg(LOG_WARN, LOGZ_MASTER, "MASTER: read() failure (errno=%d '%s')", errno, strerror(errno));
+        return -1;
+    }
+    zlogmsg(LOG_TRACE, LOGZ_MASTER, "MASTER: SEND_THREAD: read() %d bytes for STDIN", (int)sz);
+    if (sz > 0) {
+        buffer.header.command = CMD_RECV_FROM_STDIN;
+        my_axiom_send_raw(info->dev, info->nodes, slave_port, sz + sizeof (header_t), (axiom_raw_payload_t *) & buffer);
+    }
+    return sz;
+}
+
+/**
+ * Stdin is ready.
+ * Called by the reactor of master_sender().
+ *
+ * @param r the reactor
+ * @param fd the stdin
+ * @param events don't care
+ * @param arg information required
+ */
+static void stdin_ready(reactor_t *r, int fd, uint32_t events, void *arg) {
+    ssize_t sz = send_stdin((thread_info_t*) arg);
+    if (sz == -1) {
+        reactor_stop(r);
+    } else if (sz == 0) {
+        // end of file: wait only the termination request
+        reactor_del_fd(r, fd);
+    }
+}
+
 /**
  * Thread that receive stdin data.
  *
@@ -454,50 +523,36 @@ static void *master_receiver(void *data) {
  */
 static void *master_sender(void *data) {
     thread_info_t *info = (thread_info_t*) data;
-    buffer_t buffer;
-    size_t sz;
-    fd_set set;
-    int res;
+    reactor_t *r;
 
     //
     // read stdin and send this data to all slaves...
     //
 
     zlogmsg(LOG_INFO, LOGZ_MASTER, "MASTER: entering redirect loop for STDIN (thread=%ld)", (long) pthread_self());
-    if (sch_setsched()!=0) {
+    if (sch_setsched_role("sender")!=0) {
         zlogmsg(LOG_ERROR, LOGZ_MASTER, "MASTER: can't set scheduling parameters (thread=%ld) on master_sender()", (long) pthread_self());
     }
-    buffer.header.command = CMD_RECV_FROM_STDIN;
+    r = thread_reactor(info->endfd, "MASTER: redirect loop for STDIN");
     //
     // main loop
     // forever...
-    for (;;) {
-        FD_ZERO(&set);
-        FD_SET(STDIN_FILENO,&set);
-        FD_SET(info->endfd,&set);
-        res=select(info->endfd+1,&set,NULL,NULL,NULL);
-        if (res==-1) {
-            if (errno == EINTR) continue; // paranoia
-            elogmsg("select() on master_sender thread");
-            break;
-        }
-        if (FD_ISSET(info->endfd,&set)) {
-            eventfd_t value;
-            eventfd_read(info->endfd,&value); // not really needed
-            zlogmsg(LOG_DEBUG, LOGZ_MASTER, "MASTER: redirect loop for STDIN received termination request");
-            break;
-        }
-        sz = read(STDIN_FILENO, buffer.raw, sizeof (buffer.raw));
-        if (sz == -1) {
-            if (errno == EINTR) continue;
-            zlogmsg(LOG_WARN, LOGZ_MASTER, "MASTER: read() failure (errno=%d '%s')", errno, strerror(errno));
-            break;
-        }
-        zlogmsg(LOG_TRACE, LOGZ_MASTER, "MASTER: SEND_THREAD: read() %d bytes for STDIN", (int)sz);
-        if (sz > 0) {
-            my_axiom_send_raw(info->dev, info->nodes, slave_port, sz + sizeof (header_t), (axiom_raw_payload_t *) & buffer);
+    if (reactor_add_fd(r, STDIN_FILENO, EPOLLIN, 0, stdin_ready, info) != 0) {
+        if (errno == EPERM) {
+            // a regular file or /dev/null is always ready (and epoll does not support it)
+            struct pollfd end = {.fd = info->endfd, .events = POLLIN};
+            // ... but the termination request is checked between the reads
+            while (poll(&end, 1, 0) == 0 && send_stdin(info) > 0);
+            if (end.revents) {
+                zlogmsg(LOG_DEBUG, LOGZ_MASTER, "MASTER: redirect loop for STDIN: received termination request");
+            }
+        } else {
+            elogmsg("reactor_add_fd() on master_sender thread");
         }
+    } else if (reactor_run(r) != 0) {
+        elogmsg("reactor_run() on master_sender thread");
     }
+    reactor_destroy(r);
     zlogmsg(LOG_INFO, LOGZ_MASTER, "MASTER: exiting redirect loop for STDIN");
     return NULL;
 }
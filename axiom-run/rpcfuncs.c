@@ -27,14 +27,6 @@ static rpc_reply_t rpc_reply;
 
 extern axiom_err_t my_axiom_send_raw(axiom_dev_t *dev, axiom_port_t port, axiom_raw_payload_size_t size, axiom_raw_payload_t *payload);
 
-int rpc_init(axiom_app_id_t app_id) {
-    return axiom_al2_init(app_id);
-}
-
-void rpc_release(axiom_dev_t *dev) {
-    axiom_al2_release(dev);
-}
-
 void rpc_postpone_reply(axiom_node_id_t reply_node, axiom_port_t reply_port,
         header_t reply_hdr)
 {
@@ -43,6 +35,55 @@ void rpc_postpone_reply(axiom_node_id_t reply_node, axiom_port_t reply_port,
     rpc_reply.reply_hdr = reply_hdr;
 }
 
+/* handlers of the RPC functions (indexed by function number) */
+static rpc_handler_t rpc_handlers[RPC_NUM_FUNCTIONS];
+
+int rpc_register(uint32_t function, rpc_handler_t handler) {
+    if (function >= RPC_NUM_FUNCTIONS) {
+        zlogmsg(LOG_ERROR, LOGZ_MASTER, "MASTER: RPC function 0x%02x out of range", function);
+        return -1;
+    }
+    rpc_handlers[function] = handler;
+    return 0;
+}
+
+/* RPC: ping request (replay the same message) */
+static int rpc_ping(axiom_dev_t *dev, axiom_node_id_t src_node, size_t size, buffer_t *inmsg) {
+    return 1;
+}
+
+/* RPC: allocation of the application memory (by the master init) */
+static int rpc_alloc(axiom_dev_t *dev, axiom_node_id_t src_node, size_t size, buffer_t *inmsg) {
+    int reply = axiom_al2_alloc(dev, master_port, size - sizeof(inmsg->header), &inmsg->raw);
+    if (!reply) {
+        /* postpone reply to slave, because we are waiting the reply from MASTER INIT */
+        rpc_postpone_reply(src_node, slave_port, inmsg->header);
+    }
+    return reply;
+}
+
+/* RPC: regions of the application */
+static int rpc_get_regions(axiom_dev_t *dev, axiom_node_id_t src_node, size_t size, buffer_t *inmsg) {
+    return axiom_al2_get_regions(dev, src_node, size - sizeof(inmsg->header), &inmsg->raw);
+}
+
+/* RPC: allocation of a shared block */
+static int rpc_alloc_shblock(axiom_dev_t *dev, axiom_node_id_t src_node, size_t size, buffer_t *inmsg) {
+    return axiom_al2_alloc_shblock(dev, src_node, size - sizeof(inmsg->header), &inmsg->raw);
+}
+
+int rpc_init(axiom_app_id_t app_id) {
+    rpc_register(AXRUN_RPC_PING, rpc_ping);
+    rpc_register(AXRUN_RPC_ALLOC, rpc_alloc);
+    rpc_register(AXRUN_RPC_GET_REGIONS, rpc_get_regions);
+    rpc_register(AXRUN_RPC_ALLOC_SHBLOCK, rpc_alloc_shblock);
+    return axiom_al2_init(app_id);
+}
+
+void rpc_release(axiom_dev_t *dev) {
+    axiom_al2_release(dev);
+}
+
 int rpc_send_reply(axiom_dev_t *dev, size_t size, void *buffer)
 {
     struct iovec send_iov[2];
@@ -67,6 +108,7 @@ int rpc_send_reply(axiom_dev_t *dev, size_t size, void *buffer)
 
 int rpc_service(axiom_dev_t *dev, axiom_node_id_t src_node, size_t size, buffer_t *inmsg) {
     axiom_err_t err;
+    uint32_t function;
     int reply = 0;
 
     /*
@@ -86,32 +128,13 @@ int rpc_service(axiom_dev_t *dev, axiom_node_id_t src_node, size_t size, buffer_
         return 0;
     }
 
-    switch (inmsg->header.rpc.function) {
-        case AXRUN_RPC_PING:
-            //
-            // RPC: ping request
-            //
-            // replay the same message to all slave
-            reply = 1;
-            break;
-        case AXRUN_RPC_ALLOC:
-            reply = axiom_al2_alloc(dev, master_port, size - sizeof(inmsg->header), &inmsg->raw);
-            if (!reply) {
-                /* postpone reply to slave, because we are waiting the reply from MASTER INIT */
-                rpc_postpone_reply(src_node, slave_port, inmsg->header);
-            }
-            break;
-        case AXRUN_RPC_GET_REGIONS:
-            reply = axiom_al2_get_regions(dev, src_node, size - sizeof(inmsg->header), &inmsg->raw);
-            break;
-        case AXRUN_RPC_ALLOC_SHBLOCK:
-            reply = axiom_al2_alloc_shblock(dev, src_node, size - sizeof(inmsg->header), &inmsg->raw);
-            break;
-        default:
-            zlogmsg(LOG_ERROR, LOGZ_MASTER, "MASTER: unknow CMD_RPC from node "
-                    "%d function 0x%02x", src_node, inmsg->header.rpc.function);
-            return -1;
+    function = inmsg->header.rpc.function;
+    if (function >= RPC_NUM_FUNCTIONS || rpc_handlers[function] == NULL) {
+        zlogmsg(LOG_ERROR, LOGZ_MASTER, "MASTER: unknow CMD_RPC from node "
+                "%d function 0x%02x", src_node, function);
+        return -1;
     }
+    reply = rpc_handlers[function](dev, src_node, size, inmsg);
 
     if (reply) {
         err = axiom_send_raw(dev, src_node, slave_port, AXIOM_TYPE_RAW_DATA,
@@ -8,7 +8,6 @@
  * Copyright (C) 2016, Evidence Srl.
  * Terms of use are as specified in COPYING
  */
-#include <sys/select.h>
 #include <sys/eventfd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -24,18 +23,20 @@
 #include "axiom-run.h"
 
 #include "axiom_common.h"
+#include "axiom_counters.h"
 
 #ifndef UNIX_PATH_MAX
 // safe default
 #define UNIX_PATH_MAX 108
 #endif
 
-static volatile int started_threads=0;
+/* posted by every service thread when started */
+static sync_t started_threads;
 static volatile int tostart_threads=0;
 
 typedef struct {
     axiom_dev_t *dev;
-    uint64_t services;
+    int services;
     int fd;
     uint8_t cmd;
     pid_t pid;
@@ -45,9 +46,49 @@ typedef struct {
 
     int endfd;
 
+    int stat_msgs, stat_bytes, stat_errors, stat_dispatch;
+    /* commands served by recv_thread() */
+    dispatch_table_t *table;
+
     int termmode;
 } thread_info_t;
 
+/**
+ * Send the data of the child stdout/stderr to the master.
+ * Called by the reactor of send_thread() when the pipe is ready.
+ *
+ * @param r the reactor
+ * @param fd the pipe
+ * @param events don't care
+ * @param arg needed information
+ */
+static void child_output(reactor_t *r, int fd, uint32_t events, void *arg) {
+    thread_info_t *info = (thread_info_t*) arg;
+    axiom_msg_id_t msg;
+    buffer_t buffer;
+    ssize_t sz;
+    char *id = (info->cmd == CMD_SEND_TO_STDOUT) ? "STDOUT" : "STDERR";
+
+    // read slave stdout/stderr...
+    sz = read(fd, buffer.raw, sizeof (buffer.raw));
+    zlogmsg(LOG_TRACE, LOGZ_MASTER, "SLAVE: SEND_THREAD: read() %d bytes for %s", (int)sz,id);
+    if (sz == -1) {
+        if (errno == EINTR) return; // paranoia
+        zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: %s thread read error (errno=%d '%s')", id, errno, strerror(errno));
+        reactor_stop(r);
+        return;
+    }
+    // send data read to axiom-run master...
+    if (sz > 0) {
+        buffer.header.command = info->cmd;
+        msg = axiom_send_raw(info->dev, master_node, master_port, AXIOM_TYPE_RAW_DATA, sz + sizeof (header_t), &buffer);
+        if (!AXIOM_RET_IS_OK(msg))
+            zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: %s thread axiom_send_raw() write error (err=%d)", id, msg);
+    } else {
+        reactor_stop(r);
+    }
+}
+
 /**
  * Thread to manage output redirect service.
  *
@@ -56,59 +97,26 @@ typedef struct {
  */
 static void *send_thread(void *data) {
     thread_info_t *info = (thread_info_t*) data;
-    axiom_msg_id_t msg;
-    buffer_t buffer;
-    size_t sz;
-    fd_set set;
-    int res, maxfd;
     char *id = (info->cmd == CMD_SEND_TO_STDOUT) ? "STDOUT" : "STDERR";
+    reactor_t *r;
 
     zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: redirect loop for %s started (thread=%ld)", id, (long) pthread_self());
-    if (sch_setsched()!=0) {
+    if (sch_setsched_role("writer")!=0) {
         zlogmsg(LOG_ERROR, LOGZ_SLAVE, "SLAVE: can't set scheduling parameters (thread=%ld) on send_tread()", (long) pthread_self());
     }
-    buffer.header.command = ((thread_info_t*) data)->cmd;
+    r = thread_reactor(info->endfd, (info->cmd == CMD_SEND_TO_STDOUT) ? "SLAVE: redirect loop for STDOUT" : "SLAVE: redirect loop for STDERR");
 
-    __sync_fetch_and_add(&started_threads,1);
+    sync_wakeup(&started_threads);
 
     //
     // main loop
     // (exit in case of read failure)
-    maxfd=info->endfd>info->fd?info->endfd+1:info->fd+1;
-    for (;;) {
-        // read slave stdout/stderr...
-        zlogmsg(LOG_TRACE, LOGZ_SLAVE, "SLAVE: %s waiting data...", id);
-        FD_ZERO(&set);
-        FD_SET(info->fd,&set);
-        FD_SET(info->endfd,&set);
-        res=select(maxfd,&set,NULL,NULL,NULL);
-        if (res==-1) {
-            if (errno == EINTR) continue; // paranoia
-            elogmsg("select() on send_thread thread");
-            break;
-        }
-        if (FD_ISSET(info->endfd,&set)) {
-            eventfd_t value;
-            eventfd_read(info->endfd,&value); // not really needed
-            zlogmsg(LOG_DEBUG, LOGZ_MASTER, "SLAVE: redirect loop for %s received termination request",id);
-            break;
-        }
-        sz = read(info->fd, buffer.raw, sizeof (buffer.raw));
-        zlogmsg(LOG_TRACE, LOGZ_MASTER, "SLAVE: SEND_THREAD: read() %d bytes for %s", (int)sz,id);
-        if (sz == -1) {
-            if (errno == EINTR) continue; // paranoia
-            zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: %s thread read error (errno=%d '%s')", id, errno, strerror(errno));
-            break;
-        }
-        // send data read to axiom-run master...
-        if (sz > 0) {
-            msg = axiom_send_raw(info->dev, master_node, master_port, AXIOM_TYPE_RAW_DATA, sz + sizeof (header_t), &buffer);
-            if (!AXIOM_RET_IS_OK(msg))
-                zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: %s thread axiom_send_raw() write error (err=%d)", id, msg);
-        } else {
-            break;
-        }
+    if (reactor_add_fd(r, info->fd, EPOLLIN, 0, child_output, info) != 0) {
+        elogmsg("reactor_add_fd() on send_thread thread");
+    } else if (reactor_run(r) != 0) {
+        elogmsg("reactor_run() on send_thread thread");
     }
+    reactor_destroy(r);
     zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: redirect loop for %s end", id);
     return NULL;
 }
@@ -141,47 +149,139 @@ static void output(int fd, uint8_t *buf, int size) {
 /* if I kill my slave process does not use SIGTERM as exit value ! */
 static int my_sigterm=0;
 
+/** CMD_RECV_FROM_STDIN: redirect stdin service. */
+static int cmd_stdin(void *ctx, axiom_node_id_t node, axiom_raw_payload_size_t size, buffer_t *buffer) {
+    thread_info_t *info = (thread_info_t*) ctx;
+    zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: received CMD_RECV_FROM_STDIN");
+    output(info->fd, buffer->raw, size - sizeof (header_t));
+    return DISPATCH_CONTINUE;
+}
+
+/** CMD_KILL: exit service. */
+static int cmd_kill(void *ctx, axiom_node_id_t node, axiom_raw_payload_size_t size, buffer_t *buffer) {
+    thread_info_t *info = (thread_info_t*) ctx;
+    int res;
+
+    zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: received CMD_KILL");
+    my_sigterm=1;
+    res = kill(info->pid, info->termmode);
+    zlogmsg(LOG_DEBUG, LOGZ_SLAVE, "SLAVE: sent signal %d to child", info->termmode);
+    if (res != 0) {
+        zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: error sending signal to controlled application errno=%d '%s'!", errno, strerror(errno));
+        if (errno!=ESRCH) {
+            /* safety! */
+            kill(info->pid, SIGKILL);
+        }
+    }
+    return DISPATCH_CONTINUE;
+}
+
+/** CMD_BARRIER: barrier service (forwarded to the child). */
+static int cmd_barrier(void *ctx, axiom_node_id_t node, axiom_raw_payload_size_t size, buffer_t *buffer) {
+    thread_info_t *info = (thread_info_t*) ctx;
+    int res;
+
+    zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: received CMD_BARRIER");
+    snprintf(info->youraddr.sun_path, sizeof (info->youraddr.sun_path), BARRIER_CHILD_TEMPLATE_NAME, (int) getpid(), buffer->header.barrier.barrier_id);
+    res = sendto(info->sock, buffer, size, 0, (struct sockaddr*) &info->youraddr, sizeof (info->youraddr));
+    if (res != size) {
+        zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: receiver thread sendto() error (errno=%d '%s') to '%s'!", errno, strerror(errno),info->youraddr.sun_path);
+    }
+    return DISPATCH_CONTINUE;
+}
+
+/** CMD_RPC: rpc service (the reply is forwarded to the child). */
+static int cmd_rpc(void *ctx, axiom_node_id_t node, axiom_raw_payload_size_t size, buffer_t *buffer) {
+    thread_info_t *info = (thread_info_t*) ctx;
+    int res;
+
+    zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: received CMD_RPC (func=%d '%s' id=%ld size=%d)",buffer->header.rpc.function,RPCFUNC_TO_NAME(buffer->header.rpc.function),buffer->header.rpc.id,buffer->header.rpc.size);
+    snprintf(info->youraddr.sun_path, sizeof (info->youraddr.sun_path), RPC_CHILD_TEMPLATE_NAME, (int) getpid(), buffer->header.rpc.id);
+    res = sendto(info->sock, buffer, size, 0, (struct sockaddr*) &info->youraddr, sizeof (info->youraddr));
+    if (res != sizeof (unsigned)) {
+        zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: receiver thread sendto() error (errno=%d '%s')!", errno, strerror(errno));
+    }
+    return DISPATCH_CONTINUE;
+}
+
 /**
- * Thread to manage message form axiom-run master.
+ * Manage a message from axiom-run master.
+ * Called by the reactor of recv_thread() when the raw fd is ready.
  *
- * @param data data needed
- * @return don't care
+ * @param r the reactor
+ * @param fd the raw file descriptor
+ * @param events don't care
+ * @param arg data needed
  */
-static void *recv_thread(void *data) {
-    thread_info_t *info = (thread_info_t*) data;
+static void master_message(reactor_t *r, int fd, uint32_t events, void *arg) {
+    thread_info_t *info = (thread_info_t*) arg;
     axiom_node_id_t node;
     axiom_port_t port;
     axiom_type_t type;
     buffer_t buffer;
     axiom_msg_id_t msg;
     axiom_raw_payload_size_t size;
-    struct sockaddr_un itsaddr;
-    int sock=0, res;
+
+    // read the master message (the raw fd is ready)...
+    size = sizeof (buffer);
+    msg = axiom_recv_raw(info->dev, &node, &port, &type, &size, &buffer);
+    if (!AXIOM_RET_IS_OK(msg)) {
+        zlogmsg(LOG_DEBUG, LOGZ_SLAVE, "SLAVE: receiver thread error into axiom_recv_raw() %d", msg);
+        axstat_add(info->stat_errors, 1);
+        return;
+    }
+    axstat_add(info->stat_msgs, 1);
+    axstat_add(info->stat_bytes, size);
+    /* time to the end of this iteration */
+    AXSTAT_SCOPE(info->stat_dispatch);
+    dispatch_message(info->table, info, node, size, &buffer);
+}
+
+/**
+ * Thread to manage message form axiom-run master.
+ *
+ * @param data data needed
+ * @return don't care
+ */
+static void *recv_thread(void *data) {
+    thread_info_t *info = (thread_info_t*) data;
     axiom_err_t err;
-    int maxfd,rawfd;
-    fd_set set;
+    int rawfd;
+    reactor_t *r;
     
     zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: receiver thread started (thread=%ld)", (long) pthread_self());
-    if (sch_setsched()!=0) {
+    if (sch_setsched_role("receiver")!=0) {
         zlogmsg(LOG_ERROR, LOGZ_SLAVE, "SLAVE: can't set scheduling parameters (thread=%ld) on recv_tread()", (long) pthread_self());
     }
-
-    __sync_fetch_and_add(&started_threads,1);
+    info->stat_msgs = axstat_counter("slave.msgs");
+    info->stat_bytes = axstat_counter("slave.bytes");
+    info->stat_errors = axstat_counter("slave.recv_errors");
+    info->stat_dispatch = axstat_histogram("slave.dispatch");
+    info->table = malloc(sizeof (dispatch_table_t));
+    if (info->table == NULL) {
+        elogmsg("malloc()");
+        exit(EXIT_FAILURE);
+    }
+    dispatch_init(info->table, "slave", "SLAVE: RECV_THREAD", LOGZ_SLAVE, &info->services);
+    dispatch_register(info->table, CMD_RECV_FROM_STDIN, "stdin", REDIRECT_SERVICE, cmd_stdin);
+    dispatch_register(info->table, CMD_KILL, "kill", EXIT_SERVICE|KILL_SERVICE, cmd_kill);
+    dispatch_register(info->table, CMD_BARRIER, "barrier", BARRIER_SERVICE, cmd_barrier);
+    dispatch_register(info->table, CMD_RPC, "rpc", RPC_SERVICE, cmd_rpc);
+    r = thread_reactor(info->endfd, "SLAVE: recv_thread");
+
+    sync_wakeup(&started_threads);
     
+    info->sock = -1;
     if (info->services & (BARRIER_SERVICE|RPC_SERVICE)) {
         // socket used to inform the child process of barrier synchronization...
-        sock = socket(AF_UNIX, SOCK_DGRAM, 0);
-        if (sock == -1) {
+        info->sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (info->sock == -1) {
             elogmsg("socket()");
             exit(EXIT_FAILURE);
         }
-        itsaddr.sun_family = AF_UNIX;
+        info->youraddr.sun_family = AF_UNIX;
     }
 
-    // this is needed because axiom_recv_raw is not a cancellation point and is blocking...
-    // PS: not used anymore but keepd for failsafe
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-
     //
     // MAIN LOOP
     // (forever)
@@ -189,110 +289,47 @@ static void *recv_thread(void *data) {
     err=axiom_get_fds(info->dev,&rawfd,NULL,NULL);
     if (!AXIOM_RET_IS_OK(err)) {
         elogmsg("axiom_get_fds() on recv_thread thread result=%d",err);
-        zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: receiver thread end");        
-        return NULL;
-    }
-    maxfd=rawfd>info->endfd?rawfd+1:info->endfd+1;
-    for (;;) {
-        FD_ZERO(&set);
-        FD_SET(info->endfd,&set);
-        FD_SET(rawfd,&set);
-        res=select(maxfd,&set,NULL,NULL,NULL);
-        if (res==-1) {
-            if (errno == EINTR) continue; // paranoia
-            elogmsg("select() on recv_thread thread");
-            break;
-        }
-        if (FD_ISSET(info->endfd,&set)) {
-            eventfd_t value;
-            eventfd_read(info->endfd,&value); // not really needed
-            zlogmsg(LOG_DEBUG, LOGZ_MASTER, "SLAVE: recv_thread received termination request");
-            break;
-        }                        
-        // wait master messages...
-        size = sizeof (buffer);
-        msg = axiom_recv_raw(info->dev, &node, &port, &type, &size, &buffer);
-        if (!AXIOM_RET_IS_OK(msg)) {
-            zlogmsg(LOG_DEBUG, LOGZ_SLAVE, "SLAVE: receiver thread error into axiom_recv_raw() %d", msg);
-            continue;
-        }
-        if (logmsg_is_zenabled(LOG_TRACE, LOGZ_MASTER)) {
-            if (buffer.header.command==CMD_RPC) {
-                zlogmsg(LOG_TRACE, LOGZ_MASTER, "SLAVE: RECV_THREAD: received %d bytes command 0x%02x '%s' function 0x%02x '%s'",
-                        size, buffer.header.command, CMD_TO_NAME(buffer.header.command),buffer.header.rpc.function,RPCFUNC_TO_NAME(buffer.header.rpc.function));
-            } else {
-                zlogmsg(LOG_TRACE, LOGZ_MASTER, "SLAVE: RECV_THREAD: received %d bytes command 0x%02x '%s'",
-                        size, buffer.header.command, CMD_TO_NAME(buffer.header.command));
-            }
-        }
-        if (buffer.header.command == CMD_RECV_FROM_STDIN) {
-            //
-            // manage stdin redirect service
-            //
-            if (info->services & REDIRECT_SERVICE) {
-                zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: received CMD_RECV_FROM_STDIN");
-                size -= sizeof (header_t);
-                output(info->fd, buffer.raw, size);
-            } else {
-                zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: received an unwanted message CMD_RECV_FROM_STDIN");
-            }
-        } else if (buffer.header.command == CMD_KILL) {
-            //
-            // manage exit service
-            //
-            if (info->services & (EXIT_SERVICE|KILL_SERVICE)) {
-                zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: received CMD_KILL");
-                my_sigterm=1;
-                res = kill(info->pid, info->termmode);
-                zlogmsg(LOG_DEBUG, LOGZ_SLAVE, "SLAVE: sent signal %d to child", info->termmode);
-                if (res != 0) {
-                    zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: error sending signal to controlled application errno=%d '%s'!", errno, strerror(errno));
-                    if (errno!=ESRCH) {
-                        /* safety! */
-                        kill(info->pid, SIGKILL);
-                    }
-                }
-                //exit(EXIT_SUCCESS);
-            } else {
-                zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: received an unwanted message CMD_KILL");
-            }
-        } else if (buffer.header.command == CMD_BARRIER) {
-            //
-            // manage barrier service
-            //
-            if (info->services & BARRIER_SERVICE) {
-                int sz=res;
-                zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: received CMD_BARRIER");
-                snprintf(itsaddr.sun_path, sizeof (itsaddr.sun_path), BARRIER_CHILD_TEMPLATE_NAME, (int) getpid(), buffer.header.barrier.barrier_id);
-                res = sendto(sock, &buffer, sz, 0, (struct sockaddr*) &itsaddr, sizeof (itsaddr));
-                if (res != sz) {
-                    zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: receiver thread sendto() error (errno=%d '%s') to '%s'!", errno, strerror(errno),itsaddr.sun_path);
-                }
-            } else {
-                zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: received an unwanted message CMD_BARRIER");
-            }
-        } else if (buffer.header.command == CMD_RPC) {
-            //
-            // manage RPC service
-            //
-            if (info->services & RPC_SERVICE) {
-                zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: received CMD_RPC (func=%d '%s' id=%ld size=%d)",buffer.header.rpc.function,RPCFUNC_TO_NAME(buffer.header.rpc.function),buffer.header.rpc.id,buffer.header.rpc.size);
-                snprintf(itsaddr.sun_path, sizeof (itsaddr.sun_path), RPC_CHILD_TEMPLATE_NAME, (int) getpid(), buffer.header.rpc.id);
-                res = sendto(sock, &buffer, size, 0, (struct sockaddr*) &itsaddr, sizeof (itsaddr));
-                if (res != sizeof (unsigned)) {
-                    zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: receiver thread sendto() error (errno=%d '%s')!", errno, strerror(errno));
-                }
-            } else {
-                zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: received an unwanted message CMD_RPC");
-            }
-        } else {
-            zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: unknown message command 0x%02x", buffer.header.command);
-        }
+    } else if (reactor_add_fd(r, rawfd, EPOLLIN, 0, master_message, info) != 0) {
+        elogmsg("reactor_add_fd() on recv_thread thread");
+    } else if (reactor_run(r) != 0) {
+        elogmsg("reactor_run() on recv_thread thread");
     }
+    reactor_destroy(r);
+    free(info->table);
+    if (info->sock != -1) close(info->sock);
     zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: receiver thread end");
     return NULL;
 }
 
+/**
+ * Send a synchronization request of the child to the master.
+ * Called by the reactor of sock_thread() when the socket is ready.
+ *
+ * @param r the reactor
+ * @param fd the socket
+ * @param events don't care
+ * @param arg data needed
+ */
+static void child_request(reactor_t *r, int fd, uint32_t events, void *arg) {
+    thread_info_t *info = (thread_info_t*) arg;
+    axiom_msg_id_t msg;
+    buffer_t buffer;
+    int res;
+
+    // receive data from child...
+    res = recv(fd, &buffer, sizeof (buffer), MSG_WAITALL);
+    if (res == -1 && errno == EAGAIN) return;
+    if (res == -1) {
+        zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: socket thread recv error (errno=%d '%s')", errno, strerror(errno));
+        return;
+    }
+    zlogmsg(LOG_TRACE, LOGZ_SLAVE, "SLAVE: SOCK_THREAD: received command 0x%02x (size=%d) from CHILD",buffer.header.command,res);
+    // send request to master...
+    msg = axiom_send_raw(info->dev, master_node, master_port, AXIOM_TYPE_RAW_DATA, res, &buffer);
+    if (!AXIOM_RET_IS_OK(msg))
+        zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: socket thread axiom_send_raw() write error (err=%d)", msg);
+}
+
 /**
  * Thread to manage barrier service.
  * @param data data needed
@@ -300,31 +337,29 @@ static void *recv_thread(void *data) {
  */
 static void *sock_thread(void *data) {
     thread_info_t *info = (thread_info_t*) data;
-    axiom_msg_id_t msg;
-    buffer_t buffer;
     struct sockaddr_un myaddr;
-    int sock, res;
-    fd_set set;
-    int maxfd;
+    int res;
+    reactor_t *r;
     
     // read synchornization request from a socket and send the request to the master...
 
     zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: socket thread started (thread=%ld)", (long) pthread_self());
-    if (sch_setsched()!=0) {
+    if (sch_setsched_role("sock")!=0) {
         zlogmsg(LOG_ERROR, LOGZ_SLAVE, "SLAVE: can't set scheduling parameters (thread=%ld) on sock_tread()", (long) pthread_self());
     }
+    r = thread_reactor(info->endfd, "SLAVE: sock_thread");
 
-    __sync_fetch_and_add(&started_threads,1);
+    sync_wakeup(&started_threads);
 
     // socket used for slave<->child comunnication
-    sock = socket(AF_UNIX, SOCK_DGRAM, 0);
-    if (sock == -1) {
+    info->sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (info->sock == -1) {
         elogmsg("socket()");
         exit(EXIT_FAILURE);
     }
     myaddr.sun_family = AF_UNIX;
     snprintf(myaddr.sun_path, sizeof (myaddr.sun_path), SLAVE_TEMPLATE_NAME, (int) getpid());
-    res = bind(sock, (struct sockaddr *) &myaddr, sizeof (myaddr));
+    res = bind(info->sock, (struct sockaddr *) &myaddr, sizeof (myaddr));
     if (res == -1) {
         elogmsg("bind()");
         exit(EXIT_FAILURE);
@@ -334,40 +369,53 @@ static void *sock_thread(void *data) {
     // MAIN LOOP
     // (forever)
     //
-    maxfd=info->endfd>sock?info->endfd+1:sock+1;
-    for (;;) {
-        FD_ZERO(&set);
-        FD_SET(sock,&set);
-        FD_SET(info->endfd,&set);
-        res=select(maxfd,&set,NULL,NULL,NULL);
-        if (res==-1) {
-            if (errno == EINTR) continue; // paranoia
-            elogmsg("select() on sock_thread thread");
-            break;
-        }
-        if (FD_ISSET(info->endfd,&set)) {
-            eventfd_t value;
-            eventfd_read(info->endfd,&value); // not really needed
-            zlogmsg(LOG_DEBUG, LOGZ_MASTER, "SLAVE: sock_thread received termination request");
-            break;
-        }
-        // receive data from child...
-        res = recv(sock, &buffer, sizeof (buffer), MSG_WAITALL);
-        if (res == -1 && errno == EAGAIN) continue;
-        if (res == -1) {
-            zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: socket thread recv error (errno=%d '%s')", errno, strerror(errno));
-            continue;
-        }
-        zlogmsg(LOG_TRACE, LOGZ_SLAVE, "SLAVE: SOCK_THREAD: received command 0x%02x (size=%d) from CHILD",buffer.header.command,res);
-        // send request to master...
-        msg = axiom_send_raw(info->dev, master_node, master_port, AXIOM_TYPE_RAW_DATA, res, &buffer);
-        if (!AXIOM_RET_IS_OK(msg))
-            zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: socket thread axiom_send_raw() write error (err=%d)", msg);
+    if (reactor_add_fd(r, info->sock, EPOLLIN, 0, child_request, info) != 0) {
+        elogmsg("reactor_add_fd() on sock_thread thread");
+    } else if (reactor_run(r) != 0) {
+        elogmsg("reactor_run() on sock_thread thread");
     }
+    reactor_destroy(r);
     zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: socket thread end");
     return NULL;
 }
 
+/**
+ * Send the spurious data of the child stdout/stderr (written after the
+ * child termination) to the master.
+ *
+ * @param r the reactor
+ * @param fd the pipe
+ * @param events don't care
+ * @param arg needed information (fd is set to -1 when closed)
+ */
+static void spurious_output(reactor_t *r, int fd, uint32_t events, void *arg) {
+    thread_info_t *info = (thread_info_t*) arg;
+    char *id = (info->cmd == CMD_SEND_TO_STDOUT) ? "STDOUT" : "STDERR";
+    axiom_msg_id_t msg;
+    buffer_t buffer;
+    ssize_t sz;
+
+    sz = read(fd, buffer.raw, sizeof (buffer.raw));
+    zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: %s read %d bytes from fd", id, (int) sz);
+    if (sz == -1) {
+        zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: %s read error (errno=%d '%s')", id, errno, strerror(errno));
+    } else if (sz > 0) {
+        buffer.header.command = info->cmd;
+        msg = axiom_send_raw(info->dev, master_node, master_port, AXIOM_TYPE_RAW_DATA, sz + sizeof (header_t), &buffer);
+        if (!AXIOM_RET_IS_OK(msg))
+            zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: %s axiom_send_raw() write error (err=%d)", id, msg);
+    } else {
+        reactor_del_fd(r, fd);
+        info->fd = -1;
+    }
+}
+
+/* end of the wait of the spurious data */
+static void spurious_timeout(reactor_t *r, void *arg) {
+    zlogmsg(LOG_TRACE, LOGZ_SLAVE, "SLAVE: timeout of the spurious write");
+    reactor_stop(r);
+}
+
 /* these are necessary for the signal handler :-( */
 static int mypid;
 static axiom_dev_t *mydev;
@@ -430,7 +478,7 @@ int manage_slave_services(axiom_dev_t *_dev, int _services, int *_fd, pid_t _pid
     pthread_t thout, therr, thin, thsock;
     sigset_t oldset;
     pid_t resp;
-    int res;
+    int res, i;
     int status;
     buffer_t buffer;
     axiom_msg_id_t msgid;
@@ -444,6 +492,9 @@ int manage_slave_services(axiom_dev_t *_dev, int _services, int *_fd, pid_t _pid
         // start service threads...
         //
         zlogmsg(LOG_DEBUG, LOGZ_SLAVE, "SLAVE: starting service threads for child pid %d",(int)_pid);
+        if (sync_open(&started_threads)!=0) {
+            exit(EXIT_FAILURE);
+        }
 
         // block all signal (so thread started have the mask set)
         block_all_signals(&oldset);
@@ -516,13 +567,17 @@ int manage_slave_services(axiom_dev_t *_dev, int _services, int *_fd, pid_t _pid
 
         // waiting slave threads...
         zlogmsg(LOG_DEBUG, LOGZ_SLAVE, "SLAVE: waiting slave threads...");
-        while (__sync_fetch_and_add(&started_threads,0)!=tostart_threads) {
-            usleep(100);
+        if (_services) {
+            for (i=0; i<tostart_threads; i++) {
+                sync_wait(&started_threads);
+            }
+            // opened also when no thread is started
+            sync_close(&started_threads);
         }
 
         // set scheduling for main thread
         // can not be done before! (SCHED_DEADLINE is not heritable)
-        if (sch_setsched()!=0) {
+        if (sch_setsched_role("main")!=0) {
             zlogmsg(LOG_ERROR, LOGZ_SLAVE, "SLAVE: can't set scheduling parameters (thread=%ld) on sock_tread()", (long) pthread_self());
         }
 
@@ -582,65 +637,21 @@ int manage_slave_services(axiom_dev_t *_dev, int _services, int *_fd, pid_t _pid
         zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: working threads died");
 
         if (_services & REDIRECT_SERVICE) {
-            struct timeval tv;
-            fd_set set;
-            buffer_t buffer;
-            int nfds, ret, sz, closedout, closederr;
-            axiom_msg_id_t msg;
+            reactor_t *r;
 
             zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: waiting spurious stdout/stderr data");
-            tv.tv_sec = 0;
-            tv.tv_usec = 750000;
-            closedout = closederr = 0;
-            for (;;) {
-                FD_ZERO(&set);
-                nfds = 0;
-                if (!closedout) {
-                    FD_SET(_fd[1], &set);
-                    nfds = _fd[1];
-                }
-                if (!closederr) {
-                    FD_SET(_fd[2], &set);
-                    nfds = nfds > _fd[2] ? nfds : _fd[2];
-                }
-                ret = select(nfds + 1, &set, NULL, NULL, &tv);
-                // NMB: we assume, as linux do but posix permits not to do, that struct timeval will be updated
-                if (ret == -1) {
-                    elogmsg("SLAVE: select()");
-                    break;
-                }
-                zlogmsg(LOG_TRACE, LOGZ_SLAVE, "SLAVE: remaining %ld usec (for spurios write)", tv.tv_usec);
-                if (!ret) break;
-                if (FD_ISSET(_fd[1], &set)) {
-                    sz = read(_fd[1], buffer.raw, sizeof (buffer.raw));
-                    zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: STDOUT read %d bytes from fd", (int) sz);
-                    if (sz == -1) {
-                        zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: STDOUT read error (errno=%d '%s')", errno, strerror(errno));
-                    } else if (sz > 0) {
-                        buffer.header.command = CMD_SEND_TO_STDOUT;
-                        msg = axiom_send_raw(_dev, master_node, master_port, AXIOM_TYPE_RAW_DATA, sz + sizeof (header_t), &buffer);
-                        if (!AXIOM_RET_IS_OK(msg))
-                            zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: STDOUT axiom_send_raw() write error (err=%d)", msg);
-                    } else {
-                        closedout = 1;
-                    }
-                }
-                if (FD_ISSET(_fd[2], &set)) {
-                    sz = read(_fd[2], buffer.raw, sizeof (buffer.raw));
-                    zlogmsg(LOG_INFO, LOGZ_SLAVE, "SLAVE: STDERR read %d bytes from fd", (int) sz);
-                    if (sz == -1) {
-                        zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: STDERR read error (errno=%d '%s')", errno, strerror(errno));
-                    } else if (sz > 0) {
-                        buffer.header.command = CMD_SEND_TO_STDERR;
-                        msg = axiom_send_raw(_dev, master_node, master_port, AXIOM_TYPE_RAW_DATA, sz + sizeof (header_t), &buffer);
-                        if (!AXIOM_RET_IS_OK(msg))
-                            zlogmsg(LOG_WARN, LOGZ_SLAVE, "SLAVE: STDERR axiom_send_raw() write error (err=%d)", msg);
-                    } else {
-                        closederr = 1;
-                    }
+            r = thread_reactor(-1, "SLAVE");
+            if (reactor_add_fd(r, forout.fd, EPOLLIN, 0, spurious_output, &forout) != 0
+                    || reactor_add_fd(r, forerr.fd, EPOLLIN, 0, spurious_output, &forerr) != 0
+                    || reactor_add_timer(r, 750, 0, spurious_timeout, NULL) == NULL) {
+                elogmsg("SLAVE: reactor setup for spurious data");
+            } else {
+                // until both are closed or the timeout
+                while (forout.fd != -1 || forerr.fd != -1) {
+                    if (reactor_run_once(r) <= 0) break;
                 }
-                if (closedout && closederr) break;
             }
+            reactor_destroy(r);
         }
 
     }
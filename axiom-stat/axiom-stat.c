@@ -0,0 +1,276 @@
+/*!
+ * \file axiom-stat.c
+ *
+ * \version     v1.2
+ * \date        2017-09-12
+ *
+ * This file contains the implementation of axiom-stat application.
+ *
+ * axiom-stat reads, while the processes run, the counters and the latency
+ * histograms exported by axiom-init, axiom-run and axiom-ethtap (see
+ * axiom_counters.h).
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/mman.h>
+
+#include "axiom_nic_types.h"
+#include "axiom_common.h"
+#include "axiom_counters.h"
+
+/** Max segments shown. */
+#define MAX_SEGMENTS 64
+
+/** A mapped segment and the values of the previous sample. */
+typedef struct {
+    char filename[256];
+    axstat_shm_t *shm;
+    uint64_t prev[AXSTAT_MAX_COUNTERS];
+    uint64_t prev_ns;
+} segment_t;
+
+static segment_t segments[MAX_SEGMENTS];
+static int num_segments = 0;
+static int per_thread = 0;
+
+static void usage(void) {
+    printf("usage: axiom-stat [arguments] [NAME|PID]...\n");
+    printf("Print the counters and the latency histograms of the running AXIOM processes\n");
+    printf("Version: %s\n", AXIOM_API_VERSION_STR);
+    printf("\n\n");
+    printf("Arguments:\n");
+    printf("-i, --interval SEC  print the rates every SEC seconds\n");
+    printf("-c, --count COUNT   stop after COUNT samples (with -i)\n");
+    printf("-t, --threads       print the values of every thread\n");
+    printf("-l, --list          list the processes\n");
+    printf("-V, --version       print version\n");
+    printf("-h, --help          print this help\n\n");
+}
+
+static int match(axstat_shm_t *shm, int argc, char **argv) {
+    int i;
+
+    if (argc == 0) return 1;
+    for (i = 0; i < argc; i++) {
+        if (strcmp(shm->name, argv[i]) == 0 || atoi(argv[i]) == shm->pid) return 1;
+    }
+    return 0;
+}
+
+static void open_segments(int argc, char **argv) {
+    struct dirent *de;
+    axstat_shm_t *shm;
+    segment_t *seg;
+    DIR *dir;
+    int fd;
+
+    dir = opendir(AXSTAT_DIR);
+    if (dir == NULL) {
+        perror(AXSTAT_DIR);
+        exit(-1);
+    }
+    while ((de = readdir(dir)) != NULL && num_segments < MAX_SEGMENTS) {
+        if (strncmp(de->d_name, AXSTAT_PREFIX, strlen(AXSTAT_PREFIX)) != 0) continue;
+        seg = &segments[num_segments];
+        snprintf(seg->filename, sizeof (seg->filename), "%s/%s", AXSTAT_DIR, de->d_name);
+
+        fd = open(seg->filename, O_RDONLY);
+        if (fd == -1) continue;
+        shm = mmap(NULL, sizeof (axstat_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (shm == MAP_FAILED) continue;
+        /* not initialized, of another version, of a killed process */
+        if (memcmp(shm->magic, AXSTAT_MAGIC, sizeof (AXSTAT_MAGIC)) != 0 ||
+                shm->version != AXSTAT_VERSION || !match(shm, argc, argv) ||
+                (kill(shm->pid, 0) == -1 && errno == ESRCH)) {
+            munmap(shm, sizeof (axstat_shm_t));
+            continue;
+        }
+        seg->shm = shm;
+        num_segments++;
+    }
+    closedir(dir);
+}
+
+/* sum of a counter of all the threads */
+static uint64_t counter_sum(axstat_shm_t *shm, int slot) {
+    uint32_t i, n = __atomic_load_n(&shm->num_threads, __ATOMIC_ACQUIRE);
+    uint64_t sum = 0;
+
+    for (i = 0; i < n; i++) {
+        sum += __atomic_load_n(&shm->thread[i].counter[slot], __ATOMIC_RELAXED);
+    }
+    return sum;
+}
+
+/* merge a histogram of the threads (all of them if thread < 0) */
+static void hist_merge(axstat_shm_t *shm, int slot, int thread, axstat_hist_t *h) {
+    uint32_t i, n = __atomic_load_n(&shm->num_threads, __ATOMIC_ACQUIRE);
+    axstat_hist_t *src;
+    uint64_t v;
+    int b;
+
+    memset(h, 0, sizeof (*h));
+    for (i = 0; i < n; i++) {
+        if (thread >= 0 && i != thread) continue;
+        src = &shm->thread[i].hist[slot];
+        h->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+        h->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+        v = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+        if (v > h->max) h->max = v;
+        for (b = 0; b < AXSTAT_HIST_BUCKETS; b++) {
+            h->bucket[b] += __atomic_load_n(&src->bucket[b], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* percentile of a histogram (lower bound of the bucket, us) */
+static double hist_percentile(axstat_hist_t *h, double p) {
+    uint64_t total = 0, n = 0;
+    int b;
+
+    for (b = 0; b < AXSTAT_HIST_BUCKETS; b++) total += h->bucket[b];
+    if (total == 0) return 0;
+    for (b = 0; b < AXSTAT_HIST_BUCKETS; b++) {
+        n += h->bucket[b];
+        if (n >= total * p) break;
+    }
+    return axstat_bucket_value(b < AXSTAT_HIST_BUCKETS ? b : AXSTAT_HIST_BUCKETS - 1) / 1000.0;
+}
+
+static void print_hist(const char *name, axstat_hist_t *h) {
+    printf("  %-24s %12lu %10.3f %10.3f %10.3f %10.3f %10.3f\n", name,
+            (unsigned long) h->count, h->count ? h->sum / 1000.0 / h->count : 0,
+            hist_percentile(h, 0.5), hist_percentile(h, 0.9), hist_percentile(h, 0.99),
+            h->max / 1000.0);
+}
+
+static void print_segment(segment_t *seg, int rates) {
+    axstat_shm_t *shm = seg->shm;
+    uint32_t nmetrics = __atomic_load_n(&shm->num_metrics, __ATOMIC_ACQUIRE);
+    uint32_t nthreads = __atomic_load_n(&shm->num_threads, __ATOMIC_ACQUIRE);
+    uint64_t now = axstat_now(), value;
+    double elapsed = (now - seg->prev_ns) / 1e9;
+    axstat_metric_t *m;
+    axstat_hist_t h;
+    uint32_t i, t;
+
+    printf("%s [pid %d] uptime %.1f s, %u threads\n", shm->name, shm->pid,
+            (now - shm->start_ns) / 1e9, nthreads);
+
+    printf("  %-24s %12s %12s\n", "COUNTER", "VALUE", rates ? "RATE/s" : "");
+    for (i = 0; i < nmetrics; i++) {
+        m = &shm->metric[i];
+        if (__atomic_load_n(&m->type, __ATOMIC_ACQUIRE) != AXSTAT_COUNTER) continue;
+        value = counter_sum(shm, m->slot);
+        if (rates) {
+            printf("  %-24s %12lu %12.1f\n", m->name, (unsigned long) value,
+                    (value - seg->prev[m->slot]) / elapsed);
+        } else {
+            printf("  %-24s %12lu\n", m->name, (unsigned long) value);
+        }
+        seg->prev[m->slot] = value;
+        if (!per_thread) continue;
+        for (t = 0; t < nthreads; t++) {
+            value = __atomic_load_n(&shm->thread[t].counter[m->slot], __ATOMIC_RELAXED);
+            if (value == 0) continue;
+            printf("    %-22.16s %12lu  tid %d\n", shm->thread[t].name, (unsigned long) value,
+                    shm->thread[t].tid);
+        }
+    }
+
+    printf("  %-24s %12s %10s %10s %10s %10s %10s\n", "HISTOGRAM (us)", "COUNT", "AVG",
+            "P50", "P90", "P99", "MAX");
+    for (i = 0; i < nmetrics; i++) {
+        m = &shm->metric[i];
+        if (__atomic_load_n(&m->type, __ATOMIC_ACQUIRE) != AXSTAT_HIST) continue;
+        hist_merge(shm, m->slot, -1, &h);
+        print_hist(m->name, &h);
+        if (!per_thread) continue;
+        for (t = 0; t < nthreads; t++) {
+            char name[AXSTAT_NAME_SIZE + 16];
+            hist_merge(shm, m->slot, t, &h);
+            if (h.count == 0) continue;
+            snprintf(name, sizeof (name), "  %.16s/%d", shm->thread[t].name, shm->thread[t].tid);
+            print_hist(name, &h);
+        }
+    }
+    printf("\n");
+    seg->prev_ns = now;
+}
+
+int main(int argc, char **argv) {
+    int interval = 0, count = 0, list = 0, n, i;
+    int long_index = 0;
+    int opt = 0;
+    static struct option long_options[] = {
+        {"interval", required_argument, 0, 'i'},
+        {"count", required_argument, 0, 'c'},
+        {"threads", no_argument, 0, 't'},
+        {"list", no_argument, 0, 'l'},
+        {"version", no_argument, 0, 'V'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "i:c:tlVh", long_options, &long_index)) != -1) {
+        switch (opt) {
+            case 'i':
+                interval = atoi(optarg);
+                break;
+            case 'c':
+                count = atoi(optarg);
+                break;
+            case 't':
+                per_thread = 1;
+                break;
+            case 'l':
+                list = 1;
+                break;
+            case 'V':
+                printf("Version: %s\n", AXIOM_API_VERSION_STR);
+                exit(0);
+            case 'h':
+            default:
+                usage();
+                exit(-1);
+        }
+    }
+
+    open_segments(argc - optind, argv + optind);
+    if (num_segments == 0) {
+        fprintf(stderr, "no AXIOM processes with statistics found in %s\n", AXSTAT_DIR);
+        exit(-1);
+    }
+
+    if (list) {
+        for (i = 0; i < num_segments; i++) {
+            printf("%-16s %8d  %s\n", segments[i].shm->name, segments[i].shm->pid,
+                    segments[i].filename);
+        }
+        return 0;
+    }
+
+    for (i = 0; i < num_segments; i++) {
+        print_segment(&segments[i], 0);
+    }
+    for (n = 1; interval > 0 && (count == 0 || n < count); n++) {
+        sleep(interval);
+        for (i = 0; i < num_segments; i++) {
+            print_segment(&segments[i], 1);
+        }
+    }
+
+    return 0;
+}
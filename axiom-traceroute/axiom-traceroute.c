@@ -7,6 +7,9 @@
  * This file contains the implementation of axiom-traceroute application.
  *
  * axiom-traceroute prints the hops needed to reach the specified axiom node
+ * (or all the nodes) and the latency of every hop. Every hop stamps its node
+ * id and its receive time in the reply; with a multipath routing table a
+ * probe is sent on every interface enabled towards the destination.
  *
  * Copyright (C) 2016, Evidence Srl.
  * Terms of use are as specified in COPYING
@@ -20,6 +23,8 @@
 #include <getopt.h>
 #include <inttypes.h>
 #include <signal.h>
+#include <sched.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/time.h>
@@ -28,10 +33,37 @@
 #include "axiom_nic_api_user.h"
 #include "axiom_nic_packets.h"
 #include "axiom_nic_init.h"
+#include "axiom_utility.h"
 #include "dprintf.h"
+#include "axiom_init_api.h"
+
+/* max hops recorded for every probe */
+#define AXTR_MAX_HOPS           64
+/* max probes (destinations x interfaces) */
+#define AXTR_MAX_PROBES         (AXIOM_NODES_NUM * AXIOM_INTERFACES_NUM)
+
+typedef struct {
+    int seen;                   /* reply received */
+    axiom_node_id_t node_id;
+    uint64_t rtt_ns;            /* local clock (0 unknown) */
+    uint64_t hop_ns;            /* clock of the hop (0 unknown) */
+} axtr_hop_t;
+
+typedef struct {
+    axiom_node_id_t dst_id;
+    axiom_if_id_t if_id;
+    uint64_t send_ns;
+    uint64_t send_rt_ns;        /* send time (CLOCK_REALTIME) */
+    int hops;                   /* hops to reach dst_id (0 unknown) */
+    int received;
+    axtr_hop_t hop[AXTR_MAX_HOPS + 1];
+} axtr_probe_t;
 
 int verbose = 0;
 
+static axtr_probe_t probes[AXTR_MAX_PROBES];
+static int num_probes;
+
 static void
 usage(void)
 {
@@ -41,61 +73,255 @@ usage(void)
     printf("\n\n");
     printf("Arguments:\n");
     printf("-d, --dest     dest_node   destination node of traceroute\n");
+    printf("-a, --all                  trace all the reachable nodes at once\n");
+    printf("-m, --multipath            send a probe on every interface enabled\n");
+    printf("                           in the routing table for the destination\n");
+    printf("-W, --timeout  timeout     sec to wait for the replies [default: 1]\n");
+    printf("-s, --synced               the wall clocks of the nodes are synchronized\n");
+    printf("                           (NTP or PTP):\n");
+    printf("                           print the one-way latency of every hop\n");
     printf("-v, --verbose              verbose output\n");
     printf("-V, --version              print version\n");
     printf("-h, --help                 print this help\n\n");
 }
 
+static inline uint64_t
+axtr_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec2nsec(ts);
+}
+
+/* CLOCK_MONOTONIC starts at the boot of every node: the one-way latency
+ * needs the wall clock, synchronized among the nodes by NTP or PTP */
+static inline uint64_t
+axtr_realtime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return timespec2nsec(ts);
+}
+
+/* difference of two wall clock times: the clocks can be slightly skewed */
+static inline double
+axtr_delta_ms(uint64_t end_ns, uint64_t start_ns)
+{
+    return (int64_t)(end_ns - start_ns) / 1000000.0;
+}
+
+/* send the probes towards dest_node: one for every enabled interface */
+static int
+axtr_send_probes(axiom_dev_t *dev, axiom_node_id_t node_id,
+        axiom_node_id_t dest_node, int multipath)
+{
+    axinit_traceroute_payload_t payload;
+    axiom_if_id_t if_id, if_mask;
+    axiom_err_t err;
+    axtr_probe_t *probe;
+    int i, sent = 0;
+
+    if (multipath) {
+        err = axiom_get_routing(dev, dest_node, &if_mask);
+    } else {
+        err = axiom_next_hop(dev, dest_node, &if_id);
+        if_mask = 1 << if_id;
+    }
+    if (!AXIOM_RET_IS_OK(err) || if_mask == 0) {
+        EPRINTF("node[%u] is unreachable", dest_node);
+        return -1;
+    }
+
+    for (i = 0; i < AXIOM_INTERFACES_NUM; i++) {
+        if (!(if_mask & (1 << i)) || num_probes >= AXTR_MAX_PROBES)
+            continue;
+
+        probe = &probes[num_probes];
+        probe->dst_id = dest_node;
+        probe->if_id = i;
+
+        memset(&payload, 0, sizeof(payload));
+        payload.command = AXIOM_CMD_TRACEROUTE;
+        payload.src_id = node_id;
+        payload.dst_id = dest_node;
+        payload.step = 0;
+        payload.probe = num_probes;
+        payload.if_id = i;
+
+        /* send initial raw neighbour traceroute message */
+        payload.send_ns = probe->send_rt_ns = axtr_realtime();
+        probe->send_ns = axtr_now();
+        err = axiom_send_raw(dev, i, AXIOM_RAW_PORT_INIT,
+                AXIOM_TYPE_RAW_NEIGHBOUR, sizeof(payload), &payload);
+        if (!AXIOM_RET_IS_OK(err)) {
+            EPRINTF("send error to node %u interface %d", dest_node, i);
+            continue;
+        }
+        num_probes++;
+        sent++;
+    }
+
+    return sent > 0 ? 0 : -1;
+}
+
+/* receive a reply; return 0 if no reply is available */
 static int
-recv_tracereoute_reply(axiom_dev_t *dev, axiom_node_id_t *recv_node,
-                       axiom_port_t *port, axiom_type_t *type,
-                       axiom_traceroute_payload_t *recv_payload)
+axtr_recv_reply(axiom_dev_t *dev)
 {
-    axiom_err_t msg_err;
-    axiom_raw_payload_size_t payload_size = sizeof(*recv_payload);
+    axinit_traceroute_payload_t payload;
+    axiom_raw_payload_size_t payload_size = sizeof(payload);
+    axiom_node_id_t recv_node;
+    axiom_port_t port;
+    axiom_type_t type;
+    axiom_err_t err;
+    axtr_probe_t *probe = NULL;
+    axtr_hop_t *hop;
+    uint64_t now;
+    int i;
 
-    msg_err =  axiom_recv_raw(dev, recv_node, port, type, &payload_size,
-            recv_payload);
+    err = axiom_recv_raw(dev, &recv_node, &port, &type, &payload_size,
+            &payload);
+    if (err == AXIOM_RET_NOTAVAIL)
+        return 0;
+    now = axtr_now();
 
-    if (!AXIOM_RET_IS_OK(msg_err)) {
+    if (!AXIOM_RET_IS_OK(err)) {
         EPRINTF("receive error");
         return -1;
     }
 
-    if (recv_payload->command != AXIOM_CMD_TRACEROUTE_REPLY) {
+    if (payload.command != AXIOM_CMD_TRACEROUTE_REPLY) {
         EPRINTF("command received [%x] != AXIOM_CMD_TRACEROUTE_REPLY [%x]",
-                recv_payload->command, AXIOM_CMD_TRACEROUTE_REPLY);
-        return -1;
+                payload.command, AXIOM_CMD_TRACEROUTE_REPLY);
+        return 1;
     }
 
-    return 0;
+    if (payload_size >= sizeof(payload)) {
+        if (payload.probe < num_probes &&
+                probes[payload.probe].dst_id == payload.dst_id)
+            probe = &probes[payload.probe];
+    } else {
+        /* reply of an old axiom-init: no probe id and no timing */
+        for (i = 0; i < num_probes && probe == NULL; i++) {
+            if (probes[i].dst_id == payload.dst_id)
+                probe = &probes[i];
+        }
+        payload.hop_id = recv_node;
+        payload.hop_ns = 0;
+        now = 0;
+    }
+    if (probe == NULL || payload.step == 0 || payload.step > AXTR_MAX_HOPS) {
+        IPRINTF(verbose, "unexpected reply from node %u", recv_node);
+        return 1;
+    }
+
+    hop = &probe->hop[payload.step];
+    if (!hop->seen) {
+        hop->seen = 1;
+        probe->received++;
+    }
+    hop->node_id = payload.hop_id;
+    hop->rtt_ns = now ? now - probe->send_ns : 0;
+    hop->hop_ns = payload.hop_ns;
+
+    /* last node reply contains the number of steps */
+    if (recv_node == probe->dst_id) {
+        probe->hops = payload.step;
+    }
+
+    return 1;
 }
 
+static int
+axtr_pending(void)
+{
+    int i, pending = 0;
+
+    for (i = 0; i < num_probes; i++) {
+        if (probes[i].hops == 0 || probes[i].received < probes[i].hops)
+            pending++;
+    }
+
+    return pending;
+}
+
+static void
+axtr_print_probe(axiom_node_id_t node_id, axtr_probe_t *probe, int synced)
+{
+    axtr_hop_t *hop, *prev;
+    int last, step;
+
+    printf("Node %u, traceroute to node %u via interface %u\n", node_id,
+            probe->dst_id, probe->if_id);
+
+    last = probe->hops ? probe->hops : AXTR_MAX_HOPS;
+    for (step = 1; step <= last; step++) {
+        hop = &probe->hop[step];
+        prev = &probe->hop[step - 1];
+
+        if (!hop->seen) {
+            if (probe->hops)
+                printf("%3d  -  *\n", step);
+            continue;
+        }
+
+        printf("%3d  -  node %-3u", step, hop->node_id);
+        if (hop->rtt_ns) {
+            /* latency added by the hop: difference of the round trip */
+            printf("  rtt %8.3f ms", nsec2msec(hop->rtt_ns));
+            if (step == 1 || prev->rtt_ns)
+                printf("  hop %+8.3f ms",
+                        nsec2msec(hop->rtt_ns) - nsec2msec(prev->rtt_ns));
+        }
+        if (synced && hop->hop_ns) {
+            if (step == 1)
+                printf("  one-way %8.3f ms",
+                        axtr_delta_ms(hop->hop_ns, probe->send_rt_ns));
+            else if (prev->hop_ns)
+                printf("  one-way %8.3f ms",
+                        axtr_delta_ms(hop->hop_ns, prev->hop_ns));
+        }
+        printf("\n");
+    }
+
+    if (probe->hops && probe->received >= probe->hops) {
+        printf("--- %u hops to reach node %u ---\n\n", probe->hops,
+                probe->dst_id);
+    } else {
+        printf("--- node %u not reached: %d replies ---\n\n", probe->dst_id,
+                probe->received);
+    }
+}
 
 int
 main(int argc, char **argv)
 {
     axiom_dev_t *dev = NULL;
-    axiom_node_id_t dest_node, recv_node = 0, node_id;
-    axiom_if_id_t if_id;
-    axiom_err_t err, msg_err;
-    axiom_port_t port;
-    axiom_type_t type;
-    axiom_traceroute_payload_t payload, recv_payload;
-    uint8_t received_reply = 0, expected_reply = 0;
-    int dest_node_ok = 0;
+    axiom_args_t axiom_args;
+    axiom_node_id_t dest_node = 0, node_id;
+    axiom_if_id_t if_mask;
+    axiom_err_t err;
+    double timeout = 1;
+    uint64_t deadline;
+    int dest_node_ok = 0, all = 0, multipath = 0, synced = 0;
     int long_index =0;
     int opt = 0;
-    int recv_err;
+    int ret = -1, recv_ret, i;
     static struct option long_options[] = {
         {"dest", required_argument, 0, 'd'},
+        {"all", no_argument, 0, 'a'},
+        {"multipath", no_argument, 0, 'm'},
+        {"timeout", required_argument, 0, 'W'},
+        {"synced", no_argument, 0, 's'},
         {"verbose", no_argument, 0, 'v'},
         {"version", no_argument, 0, 'V'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
 
-    while ((opt = getopt_long(argc, argv,"vhd:V",
+    while ((opt = getopt_long(argc, argv,"vhd:amW:sV",
                          long_options, &long_index )) != -1) {
         switch (opt) {
             case 'd' :
@@ -107,6 +333,26 @@ main(int argc, char **argv)
                 dest_node_ok = 1;
                 break;
 
+            case 'a':
+                all = 1;
+                break;
+
+            case 'm':
+                multipath = 1;
+                break;
+
+            case 'W':
+                if (sscanf(optarg, "%lf", &timeout) != 1 || timeout <= 0) {
+                    EPRINTF("wrong timeout");
+                    usage();
+                    exit(-1);
+                }
+                break;
+
+            case 's':
+                synced = 1;
+                break;
+
             case 'v':
                 verbose = 1;
                 break;
@@ -123,13 +369,14 @@ main(int argc, char **argv)
     }
 
     /* check if dest_node parameter has been inserted */
-    if (dest_node_ok != 1) {
+    if (dest_node_ok != 1 && !all) {
         usage();
         exit(-1);
     }
 
-    /* open the axiom device */
-    dev = axiom_open(NULL);
+    /* open the axiom device: the replies are polled until the timeout */
+    axiom_args.flags = AXIOM_FLAG_NOBLOCK;
+    dev = axiom_open(&axiom_args);
     if (dev == NULL) {
         perror("axiom_open()");
         exit(-1);
@@ -141,57 +388,44 @@ main(int argc, char **argv)
     err = axiom_bind(dev, AXIOM_RAW_PORT_NETUTILS);
     if (err != AXIOM_RAW_PORT_NETUTILS) {
         EPRINTF("axiom_bind error");
-        exit(-1);
-    }
-
-    /* get interface to reach next hop for dest_node */
-    err = axiom_next_hop(dev, dest_node, &if_id);
-    if (!AXIOM_RET_IS_OK(err)) {
-        EPRINTF("node[%u] is unreachable", dest_node);
-        exit(-1);
-    }
-
-    printf("Node %u, start traceroute to node %u, %d hops max\n", node_id,
-            dest_node, AXIOM_NODES_MAX);
-
-    type = AXIOM_TYPE_RAW_NEIGHBOUR;
-    port = AXIOM_RAW_PORT_INIT;
-    payload.command = AXIOM_CMD_TRACEROUTE;
-    payload.src_id = node_id;
-    payload.dst_id = dest_node;
-    payload.step = 0;
-
-    /* send initial raw neighbour traceroute message */
-    msg_err = axiom_send_raw(dev, if_id, port, type, sizeof(payload),
-            &payload);
-
-    if (!AXIOM_RET_IS_OK(msg_err)) {
-        EPRINTF("send error");
         goto err;
     }
 
-    expected_reply = AXIOM_NODES_MAX;
-    do {
-        recv_err = recv_tracereoute_reply(dev, &recv_node, &port,
-                &type, &recv_payload);
-        if (recv_err == -1) {
-            goto err;
-        }
-        received_reply++;
-        printf("%u  -  node %u\n", recv_payload.step, recv_node);
-
-        /* last node reply contains the number of steps */
-        if (recv_node == dest_node) {
-            expected_reply = recv_payload.step;
+    if (all) {
+        printf("Node %u, start traceroute to all nodes, %d hops max\n\n",
+                node_id, AXTR_MAX_HOPS);
+        for (i = 0; i < AXIOM_NODES_NUM; i++) {
+            if (i == node_id)
+                continue;
+            err = axiom_get_routing(dev, i, &if_mask);
+            if (!AXIOM_RET_IS_OK(err) || if_mask == 0)
+                continue;
+            axtr_send_probes(dev, node_id, i, multipath);
         }
+    } else {
+        printf("Node %u, start traceroute to node %u, %d hops max\n\n",
+                node_id, dest_node, AXTR_MAX_HOPS);
+        if (axtr_send_probes(dev, node_id, dest_node, multipath))
+            goto err;
+    }
 
-    } while (received_reply < expected_reply);
+    deadline = axtr_now() + timeout * 1e9;
+    while (axtr_pending() > 0 && axtr_now() < deadline) {
+        recv_ret = axtr_recv_reply(dev);
+        if (recv_ret < 0)
+            goto err;
+        if (recv_ret == 0)
+            sched_yield();
+    }
 
-    printf("\n--- %u hops to reach node %u ---\n", received_reply, dest_node);
+    for (i = 0; i < num_probes; i++) {
+        axtr_print_probe(node_id, &probes[i], synced);
+    }
+    ret = axtr_pending() > 0 ? 1 : 0;
 
 err:
     axiom_close(dev);
 
-    return 0;
+    return ret;
 
 }
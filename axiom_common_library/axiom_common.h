@@ -30,9 +30,23 @@ extern "C" {
 #include <stdlib.h>
 #include <time.h>
 
+    /** Branch prediction hints. */
+#ifndef likely
+#define likely(x) __builtin_expect(!!(x),1)
+#endif
+#ifndef unlikely
+#define unlikely(x) __builtin_expect(!!(x),0)
+#endif
+
     /* If compiled with NLOG the logging subsystem will be discharged. 
      * Note that the overhead of not disabling is a machine test istruction for every possibly message to emit.
      * (so should be irrilevant).
+     * To discharge only some messages compile with (i.e. into DFLAGS):
+     * - AXIOM_LOG_BUILD_LEVEL the most verbose level compiled (i.e. -DAXIOM_LOG_BUILD_LEVEL=LOG_INFO
+     *   removes the LOG_DEBUG and LOG_TRACE messages; default LOG_TRACE)
+     * - AXIOM_LOG_BUILD_ZONES the mask of the zones compiled (default all)
+     * The runtime level and zones (logmsg_level and logmsg_zones) are still used
+     * for the messages compiled.
      */
 
 #ifdef NLOG
@@ -45,6 +59,8 @@ extern "C" {
 #define logmsg(lvl, msg, ...)
 #define  _logmsg(lvl, msg, ...)
 #define logmsg_init()
+#define logmsg_flush()
+#define logmsg_trace_to(filename, size) (-1)
 #define logmsg_to(pathanme)
 #define logmsg_to_console()
 #define lassert(x) assert(x)
@@ -54,6 +70,13 @@ extern "C" {
 
 #else
 
+#ifndef AXIOM_LOG_BUILD_LEVEL
+#define AXIOM_LOG_BUILD_LEVEL LOG_TRACE
+#endif
+#ifndef AXIOM_LOG_BUILD_ZONES
+#define AXIOM_LOG_BUILD_ZONES 0xffffffff
+#endif
+
     /**
      * Level of logging.
      */
@@ -71,10 +94,12 @@ extern "C" {
     extern int logmsg_level;
     extern pid_t logmsg_pid;
     extern int logmsg_zones;
+    extern int logmsg_trace;
 
     /**
      * Emit a log message.
-     * Used internally.
+     * The message is queued in a buffer of the calling thread and written
+     * by a background thread. Used internally.
      * @param msg printf syle message.
      * @param ... parameters for the printf.
      */
@@ -89,19 +114,32 @@ extern "C" {
      */
     void _slogmsg(char *msg, ...) __attribute__((format(printf, 1, 2)));
 
+    /**
+     * Record a log message in the binary trace file.
+     * Used internally.
+     *
+     * @param fid Format id of the call site (-1 not yet registered).
+     * @param lvl The level.
+     * @param msg printf style message.
+     * @param ... parameters for the printf.
+     */
+    void _tlogmsg(int *fid, int lvl, const char *msg, ...) __attribute__((format(printf, 3, 4)));
+
     /**
      * Test if a log level is enabled.
+     * A constant level above AXIOM_LOG_BUILD_LEVEL is false at compile time.
      * @param lvl the level to test
      * @return 1 if enabled.
      */
-#define logmsg_is_enabled(lvl) ((lvl)<=logmsg_level)
+#define logmsg_is_enabled(lvl) ((lvl)<=AXIOM_LOG_BUILD_LEVEL&&(lvl)<=logmsg_level)
 
     /**
      * Test if a log level is enabled on a zone.
+     * A constant zone out of AXIOM_LOG_BUILD_ZONES is false at compile time.
      * @param lvl the level to test
      * @zone the zone to test
      */
-#define logmsg_is_zenabled(lvl,zone) ((logmsg_zones&(zone))&&logmsg_is_enabled(lvl))
+#define logmsg_is_zenabled(lvl,zone) (((zone)&AXIOM_LOG_BUILD_ZONES)&&(logmsg_zones&(zone))&&logmsg_is_enabled(lvl))
 
 
     /**
@@ -113,10 +151,15 @@ extern "C" {
      * @param ... the parameters for the printf
      */
 #define zlogmsg(lvl, zone, msg, ...) {\
-  if (logmsg_is_zenabled(lvl,zone)) {\
-    struct timespec _t0;\
-    clock_gettime(CLOCK_REALTIME_COARSE,&_t0);\
-    _logmsg("[%5d.%06d] %5s{%d}: " msg "\n", (int)(_t0.tv_sec % 10000), (int)_t0.tv_nsec/1000, logmsg_name[lvl], logmsg_pid, ##__VA_ARGS__);\
+  if (unlikely(logmsg_is_zenabled(lvl,zone))) {\
+    if (logmsg_trace) {\
+      static int _fid = -1;\
+      _tlogmsg(&_fid, lvl, msg "\n", ##__VA_ARGS__);\
+    } else {\
+      struct timespec _t0;\
+      clock_gettime(CLOCK_REALTIME_COARSE,&_t0);\
+      _logmsg("[%5d.%06d] %5s{%d}: " msg "\n", (int)(_t0.tv_sec % 10000), (int)_t0.tv_nsec/1000, logmsg_name[lvl], logmsg_pid, ##__VA_ARGS__);\
+    }\
   }\
 }
 
@@ -130,7 +173,7 @@ extern "C" {
      * @param ... the parameters for the printf
      */
 #define szlogmsg(lvl, zone, msg, ...) {\
-  if (logmsg_is_zenabled(lvl,zone)) {\
+  if (unlikely(logmsg_is_zenabled(lvl,zone))) {\
     struct timespec _t0;\
     clock_gettime(CLOCK_REALTIME_COARSE,&_t0);\
     _slogmsg("[%5d.%06d] %5s{%d}: " msg "\n", (int)(_t0.tv_sec % 1000), (int)_t0.tv_nsec/1000, logmsg_name[lvl], logmsg_pid, ##__VA_ARGS__);\
@@ -187,9 +230,27 @@ extern "C" {
      * - AXIOM_LOG_LEVEL the log level to enable (log_level_t without the LOG_ part)
      * - AXIOM_LOG_ZONE the zones to enabled (integer bitwise)
      * - AXIOM_LOG_FILE the file where to emit mlog messages
+     * - AXIOM_LOG_TRACE the binary trace file (axiom_logtrace.h) where to
+     *   record the messages instead of AXIOM_LOG_FILE ("%ld" is the pid,
+     *   ".<pid>" is appended without it)
+     * - AXIOM_LOG_TRACE_SIZE the size of the binary trace file (MB)
      */
     void logmsg_init();
 
+    /**
+     * Record the log messages in a binary trace file.
+     * @param filename The trace file.
+     * @param size Size of the records area of the file.
+     * @return 0 on success.
+     */
+    int logmsg_trace_to(char *filename, size_t size);
+
+    /**
+     * Write all the queued log messages.
+     * Called at exit; to be called before terminating with _exit() or exec().
+     */
+    void logmsg_flush();
+
     /**
      * Redirect the log output to a file.
      * @param pathanme The file to log into.
@@ -267,10 +328,17 @@ extern "C" {
     /* */
     /* */
 
-    /** A structure to implement a variable list of string. */
+    /**
+     * A structure to implement a variable list of string.
+     * The array of pointers and the copies of the strings are in a single
+     * growable block (data).
+     */
     typedef struct strlist {
         int size; /**< Size of data (i.e. how many pointer it has) */
-        char **data; /**< Array of pointers to string.*/
+        char **data; /**< Array of pointers to string (start of the block).*/
+        int capacity; /**< Pointers of the block. */
+        size_t strsize; /**< Bytes of the block for the strings (after the pointers). */
+        size_t strused; /**< Bytes used by the strings. */
     } strlist_t;
 
     /**
@@ -294,7 +362,7 @@ extern "C" {
     void sl_append(strlist_t *p, char *s);
 
     /**
-     * Insert all the string to the head of the list.
+     * Insert all the string to the head of the list (in the same order).
      * @param p The list.
      * @param args The array of string (last element MUST BE a NULL).
      */
@@ -329,34 +397,69 @@ extern "C" {
     /* */
 
     /**
-     * Struct used for fork/join process synchornization
+     * Struct used for fork/join process synchornization.
+     * A semaphore (sync_open) or a latch (sync_latch_open) shared with the
+     * forked processes: the waiters sleep on a futex, no polling.
      */
     typedef struct {
-        int smfd;
+        int smfd; /** eventfd used to sleep if futex are not available (else -1) */
         int *smptr; /** pointer to a inter-process shared memory region */
     } sync_t ;
 
     /**
-     * Open and initilize the sync structure.
+     * Open and initilize the sync structure as a semaphore with value 0.
+     * Must be called before fork() to be shared.
      * @param sync The sync structure.
      * @return 0 success, -1 error
      */
     int sync_open(sync_t *sync);
 
     /**
-     * Wait (active) for a wake up.
+     * Wait for a wake up (decrement the semaphore).
      * @param sync The sync structure.
      * @return 0 success, -1 error
      */
     int sync_wait(sync_t *sync);
 
     /**
-     * Wakeup a wainting process on sync_wait().
+     * Wait for a wake up (decrement the semaphore) with a timeout.
+     * @param sync The sync structure.
+     * @param timeout_ms Timeout in milliseconds (-1 no timeout).
+     * @return 0 success, -1 error (errno=ETIMEDOUT on timeout)
+     */
+    int sync_timedwait(sync_t *sync, int timeout_ms);
+
+    /**
+     * Wakeup a wainting process on sync_wait() (increment the semaphore).
      * @param sync The sync structure.
      * @return 0 success, -1 error
      */
     int sync_wakeup(sync_t *sync);
 
+    /**
+     * Open and initilize the sync structure as a latch.
+     * Must be called before fork() to be shared.
+     * @param sync The sync structure.
+     * @param count Number of sync_countdown() that open the latch.
+     * @return 0 success, -1 error
+     */
+    int sync_latch_open(sync_t *sync, int count);
+
+    /**
+     * Decrement the latch; wake up all the waiters when it reaches zero.
+     * @param sync The sync structure.
+     * @return 0 success, -1 error
+     */
+    int sync_countdown(sync_t *sync);
+
+    /**
+     * Wait for the latch to reach zero.
+     * @param sync The sync structure.
+     * @param timeout_ms Timeout in milliseconds (-1 no timeout).
+     * @return 0 success, -1 error (errno=ETIMEDOUT on timeout)
+     */
+    int sync_latch_wait(sync_t *sync, int timeout_ms);
+
     /**
      * Release sync_t resources.
      * @param sync The sync structure.
@@ -372,6 +475,9 @@ extern "C" {
      * The semantic of exec, args, env are the same of execvpe().
      * If 'exec' is NULL then no new program is executed so the function return a pid_t of zero into the new daemonized process.
      * So if 'exec' is NULL the 'args' and 'env' parameters are ignored.
+     * If 'exec' is not NULL and 'sync' is NULL the process is created with posix_spawn()
+     * (the page tables of the caller are not copied) and an exec failure is returned;
+     * AXIOM_DAEMONIZE=fork in the environment forces fork().
      *
      * @param cwd The working directory where to run (can be null).
      * @param exec The executable (can be null).
@@ -386,6 +492,71 @@ extern "C" {
     pid_t daemonize(char *cwd, char *exec, char **args, char **env, int *pipefd, int newsession, int verbose, sync_t *sync);
 
 
+    /* */
+    /* */
+    /* memory zone functions (i.e. for RDMA zones) */
+    /* */
+    /* */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+    /** Size of the chunks hashed independently by axmem_digest(). */
+#define AXMEM_DIGEST_CHUNK (1024*1024)
+
+    /**
+     * Fill a memory zone with a 64 bits pattern.
+     * The pattern is written with aligned 64 bits (or vector) stores, so the
+     * byte at address 'a' is the byte 'a%8' of the pattern in memory order;
+     * so a zone of uncached memory (RDMA zone) must be 8 bytes aligned.
+     * SSE2/AVX2/NEON kernels are used if enabled at compile time.
+     *
+     * @param dst The memory zone.
+     * @param pattern The pattern.
+     * @param size The size of the zone in bytes.
+     * @param threads Number of threads to use on large zones (<=0 means the number of online cpus).
+     */
+    void axmem_fill64(void *dst, uint64_t pattern, size_t size, int threads);
+
+    /**
+     * Fill a memory zone with a pseudo random sequence of 64 bits words.
+     * Every word depends on the seed and on its offset in the zone, so a
+     * misplaced block is detected by axmem_digest().
+     * The zone must be 8 bytes aligned.
+     *
+     * @param dst The memory zone.
+     * @param seed The seed of the sequence.
+     * @param size The size of the zone in bytes.
+     * @param threads Number of threads to use on large zones (<=0 means the number of online cpus).
+     */
+    void axmem_fill_seq64(void *dst, uint64_t seed, size_t size, int threads);
+
+    /**
+     * Verify that a memory zone is filled with a 64 bits pattern.
+     * The zone must be filled as axmem_fill64() does.
+     *
+     * @param src The memory zone.
+     * @param pattern The pattern.
+     * @param size The size of the zone in bytes.
+     * @param threads Number of threads to use on large zones (<=0 means the number of online cpus).
+     * @return -1 if the zone is valid otherwise the offset of the first wrong byte.
+     */
+    ssize_t axmem_verify64(const void *src, uint64_t pattern, size_t size, int threads);
+
+    /**
+     * Compute a 64 bits digest of a memory zone.
+     * Every AXMEM_DIGEST_CHUNK bytes of the zone are hashed with xxHash64 (in parallel) and the
+     * chunk hashes are combined in order, so the result does not depend on the number of threads.
+     * The zone must be 8 bytes aligned.
+     *
+     * @param src The memory zone.
+     * @param size The size of the zone in bytes.
+     * @param seed The digest seed.
+     * @param threads Number of threads to use on large zones (<=0 means the number of online cpus).
+     * @return The digest.
+     */
+    uint64_t axmem_digest(const void *src, size_t size, uint64_t seed, int threads);
+
     /* */
     /* */
     /* scheduling functions */
@@ -399,6 +570,31 @@ extern "C" {
     int sch_encodeopt(char *buf, int bufsize);
     int sch_setsched();
 
+    /**
+     * Set the scheduling parameters and the placement (cpus and memory
+     * nodes, see --sched ...@ROLE=CPUS:MEMS) of the calling thread.
+     * @param role The role of the thread; if it has no placement the one of
+     *             '*' is used (NULL means only '*').
+     * @return 0 on success, -1 on failure.
+     */
+    int sch_setsched_role(const char *role);
+
+    /**
+     * Set only the placement of the calling thread. If the role has no
+     * placement, the initial cpus and the default memory policy are restored.
+     * It is inherited by the processes created by the thread.
+     * @param role The role of the thread (NULL means '*').
+     * @return 0 on success, -1 on failure.
+     */
+    int sch_setplacement(const char *role);
+
+    /**
+     * Check if a role has a placement.
+     * @param role The role (NULL means '*').
+     * @return true if the role (or '*') has a placement.
+     */
+    int sch_hasplacement(const char *role);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,229 @@
+/*!
+ * \file axiom_counters.h
+ *
+ * \version     v1.2
+ *
+ * Hot-path performance counters and latency histograms.
+ * Every thread updates its own cache line aligned block of a per-process
+ * shared memory segment (/dev/shm/axiom-stat.<name>.<pid>) without locks or
+ * atomic read-modify-write; axiom-stat maps the segment and sums the blocks
+ * while the process runs.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#ifndef AXIOM_COUNTERS_H
+#define AXIOM_COUNTERS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+    /** Magic of the segment. */
+#define AXSTAT_MAGIC "AXSTAT"
+    /** Version of the segment. */
+#define AXSTAT_VERSION 1
+    /** Directory and prefix of the segments. */
+#define AXSTAT_DIR "/dev/shm"
+#define AXSTAT_PREFIX "axiom-stat."
+    /** Max length of the metric and process names (with '\0'). */
+#define AXSTAT_NAME_SIZE 32
+    /** Max counters of a process. */
+#define AXSTAT_MAX_COUNTERS 64
+    /** Max histograms of a process. */
+#define AXSTAT_MAX_HISTS 16
+    /** Max threads of a process (the others are not counted). */
+#define AXSTAT_MAX_THREADS 64
+    /** Sub-buckets for every power of two of the histograms. */
+#define AXSTAT_HIST_SUB_BITS 2
+#define AXSTAT_HIST_SUB (1 << AXSTAT_HIST_SUB_BITS)
+    /** Buckets of a histogram (values up to 2^33, about 8 s in ns). */
+#define AXSTAT_HIST_BUCKETS 128
+
+    /** Metric types. */
+    typedef enum {
+        AXSTAT_NONE = 0,
+        AXSTAT_COUNTER = 1, /**< Counter (sum of the values). */
+        AXSTAT_HIST = 2 /**< Histogram of latencies (ns). */
+    } axstat_type_t;
+
+    /** Name of a metric, index of the counter or of the histogram. */
+    typedef struct {
+        char name[AXSTAT_NAME_SIZE];
+        uint32_t type; /**< axstat_type_t, written last. */
+        uint32_t slot;
+    } axstat_metric_t;
+
+    /** Log-linear histogram. */
+    typedef struct {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+        uint64_t bucket[AXSTAT_HIST_BUCKETS];
+    } axstat_hist_t;
+
+    /** Block of a thread (only the thread writes it). */
+    typedef struct {
+        int32_t tid; /**< Thread id, written last (0 if unused). */
+        char name[16]; /**< Thread name (pthread_getname_np). */
+        uint64_t counter[AXSTAT_MAX_COUNTERS];
+        axstat_hist_t hist[AXSTAT_MAX_HISTS];
+    } __attribute__((aligned(64))) axstat_thread_t;
+
+    /** The shared memory segment. */
+    typedef struct {
+        char magic[8];
+        uint32_t version;
+        int32_t pid;
+        char name[AXSTAT_NAME_SIZE]; /**< Process name (axstat_init). */
+        uint64_t start_ns; /**< CLOCK_MONOTONIC of axstat_init. */
+        uint32_t num_metrics;
+        uint32_t num_counters;
+        uint32_t num_hists;
+        uint32_t num_threads;
+        axstat_metric_t metric[AXSTAT_MAX_COUNTERS + AXSTAT_MAX_HISTS];
+        axstat_thread_t thread[AXSTAT_MAX_THREADS];
+    } axstat_shm_t;
+
+    extern axstat_shm_t *axstat_shm;
+    extern __thread axstat_thread_t *axstat_self;
+
+#ifndef NSTAT
+
+    /**
+     * Create the shared memory segment of the process.
+     * Does nothing if AXIOM_STAT is set to 0 in the environment.
+     * @param name The process name shown by axiom-stat.
+     * @return 0 on success, -1 on error (the metrics are disabled).
+     */
+    int axstat_init(const char *name);
+
+    /**
+     * Register a counter; registering an existing name returns its id.
+     * @param name The name of the counter.
+     * @return The counter id, -1 if the metrics are disabled or full.
+     */
+    int axstat_counter(const char *name);
+
+    /**
+     * Register a histogram; registering an existing name returns its id.
+     * @param name The name of the histogram.
+     * @return The histogram id, -1 if the metrics are disabled or full.
+     */
+    int axstat_histogram(const char *name);
+
+    /**
+     * Block of the calling thread, allocated on first use.
+     * @return The block, NULL if the metrics are disabled or full.
+     */
+    axstat_thread_t *axstat_thread(void);
+
+    /**
+     * Bucket of a histogram value: values below AXSTAT_HIST_SUB have their own
+     * bucket, then every power of two is split in AXSTAT_HIST_SUB buckets.
+     */
+    static inline int axstat_bucket(uint64_t v) {
+        int e, b;
+
+        if (v < AXSTAT_HIST_SUB) return v;
+        e = 63 - __builtin_clzll(v);
+        b = ((e - AXSTAT_HIST_SUB_BITS + 1) << AXSTAT_HIST_SUB_BITS) +
+                ((v >> (e - AXSTAT_HIST_SUB_BITS)) & (AXSTAT_HIST_SUB - 1));
+        return b < AXSTAT_HIST_BUCKETS ? b : AXSTAT_HIST_BUCKETS - 1;
+    }
+
+    /** Lower bound of the values of a bucket. */
+    static inline uint64_t axstat_bucket_value(int b) {
+        int e;
+
+        if (b < AXSTAT_HIST_SUB) return b;
+        e = (b >> AXSTAT_HIST_SUB_BITS) + AXSTAT_HIST_SUB_BITS - 1;
+        return (uint64_t) (AXSTAT_HIST_SUB + (b & (AXSTAT_HIST_SUB - 1))) << (e - AXSTAT_HIST_SUB_BITS);
+    }
+
+    /** Single writer update, readable by axiom-stat. */
+    static inline void axstat_inc(uint64_t *p, uint64_t v) {
+        __atomic_store_n(p, *p + v, __ATOMIC_RELAXED);
+    }
+
+    /**
+     * Add a value to a counter of the calling thread.
+     * @param id The counter id (-1 is ignored).
+     * @param v The value.
+     */
+    static inline void axstat_add(int id, uint64_t v) {
+        axstat_thread_t *t = axstat_self;
+
+        if (id < 0) return;
+        if (t == NULL && (t = axstat_thread()) == NULL) return;
+        axstat_inc(&t->counter[id], v);
+    }
+
+    /**
+     * Record a latency in a histogram of the calling thread.
+     * @param id The histogram id (-1 is ignored).
+     * @param ns The latency (ns).
+     */
+    static inline void axstat_record(int id, uint64_t ns) {
+        axstat_thread_t *t = axstat_self;
+        axstat_hist_t *h;
+
+        if (id < 0) return;
+        if (t == NULL && (t = axstat_thread()) == NULL) return;
+        h = &t->hist[id];
+        axstat_inc(&h->bucket[axstat_bucket(ns)], 1);
+        axstat_inc(&h->sum, ns);
+        if (ns > h->max) __atomic_store_n(&h->max, ns, __ATOMIC_RELAXED);
+        /* count last: the readers use it to compute the averages */
+        axstat_inc(&h->count, 1);
+    }
+
+    /** CLOCK_MONOTONIC (ns). */
+    static inline uint64_t axstat_now(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    /** Timer of AXSTAT_SCOPE(). */
+    typedef struct {
+        int id;
+        uint64_t start;
+    } axstat_timer_t;
+
+    static inline void axstat_timer_end(axstat_timer_t *t) {
+        if (t->id >= 0) axstat_record(t->id, axstat_now() - t->start);
+    }
+
+#define _AXSTAT_CAT(a, b) a ## b
+#define _AXSTAT_NAME(a, b) _AXSTAT_CAT(a, b)
+
+    /**
+     * Record in the histogram id the time spent from here to the end of the
+     * enclosing block (also leaving it with return, break or continue).
+     */
+#define AXSTAT_SCOPE(id) \
+    axstat_timer_t _AXSTAT_NAME(_axstat_timer_, __LINE__) \
+    __attribute__((cleanup(axstat_timer_end), unused)) = \
+        { (id), (id) >= 0 ? axstat_now() : 0 }
+
+#else /* NSTAT */
+
+#define axstat_init(name) (-1)
+#define axstat_counter(name) (-1)
+#define axstat_histogram(name) (-1)
+#define axstat_add(id, v) do { (void) (id); (void) (v); } while (0)
+#define axstat_record(id, ns) do { (void) (id); (void) (ns); } while (0)
+#define AXSTAT_SCOPE(id) do { (void) (id); } while (0)
+
+#endif /* NSTAT */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,92 @@
+/*!
+ * \file axiom_logtrace.h
+ *
+ * \version     v1.2
+ *
+ * Binary trace file of the logging subsystem.
+ * With AXIOM_LOG_TRACE set, the enabled zlogmsg()/logmsg() messages are not
+ * formatted: the id of the format string, the timestamp, the thread id and
+ * the raw arguments are appended to a per-process mmap'd file, decoded
+ * offline by axiom-logdecode.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#ifndef AXIOM_LOGTRACE_H
+#define AXIOM_LOGTRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+    /** Magic of the trace file. */
+#define LOGTRACE_MAGIC "AXTRACE"
+    /** Version of the trace file. */
+#define LOGTRACE_VERSION 1
+    /** Size of the file header (the records start here). */
+#define LOGTRACE_HEADER_SIZE 4096
+    /** Default size of the records area (MB, AXIOM_LOG_TRACE_SIZE). */
+#define LOGTRACE_DEF_SIZE_MB 64
+    /** Max arguments of a message. */
+#define LOGTRACE_MAX_ARGS 16
+    /** Max bytes of a string argument. */
+#define LOGTRACE_MAX_STR 128
+
+    /** Record types. */
+    typedef enum {
+        LOGTRACE_NONE = 0, /**< Reserved but not written (yet). */
+        LOGTRACE_FMT = 1, /**< Format: argument types and format string. */
+        LOGTRACE_MSG = 2 /**< Message: raw arguments. */
+    } logtrace_type_t;
+
+    /**
+     * Argument types (one char for every argument in the types string):
+     * 'i' int32, 'l' int64, 'f' double, 'F' long double (stored as double),
+     * 'p' pointer (int64), 's' string (uint16 length and the bytes),
+     * 'n' pointer not stored (%n).
+     */
+
+    /** Header of the trace file. */
+    typedef struct {
+        char magic[8];
+        uint32_t version;
+        uint32_t header_size;
+        uint64_t size; /**< Size of the records area. */
+        uint64_t used; /**< Bytes reserved (can exceed size). */
+        uint64_t dropped; /**< Messages not recorded (file full). */
+        uint32_t next_fid; /**< Next format id. */
+        int32_t pid;
+    } logtrace_hdr_t;
+
+    /**
+     * Header of a record (8 bytes aligned).
+     * LOGTRACE_FMT: the types string and the format string follow.
+     * LOGTRACE_MSG: the arguments follow (unaligned, in order).
+     */
+    typedef struct {
+        uint8_t type; /**< logtrace_type_t, written last. */
+        uint8_t level;
+        uint16_t size; /**< Size of the record. */
+        uint32_t fid; /**< Format id. */
+        uint32_t tid; /**< Thread id. */
+        uint32_t spare;
+        uint64_t ts; /**< CLOCK_REALTIME (ns). */
+    } logtrace_rec_t;
+
+    /**
+     * Find the next conversion of a printf format.
+     * @param p The format.
+     * @param spec Start of the conversion ('%').
+     * @param types Types of the arguments consumed (at least 3 chars, see above).
+     * @param ntypes Number of arguments consumed (0 for "%%" and "%m").
+     * @return The format after the conversion, NULL if there are no conversions.
+     */
+    const char *logtrace_conv(const char *p, const char **spec, char *types, int *ntypes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,202 @@
+/*!
+ * \file axiom_reactor.h
+ *
+ * \version     v1.2
+ *
+ * Single thread event loop (reactor) built on epoll.
+ * A reactor dispatches to callbacks the events of file descriptors (level
+ * or edge triggered), the expired timers (a timer wheel with a tick of
+ * REACTOR_TICK_MS), the functions posted by other threads (through an
+ * eventfd) and the signals (through a signalfd). Every callback runs in the
+ * thread of reactor_run(). Optionally the loop polls for a while before
+ * sleeping (see reactor_set_busypoll()).
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#ifndef AXIOM_REACTOR_H
+#define AXIOM_REACTOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+    /** Tick of the timer wheel (msec). */
+#define REACTOR_TICK_MS 1
+    /** Slots of the timer wheel (power of two). */
+#define REACTOR_WHEEL_SIZE 256
+    /** Max events dispatched for every wakeup. */
+#define REACTOR_MAX_EVENTS 32
+
+    /** reactor_add_fd() flag: edge triggered (the callback must read until EAGAIN). */
+#define REACTOR_EDGE 0x01
+
+    /** A reactor (opaque). */
+    typedef struct reactor reactor_t;
+    /** A timer of a reactor (opaque). */
+    typedef struct reactor_timer reactor_timer_t;
+
+    /**
+     * Called when a file descriptor is ready.
+     * @param r The reactor.
+     * @param fd The file descriptor.
+     * @param events The epoll events (EPOLLIN, EPOLLOUT, EPOLLERR, EPOLLHUP...).
+     * @param arg The argument of reactor_add_fd().
+     */
+    typedef void (*reactor_fd_cb_t)(reactor_t *r, int fd, uint32_t events, void *arg);
+
+    /**
+     * Called when a timer expires or for a posted function.
+     * @param r The reactor.
+     * @param arg The argument of reactor_add_timer() or reactor_post().
+     */
+    typedef void (*reactor_cb_t)(reactor_t *r, void *arg);
+
+    /**
+     * Called when a signal is received.
+     * @param r The reactor.
+     * @param si The signal information.
+     * @param arg The argument of reactor_add_signal().
+     */
+    typedef void (*reactor_signal_cb_t)(reactor_t *r, const struct signalfd_siginfo *si, void *arg);
+
+    /** Counters of a reactor (see reactor_get_stats()). */
+    typedef struct {
+        uint64_t polled;    /**< wakeups found by busy polling */
+        uint64_t slept;     /**< wakeups after sleeping in epoll_wait() */
+        uint64_t poll_ns;   /**< current busy-poll time */
+        uint64_t timers;    /**< timers expired */
+        uint64_t posted;    /**< functions posted */
+    } reactor_stats_t;
+
+    /**
+     * Create a reactor.
+     * @return The reactor or NULL on error (errno is set).
+     */
+    reactor_t *reactor_create(void);
+
+    /**
+     * Destroy a reactor.
+     * The file descriptors added are not closed; the timers and the posted
+     * functions not yet called are released.
+     * @param r The reactor.
+     */
+    void reactor_destroy(reactor_t *r);
+
+    /**
+     * Watch a file descriptor.
+     * @param r The reactor.
+     * @param fd The file descriptor.
+     * @param events The epoll events to watch (i.e. EPOLLIN).
+     * @param flags 0 or REACTOR_EDGE.
+     * @param cb The callback.
+     * @param arg The argument of the callback.
+     * @return 0 on success, -1 on error (errno is set).
+     */
+    int reactor_add_fd(reactor_t *r, int fd, uint32_t events, int flags, reactor_fd_cb_t cb, void *arg);
+
+    /**
+     * Stop watching a file descriptor.
+     * Can be called from a callback (also for the fd of the callback).
+     * @param r The reactor.
+     * @param fd The file descriptor.
+     * @return 0 on success, -1 on error (errno is set).
+     */
+    int reactor_del_fd(reactor_t *r, int fd);
+
+    /**
+     * Add a timer.
+     * @param r The reactor.
+     * @param ms The expiration (msec from now, rounded up to REACTOR_TICK_MS).
+     * @param periodic true to rearm the timer after every expiration.
+     * @param cb The callback.
+     * @param arg The argument of the callback.
+     * @return The timer or NULL on error (a one shot timer is released after
+     *         its callback).
+     */
+    reactor_timer_t *reactor_add_timer(reactor_t *r, unsigned ms, int periodic, reactor_cb_t cb, void *arg);
+
+    /**
+     * Cancel a timer.
+     * Can be called from a callback (also from the one of the timer).
+     * @param r The reactor.
+     * @param t The timer (released).
+     */
+    void reactor_del_timer(reactor_t *r, reactor_timer_t *t);
+
+    /**
+     * Call a function in the thread of the reactor.
+     * Thread safe.
+     * @param r The reactor.
+     * @param cb The function.
+     * @param arg The argument of the function.
+     * @return 0 on success, -1 on error.
+     */
+    int reactor_post(reactor_t *r, reactor_cb_t cb, void *arg);
+
+    /**
+     * Receive a signal with a callback.
+     * The signal is blocked in the calling thread (it should be blocked in
+     * all the threads, i.e. before they are created).
+     * @param r The reactor.
+     * @param signo The signal.
+     * @param cb The callback.
+     * @param arg The argument of the callback.
+     * @return 0 on success, -1 on error (errno is set).
+     */
+    int reactor_add_signal(reactor_t *r, int signo, reactor_signal_cb_t cb, void *arg);
+
+    /**
+     * Set the busy polling before sleeping.
+     * The polling time adapts: it grows when the events arrive shortly after
+     * going to sleep and shrinks when the idle periods are longer.
+     * @param r The reactor.
+     * @param usec Max polling time (0 to never poll).
+     */
+    void reactor_set_busypoll(reactor_t *r, unsigned usec);
+
+    /**
+     * Wait the events and call their callbacks (one wakeup).
+     * @param r The reactor.
+     * @return The number of events dispatched (0 if stopped), -1 on error.
+     */
+    int reactor_run_once(reactor_t *r);
+
+    /**
+     * Call reactor_run_once() until reactor_stop().
+     * @param r The reactor.
+     * @return 0 if stopped, -1 on error.
+     */
+    int reactor_run(reactor_t *r);
+
+    /**
+     * Stop reactor_run().
+     * Thread safe.
+     * @param r The reactor.
+     */
+    void reactor_stop(reactor_t *r);
+
+    /**
+     * Time of the last wakeup.
+     * @param r The reactor.
+     * @return The CLOCK_MONOTONIC time (nsec).
+     */
+    uint64_t reactor_woke(reactor_t *r);
+
+    /**
+     * Read the counters of a reactor.
+     * Thread safe.
+     * @param r The reactor.
+     * @param st Where to store the counters.
+     */
+    void reactor_get_stats(reactor_t *r, reactor_stats_t *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AXIOM_REACTOR_H */
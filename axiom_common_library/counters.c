@@ -0,0 +1,153 @@
+/*!
+ * \file counters.c
+ *
+ * \version     v1.2
+ *
+ * Hot-path performance counters and latency histograms (see axiom_counters.h).
+ *
+ * The metrics and the thread blocks are registered under a mutex, once; the
+ * updates are plain stores of the owner thread into its cache line aligned
+ * block. The segment is removed at exit; the forked children do not update
+ * it (they are usually exec'd).
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+// to use the pthread_getname_np() function
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "axiom_common.h"
+#include "axiom_counters.h"
+
+axstat_shm_t *axstat_shm = NULL;
+__thread axstat_thread_t *axstat_self = NULL;
+
+static pthread_mutex_t axstat_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char axstat_filename[256];
+static pid_t axstat_pid;
+
+static void axstat_atfork_child() {
+    /* the parent keeps updating its segment: stop here */
+    axstat_shm = NULL;
+    axstat_self = NULL;
+}
+
+static void axstat_exit() {
+    if (axstat_pid == getpid()) unlink(axstat_filename);
+}
+
+int axstat_init(const char *name) {
+    axstat_shm_t *shm;
+    char *env;
+    int fd;
+
+    env = getenv("AXIOM_STAT");
+    if (env != NULL && atoi(env) == 0) return -1;
+    if (axstat_shm != NULL) return 0;
+
+    axstat_pid = getpid();
+    snprintf(axstat_filename, sizeof (axstat_filename), "%s/%s%s.%d", AXSTAT_DIR,
+            AXSTAT_PREFIX, name, (int) axstat_pid);
+    fd = open(axstat_filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        logmsg(LOG_WARN, "unable to create %s", axstat_filename);
+        return -1;
+    }
+    if (ftruncate(fd, sizeof (axstat_shm_t)) == -1) {
+        close(fd);
+        unlink(axstat_filename);
+        return -1;
+    }
+    shm = mmap(NULL, sizeof (axstat_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        unlink(axstat_filename);
+        return -1;
+    }
+
+    /* the file is zeroed by ftruncate() */
+    shm->version = AXSTAT_VERSION;
+    shm->pid = axstat_pid;
+    strlcpy(shm->name, name, sizeof (shm->name));
+    shm->start_ns = axstat_now();
+    memcpy(shm->magic, AXSTAT_MAGIC, sizeof (AXSTAT_MAGIC));
+
+    pthread_atfork(NULL, NULL, axstat_atfork_child);
+    atexit(axstat_exit);
+    __atomic_store_n(&axstat_shm, shm, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static int axstat_register(const char *name, axstat_type_t type) {
+    axstat_shm_t *shm = __atomic_load_n(&axstat_shm, __ATOMIC_ACQUIRE);
+    axstat_metric_t *m;
+    uint32_t *num;
+    int i, max, id = -1;
+
+    if (shm == NULL) return -1;
+    num = type == AXSTAT_COUNTER ? &shm->num_counters : &shm->num_hists;
+    max = type == AXSTAT_COUNTER ? AXSTAT_MAX_COUNTERS : AXSTAT_MAX_HISTS;
+
+    pthread_mutex_lock(&axstat_mutex);
+    for (i = 0; i < shm->num_metrics; i++) {
+        m = &shm->metric[i];
+        if (m->type == type && strncmp(m->name, name, AXSTAT_NAME_SIZE) == 0) {
+            id = m->slot;
+            goto out;
+        }
+    }
+    if (*num >= max) {
+        logmsg(LOG_WARN, "too many metrics: %s not registered", name);
+        goto out;
+    }
+    id = (*num)++;
+    m = &shm->metric[shm->num_metrics];
+    strlcpy(m->name, name, sizeof (m->name));
+    m->slot = id;
+    __atomic_store_n(&m->type, type, __ATOMIC_RELEASE);
+    __atomic_store_n(&shm->num_metrics, shm->num_metrics + 1, __ATOMIC_RELEASE);
+out:
+    pthread_mutex_unlock(&axstat_mutex);
+
+    return id;
+}
+
+int axstat_counter(const char *name) {
+    return axstat_register(name, AXSTAT_COUNTER);
+}
+
+int axstat_histogram(const char *name) {
+    return axstat_register(name, AXSTAT_HIST);
+}
+
+axstat_thread_t *axstat_thread(void) {
+    axstat_shm_t *shm = __atomic_load_n(&axstat_shm, __ATOMIC_ACQUIRE);
+    axstat_thread_t *t = NULL;
+
+    /* disabled, or no more blocks (checked again under the mutex) */
+    if (shm == NULL || __atomic_load_n(&shm->num_threads, __ATOMIC_RELAXED) >= AXSTAT_MAX_THREADS) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&axstat_mutex);
+    if (shm->num_threads < AXSTAT_MAX_THREADS) {
+        t = &shm->thread[shm->num_threads];
+        pthread_getname_np(pthread_self(), t->name, sizeof (t->name));
+        __atomic_store_n(&t->tid, (int32_t) syscall(SYS_gettid), __ATOMIC_RELEASE);
+        __atomic_store_n(&shm->num_threads, shm->num_threads + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&axstat_mutex);
+    axstat_self = t;
+
+    return t;
+}
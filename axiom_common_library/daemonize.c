@@ -15,7 +15,16 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <signal.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
@@ -39,48 +48,284 @@ extern char **environ;
   }\
 }
 
-int sync_open(sync_t *sync) {
-    //sync->smfd=shm_open("/pippo",O_CREAT|O_RDWR,S_IRWXU);
-    //if (sync->smfd<0) {
-    //    elogmsg("shm_open() (errno=%d %s)!", errno, strerror(errno));
-    //    return -1;
-    //}
-    sync->smptr=mmap(NULL,sizeof(int),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,0,0);
+/*
+ * sync_t: the shared word is the value of the semaphore (or the count of the
+ * latch); the waiters sleep on it with a shared futex. If the kernel has no
+ * futex (ENOSYS) an eventfd, inherited by the forked process, is used to sleep.
+ */
+
+static int futex_wait(int *addr, int val, const struct timespec *timeout) {
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static int futex_wake(int *addr, int nr) {
+    return syscall(SYS_futex, addr, FUTEX_WAKE, nr, NULL, NULL, 0);
+}
+
+static int _sync_open(sync_t *sync, int value, int flags) {
+    sync->smfd=-1;
+    sync->smptr=mmap(NULL,sizeof(int),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
     if (sync->smptr==MAP_FAILED) {
-        close(sync->smfd);
         elogmsg("mmap() (errno=%d %s)!", errno, strerror(errno));
         return -1;
     }
-    *sync->smptr=0;
+    *sync->smptr=value;
+    if (futex_wake(sync->smptr,1)==-1 && errno==ENOSYS) {
+        sync->smfd=eventfd(0,flags|EFD_NONBLOCK|EFD_CLOEXEC);
+        if (sync->smfd==-1) {
+            elogmsg("eventfd() (errno=%d %s)!", errno, strerror(errno));
+            munmap(sync->smptr,sizeof(int));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int sync_open(sync_t *sync) {
+    return _sync_open(sync,0,EFD_SEMAPHORE);
+}
+
+int sync_latch_open(sync_t *sync, int count) {
+    return _sync_open(sync,count,0);
+}
+
+/* remaining time to the deadline, -1 (errno=ETIMEDOUT) if expired */
+static int sync_remaining(struct timespec *deadline, struct timespec *ts) {
+    struct timespec now;
+    int64_t ns;
+
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    ns=(deadline->tv_sec-now.tv_sec)*1000000000LL+deadline->tv_nsec-now.tv_nsec;
+    if (ns<=0) {
+        errno=ETIMEDOUT;
+        return -1;
+    }
+    ts->tv_sec=ns/1000000000LL;
+    ts->tv_nsec=ns%1000000000LL;
     return 0;
 }
 
+/* sleep until the word changes from val (or the eventfd is readable) */
+static int sync_sleep(sync_t *sync, int val, int timeout_ms, struct timespec *deadline) {
+    struct timespec ts;
+    struct pollfd pfd;
+    int res;
+
+    if (timeout_ms>=0 && sync_remaining(deadline,&ts)!=0) return -1;
+    if (sync->smfd==-1) {
+        res=futex_wait(sync->smptr,val,timeout_ms>=0?&ts:NULL);
+        if (res==-1 && errno==ETIMEDOUT) return -1;
+        /* woken, value changed (EAGAIN) or signal (EINTR): check again */
+        return 0;
+    }
+    pfd.fd=sync->smfd;
+    pfd.events=POLLIN;
+    res=poll(&pfd,1,timeout_ms>=0?(int)(ts.tv_sec*1000+(ts.tv_nsec+999999)/1000000):-1);
+    if (res==0) {
+        errno=ETIMEDOUT;
+        return -1;
+    }
+    if (res>0 && __atomic_load_n(sync->smptr,__ATOMIC_ACQUIRE)==val) {
+        /* unit of a wakeup already consumed by another waiter: drain it */
+        eventfd_t value;
+        eventfd_read(sync->smfd,&value);
+    }
+    return 0;
+}
+
+static void sync_deadline(int timeout_ms, struct timespec *deadline) {
+    if (timeout_ms<0) return;
+    clock_gettime(CLOCK_MONOTONIC,deadline);
+    deadline->tv_sec+=timeout_ms/1000;
+    deadline->tv_nsec+=(timeout_ms%1000)*1000000L;
+    if (deadline->tv_nsec>=1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec-=1000000000L;
+    }
+}
+
 int sync_wakeup(sync_t *sync) {
-    __sync_fetch_and_add(sync->smptr,1);
+    __atomic_fetch_add(sync->smptr,1,__ATOMIC_RELEASE);
+    if (sync->smfd!=-1) {
+        if (eventfd_write(sync->smfd,1)!=0) return -1;
+        return 0;
+    }
+    if (futex_wake(sync->smptr,1)==-1) return -1;
     return 0;
 }
 
+int sync_timedwait(sync_t *sync, int timeout_ms) {
+    struct timespec deadline;
+    eventfd_t value;
+    int val;
+
+    sync_deadline(timeout_ms,&deadline);
+    for (;;) {
+        val=__atomic_load_n(sync->smptr,__ATOMIC_ACQUIRE);
+        if (val>0) {
+            if (__atomic_compare_exchange_n(sync->smptr,&val,val-1,0,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED)) {
+                /* consume the eventfd unit of this wakeup */
+                if (sync->smfd!=-1) eventfd_read(sync->smfd,&value);
+                return 0;
+            }
+            continue;
+        }
+        if (sync_sleep(sync,val,timeout_ms,&deadline)!=0) return -1;
+    }
+}
+
 int sync_wait(sync_t *sync) {
-    while (__sync_fetch_and_add(sync->smptr,0)==0) {
-        usleep(100);
+    return sync_timedwait(sync,-1);
+}
+
+int sync_countdown(sync_t *sync) {
+    if (__atomic_sub_fetch(sync->smptr,1,__ATOMIC_RELEASE)!=0) return 0;
+    if (sync->smfd!=-1) {
+        /* not a semaphore: readable until closed, wakes all the waiters */
+        if (eventfd_write(sync->smfd,1)!=0) return -1;
+        return 0;
     }
+    if (futex_wake(sync->smptr,INT_MAX)==-1) return -1;
     return 0;
 }
 
+int sync_latch_wait(sync_t *sync, int timeout_ms) {
+    struct timespec deadline;
+    int val;
+
+    sync_deadline(timeout_ms,&deadline);
+    for (;;) {
+        val=__atomic_load_n(sync->smptr,__ATOMIC_ACQUIRE);
+        if (val<=0) return 0;
+        if (sync_sleep(sync,val,timeout_ms,&deadline)!=0) return -1;
+    }
+}
+
 int sync_close(sync_t *sync) {
     int ret=0;
     if (munmap(sync->smptr,sizeof(int))!=0) {
         elogmsg("munmap() (errno=%d %s)!", errno, strerror(errno));
+        ret=-1;
+    }
+    if (sync->smfd!=-1 && close(sync->smfd)!=0) {
+        elogmsg("close() (errno=%d %s)!", errno, strerror(errno));
+        ret=-1;
     }
-    //if (close(sync->smfd)!=0) {
-    //    elogmsg("close() (errno=%d %s)!", errno, strerror(errno));
-    //}
-    //if (shm_unlink("/pippo")!=0) {
-    //    elogmsg("shm_unlink() (errno=%d %s)!", errno, strerror(errno));
-    //}
     return ret;
 }
 
+/*
+ * posix_spawn() is used (clone with CLONE_VM|CLONE_VFORK in glibc: the page
+ * tables of the parent are not copied) when the file actions can do all the
+ * work of the forked process.
+ */
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 29)
+#define HAVE_SPAWN_CHDIR
+#endif
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 34)
+#define HAVE_SPAWN_CLOSEFROM
+#endif
+
+/**
+ * Test if daemonize() can use posix_spawn().
+ * AXIOM_DAEMONIZE=fork in the environment forces fork().
+ */
+static int spawn_supported(char *cwd, char *exec, int newsession, sync_t *sync) {
+    char *env;
+
+    /* the forked process waits the sync or does not exec at all */
+    if (exec == NULL || sync != NULL) return 0;
+#ifndef HAVE_SPAWN_CHDIR
+    if (cwd != NULL) return 0;
+#endif
+#ifndef POSIX_SPAWN_SETSID
+    if (newsession) return 0;
+#endif
+    env = getenv("AXIOM_DAEMONIZE");
+    if (env != NULL && strcmp(env, "fork") == 0) return 0;
+    return 1;
+}
+
+/* new stdin/stdout/stderr: the pipe or /dev/null */
+static int spawn_stdio(posix_spawn_file_actions_t *fa, int fd, int target, int flags) {
+    if (fd != -1) return posix_spawn_file_actions_adddup2(fa, fd, target);
+    return posix_spawn_file_actions_addopen(fa, target, "/dev/null", flags, 0);
+}
+
+/* close all the file descriptors but stdin/stdout/stderr */
+static int spawn_closeall(posix_spawn_file_actions_t *fa) {
+#ifdef HAVE_SPAWN_CLOSEFROM
+    return posix_spawn_file_actions_addclosefrom_np(fa, STDERR_FILENO + 1);
+#else
+    struct dirent *de;
+    DIR *dir;
+    int fd, res = 0;
+
+    dir = opendir("/proc/self/fd");
+    if (dir == NULL) return errno;
+    while (res == 0 && (de = readdir(dir)) != NULL) {
+        fd = atoi(de->d_name);
+        /* the close errors of the not open file descriptors are ignored */
+        if (fd > STDERR_FILENO && fd != dirfd(dir)) {
+            res = posix_spawn_file_actions_addclose(fa, fd);
+        }
+    }
+    closedir(dir);
+    return res;
+#endif
+}
+
+/**
+ * Exec a program in background with posix_spawn().
+ * @return The pid of the new process or -1 in case of failure (set errno).
+ */
+static pid_t spawn_exec(char *cwd, char *exec, char **args, char **env, int fdin, int fdout, int fderr, int newsession) {
+    char *nullargs[] = {exec, NULL};
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    short flags = POSIX_SPAWN_SETSIGMASK;
+    sigset_t mask;
+    pid_t pid;
+    int res;
+
+    res = posix_spawn_file_actions_init(&fa);
+    if (res != 0) {
+        errno = res;
+        return -1;
+    }
+    res = posix_spawnattr_init(&attr);
+    if (res != 0) {
+        posix_spawn_file_actions_destroy(&fa);
+        errno = res;
+        return -1;
+    }
+#ifdef POSIX_SPAWN_SETSID
+    if (newsession) flags |= POSIX_SPAWN_SETSID;
+#endif
+    // the signals blocked by the caller (i.e. for a signalfd) are not inherited
+    sigemptyset(&mask);
+    res = posix_spawnattr_setsigmask(&attr, &mask);
+    if (res == 0) res = posix_spawnattr_setflags(&attr, flags);
+    if (res == 0) res = spawn_stdio(&fa, fdin, STDIN_FILENO, O_RDONLY);
+    if (res == 0) res = spawn_stdio(&fa, fdout, STDOUT_FILENO, O_WRONLY);
+    if (res == 0) res = spawn_stdio(&fa, fderr, STDERR_FILENO, O_WRONLY);
+    if (res == 0) res = spawn_closeall(&fa);
+#ifdef HAVE_SPAWN_CHDIR
+    if (res == 0 && cwd != NULL) res = posix_spawn_file_actions_addchdir_np(&fa, cwd);
+#endif
+    if (res == 0) {
+        res = posix_spawnp(&pid, exec, &fa, &attr, args == NULL || *args == NULL ? nullargs : args,
+                env == NULL ? environ : env);
+    }
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    if (res != 0) {
+        errno = res;
+        return -1;
+    }
+    return pid;
+}
+
 /* See axiom_common.h */
 pid_t daemonize(char *cwd, char *exec, char **args, char **env, int *pipefd, int newsession, int verbose, sync_t *sync) {
 
@@ -137,6 +382,20 @@ pid_t daemonize(char *cwd, char *exec, char **args, char **env, int *pipefd, int
         pipefd[2] = fd[0];
     }
 
+    if (spawn_supported(cwd, exec, newsession, sync)) {
+        pid = spawn_exec(cwd, exec, args, env, fdin, fdout, fderr, newsession);
+        if (pid < 0) {
+            elogmsg("posix_spawnp() failure");
+            CLEAN();
+            return -1;
+        }
+        if (verbose) logmsg(LOG_INFO, "daemonize() - spawned pid %d", (int) pid);
+        if (fdin != -1) close(fdin);
+        if (fdout != -1) close(fdout);
+        if (fderr != -1) close(fderr);
+        return pid;
+    }
+
     oldcwd = NULL;
     if (cwd != NULL) {
         int res;
@@ -240,6 +499,10 @@ pid_t daemonize(char *cwd, char *exec, char **args, char **env, int *pipefd, int
         }
         // exec
         if (exec!=NULL) {
+            // the signals blocked by the caller (i.e. for a signalfd) are not inherited
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigprocmask(SIG_SETMASK, &mask, NULL);
             execvpe(exec, args == NULL || *args == NULL ? nullargs : args, env == NULL ? environ : env);
             // exit... in case of execvpe failure
             elogmsg("execvpe() failure");
@@ -3,17 +3,33 @@
  *
  * \version     v1.2
  *
+ * Logging backend.
+ *
+ * Every thread formats its records in a private ring (single producer,
+ * single consumer, no locks); a background thread merges the rings by the
+ * CLOCK_MONOTONIC timestamp of the records and writes them with writev().
+ * Records younger than LOGMSG_REORDER_NS are left in the rings, so a record
+ * that is still being written by another thread is not overtaken.
+ * A forked child logs synchronously (it can exec or close the descriptors
+ * at any time).
+ *
  * Copyright (C) 2016, Evidence Srl.
  * Terms of use are as specified in COPYING
  */
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <signal.h>
+#include <poll.h>
 #include <sys/param.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
 
 #include "axiom_common.h"
+#include "axiom_logtrace.h"
 
 extern char **environ;
 
@@ -24,62 +40,397 @@ pid_t logmsg_pid = -1;
 int logmsg_level = LOG_NOLOG;
 int logmsg_zones = 0xffffffff;
 
-void logmsg_to(char *filename) {
-    // :-(
-    FILE *old;
-    FILE *f = fopen(filename, "w+");
-    if (f == NULL) {
-        //elogmsg("fopen()");
-        return;
+/** Size of the ring of every thread (power of two). */
+#define LOGMSG_RING_SIZE (64*1024)
+/** Records longer than this are truncated. */
+#define LOGMSG_RECORD_MAX (LOGMSG_RING_SIZE/4)
+/** Records formatted on the stack before copying them in the ring. */
+#define LOGMSG_LINE_SIZE 512
+/** Records of the last LOGMSG_REORDER_NS are not written yet. */
+#define LOGMSG_REORDER_NS 1000000
+/** Flusher period when no thread wakes it up. */
+#define LOGMSG_FLUSH_MS 10
+/** Max records for each writev(). */
+#define LOGMSG_IOV_MAX 64
+
+/** Header of a record in the ring (len 0 is padding to the ring end). */
+typedef struct {
+    uint64_t ts;
+    uint32_t len;
+    uint32_t size;
+} logmsg_rec_t;
+
+/** Ring of a thread. */
+typedef struct logmsg_ring {
+    struct logmsg_ring *next;
+    int used;           /**< owned by a thread */
+    volatile int busy;  /**< the owner is writing (signal handlers) */
+    uint64_t head;      /**< written by the owner */
+    uint64_t tail;      /**< written by the flusher */
+    uint64_t pos;       /**< records taken by the flusher, not yet written */
+    uint32_t reserved;  /**< bytes of the record being written */
+    char buf[LOGMSG_RING_SIZE] __attribute__((aligned(16)));
+} logmsg_ring_t;
+
+static logmsg_ring_t *logmsg_rings = NULL;
+static __thread logmsg_ring_t *logmsg_ring = NULL;
+static pthread_key_t logmsg_key;
+static pthread_mutex_t flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+/** 0 not started, 1 starting, 2 running, -1 synchronous. */
+static int flusher_state = 0;
+static int flusher_fd = -1;
+
+static inline uint64_t logmsg_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int logmsg_fd() {
+    // NMB: logmsg_fout can be NULL if logmsg_init() has not been never called
+    return fileno(logmsg_fout != NULL ? logmsg_fout : stderr);
+}
+
+static void logmsg_write(int fd, const char *p, size_t sz) {
+    ssize_t r;
+    while (sz > 0) {
+        r = write(fd, p, sz);
+        if (r <= 0) break;
+        p += r;
+        sz -= r;
     }
-    old = logmsg_fout;
-    logmsg_fout = f;
-    if (old != stderr) fclose(old);
-    setvbuf(logmsg_fout, NULL, _IONBF, 0);
 }
 
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static void logmsg_writev(int fd, struct iovec *iov, int n) {
+    ssize_t r;
+    while (n > 0) {
+        r = writev(fd, iov, n);
+        if (r <= 0) break;
+        while (n > 0 && r >= (ssize_t) iov->iov_len) {
+            r -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *) iov->iov_base + r;
+            iov->iov_len -= r;
+        }
+    }
+}
+
+/* wake up the flusher (async-signal-safe) */
+static inline void logmsg_kick() {
+    uint64_t one = 1;
+    if (flusher_fd != -1 && write(flusher_fd, &one, sizeof (one)) < 0) {
+        /* already pending */
+    }
+}
+
+/* next record to write of a ring (skipping the padding), NULL if none */
+static logmsg_rec_t *ring_peek(logmsg_ring_t *ring) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    logmsg_rec_t *rec;
+
+    while (ring->pos != head) {
+        rec = (logmsg_rec_t *) (ring->buf + (ring->pos & (LOGMSG_RING_SIZE - 1)));
+        if (rec->len != 0) return rec;
+        ring->pos += rec->size;
+    }
+    return NULL;
+}
+
+/*
+ * Write the records older than limit, merged by timestamp.
+ * Called with flush_mutex locked.
+ */
+static void logmsg_drain(uint64_t limit) {
+    struct iovec iov[LOGMSG_IOV_MAX];
+    logmsg_ring_t *ring, *oldest;
+    logmsg_rec_t *rec, *orec;
+    int n, fd = logmsg_fd();
+
+    do {
+        n = 0;
+        while (n < LOGMSG_IOV_MAX) {
+            oldest = NULL;
+            orec = NULL;
+            for (ring = __atomic_load_n(&logmsg_rings, __ATOMIC_ACQUIRE);
+                    ring != NULL; ring = ring->next) {
+                rec = ring_peek(ring);
+                if (rec != NULL && rec->ts <= limit && (orec == NULL || rec->ts < orec->ts)) {
+                    oldest = ring;
+                    orec = rec;
+                }
+            }
+            if (oldest == NULL) break;
+            iov[n].iov_base = orec + 1;
+            iov[n].iov_len = orec->len;
+            n++;
+            oldest->pos += orec->size;
+        }
+        if (n == 0) break;
+        logmsg_writev(fd, iov, n);
+        /* the space of the records written is returned to the threads */
+        for (ring = __atomic_load_n(&logmsg_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+            __atomic_store_n(&ring->tail, ring->pos, __ATOMIC_RELEASE);
+        }
+    } while (n == LOGMSG_IOV_MAX);
+}
+
+void logmsg_flush() {
+    pthread_mutex_lock(&flush_mutex);
+    logmsg_drain(UINT64_MAX);
+    pthread_mutex_unlock(&flush_mutex);
+}
+
+static void *flusher_thread(void *data) {
+    struct pollfd pfd;
+    uint64_t value;
+
+    pfd.fd = flusher_fd;
+    pfd.events = POLLIN;
+    for (;;) {
+        if (poll(&pfd, 1, LOGMSG_FLUSH_MS) > 0 && read(flusher_fd, &value, sizeof (value)) < 0) {
+            /* nothing to read */
+        }
+        pthread_mutex_lock(&flush_mutex);
+        logmsg_drain(logmsg_now() - LOGMSG_REORDER_NS);
+        pthread_mutex_unlock(&flush_mutex);
+    }
+    return NULL;
+}
+
+static void ring_release(void *data) {
+    logmsg_ring_t *ring = (logmsg_ring_t *) data;
+    /* the records left are written by the flusher; the ring can be reused */
+    __atomic_store_n(&ring->used, 0, __ATOMIC_RELEASE);
+}
+
+static void atfork_child() {
+    logmsg_ring_t *ring;
+    /* the records of the parent are written by the parent */
+    for (ring = logmsg_rings; ring != NULL; ring = ring->next) {
+        ring->busy = 0;
+        ring->pos = ring->tail = ring->head;
+    }
+    pthread_mutex_init(&flush_mutex, NULL);
+    if (flusher_fd != -1) close(flusher_fd);
+    flusher_fd = -1;
+    flusher_state = -1;
+}
+
+/* start the flusher; return 0 if the records can be written in the rings */
+static int flusher_start() {
+    int state = __atomic_load_n(&flusher_state, __ATOMIC_ACQUIRE);
+    sigset_t all, old;
+    pthread_t thread;
+
+    if (state == 2) return 0;
+    if (state != 0 || !__atomic_compare_exchange_n(&flusher_state, &state, 1, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        /* synchronous or started by another thread now */
+        return -1;
+    }
+
+    flusher_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (flusher_fd == -1 || pthread_key_create(&logmsg_key, ring_release) != 0) {
+        __atomic_store_n(&flusher_state, -1, __ATOMIC_RELEASE);
+        return -1;
+    }
+    /* the signals are handled by the threads of the application */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&thread, NULL, flusher_thread, NULL) != 0) {
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        __atomic_store_n(&flusher_state, -1, __ATOMIC_RELEASE);
+        return -1;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_detach(thread);
+    pthread_atfork(NULL, NULL, atfork_child);
+    atexit(logmsg_flush);
+
+    __atomic_store_n(&flusher_state, 2, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* ring of the calling thread (NULL if the records must be written directly) */
+static logmsg_ring_t *ring_get() {
+    logmsg_ring_t *ring;
+    int unused;
+
+    /* not running in a forked child */
+    if (flusher_start()) return NULL;
+    if (logmsg_ring != NULL) return logmsg_ring;
+
+    /* reuse the ring of a terminated thread */
+    for (ring = __atomic_load_n(&logmsg_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        unused = 0;
+        if (__atomic_compare_exchange_n(&ring->used, &unused, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+    if (ring == NULL) {
+        if (posix_memalign((void **) &ring, 64, sizeof (*ring)) != 0) return NULL;
+        memset(ring, 0, offsetof(logmsg_ring_t, buf));
+        ring->used = 1;
+        ring->next = __atomic_load_n(&logmsg_rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&logmsg_rings, &ring->next, ring, 1,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    pthread_setspecific(logmsg_key, ring);
+    logmsg_ring = ring;
+    return ring;
+}
+
+/*
+ * Reserve a record of len bytes (plus the terminator written by vsnprintf);
+ * return NULL if the ring is full and the caller cannot wait (signal handler).
+ */
+static logmsg_rec_t *ring_reserve(logmsg_ring_t *ring, size_t len, int can_wait) {
+    uint32_t size = (sizeof (logmsg_rec_t) + len + 1 + 15) & ~15;
+    uint64_t tail;
+    uint32_t off, contig, need;
+    logmsg_rec_t *rec;
+
+    for (;;) {
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        off = ring->head & (LOGMSG_RING_SIZE - 1);
+        contig = LOGMSG_RING_SIZE - off;
+        need = size + (contig < size ? contig : 0);
+        if (LOGMSG_RING_SIZE - (ring->head - tail) >= need) break;
+        if (!can_wait) return NULL;
+        /* full: write everything now */
+        logmsg_flush();
+    }
+
+    if (contig < size) {
+        /* the records are contiguous: pad to the end of the ring */
+        rec = (logmsg_rec_t *) (ring->buf + off);
+        rec->len = 0;
+        rec->size = contig;
+        off = 0;
+    }
+    rec = (logmsg_rec_t *) (ring->buf + off);
+    rec->len = len;
+    rec->size = size;
+    ring->reserved = need;
+    return rec;
+}
+
+/* publish the record reserved */
+static void ring_commit(logmsg_ring_t *ring) {
+    uint64_t head = ring->head, tail;
+
+    __atomic_store_n(&ring->head, head + ring->reserved, __ATOMIC_RELEASE);
+
+    /* wake up the flusher when the ring gets half full */
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    if (head - tail < LOGMSG_RING_SIZE / 2 &&
+            head + ring->reserved - tail >= LOGMSG_RING_SIZE / 2) {
+        logmsg_kick();
+    }
+}
 
 void _logmsg(char *msg, ...) {
+    char line[LOGMSG_LINE_SIZE];
+    logmsg_ring_t *ring;
+    logmsg_rec_t *rec;
+    uint64_t ts = logmsg_now();
     va_list list;
+    int len, state;
+
     va_start(list, msg);
-    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-    pthread_mutex_lock(&mutex);
-    // NMB: logmsg_fout can be NULL if logmsg_init() has not been never called
-    vfprintf(logmsg_fout, msg, list);
-    pthread_mutex_unlock(&mutex);
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    len = vsnprintf(line, sizeof (line), msg, list);
     va_end(list);
+    if (len < 0) return;
+    if (len > LOGMSG_RECORD_MAX - 1) len = LOGMSG_RECORD_MAX - 1;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+    ring = ring_get();
+    if (ring == NULL) {
+        /* synchronous */
+        char *p = len < (int) sizeof (line) ? line : malloc(len + 1);
+        if (p != line && p != NULL) {
+            va_start(list, msg);
+            vsnprintf(p, len + 1, msg, list);
+            va_end(list);
+        }
+        if (p != NULL) logmsg_write(logmsg_fd(), p, len < (int) sizeof (line) ? len : strlen(p));
+        if (p != line) free(p);
+        pthread_setcancelstate(state, NULL);
+        return;
+    }
+
+    ring->busy = 1;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    rec = ring_reserve(ring, len, 1);
+    rec->ts = ts;
+    if (len < (int) sizeof (line)) {
+        memcpy(rec + 1, line, len);
+    } else {
+        /* too long for the line: format again in the ring */
+        va_start(list, msg);
+        vsnprintf((char *) (rec + 1), len + 1, msg, list);
+        va_end(list);
+    }
+    ring_commit(ring);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    ring->busy = 0;
+    pthread_setcancelstate(state, NULL);
 }
 
 void _slogmsg(char *msg, ...) {
     char buffer[256];
-    char *p;
-    int h, sz, r;
+    logmsg_ring_t *ring = logmsg_ring;
+    logmsg_rec_t *rec;
+    int sz;
     int _errno;
 
     _errno = errno;
 
     va_list list;
     va_start(list, msg);
-    // NMB: logmsg_fout can be NULL if logmsg_init() has not been never called
     vsnprintf(buffer, sizeof (buffer), msg, list);
     va_end(list);
 
     buffer[255] = '\0';
-    h = fileno(logmsg_fout);
     sz = strlen(buffer);
-    p = buffer;
-    while (sz > 0) {
-        r = write(h, p, sz);
-        if (r <= 0) break;
-        p += r;
-        sz -= r;
+
+    /*
+     * in the ring of the thread, unless the handler interrupted the thread
+     * while it was writing in the ring; no allocation and no waiting here
+     */
+    if (ring != NULL && !ring->busy && __atomic_load_n(&flusher_state, __ATOMIC_ACQUIRE) == 2 &&
+            (rec = ring_reserve(ring, sz, 0)) != NULL) {
+        rec->ts = logmsg_now();
+        memcpy(rec + 1, buffer, sz);
+        ring_commit(ring);
+        logmsg_kick();
+    } else {
+        logmsg_write(logmsg_fd(), buffer, sz);
     }
 
     errno = _errno;
 }
 
+void logmsg_to(char *filename) {
+    // :-(
+    FILE *old;
+    FILE *f = fopen(filename, "w+");
+    if (f == NULL) {
+        //elogmsg("fopen()");
+        return;
+    }
+    /* the pending records go to the old file */
+    pthread_mutex_lock(&flush_mutex);
+    logmsg_drain(UINT64_MAX);
+    old = logmsg_fout;
+    logmsg_fout = f;
+    if (old != NULL && old != stderr) fclose(old);
+    pthread_mutex_unlock(&flush_mutex);
+    setvbuf(logmsg_fout, NULL, _IONBF, 0);
+}
+
 void logmsg_init() {
     char buf[MAXPATHLEN];
     char *value;
@@ -113,6 +464,18 @@ void logmsg_init() {
         logmsg_to(value);
     }
     //
+    value = getenv("AXIOM_LOG_TRACE");
+    if (value != NULL) {
+        char *size = getenv("AXIOM_LOG_TRACE_SIZE");
+        /* every process has its own file (the pid is added if missing) */
+        if (strstr(value, "%ld") != NULL) {
+            snprintf(buf, sizeof (buf), value, (long) getpid());
+        } else {
+            snprintf(buf, sizeof (buf), "%s.%ld", value, (long) getpid());
+        }
+        value = buf;
+        logmsg_trace_to(value, (size_t) (size != NULL ? atoi(size) : LOGTRACE_DEF_SIZE_MB) << 20);
+    }
+    //
     logmsg_pid = getpid();
 }
-
@@ -0,0 +1,323 @@
+/*!
+ * \file logtrace.c
+ *
+ * \version     v1.2
+ *
+ * Binary trace backend of the logging subsystem (see axiom_logtrace.h).
+ *
+ * The first message of every call site registers its format string: the
+ * types of the arguments are parsed once and a LOGTRACE_FMT record is
+ * written (the formats with %m, that needs the errno of the call, are
+ * formatted as text). Every message then reserves its record with an atomic add on the
+ * mmap'd file and copies the raw arguments: no formatting and no locks.
+ * The file is shared with the forked children (the header is updated
+ * atomically); when it is full the messages are counted as dropped.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "axiom_common.h"
+#include "axiom_logtrace.h"
+
+/** Max format strings. */
+#define LOGTRACE_MAX_FMTS 4096
+
+/** Format id of the call sites that cannot be traced. */
+#define LOGTRACE_NOFID -2
+
+typedef struct {
+    char types[LOGTRACE_MAX_ARGS + 1];
+    int ntypes;
+} logtrace_fmt_t;
+
+int logmsg_trace = 0;
+
+static logtrace_hdr_t *trace_hdr;
+static char *trace_data;
+static logtrace_fmt_t trace_fmts[LOGTRACE_MAX_FMTS];
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread uint32_t trace_tid;
+
+const char *logtrace_conv(const char *p, const char **spec, char *types, int *ntypes) {
+    int lng;
+
+    p = strchr(p, '%');
+    if (p == NULL) return NULL;
+    *spec = p++;
+    *ntypes = 0;
+    if (*p == '%') return p + 1;
+
+    while (*p != '\0' && strchr("-+ #0'I", *p) != NULL) p++;
+    if (*p == '*') {
+        types[(*ntypes)++] = 'i';
+        p++;
+    } else {
+        while (isdigit((unsigned char) *p)) p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            types[(*ntypes)++] = 'i';
+            p++;
+        } else {
+            while (isdigit((unsigned char) *p)) p++;
+        }
+    }
+    /* length: the 'l' types are 64 bits (LP64) */
+    for (lng = 0;; p++) {
+        if (*p == 'h') continue;
+        else if (*p != '\0' && strchr("ljztq", *p) != NULL) lng = 1;
+        else if (*p == 'L') lng = -1;
+        else break;
+    }
+
+    switch (*p) {
+        case '\0':
+            return NULL;
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+            types[(*ntypes)++] = lng > 0 ? 'l' : 'i';
+            break;
+        case 'c':
+            types[(*ntypes)++] = 'i';
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            types[(*ntypes)++] = lng < 0 ? 'F' : 'f';
+            break;
+        case 's':
+            /* wide strings are recorded as pointers */
+            types[(*ntypes)++] = lng > 0 ? 'p' : 's';
+            break;
+        case 'S': case 'p':
+            types[(*ntypes)++] = 'p';
+            break;
+        case 'n':
+            types[(*ntypes)++] = 'n';
+            break;
+        default:
+            /* %m and unknown conversions: no arguments */
+            break;
+    }
+    return p + 1;
+}
+
+static void trace_atfork_child() {
+    /* the forked child shares the file: its thread id is new */
+    trace_tid = 0;
+}
+
+int logmsg_trace_to(char *filename, size_t size) {
+    size_t total = LOGTRACE_HEADER_SIZE + size;
+    void *map;
+    int fd;
+
+    fd = open(filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "WARNING..... unable to open AXIOM_LOG_TRACE file %s\n", filename);
+        return -1;
+    }
+    if (ftruncate(fd, total) == -1) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    trace_hdr = (logtrace_hdr_t *) map;
+    trace_data = (char *) map + LOGTRACE_HEADER_SIZE;
+    memcpy(trace_hdr->magic, LOGTRACE_MAGIC, sizeof (LOGTRACE_MAGIC));
+    trace_hdr->version = LOGTRACE_VERSION;
+    trace_hdr->header_size = LOGTRACE_HEADER_SIZE;
+    trace_hdr->size = size;
+    trace_hdr->pid = getpid();
+    pthread_atfork(NULL, NULL, trace_atfork_child);
+    __atomic_store_n(&logmsg_trace, 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static logtrace_rec_t *trace_reserve(size_t size) {
+    uint64_t off;
+
+    size = (size + 7) & ~(size_t) 7;
+    off = __atomic_fetch_add(&trace_hdr->used, size, __ATOMIC_RELAXED);
+    if (off + size > trace_hdr->size) {
+        __atomic_fetch_add(&trace_hdr->dropped, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    return (logtrace_rec_t *) (trace_data + off);
+}
+
+static inline void trace_commit(logtrace_rec_t *rec, int type) {
+    __atomic_store_n(&rec->type, type, __ATOMIC_RELEASE);
+}
+
+/* register the format of a call site; return its id */
+static int trace_register(int *fid, const char *msg) {
+    logtrace_fmt_t fmt;
+    logtrace_rec_t *rec;
+    const char *p = msg, *spec;
+    char types[3];
+    size_t len = strlen(msg);
+    int id, n;
+
+    fmt.ntypes = 0;
+    while ((p = logtrace_conv(p, &spec, types, &n)) != NULL) {
+        if (fmt.ntypes + n > LOGTRACE_MAX_ARGS || p[-1] == 'm') {
+            __atomic_store_n(fid, LOGTRACE_NOFID, __ATOMIC_RELEASE);
+            return LOGTRACE_NOFID;
+        }
+        memcpy(fmt.types + fmt.ntypes, types, n);
+        fmt.ntypes += n;
+    }
+    fmt.types[fmt.ntypes] = '\0';
+
+    pthread_mutex_lock(&trace_mutex);
+    id = __atomic_load_n(fid, __ATOMIC_ACQUIRE);
+    if (id != -1) {
+        pthread_mutex_unlock(&trace_mutex);
+        return id;
+    }
+    /* the ids are unique in the file, shared with the forked children */
+    id = __atomic_fetch_add(&trace_hdr->next_fid, 1, __ATOMIC_RELAXED);
+    rec = NULL;
+    if (id < LOGTRACE_MAX_FMTS && len < UINT16_MAX / 2) {
+        rec = trace_reserve(sizeof (*rec) + fmt.ntypes + 1 + len + 1);
+    }
+    if (rec == NULL) {
+        id = LOGTRACE_NOFID;
+    } else {
+        trace_fmts[id] = fmt;
+        rec->level = 0;
+        rec->size = (sizeof (*rec) + fmt.ntypes + 1 + len + 1 + 7) & ~7;
+        rec->fid = id;
+        rec->tid = 0;
+        rec->ts = 0;
+        memcpy(rec + 1, fmt.types, fmt.ntypes + 1);
+        memcpy((char *) (rec + 1) + fmt.ntypes + 1, msg, len + 1);
+        trace_commit(rec, LOGTRACE_FMT);
+    }
+    __atomic_store_n(fid, id, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&trace_mutex);
+
+    return id;
+}
+
+void _tlogmsg(int *fid, int lvl, const char *msg, ...) {
+    logtrace_fmt_t *fmt;
+    logtrace_rec_t *rec;
+    struct timespec ts;
+    va_list list, copy;
+    char *p;
+    const char *s;
+    size_t size, len;
+    int id, i, err = errno;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    id = __atomic_load_n(fid, __ATOMIC_ACQUIRE);
+    if (id == -1) id = trace_register(fid, msg);
+    va_start(list, msg);
+    if (id < 0) {
+        /* not traceable (too many formats or arguments, %m): text */
+        char line[1024];
+        errno = err;
+        vsnprintf(line, sizeof (line), msg, list);
+        va_end(list);
+        _logmsg("[%5d.%06d] %5s{%d}: %s", (int) (ts.tv_sec % 10000), (int) ts.tv_nsec / 1000,
+                logmsg_name[lvl], logmsg_pid, line);
+        return;
+    }
+    fmt = &trace_fmts[id];
+
+    /* size of the arguments */
+    size = sizeof (*rec);
+    va_copy(copy, list);
+    for (i = 0; i < fmt->ntypes; i++) {
+        switch (fmt->types[i]) {
+            case 'i': (void) va_arg(copy, int); size += 4; break;
+            case 'l': (void) va_arg(copy, long long); size += 8; break;
+            case 'f': (void) va_arg(copy, double); size += 8; break;
+            case 'F': (void) va_arg(copy, long double); size += 8; break;
+            case 'p': (void) va_arg(copy, void *); size += 8; break;
+            case 'n': (void) va_arg(copy, void *); break;
+            case 's':
+                s = va_arg(copy, const char *);
+                size += 2 + (s == NULL ? 6 : strnlen(s, LOGTRACE_MAX_STR));
+                break;
+        }
+    }
+    va_end(copy);
+
+    rec = trace_reserve(size);
+    if (rec == NULL) {
+        va_end(list);
+        return;
+    }
+    if (trace_tid == 0) trace_tid = syscall(SYS_gettid);
+    rec->level = lvl;
+    rec->size = (size + 7) & ~7;
+    rec->fid = id;
+    rec->tid = trace_tid;
+    rec->ts = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    p = (char *) (rec + 1);
+    for (i = 0; i < fmt->ntypes; i++) {
+        int32_t i32;
+        int64_t i64;
+        double d;
+        uint16_t l16;
+
+        switch (fmt->types[i]) {
+            case 'i':
+                i32 = va_arg(list, int);
+                memcpy(p, &i32, 4);
+                p += 4;
+                break;
+            case 'l':
+                i64 = va_arg(list, long long);
+                memcpy(p, &i64, 8);
+                p += 8;
+                break;
+            case 'f':
+            case 'F':
+                d = fmt->types[i] == 'f' ? va_arg(list, double) : (double) va_arg(list, long double);
+                memcpy(p, &d, 8);
+                p += 8;
+                break;
+            case 'p':
+                i64 = (intptr_t) va_arg(list, void *);
+                memcpy(p, &i64, 8);
+                p += 8;
+                break;
+            case 'n':
+                (void) va_arg(list, void *);
+                break;
+            case 's':
+                s = va_arg(list, const char *);
+                if (s == NULL) s = "(null)";
+                len = strnlen(s, LOGTRACE_MAX_STR);
+                l16 = len;
+                memcpy(p, &l16, 2);
+                memcpy(p + 2, s, len);
+                p += 2 + len;
+                break;
+        }
+    }
+    va_end(list);
+
+    trace_commit(rec, LOGTRACE_MSG);
+}
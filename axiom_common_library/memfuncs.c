@@ -0,0 +1,487 @@
+/*!
+ * \file memfuncs.c
+ *
+ * \version     v1.2
+ *
+ * Fill, verify and digest of large memory zones (i.e. RDMA zones).
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "axiom_common.h"
+
+/*
+ * rationale: the RDMA zone is not cached, so it is accessed only with
+ * aligned 64bits (or vector) loads and stores. Only the unaligned head and
+ * tail of a zone are accessed byte per byte.
+ */
+
+/* zones smaller than this are processed by the caller thread */
+#define AXMEM_MT_THRESHOLD      (4 * 1024 * 1024)
+/* max number of worker threads */
+#define AXMEM_MAX_THREADS       64
+
+/* byte 'i' of the 64bits pattern (in memory order) */
+static inline uint8_t pattern_byte(uint64_t pattern, uintptr_t addr) {
+    uint8_t b[sizeof (pattern)];
+    memcpy(b, &pattern, sizeof (pattern));
+    return b[addr % sizeof (pattern)];
+}
+
+/* */
+/* */
+/* vector kernels (aligned pointers, size multiple of 32) */
+/* */
+/* */
+
+#if defined(__AVX2__)
+
+#define AXMEM_VEC_SIZE 32
+
+static void fill_vec(uint8_t *dst, uint64_t pattern, size_t size) {
+    __m256i v = _mm256_set1_epi64x((long long) pattern);
+    size_t i;
+    for (i = 0; i < size; i += 32)
+        _mm256_store_si256((__m256i *) (dst + i), v);
+}
+
+static size_t verify_vec(const uint8_t *src, uint64_t pattern, size_t size) {
+    __m256i v = _mm256_set1_epi64x((long long) pattern);
+    size_t i;
+    for (i = 0; i < size; i += 32) {
+        __m256i d = _mm256_load_si256((const __m256i *) (src + i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(d, v)) != -1)
+            return i;
+    }
+    return size;
+}
+
+#elif defined(__SSE2__)
+
+#define AXMEM_VEC_SIZE 32
+
+static void fill_vec(uint8_t *dst, uint64_t pattern, size_t size) {
+    __m128i v = _mm_set1_epi64x((long long) pattern);
+    size_t i;
+    for (i = 0; i < size; i += 32) {
+        _mm_store_si128((__m128i *) (dst + i), v);
+        _mm_store_si128((__m128i *) (dst + i + 16), v);
+    }
+}
+
+static size_t verify_vec(const uint8_t *src, uint64_t pattern, size_t size) {
+    __m128i v = _mm_set1_epi64x((long long) pattern);
+    size_t i;
+    for (i = 0; i < size; i += 32) {
+        __m128i d0 = _mm_load_si128((const __m128i *) (src + i));
+        __m128i d1 = _mm_load_si128((const __m128i *) (src + i + 16));
+        __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(d0, v), _mm_cmpeq_epi8(d1, v));
+        if (_mm_movemask_epi8(eq) != 0xffff)
+            return i;
+    }
+    return size;
+}
+
+#elif defined(__ARM_NEON)
+
+#define AXMEM_VEC_SIZE 32
+
+static void fill_vec(uint8_t *dst, uint64_t pattern, size_t size) {
+    uint64x2_t v = vdupq_n_u64(pattern);
+    size_t i;
+    for (i = 0; i < size; i += 32) {
+        vst1q_u64((uint64_t *) (dst + i), v);
+        vst1q_u64((uint64_t *) (dst + i + 16), v);
+    }
+}
+
+static size_t verify_vec(const uint8_t *src, uint64_t pattern, size_t size) {
+    uint64x2_t v = vdupq_n_u64(pattern);
+    size_t i;
+    for (i = 0; i < size; i += 32) {
+        uint64x2_t x0 = veorq_u64(vld1q_u64((const uint64_t *) (src + i)), v);
+        uint64x2_t x1 = veorq_u64(vld1q_u64((const uint64_t *) (src + i + 16)), v);
+        uint64x2_t x = vorrq_u64(x0, x1);
+        if ((vgetq_lane_u64(x, 0) | vgetq_lane_u64(x, 1)) != 0)
+            return i;
+    }
+    return size;
+}
+
+#else
+
+/* portable version: four 64bits words per iteration */
+#define AXMEM_VEC_SIZE 32
+
+static void fill_vec(uint8_t *dst, uint64_t pattern, size_t size) {
+    uint64_t *p = (uint64_t *) dst;
+    size_t i;
+    for (i = 0; i < size / 8; i += 4) {
+        p[i] = pattern;
+        p[i + 1] = pattern;
+        p[i + 2] = pattern;
+        p[i + 3] = pattern;
+    }
+}
+
+static size_t verify_vec(const uint8_t *src, uint64_t pattern, size_t size) {
+    const uint64_t *p = (const uint64_t *) src;
+    size_t i;
+    for (i = 0; i < size / 8; i += 4) {
+        if (((p[i] ^ pattern) | (p[i + 1] ^ pattern) |
+                (p[i + 2] ^ pattern) | (p[i + 3] ^ pattern)) != 0)
+            return i * 8;
+    }
+    return size;
+}
+
+#endif
+
+/* */
+/* */
+/* single thread fill/verify of any zone */
+/* */
+/* */
+
+static void fill_range(uint8_t *dst, uint64_t pattern, size_t size) {
+    uint8_t *end = dst + size;
+    uint8_t *vstart, *vend;
+
+    /* head: up to the first vector aligned address */
+    vstart = (uint8_t *) (((uintptr_t) dst + AXMEM_VEC_SIZE - 1) & ~((uintptr_t) AXMEM_VEC_SIZE - 1));
+    if (vstart > end) vstart = end;
+    for (; dst < vstart && ((uintptr_t) dst & 7); dst++)
+        *dst = pattern_byte(pattern, (uintptr_t) dst);
+    for (; dst + 8 <= vstart; dst += 8)
+        *(uint64_t *) dst = pattern;
+    for (; dst < vstart; dst++)
+        *dst = pattern_byte(pattern, (uintptr_t) dst);
+
+    /* body */
+    vend = vstart + (((size_t) (end - vstart)) & ~((size_t) AXMEM_VEC_SIZE - 1));
+    if (vend > vstart) {
+        fill_vec(vstart, pattern, vend - vstart);
+        dst = vend;
+    }
+
+    /* tail */
+    for (; dst + 8 <= end; dst += 8)
+        *(uint64_t *) dst = pattern;
+    for (; dst < end; dst++)
+        *dst = pattern_byte(pattern, (uintptr_t) dst);
+}
+
+/* return the offset of the first byte different from the pattern or size */
+static size_t verify_range(const uint8_t *src, uint64_t pattern, size_t size) {
+    const uint8_t *start = src, *end = src + size;
+    const uint8_t *vstart, *vend;
+    size_t off;
+
+    vstart = (const uint8_t *) (((uintptr_t) src + AXMEM_VEC_SIZE - 1) & ~((uintptr_t) AXMEM_VEC_SIZE - 1));
+    if (vstart > end) vstart = end;
+    vend = vstart + (((size_t) (end - vstart)) & ~((size_t) AXMEM_VEC_SIZE - 1));
+
+    while (src < end) {
+        if (src == vstart && vend > vstart) {
+            off = verify_vec(src, pattern, vend - vstart);
+            src += off;
+            if (src == vend)
+                continue;
+            /* mismatch found: locate the byte below */
+        }
+        if (((uintptr_t) src & 7) == 0 && src + 8 <= end) {
+            if (*(const uint64_t *) src == pattern) {
+                src += 8;
+                continue;
+            }
+            for (off = 0; off < 8; off++)
+                if (src[off] != pattern_byte(pattern, (uintptr_t) (src + off)))
+                    return src + off - start;
+        }
+        if (*src != pattern_byte(pattern, (uintptr_t) src))
+            return src - start;
+        src++;
+    }
+    return size;
+}
+
+/* word at offset 'off' (multiple of 8) of a sequence */
+static inline uint64_t seq_word(uint64_t seed, size_t off) {
+    uint64_t z = seed + (off / 8 + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* fill the bytes [first,last) of a sequence zone (first is 8 bytes aligned) */
+static void fill_seq_range(uint8_t *zone, uint64_t seed, size_t first, size_t last) {
+    size_t off;
+    uint64_t w;
+
+    for (off = first; off + 8 <= last; off += 8)
+        *(uint64_t *) (zone + off) = seq_word(seed, off);
+    if (off < last) {
+        w = seq_word(seed, off);
+        memcpy(zone + off, &w, last - off);
+    }
+}
+
+/* */
+/* */
+/* xxHash64 (used by axmem_digest) */
+/* */
+/* */
+
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t xxh_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_P2;
+    acc = xxh_rotl(acc, 31);
+    return acc * XXH_P1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+static uint64_t xxh64(const uint8_t *p, size_t len, uint64_t seed) {
+    const uint8_t *end = p + len;
+    uint64_t h, v, k;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + XXH_P1 + XXH_P2;
+        uint64_t v2 = seed + XXH_P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_P1;
+        do {
+            v1 = xxh_round(v1, *(const uint64_t *) p);
+            v2 = xxh_round(v2, *(const uint64_t *) (p + 8));
+            v3 = xxh_round(v3, *(const uint64_t *) (p + 16));
+            v4 = xxh_round(v4, *(const uint64_t *) (p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + XXH_P5;
+    }
+
+    h += (uint64_t) len;
+
+    while (p + 8 <= end) {
+        k = xxh_round(0, *(const uint64_t *) p);
+        h ^= k;
+        h = xxh_rotl(h, 27) * XXH_P1 + XXH_P4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        uint32_t w;
+        memcpy(&w, p, sizeof (w));
+        h ^= (uint64_t) w * XXH_P1;
+        h = xxh_rotl(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * XXH_P5;
+        h = xxh_rotl(h, 11) * XXH_P1;
+        p++;
+    }
+
+    v = h;
+    v ^= v >> 33;
+    v *= XXH_P2;
+    v ^= v >> 29;
+    v *= XXH_P3;
+    v ^= v >> 32;
+    return v;
+}
+
+/* */
+/* */
+/* multi-thread dispatch */
+/* */
+/* */
+
+#define AXMEM_OP_FILL           0
+#define AXMEM_OP_VERIFY         1
+#define AXMEM_OP_DIGEST         2
+#define AXMEM_OP_FILL_SEQ       3
+
+typedef struct {
+    int op;
+    uint8_t *zone;
+    size_t size;
+    uint64_t pattern; /* pattern or digest seed */
+    size_t first; /* first chunk (or byte) of this worker */
+    size_t last; /* last chunk (or byte) + 1 of this worker */
+    uint64_t *digests; /* AXMEM_OP_DIGEST: digest of every chunk */
+    size_t result; /* AXMEM_OP_VERIFY: first mismatch offset (or size) */
+} axmem_work_t;
+
+static void do_work(axmem_work_t *w) {
+    size_t i, len;
+
+    switch (w->op) {
+        case AXMEM_OP_FILL:
+            fill_range(w->zone + w->first, w->pattern, w->last - w->first);
+            break;
+        case AXMEM_OP_VERIFY:
+            w->result = w->first + verify_range(w->zone + w->first, w->pattern, w->last - w->first);
+            if (w->result == w->last)
+                w->result = w->size;
+            break;
+        case AXMEM_OP_FILL_SEQ:
+            fill_seq_range(w->zone, w->pattern, w->first, w->last);
+            break;
+        case AXMEM_OP_DIGEST:
+            for (i = w->first; i < w->last; i++) {
+                len = w->size - i * AXMEM_DIGEST_CHUNK;
+                if (len > AXMEM_DIGEST_CHUNK)
+                    len = AXMEM_DIGEST_CHUNK;
+                w->digests[i] = xxh64(w->zone + i * AXMEM_DIGEST_CHUNK, len, w->pattern);
+            }
+            break;
+    }
+}
+
+static void *worker(void *arg) {
+    do_work((axmem_work_t *) arg);
+    return NULL;
+}
+
+static int num_threads(int threads, size_t size) {
+    long cpus;
+
+    if (size < AXMEM_MT_THRESHOLD)
+        return 1;
+    if (threads <= 0) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? (int) cpus : 1;
+    }
+    if (threads > AXMEM_MAX_THREADS)
+        threads = AXMEM_MAX_THREADS;
+    return threads;
+}
+
+/*
+ * Split [0,units) among the threads; a unit is a byte for fill/verify (the
+ * split points are aligned to AXMEM_VEC_SIZE) or a chunk for digest.
+ * Returns the result of AXMEM_OP_VERIFY.
+ */
+static size_t run(axmem_work_t *proto, size_t units, size_t align, int threads) {
+    axmem_work_t work[AXMEM_MAX_THREADS];
+    pthread_t tid[AXMEM_MAX_THREADS];
+    int started[AXMEM_MAX_THREADS];
+    size_t step, pos = 0, result = proto->size;
+    int i;
+
+    if ((size_t) threads > units)
+        threads = (units > 0) ? (int) units : 1;
+    step = (units / threads + align - 1) & ~(align - 1);
+
+    for (i = 0; i < threads; i++) {
+        work[i] = *proto;
+        work[i].first = pos;
+        work[i].last = (i == threads - 1 || pos + step > units) ? units : pos + step;
+        pos = work[i].last;
+        started[i] = 0;
+        if (i > 0 && work[i].first < work[i].last)
+            started[i] = (pthread_create(&tid[i], NULL, worker, &work[i]) == 0);
+    }
+
+    /* the caller thread does the first part and the parts without thread */
+    do_work(&work[0]);
+    for (i = 1; i < threads; i++) {
+        if (started[i])
+            pthread_join(tid[i], NULL);
+        else if (work[i].first < work[i].last)
+            do_work(&work[i]);
+    }
+
+    /* the workers are in address order: the first mismatch is the lowest */
+    if (proto->op == AXMEM_OP_VERIFY) {
+        for (i = 0; i < threads; i++) {
+            if (work[i].first < work[i].last && work[i].result < proto->size) {
+                result = work[i].result;
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+/* see axiom_common.h */
+void axmem_fill64(void *dst, uint64_t pattern, size_t size, int threads) {
+    axmem_work_t w = {.op = AXMEM_OP_FILL, .zone = dst, .size = size, .pattern = pattern};
+    run(&w, size, AXMEM_VEC_SIZE, num_threads(threads, size));
+}
+
+/* see axiom_common.h */
+void axmem_fill_seq64(void *dst, uint64_t seed, size_t size, int threads) {
+    axmem_work_t w = {.op = AXMEM_OP_FILL_SEQ, .zone = dst, .size = size, .pattern = seed};
+    run(&w, size, AXMEM_VEC_SIZE, num_threads(threads, size));
+}
+
+/* see axiom_common.h */
+ssize_t axmem_verify64(const void *src, uint64_t pattern, size_t size, int threads) {
+    axmem_work_t w = {.op = AXMEM_OP_VERIFY, .zone = (uint8_t *) src, .size = size, .pattern = pattern};
+    size_t res = run(&w, size, AXMEM_VEC_SIZE, num_threads(threads, size));
+    return (res == size) ? -1 : (ssize_t) res;
+}
+
+/* see axiom_common.h */
+uint64_t axmem_digest(const void *src, size_t size, uint64_t seed, int threads) {
+    size_t chunks = (size + AXMEM_DIGEST_CHUNK - 1) / AXMEM_DIGEST_CHUNK;
+    axmem_work_t w = {.op = AXMEM_OP_DIGEST, .zone = (uint8_t *) src, .size = size, .pattern = seed};
+    uint64_t digest;
+
+    if (chunks <= 1)
+        return xxh64(src, size, seed);
+
+    w.digests = malloc(chunks * sizeof (uint64_t));
+    if (w.digests == NULL) {
+        /* no memory: compute the same digest chunk by chunk */
+        digest = seed;
+        for (size_t i = 0; i < chunks; i++) {
+            size_t len = size - i * AXMEM_DIGEST_CHUNK;
+            if (len > AXMEM_DIGEST_CHUNK)
+                len = AXMEM_DIGEST_CHUNK;
+            digest = xxh_merge(digest, xxh64(w.zone + i * AXMEM_DIGEST_CHUNK, len, seed));
+        }
+        return digest;
+    }
+
+    run(&w, chunks, 1, num_threads(threads, size));
+
+    /* digest of the chunk digests */
+    digest = seed;
+    for (size_t i = 0; i < chunks; i++)
+        digest = xxh_merge(digest, w.digests[i]);
+
+    free(w.digests);
+    return digest;
+}
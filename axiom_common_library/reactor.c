@@ -0,0 +1,476 @@
+/*!
+ * \file reactor.c
+ *
+ * \version     v1.2
+ *
+ * Single thread event loop (reactor) built on epoll.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "axiom_reactor.h"
+
+#define TICK_NS ((uint64_t) REACTOR_TICK_MS * 1000000)
+#define WHEEL_MASK (REACTOR_WHEEL_SIZE - 1)
+
+/* states of a timer */
+#define TIMER_ARMED 0
+#define TIMER_FIRING 1
+#define TIMER_DELETED 2
+
+/* a watched file descriptor (fd is -1 when deleted) */
+typedef struct reactor_handler {
+    int fd;
+    reactor_fd_cb_t cb;
+    void *arg;
+    struct reactor_handler *next;
+} reactor_handler_t;
+
+struct reactor_timer {
+    uint64_t expire;    /* tick */
+    unsigned period;    /* ticks (0 for one shot) */
+    int state;
+    reactor_cb_t cb;
+    void *arg;
+    struct reactor_timer *prev, *next;
+};
+
+/* a posted function */
+typedef struct reactor_post {
+    reactor_cb_t cb;
+    void *arg;
+    struct reactor_post *next;
+} reactor_post_t;
+
+struct reactor {
+    int epfd;
+    int stop;
+
+    /* fds (zombies are the ones deleted during the dispatch) */
+    reactor_handler_t *handlers, *zombies;
+
+    /* timer wheel: tick is the last processed */
+    reactor_timer_t *wheel[REACTOR_WHEEL_SIZE];
+    int ntimers;
+    uint64_t tick;
+
+    /* posted functions */
+    int postfd;
+    pthread_mutex_t lock;
+    reactor_post_t *posted, **posted_tail;
+
+    /* signals */
+    int sigfd;
+    sigset_t sigmask;
+    reactor_signal_cb_t sigcb[_NSIG];
+    void *sigarg[_NSIG];
+
+    /* busy polling */
+    uint64_t poll_max, poll_ns;
+    uint64_t woke, last;
+
+    reactor_stats_t stats;
+};
+
+static inline uint64_t _now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void _stats_add(uint64_t *counter, uint64_t value) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+/* run the posted functions */
+static void _posted(reactor_t *r, int fd, uint32_t events, void *arg) {
+    reactor_post_t *p, *next;
+    eventfd_t value;
+    uint64_t n = 0;
+
+    eventfd_read(fd, &value);
+    pthread_mutex_lock(&r->lock);
+    p = r->posted;
+    r->posted = NULL;
+    r->posted_tail = &r->posted;
+    pthread_mutex_unlock(&r->lock);
+    for (; p != NULL; p = next) {
+        next = p->next;
+        p->cb(r, p->arg);
+        free(p);
+        n++;
+    }
+    _stats_add(&r->stats.posted, n);
+}
+
+/* dispatch the pending signals */
+static void _signaled(reactor_t *r, int fd, uint32_t events, void *arg) {
+    struct signalfd_siginfo si;
+
+    while (read(fd, &si, sizeof (si)) == sizeof (si)) {
+        if (si.ssi_signo < _NSIG && r->sigcb[si.ssi_signo] != NULL) {
+            r->sigcb[si.ssi_signo](r, &si, r->sigarg[si.ssi_signo]);
+        }
+    }
+}
+
+/* see axiom_reactor.h */
+reactor_t *reactor_create(void) {
+    reactor_t *r = calloc(1, sizeof (reactor_t));
+    int err;
+
+    if (r == NULL) return NULL;
+    r->sigfd = -1;
+    r->postfd = -1;
+    r->posted_tail = &r->posted;
+    sigemptyset(&r->sigmask);
+    pthread_mutex_init(&r->lock, NULL);
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epfd < 0) goto error;
+    r->postfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->postfd < 0) goto error;
+    if (reactor_add_fd(r, r->postfd, EPOLLIN, 0, _posted, NULL) != 0) goto error;
+    r->last = _now();
+    return r;
+
+error:
+    err = errno;
+    reactor_destroy(r);
+    errno = err;
+    return NULL;
+}
+
+/* see axiom_reactor.h */
+void reactor_destroy(reactor_t *r) {
+    reactor_handler_t *h, *hnext;
+    reactor_timer_t *t, *tnext;
+    reactor_post_t *p, *pnext;
+    int i;
+
+    if (r == NULL) return;
+    for (h = r->handlers; h != NULL; h = hnext) {
+        hnext = h->next;
+        free(h);
+    }
+    for (h = r->zombies; h != NULL; h = hnext) {
+        hnext = h->next;
+        free(h);
+    }
+    for (i = 0; i < REACTOR_WHEEL_SIZE; i++) {
+        for (t = r->wheel[i]; t != NULL; t = tnext) {
+            tnext = t->next;
+            free(t);
+        }
+    }
+    for (p = r->posted; p != NULL; p = pnext) {
+        pnext = p->next;
+        free(p);
+    }
+    if (r->sigfd >= 0) close(r->sigfd);
+    if (r->postfd >= 0) close(r->postfd);
+    if (r->epfd >= 0) close(r->epfd);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+}
+
+/* see axiom_reactor.h */
+int reactor_add_fd(reactor_t *r, int fd, uint32_t events, int flags, reactor_fd_cb_t cb, void *arg) {
+    struct epoll_event ev;
+    reactor_handler_t *h;
+
+    h = malloc(sizeof (reactor_handler_t));
+    if (h == NULL) return -1;
+    h->fd = fd;
+    h->cb = cb;
+    h->arg = arg;
+    memset(&ev, 0, sizeof (ev));
+    ev.events = events | ((flags & REACTOR_EDGE) ? EPOLLET : 0);
+    ev.data.ptr = h;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        free(h);
+        return -1;
+    }
+    h->next = r->handlers;
+    r->handlers = h;
+    return 0;
+}
+
+/* see axiom_reactor.h */
+int reactor_del_fd(reactor_t *r, int fd) {
+    reactor_handler_t **hp, *h;
+    int ret;
+
+    for (hp = &r->handlers; *hp != NULL && (*hp)->fd != fd; hp = &(*hp)->next);
+    if (*hp == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    ret = epoll_ctl(r->epfd, EPOLL_CTL_DEL, fd, NULL);
+    /* an event of this fd can be pending: released after the dispatch */
+    h = *hp;
+    *hp = h->next;
+    h->fd = -1;
+    h->next = r->zombies;
+    r->zombies = h;
+    return ret;
+}
+
+/* insert an armed timer into the wheel */
+static void _timer_insert(reactor_t *r, reactor_timer_t *t) {
+    reactor_timer_t **slot = &r->wheel[t->expire & WHEEL_MASK];
+
+    t->state = TIMER_ARMED;
+    t->prev = NULL;
+    t->next = *slot;
+    if (*slot != NULL) (*slot)->prev = t;
+    *slot = t;
+    r->ntimers++;
+}
+
+/* remove an armed timer from the wheel */
+static void _timer_remove(reactor_t *r, reactor_timer_t *t) {
+    if (t->prev != NULL) t->prev->next = t->next;
+    else r->wheel[t->expire & WHEEL_MASK] = t->next;
+    if (t->next != NULL) t->next->prev = t->prev;
+    r->ntimers--;
+}
+
+/* see axiom_reactor.h */
+reactor_timer_t *reactor_add_timer(reactor_t *r, unsigned ms, int periodic, reactor_cb_t cb, void *arg) {
+    uint64_t now = _now() / TICK_NS;
+    unsigned ticks = (ms + REACTOR_TICK_MS - 1) / REACTOR_TICK_MS;
+    reactor_timer_t *t;
+
+    t = malloc(sizeof (reactor_timer_t));
+    if (t == NULL) return NULL;
+    if (ticks == 0) ticks = 1;
+    if (r->ntimers == 0) r->tick = now;
+    t->expire = now + ticks;
+    t->period = periodic ? ticks : 0;
+    t->cb = cb;
+    t->arg = arg;
+    _timer_insert(r, t);
+    return t;
+}
+
+/* see axiom_reactor.h */
+void reactor_del_timer(reactor_t *r, reactor_timer_t *t) {
+    if (t == NULL) return;
+    if (t->state == TIMER_FIRING) {
+        /* released by _expire() */
+        t->state = TIMER_DELETED;
+        return;
+    }
+    if (t->state == TIMER_ARMED) _timer_remove(r, t);
+    free(t);
+}
+
+/**
+ * Call the callbacks of the expired timers.
+ * @param r The reactor.
+ * @param now The actual time.
+ * @return The number of timers expired.
+ */
+static int _expire(reactor_t *r, uint64_t now) {
+    reactor_timer_t *t, *next, *expired = NULL;
+    uint64_t tick = now / TICK_NS, steps, i;
+    int n = 0;
+
+    if (tick <= r->tick) return 0;
+    if (r->ntimers == 0) {
+        r->tick = tick;
+        return 0;
+    }
+    /* after a full turn every slot has been visited */
+    steps = tick - r->tick;
+    if (steps > REACTOR_WHEEL_SIZE) steps = REACTOR_WHEEL_SIZE;
+    for (i = 1; i <= steps; i++) {
+        for (t = r->wheel[(r->tick + i) & WHEEL_MASK]; t != NULL; t = next) {
+            next = t->next;
+            if (t->expire > tick) continue;
+            _timer_remove(r, t);
+            t->state = TIMER_FIRING;
+            t->next = expired;
+            expired = t;
+        }
+    }
+    r->tick = tick;
+
+    for (t = expired; t != NULL; t = next) {
+        next = t->next;
+        if (t->state == TIMER_FIRING) {
+            t->cb(r, t->arg);
+            n++;
+        }
+        if (t->state == TIMER_FIRING && t->period != 0) {
+            t->expire = tick + t->period;
+            _timer_insert(r, t);
+        } else {
+            free(t);
+        }
+    }
+    _stats_add(&r->stats.timers, n);
+    return n;
+}
+
+/**
+ * Timeout of epoll_wait() up to the first slot of the wheel with timers.
+ * @param r The reactor.
+ * @param now The actual time.
+ * @return The timeout (msec) or -1.
+ */
+static int _timeout(reactor_t *r, uint64_t now) {
+    uint64_t d, next;
+
+    if (r->ntimers == 0) return -1;
+    for (d = 1; d < REACTOR_WHEEL_SIZE && r->wheel[(r->tick + d) & WHEEL_MASK] == NULL; d++);
+    next = (r->tick + d) * TICK_NS;
+    return next > now ? (int) ((next - now + 999999) / 1000000) : 0;
+}
+
+/* see axiom_reactor.h */
+int reactor_post(reactor_t *r, reactor_cb_t cb, void *arg) {
+    reactor_post_t *p = malloc(sizeof (reactor_post_t));
+
+    if (p == NULL) return -1;
+    p->cb = cb;
+    p->arg = arg;
+    p->next = NULL;
+    pthread_mutex_lock(&r->lock);
+    *r->posted_tail = p;
+    r->posted_tail = &p->next;
+    pthread_mutex_unlock(&r->lock);
+    return eventfd_write(r->postfd, 1);
+}
+
+/* see axiom_reactor.h */
+int reactor_add_signal(reactor_t *r, int signo, reactor_signal_cb_t cb, void *arg) {
+    sigset_t set;
+    int fd;
+
+    if (signo <= 0 || signo >= _NSIG) {
+        errno = EINVAL;
+        return -1;
+    }
+    sigemptyset(&set);
+    sigaddset(&set, signo);
+    if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) return -1;
+    r->sigcb[signo] = cb;
+    r->sigarg[signo] = arg;
+    sigaddset(&r->sigmask, signo);
+    /* a new signalfd or the update of the mask */
+    fd = signalfd(r->sigfd, &r->sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) return -1;
+    if (r->sigfd < 0) {
+        if (reactor_add_fd(r, fd, EPOLLIN, 0, _signaled, NULL) != 0) {
+            close(fd);
+            return -1;
+        }
+        r->sigfd = fd;
+    }
+    return 0;
+}
+
+/* see axiom_reactor.h */
+void reactor_set_busypoll(reactor_t *r, unsigned usec) {
+    r->poll_max = r->poll_ns = (uint64_t) usec * 1000;
+    __atomic_store_n(&r->stats.poll_ns, r->poll_ns, __ATOMIC_RELAXED);
+}
+
+/* see axiom_reactor.h */
+int reactor_run_once(reactor_t *r) {
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    reactor_handler_t *h;
+    uint64_t now, idle;
+    int n, i, expired, timeout;
+
+    for (;;) {
+        if (__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) return 0;
+        now = _now();
+        expired = _expire(r, now);
+        if (expired > 0) r->woke = now;
+        /* poll when timers expired or shortly after the last events */
+        timeout = (expired > 0 || now - r->last < r->poll_ns) ? 0 : _timeout(r, now);
+        n = epoll_wait(r->epfd, events, REACTOR_MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n > 0) break;
+        if (expired > 0) {
+            r->last = _now();
+            return expired;
+        }
+    }
+
+    r->woke = _now();
+    if (timeout == 0) {
+        _stats_add(&r->stats.polled, 1);
+    } else {
+        _stats_add(&r->stats.slept, 1);
+        /* adapt the polling time to the length of the idle period */
+        idle = r->woke - r->last;
+        if (idle <= r->poll_max) {
+            r->poll_ns = r->poll_ns * 2 + 1000;
+            if (r->poll_ns > r->poll_max) r->poll_ns = r->poll_max;
+        } else {
+            r->poll_ns /= 2;
+        }
+        __atomic_store_n(&r->stats.poll_ns, r->poll_ns, __ATOMIC_RELAXED);
+    }
+
+    for (i = 0; i < n; i++) {
+        h = events[i].data.ptr;
+        /* deleted by a previous callback */
+        if (h->fd < 0) continue;
+        h->cb(r, h->fd, events[i].events, h->arg);
+    }
+    while (r->zombies != NULL) {
+        h = r->zombies;
+        r->zombies = h->next;
+        free(h);
+    }
+
+    r->last = _now();
+    return n + expired;
+}
+
+/* see axiom_reactor.h */
+int reactor_run(reactor_t *r) {
+    while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) {
+        if (reactor_run_once(r) < 0) return -1;
+    }
+    return 0;
+}
+
+/* see axiom_reactor.h */
+void reactor_stop(reactor_t *r) {
+    __atomic_store_n(&r->stop, 1, __ATOMIC_RELEASE);
+    eventfd_write(r->postfd, 1);
+}
+
+/* see axiom_reactor.h */
+uint64_t reactor_woke(reactor_t *r) {
+    return r->woke;
+}
+
+/* see axiom_reactor.h */
+void reactor_get_stats(reactor_t *r, reactor_stats_t *st) {
+    st->polled = __atomic_load_n(&r->stats.polled, __ATOMIC_RELAXED);
+    st->slept = __atomic_load_n(&r->stats.slept, __ATOMIC_RELAXED);
+    st->poll_ns = __atomic_load_n(&r->stats.poll_ns, __ATOMIC_RELAXED);
+    st->timers = __atomic_load_n(&r->stats.timers, __ATOMIC_RELAXED);
+    st->posted = __atomic_load_n(&r->stats.posted, __ATOMIC_RELAXED);
+}
@@ -1,5 +1,9 @@
 
+// to use the cpu_set_t macros and sched_setaffinity()
+#define _GNU_SOURCE
+
 #include <linux/sched.h>
+#include <linux/mempolicy.h>
 #include <linux/types.h>
 #include <sys/syscall.h>
 #include <unistd.h>
@@ -9,6 +13,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "axiom_common.h"
+
 #define gettid() syscall(SYS_gettid)
 
 struct sched_attr {
@@ -36,7 +42,7 @@ static int sched_setattr(pid_t pid, const struct sched_attr *attr, unsigned int
 
 void sch_usage(FILE *out)
 {
-    fprintf(out, "-S, --sched SCHED[:P_0:[:P_1:[:P_2]]\n");
+    fprintf(out, "-S, --sched [SCHED[,P_0[,P_1[,P_2]]]][@ROLE=CPUS[:MEMS][/ROLE=CPUS[:MEMS]...]]\n");
     fprintf(out, "    set the scheduling parameters for the threads; SCHED can be (see 'sched' man page):\n");
     fprintf(out, "    OTHER    = use SCHED_OTHER (default if no --sched)\n");
     fprintf(out, "    BATCH    = use SCHED_BATCH\n");
@@ -51,6 +57,12 @@ void sch_usage(FILE *out)
     fprintf(out, "      DEADLINE     P_0 is the mean execution time, P_1 is the deadline, P_2 is the periond\n");
     fprintf(out, "    (for P_0 use 'chrt -m' to see parameter range and 'man sched' for more information)\n");
     fprintf(out, "    (for DEADLINE you should use 'u' for usec, 'm' for msec and none for sec)\n");
+    fprintf(out, "    after '@' the cpus and the memory nodes of the threads can be set for every ROLE\n");
+    fprintf(out, "    (receiver, sender, writer, sock, event, main, child or '*' for the others):\n");
+    fprintf(out, "      CPUS is a cpu list (i.e. 3 or 4-5,8), 'isolated' for the isolated cpus\n");
+    fprintf(out, "           or 'nodeN' for the cpus of the NUMA node N (resolved on every node)\n");
+    fprintf(out, "      MEMS is a NUMA node list: the memory of the threads is bound to these nodes\n");
+    fprintf(out, "    (i.e. --sched FIFO,10@receiver=3/writer=4-5/child=isolated:0)\n");
 }
 
 /* used for thread scheduling */
@@ -59,6 +71,23 @@ static uint64_t sched_p0 = 0;
 static uint64_t sched_p1 = 0;
 static uint64_t sched_p2 = 0;
 
+/* max number of roles of the placement */
+#define SCH_MAX_ROLES 16
+
+/* placement of the threads of a role */
+typedef struct {
+    char role[16];
+    int has_cpus;
+    cpu_set_t cpus;
+    unsigned long mems;
+} sch_place_t;
+
+/* used for thread placement */
+static char sched_placespec[256];
+static sch_place_t sched_place[SCH_MAX_ROLES];
+static int sched_nplace = 0;
+static cpu_set_t sched_initial;
+
 int sch_encodeopt(char *buf, int bufsize) {
     switch (sched_policy) {
         case SCHED_IDLE:
@@ -74,11 +103,149 @@ int sch_encodeopt(char *buf, int bufsize) {
             snprintf(buf,bufsize,"%d,%luu,%luu,%luu",sched_policy,sched_p0,sched_p1,sched_p2);
             break;
     }
+    if (sched_placespec[0] != '\0') {
+        // the cpus are resolved by the receiver (i.e. 'isolated')
+        size_t len = strlen(buf);
+        snprintf(buf + len, bufsize - len, "@%s", sched_placespec);
+    }
+    return 0;
+}
+
+/**
+ * Parse a list of numbers (i.e. "0-3,6").
+ * @param list the list
+ * @param set the function called for every number
+ * @param arg the argument of set
+ * @return 0 on success, -1 on syntax error
+ */
+static int sch_parselist(const char *list, void (*set)(int, void *), void *arg)
+{
+    const char *start = list;
+    char *end;
+    long first, last;
+
+    while (*start != '\0' && *start != '\n') {
+        first = strtol(start, &end, 10);
+        if (start == end || first < 0) return -1;
+        last = first;
+        if (*end == '-') {
+            start = end + 1;
+            last = strtol(start, &end, 10);
+            if (start == end || last < first) return -1;
+        }
+        for (; first <= last; first++) {
+            set(first, arg);
+        }
+        if (*end == ',') end++;
+        else if (*end != '\0' && *end != '\n') return -1;
+        start = end;
+    }
     return 0;
 }
 
-int sch_decodeopt(char *optarg, void(*_usage)(const char *, ...))
+static void sch_setcpu(int cpu, void *arg)
 {
+    if (cpu < CPU_SETSIZE) CPU_SET(cpu, (cpu_set_t *) arg);
+}
+
+static void sch_setmem(int node, void *arg)
+{
+    if (node < (int) sizeof (unsigned long) * 8) *(unsigned long *) arg |= 1UL << node;
+}
+
+/**
+ * Resolve the cpus of a placement on this node.
+ * @param cpus the cpu list, 'isolated' or 'nodeN'
+ * @param set the resolved cpus
+ * @return 0 on success, -1 on syntax error
+ */
+static int sch_parsecpus(const char *cpus, cpu_set_t *set)
+{
+    char path[64], line[1024];
+    FILE *fin;
+    int ret;
+
+    CPU_ZERO(set);
+    if (strcmp(cpus, "isolated") == 0) {
+        snprintf(path, sizeof (path), "/sys/devices/system/cpu/isolated");
+    } else if (strncmp(cpus, "node", 4) == 0) {
+        snprintf(path, sizeof (path), "/sys/devices/system/node/%s/cpulist", cpus);
+    } else {
+        return sch_parselist(cpus, sch_setcpu, set);
+    }
+    fin = fopen(path, "r");
+    if (fin == NULL) {
+        logmsg(LOG_WARN, "sched: can not read %s", path);
+        return 0;
+    }
+    if (fgets(line, sizeof (line), fin) == NULL) line[0] = '\0';
+    fclose(fin);
+    ret = sch_parselist(line, sch_setcpu, set);
+    if (ret == 0 && CPU_COUNT(set) == 0) {
+        logmsg(LOG_WARN, "sched: no cpus for '%s' on this node", cpus);
+    }
+    return ret;
+}
+
+/**
+ * Parse the placement part of --sched (ROLE=CPUS[:MEMS][/ROLE=...]).
+ * @param spec the placement
+ * @return 0 on success, -1 on syntax error
+ */
+static int sch_parseplace(const char *spec)
+{
+    char buf[sizeof (sched_placespec)];
+    char *saveptr, *item, *cpus, *mems;
+    sch_place_t *p;
+    int n = 0;
+
+    if (strlen(spec) >= sizeof (buf)) return -1;
+    strcpy(buf, spec);
+    for (item = strtok_r(buf, "/", &saveptr); item != NULL; item = strtok_r(NULL, "/", &saveptr)) {
+        if (n == SCH_MAX_ROLES) return -1;
+        cpus = strchr(item, '=');
+        if (cpus == NULL || cpus == item || cpus - item >= (int) sizeof (p->role)) return -1;
+        *cpus++ = '\0';
+        mems = strchr(cpus, ':');
+        if (mems != NULL) *mems++ = '\0';
+
+        p = &sched_place[n];
+        memset(p, 0, sizeof (*p));
+        strcpy(p->role, item);
+        if (sch_parsecpus(cpus, &p->cpus) != 0) return -1;
+        // no cpus on this node: the affinity is not changed
+        p->has_cpus = CPU_COUNT(&p->cpus) > 0;
+        if (mems != NULL && sch_parselist(mems, sch_setmem, &p->mems) != 0) return -1;
+        n++;
+    }
+    sched_nplace = n;
+    strcpy(sched_placespec, spec);
+    // used to restore the affinity of the roles without placement
+    if (sched_getaffinity(0, sizeof (sched_initial), &sched_initial) != 0) {
+        CPU_ZERO(&sched_initial);
+        for (int i = 0; i < CPU_SETSIZE; i++) CPU_SET(i, &sched_initial);
+    }
+    return 0;
+}
+
+int sch_decodeopt(char *optarg, void(*_usage)(char *, ...))
+{
+    char *place;
+
+    if (optarg != NULL && (place = strchr(optarg, '@')) != NULL) {
+        if (sch_parseplace(place + 1) != 0) {
+            if (_usage!=NULL) {
+                _usage("'%s': bad cpus placement", optarg);
+            }
+            return -1;
+        }
+        // only placement: the scheduling policy is not changed
+        if (place == optarg) return 0;
+        *place = '\0';
+        int ret = sch_decodeopt(optarg, _usage);
+        *place = '@';
+        return ret;
+    }
     if (optarg != NULL) {
         int per = 0;
         char *start, *end;
@@ -224,8 +391,56 @@ int sch_decodeopt(char *optarg, void(*_usage)(const char *, ...))
     return 0;
 }
 
+/**
+ * Find the placement of a role.
+ * @param role the role (NULL for the default)
+ * @return the placement of the role, or of '*', or NULL
+ */
+static sch_place_t *sch_findplace(const char *role)
+{
+    sch_place_t *def = NULL;
+    int i;
+
+    for (i = 0; i < sched_nplace; i++) {
+        if (role != NULL && strcmp(sched_place[i].role, role) == 0) return &sched_place[i];
+        if (strcmp(sched_place[i].role, "*") == 0) def = &sched_place[i];
+    }
+    return def;
+}
+
+int sch_hasplacement(const char *role)
+{
+    return sch_findplace(role) != NULL;
+}
+
+int sch_setplacement(const char *role)
+{
+    sch_place_t *p;
+    unsigned long mems = 0;
+    int ret = 0;
+
+    if (sched_nplace == 0) return 0;
+    p = sch_findplace(role);
+    if (sched_setaffinity(0, sizeof (cpu_set_t), p != NULL && p->has_cpus ? &p->cpus : &sched_initial) != 0) {
+        ret = -1;
+    }
+    if (p != NULL) mems = p->mems;
+    // maxnode is the number of bits plus one (see set_mempolicy man page)
+    if (syscall(SYS_set_mempolicy, mems != 0 ? MPOL_BIND : MPOL_DEFAULT,
+            mems != 0 ? &mems : NULL, mems != 0 ? sizeof (mems) * 8 + 1 : 0) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
 int sch_setsched()
 {
+    return sch_setsched_role(NULL);
+}
+
+int sch_setsched_role(const char *role)
+{
+    int ret = sch_setplacement(role);
     struct sched_attr attr;
     pid_t mytid = gettid();
     memset(&attr, 0, sizeof (struct sched_attr));
@@ -248,5 +463,6 @@ int sch_setsched()
             attr.sched_period = sched_p2 * 1000;
             break;
     }
-    return sched_setattr(mytid, &attr, 0);
+    if (sched_setattr(mytid, &attr, 0) != 0) ret = -1;
+    return ret;
 }
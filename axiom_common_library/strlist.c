@@ -5,14 +5,87 @@
  *
  * String list manipulation functions.
  *
+ * The pointer vector and the copies of the strings are kept in a single
+ * block: the vector at the start (capacity slots), the strings after it.
+ * The block doubles when it is full, so an append is O(1) amortised and
+ * the list is released with one free().
+ *
  * Copyright (C) 2016, Evidence Srl.
  * Terms of use are as specified in COPYING
  */
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "axiom_common.h"
 
+/** Minimum pointer slots of the block. */
+#define SL_MIN_SLOTS 16
+/** Minimum string bytes of the block. */
+#define SL_MIN_BYTES 512
+
+/** Start of the string area of the block. */
+static inline char *_strings(strlist_t *p) {
+    return (char *) (p->data + p->capacity);
+}
+
+/**
+ * Make room for more pointers and string bytes.
+ * @param p The string list.
+ * @param n Pointers to add.
+ * @param bytes String bytes to add.
+ * @return 0 on success, -1 on failure.
+ */
+static int _reserve(strlist_t *p, int n, size_t bytes) {
+    int capacity = p->capacity;
+    size_t strsize = p->strsize;
+    char **data, *oldstr, *newstr;
+    int i;
+
+    if (p->size + n <= capacity && p->strused + bytes <= strsize) return 0;
+    while (p->size + n > capacity) capacity = capacity < SL_MIN_SLOTS ? SL_MIN_SLOTS : capacity * 2;
+    while (p->strused + bytes > strsize) strsize = strsize < SL_MIN_BYTES ? SL_MIN_BYTES : strsize * 2;
+
+    data = malloc(sizeof (char*) * capacity + strsize);
+    if (data == NULL) {
+        elogmsg("malloc() failure");
+        return -1;
+    }
+    oldstr = _strings(p);
+    newstr = (char *) (data + capacity);
+    if (p->strused > 0) memcpy(newstr, oldstr, p->strused);
+    for (i = 0; i < p->size; i++) {
+        char *s = p->data[i];
+        /* only the copies in the block move */
+        if (s != NULL && (uintptr_t) s - (uintptr_t) oldstr < p->strused) {
+            s = newstr + (s - oldstr);
+        }
+        data[i] = s;
+    }
+    free(p->data);
+    p->data = data;
+    p->capacity = capacity;
+    p->strsize = strsize;
+    return 0;
+}
+
+/**
+ * Copy a string in the block (the room must be reserved).
+ * @param p The string list.
+ * @param s The string (can be NULL).
+ * @return The copy.
+ */
+static inline char *_copy(strlist_t *p, char *s) {
+    char *s2;
+    size_t size;
+    if (s == NULL) return NULL;
+    size = strlen(s) + 1;
+    s2 = _strings(p) + p->strused;
+    memcpy(s2, s, size);
+    p->strused += size;
+    return s2;
+}
+
 /**
  * Insert a string into the string list.
  * @param p The string list.
@@ -20,37 +93,19 @@
  * @param head true insert into head else into tail.
  */
 static void _insert(strlist_t *p, char *s, int head) {
-    void *ptr;
-    int idx;
-    if (p->size == 0) {
-        ptr = malloc(sizeof (char*));
-    } else {
-        ptr = realloc(p->data, sizeof (char*)*(p->size + 1));
-    }
-    if (ptr == NULL) {
-        elogmsg("realloc() failure");
-        return;
-    }
-    p->data = (char**) ptr;
-    p->size++;
+    size_t off = (uintptr_t) s - (uintptr_t) _strings(p);
+    int inside = s != NULL && p->data != NULL && off < p->strused;
+
+    if (_reserve(p, 1, s == NULL ? 0 : strlen(s) + 1) != 0) return;
+    /* a string of the list itself may have been moved */
+    if (inside) s = _strings(p) + off;
     if (head) {
-        memmove(p->data, p->data + 1, p->size - 1);
-        idx = 0;
-    } else {
-        idx = p->size - 1;
-    }
-    if (s == NULL) {
-        p->data[idx] = NULL;
+        memmove(p->data + 1, p->data, sizeof (char*) * p->size);
+        p->data[0] = _copy(p, s);
     } else {
-        int size = strlen(s) + 1;
-        char *s2 = malloc(size);
-        if (s2 == NULL) {
-            elogmsg("malloc() failure");
-            return;
-        }
-        strlcpy(s2, s, size);
-        p->data[idx] = s2;
+        p->data[p->size] = _copy(p, s);
     }
+    p->size++;
 }
 
 /* see axiom_common.h */
@@ -72,18 +127,9 @@ char** sl_get(strlist_t *p) {
 void sl_init(strlist_t *p) {
     p->size = 0;
     p->data = NULL;
-}
-
-/**
- * Count a NULL terminated array of string.
- * @param args The array of string.
- * @return The number of elements of array.
- */
-static inline int count(char **args) {
-    register int c = 0;
-    if (args == NULL) return 0;
-    while (*args++ != NULL) c++;
-    return c;
+    p->capacity = 0;
+    p->strsize = 0;
+    p->strused = 0;
 }
 
 /**
@@ -93,12 +139,40 @@ static inline int count(char **args) {
  * @param head true insert into head else into tail
  */
 static inline void _insert_all(strlist_t *p, char **args, int head) {
-    // slow implementation :-(
+    char **vec = p->data, **tmp = NULL;
+    uintptr_t oldstr = vec != NULL ? (uintptr_t) _strings(p) : 0;
+    size_t bytes = 0, oldused = p->strused;
+    int i, n;
+
     if (args == NULL) return;
-    while (*args != NULL) {
-        _insert(p, *args, head);
-        args++;
+    for (n = 0; args[n] != NULL; n++) bytes += strlen(args[n]) + 1;
+    if (n == 0) return;
+    /* args can be the vector of the list itself: it moves */
+    if (vec != NULL && (uintptr_t) args - (uintptr_t) vec < sizeof (char*) * p->capacity) {
+        tmp = malloc(sizeof (char*) * n);
+        if (tmp == NULL) {
+            elogmsg("malloc() failure");
+            return;
+        }
+        memcpy(tmp, args, sizeof (char*) * n);
+        args = tmp;
     }
+    if (_reserve(p, n, bytes) != 0) {
+        free(tmp);
+        return;
+    }
+    /* the order of args is kept */
+    if (head) memmove(p->data + n, p->data, sizeof (char*) * p->size);
+    for (i = 0; i < n; i++) {
+        char *s = args[i];
+        /* a string of the list itself may have been moved */
+        if (p->data != vec && (uintptr_t) s - oldstr < oldused) {
+            s = _strings(p) + ((uintptr_t) s - oldstr);
+        }
+        p->data[head ? i : p->size + i] = _copy(p, s);
+    }
+    p->size += n;
+    free(tmp);
 }
 
 /* see axiom_common.h */
@@ -113,12 +187,6 @@ void sl_insert_all(strlist_t *p, char **args) {
 
 /* see axiom_common.h */
 void sl_free(strlist_t *p) {
-    if (p->size > 0) {
-        int i;
-        for (i = 0; i < p->size; i++) {
-            if (p->data[i] != NULL) free(p->data[i]);
-        }
-        free(p->data);
-    }
+    free(p->data);
     sl_init(p);
 }
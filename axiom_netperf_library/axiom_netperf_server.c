@@ -0,0 +1,465 @@
+/*!
+ * \file axiom_netperf_server.c
+ *
+ * \version     v1.2
+ * \date        2017-09-05
+ *
+ * This file contains the implementation of the axiom-netperf server core.
+ *
+ * The core keeps an independent session for each source node, so several
+ * clients can run at the same time. It is used by the axiom-netperf server
+ * mode and by the axiom-init daemon, which can hand the netperf traffic off
+ * to dedicated threads bound to their own port.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "axiom_nic_types.h"
+#include "axiom_nic_api_user.h"
+#include "axiom_nic_packets.h"
+#include "axiom_nic_init.h"
+#include "axiom_utility.h"
+#include "dprintf.h"
+#include "axiom_common.h"
+
+#include "axiom_netperf_server.h"
+
+/* send the result of a session to the client */
+static void
+axnetperf_core_reply(axnetperf_core_t *core, axiom_node_id_t src,
+        axiom_port_t reply_port, uint64_t received_bytes,
+        struct timespec elapsed_ts, uint8_t error_report)
+{
+    axiom_err_t err;
+    axiom_netperf_payload_t payload;
+    uint64_t elapsed_nsec;
+    double rx_th;
+
+    /* compute time elapsed */
+    elapsed_nsec = timespec2nsec(elapsed_ts);
+    rx_th = (double)(received_bytes / nsec2sec(elapsed_nsec));
+    IPRINTF(core->verbose, "Rx throughput = %3.3f Gb/s - elapsed_nsec = %llu",
+            rx_th * 8 / 1024 / 1024 / 1024, (long long unsigned)elapsed_nsec);
+
+    /* send elapsed time to netperf application */
+    memset(&payload, 0, sizeof(payload));
+    payload.command = AXIOM_CMD_NETPERF_END;
+    payload.total_bytes = received_bytes;
+    payload.elapsed_time = elapsed_nsec;
+    payload.error = error_report;
+    /* the device of axnetperf_core_start() does not block */
+    while ((err = axiom_send_raw(core->dev, src, reply_port,
+            AXIOM_TYPE_RAW_DATA, sizeof(payload), &payload)) ==
+            AXIOM_RET_NOTAVAIL) {
+        sched_yield();
+    }
+    if (!AXIOM_RET_IS_OK(err)) {
+        EPRINTF("send back time error");
+    }
+}
+
+/* close the session; called with the session lock held */
+static void
+axnetperf_core_close(axnetperf_core_t *core, axnetperf_server_t *server,
+        axiom_node_id_t src)
+{
+    unsigned int active;
+
+    if (!server->active)
+        return;
+
+    server->active = 0;
+    server->mode = AXNP_MODE_STREAM;
+
+    pthread_mutex_lock(&core->mutex);
+    active = --core->active;
+    pthread_mutex_unlock(&core->mutex);
+
+    IPRINTF(core->log_sessions || core->verbose,
+            "Session with node %d ended [%u active]", src, active);
+}
+
+/* map the RDMA zone the first time it is needed */
+static void *
+axnetperf_core_rdma_zone(axnetperf_core_t *core)
+{
+    void *zone;
+
+    pthread_mutex_lock(&core->mutex);
+    if (!core->rdma_zone) {
+        core->rdma_zone = axiom_rdma_mmap(core->dev, &core->rdma_size);
+    }
+    zone = core->rdma_zone;
+    pthread_mutex_unlock(&core->mutex);
+
+    return zone;
+}
+
+/* latency mode: send back the message received from the client */
+static void
+axnetperf_core_echo(axnetperf_core_t *core, axiom_node_id_t src,
+        axiom_port_t reply_port, uint8_t type, size_t payload_size,
+        void *payload)
+{
+    axiom_netperf_payload_t *recv_payload =
+            ((axiom_netperf_payload_t *) payload);
+    axiom_err_t err;
+
+again:
+    switch (type) {
+        case AXNP_RAW:
+            err = axiom_send_raw(core->dev, src, reply_port,
+                    AXIOM_TYPE_RAW_DATA, payload_size, payload);
+            break;
+
+        case AXNP_LONG:
+            err = axiom_send_long(core->dev, src, reply_port,
+                    payload_size, payload);
+            break;
+
+        case AXNP_RDMA:
+            /* the client wrote total_bytes in our RDMA zone: write them back
+             * in the RDMA zone of the client before ringing it */
+            err = axiom_rdma_write_sync(core->dev, src,
+                    recv_payload->total_bytes, (void *)0, (void *)0, NULL);
+            if (!AXIOM_RET_IS_OK(err))
+                break;
+
+            err = axiom_send_raw(core->dev, src, reply_port,
+                    AXIOM_TYPE_RAW_DATA, payload_size, payload);
+            break;
+
+        default:
+            EPRINTF("echo of unknown message type %u", type);
+            return;
+    }
+
+    if (err == AXIOM_RET_NOTAVAIL) {
+        /* the device of axnetperf_core_start() does not block */
+        sched_yield();
+        goto again;
+    }
+    if (!AXIOM_RET_IS_OK(err)) {
+        EPRINTF("echo send error");
+    }
+}
+
+/* RDMA end message: check the data written by the client */
+static void
+axnetperf_core_rdma_end(axnetperf_core_t *core, axnetperf_server_t *server,
+        axiom_node_id_t src, axiom_netperf_payload_t *recv_payload)
+{
+    struct timespec elapsed_ts;
+    axiom_port_t reply_port;
+    uint64_t received_bytes;
+    uint8_t failed = 0;
+    void *rdma_zone;
+
+    pthread_mutex_lock(&server->lock);
+    server->received_bytes = received_bytes = recv_payload->total_bytes;
+    elapsed_ts = timespec_sub(server->cur_ts, server->start_ts);
+    reply_port = server->reply_port;
+    axnetperf_core_close(core, server, src);
+    pthread_mutex_unlock(&server->lock);
+
+    /* RDMA read: the client read our zone, nothing to check */
+    if (recv_payload->mode != AXNP_MODE_RDMA_READ) {
+        /* the check can be long: other sessions must not wait for it */
+        rdma_zone = axnetperf_core_rdma_zone(core);
+        if (!rdma_zone) {
+            EPRINTF("rdma map failed");
+            failed = 1;
+        } else if (received_bytes > core->rdma_size) {
+            EPRINTF("rdma session exceeds the RDMA zone");
+            failed = 1;
+        } else if (recv_payload->check == AXNP_CHECK_DIGEST) {
+            failed = axmem_digest(rdma_zone, received_bytes, 0, 0) !=
+                recv_payload->magic;
+        } else {
+            failed = axmem_verify64(rdma_zone, recv_payload->magic,
+                    received_bytes, 0) >= 0;
+        }
+    }
+
+    axnetperf_core_reply(core, src, reply_port, received_bytes, elapsed_ts,
+            failed);
+}
+
+void
+axnetperf_core_init(axnetperf_core_t *core, axiom_dev_t *dev, int verbose)
+{
+    int i;
+
+    memset(core, 0, sizeof(*core));
+    core->dev = dev;
+    core->verbose = verbose;
+    core->stop_fd = -1;
+    pthread_mutex_init(&core->mutex, NULL);
+
+    for (i = 0; i < AXIOM_NODES_NUM; i++) {
+        pthread_mutex_init(&core->sessions[i].lock, NULL);
+    }
+}
+
+int
+axnetperf_core_start(axnetperf_core_t *core, axiom_port_t port,
+        unsigned int num_threads, int verbose)
+{
+    axiom_args_t axiom_args;
+    axiom_dev_t *dev;
+    axiom_err_t err;
+    unsigned int i;
+
+    if (num_threads == 0 || num_threads > AXNP_CORE_MAX_THREADS) {
+        EPRINTF("invalid number of netperf threads [%u]", num_threads);
+        return -1;
+    }
+
+    /* the threads wait with poll(): a message can be taken by another one */
+    axiom_args.flags = AXIOM_FLAG_NOBLOCK;
+    dev = axiom_open(&axiom_args);
+    if (dev == NULL) {
+        EPRINTF("axiom_open error");
+        return -1;
+    }
+
+    err = axiom_bind(dev, port);
+    if (err != port) {
+        EPRINTF("axiom_bind error on port %u", port);
+        axiom_close(dev);
+        return -1;
+    }
+
+    axnetperf_core_init(core, dev, verbose);
+    core->own_dev = 1;
+    core->port = port;
+
+    core->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (core->stop_fd < 0) {
+        EPRINTF("eventfd error");
+        axnetperf_core_release(core);
+        return -1;
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        if (pthread_create(&core->threads[i], NULL, axnetperf_core_loop,
+                    core)) {
+            EPRINTF("netperf thread creation error");
+            break;
+        }
+        core->num_threads++;
+    }
+
+    if (core->num_threads == 0) {
+        axnetperf_core_release(core);
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+axnetperf_core_release(axnetperf_core_t *core)
+{
+    unsigned int i;
+
+    /* the eventfd stays readable: it wakes all the threads */
+    if (core->num_threads > 0 && eventfd_write(core->stop_fd, 1)) {
+        EPRINTF("netperf threads stop error");
+    }
+    for (i = 0; i < core->num_threads; i++) {
+        pthread_join(core->threads[i], NULL);
+    }
+    core->num_threads = 0;
+
+    if (core->stop_fd >= 0) {
+        close(core->stop_fd);
+        core->stop_fd = -1;
+    }
+
+    if (core->rdma_zone) {
+        axiom_rdma_munmap(core->dev);
+        core->rdma_zone = NULL;
+    }
+
+    if (core->own_dev) {
+        axiom_close(core->dev);
+        core->own_dev = 0;
+    }
+}
+
+void
+axnetperf_core_handle(axnetperf_core_t *core, axiom_node_id_t src,
+        size_t payload_size, void *payload)
+{
+    axiom_netperf_payload_t *recv_payload =
+            ((axiom_netperf_payload_t *) payload);
+    axnetperf_server_t *server = &core->sessions[src];
+    struct timespec now, elapsed_ts;
+    axiom_port_t reply_port;
+    uint64_t received_bytes;
+    unsigned int active;
+    uint8_t type;
+
+    /* take a timestamp */
+    if (clock_gettime(CLOCK_REALTIME, &now)) {
+        EPRINTF("gettime error");
+        return;
+    }
+
+    switch (recv_payload->command) {
+        case AXIOM_CMD_NETPERF_START:
+            pthread_mutex_lock(&server->lock);
+            server->expected_bytes = recv_payload->total_bytes;
+            server->received_bytes = 0;
+            server->reply_port = recv_payload->reply_port;
+            server->type = recv_payload->type;
+            server->mode = recv_payload->mode;
+            /* get time of the first netperf message received */
+            server->start_ts = server->cur_ts = now;
+
+            pthread_mutex_lock(&core->mutex);
+            if (!server->active)
+                core->active++;
+            active = core->active;
+            pthread_mutex_unlock(&core->mutex);
+            server->active = 1;
+            pthread_mutex_unlock(&server->lock);
+
+            IPRINTF(core->log_sessions || core->verbose,
+                    "Session with node %d started [%u active]", src, active);
+            IPRINTF(core->verbose, "Start timestamp: %ld sec %ld nsec - "
+                    "Reply-port: 0x%x", now.tv_sec, now.tv_nsec,
+                    recv_payload->reply_port);
+            break;
+
+        case AXIOM_CMD_NETPERF_END:
+            pthread_mutex_lock(&server->lock);
+            server->cur_ts = now;
+            if (server->mode == AXNP_MODE_ECHO) {
+                axnetperf_core_close(core, server, src);
+                pthread_mutex_unlock(&server->lock);
+                break;
+            }
+            pthread_mutex_unlock(&server->lock);
+
+            /* RAW and LONG sessions end with the last byte received */
+            if (recv_payload->type == AXNP_RDMA) {
+                axnetperf_core_rdma_end(core, server, src, recv_payload);
+            }
+            break;
+
+        case AXIOM_CMD_NETPERF:
+            pthread_mutex_lock(&server->lock);
+            if (server->mode == AXNP_MODE_ECHO) {
+                reply_port = server->reply_port;
+                type = server->type;
+                pthread_mutex_unlock(&server->lock);
+
+                axnetperf_core_echo(core, src, reply_port, type, payload_size,
+                        payload);
+                break;
+            }
+
+            /* RAW or LONG message */
+            server->cur_ts = now;
+            server->received_bytes += payload_size;
+            received_bytes = server->received_bytes;
+
+            DPRINTF("NETPERF msg received from: %u - expected_bytes: %llu "
+                    "received_bytes: %llu", src,
+                    (long long unsigned)server->expected_bytes,
+                    (long long unsigned)server->received_bytes);
+
+            if (!server->active ||
+                    server->received_bytes < server->expected_bytes) {
+                pthread_mutex_unlock(&server->lock);
+                break;
+            }
+
+            elapsed_ts = timespec_sub(server->cur_ts, server->start_ts);
+            reply_port = server->reply_port;
+            axnetperf_core_close(core, server, src);
+            pthread_mutex_unlock(&server->lock);
+
+            axnetperf_core_reply(core, src, reply_port, received_bytes,
+                    elapsed_ts, 0);
+            break;
+
+        default:
+            EPRINTF("receive a not AXIOM_CMD_NETPERF message");
+    }
+}
+
+void *
+axnetperf_core_loop(void *arg)
+{
+    axnetperf_core_t *core = ((axnetperf_core_t *) arg);
+    axiom_node_id_t src;
+    axiom_port_t port;
+    axiom_type_t type;
+    axiom_long_payload_t payload;
+    struct pollfd fds[3];
+    axiom_err_t err;
+
+    IPRINTF(core->log_sessions || core->verbose,
+            "[TID %ld] SERVER started on port %d", syscall(SYS_gettid),
+            core->port);
+
+    if (core->stop_fd >= 0) {
+        err = axiom_get_fds(core->dev, &fds[1].fd, &fds[2].fd, NULL);
+        if (!AXIOM_RET_IS_OK(err)) {
+            EPRINTF("axiom_get_fds error");
+            return (void *)AXIOM_RET_ERROR;
+        }
+        fds[0].fd = core->stop_fd;
+        fds[0].events = fds[1].events = fds[2].events = POLLIN;
+    }
+
+    while (1) {
+        size_t payload_size = sizeof(payload);
+
+        if (core->stop_fd >= 0) {
+            /* wait a message or the stop of axnetperf_core_release() */
+            if (poll(fds, 3, -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                EPRINTF("poll error");
+                return (void *)AXIOM_RET_ERROR;
+            }
+            if (fds[0].revents)
+                break;
+        }
+
+        err = axiom_recv(core->dev, &src, &port, &type, &payload_size,
+                &payload);
+        if (err == AXIOM_RET_NOTAVAIL) {
+            /* taken by another thread */
+            continue;
+        }
+        if (!AXIOM_RET_IS_OK(err)) {
+            EPRINTF("error receiving message");
+            return (void *)AXIOM_RET_ERROR;
+        }
+
+        axnetperf_core_handle(core, src, payload_size, &payload);
+    }
+
+    return (void *)AXIOM_RET_OK;
+}
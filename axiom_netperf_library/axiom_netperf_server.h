@@ -0,0 +1,147 @@
+/*!
+ * \file axiom_netperf_server.h
+ *
+ * \version     v1.2
+ * \date        2017-09-05
+ *
+ * This file contains the wire format of the axiom-netperf messages and the
+ * API of the axiom-netperf server core, shared by the axiom-netperf server
+ * mode and by the axiom-init daemon.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#ifndef AXIOM_NETPERF_SERVER_h
+#define AXIOM_NETPERF_SERVER_h
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "axiom_nic_types.h"
+#include "axiom_nic_api_user.h"
+
+/* netperf session modes (axiom_netperf_payload_t.mode) */
+#define AXNP_MODE_STREAM                0
+#define AXNP_MODE_ECHO                  1
+#define AXNP_MODE_REPORT_TX             2
+#define AXNP_MODE_REPORT_RX             3
+#define AXNP_MODE_RDMA_READ             4
+
+/* RDMA data check (axiom_netperf_payload_t.check) */
+#define AXNP_CHECK_MAGIC                0
+#define AXNP_CHECK_DIGEST               1
+
+/*! \brief Maximum number of receiver threads of a server core */
+#define AXNP_CORE_MAX_THREADS           64
+
+/*! \brief Message payload for the axiom-netperf application */
+typedef struct axiom_netperf_payload {
+    uint8_t  command;           /*!< \brief Command of netperf messages */
+    uint8_t  padding[7];
+    uint64_t total_bytes;       /*!< \brief Total bytes of the stream */
+    uint64_t elapsed_time;      /*!< \brief Time elapsed to receive data */
+    uint8_t  type;              /*!< \brief Type of message used in the test */
+    uint64_t magic;            /*!< \brief Magic byte written in the payload */
+    uint8_t  error;             /*!< \brief Error report */
+    uint8_t  reply_port;
+    uint8_t  mode;              /*!< \brief Session mode (stream or echo) */
+    uint8_t  src_id;            /*!< \brief Sender of a reported stream */
+    uint8_t  dst_id;            /*!< \brief Receiver of a reported stream */
+    uint8_t  check;             /*!< \brief magic is a pattern or a digest */
+    uint8_t  spare[89];
+} axiom_netperf_payload_t;
+
+/*! \brief Server side state of the session with one source node */
+typedef struct {
+    pthread_mutex_t lock;       /*!< \brief protects the session */
+    struct timespec start_ts;   /*!< \brief timestamp of the first byte */
+    struct timespec cur_ts;     /*!< \brief current timestamp */
+    uint64_t expected_bytes;    /*!< \brief total bytes that will be received */
+    uint64_t received_bytes;    /*!< \brief number of bytes received */
+    uint8_t reply_port;
+    uint8_t type;               /*!< \brief message type of the session */
+    uint8_t mode;               /*!< \brief session mode (stream or echo) */
+    uint8_t active;             /*!< \brief session started and not ended */
+} axnetperf_server_t;
+
+/*! \brief axiom-netperf server core */
+typedef struct {
+    axiom_dev_t *dev;           /*!< \brief device used to receive and reply */
+    int own_dev;                /*!< \brief dev opened by the core itself */
+    axiom_port_t port;          /*!< \brief port where the core receives */
+    int verbose;
+    int log_sessions;           /*!< \brief print start/end of the sessions */
+    pthread_mutex_t mutex;      /*!< \brief protects the fields below */
+    void *rdma_zone;            /*!< \brief RDMA zone (mapped on demand) */
+    uint64_t rdma_size;
+    unsigned int active;        /*!< \brief number of active sessions */
+    unsigned int num_threads;
+    pthread_t threads[AXNP_CORE_MAX_THREADS];
+    int stop_fd;                /*!< \brief eventfd that stops the threads (-1 if unused) */
+    axnetperf_server_t sessions[AXIOM_NODES_NUM];
+} axnetperf_core_t;
+
+/*!
+ * \brief Initialize a server core that uses an already bound device.
+ *
+ * \param core          The server core to initialize
+ * \param dev           The axiom device private data pointer
+ * \param verbose       Enable verbose output
+ */
+void axnetperf_core_init(axnetperf_core_t *core, axiom_dev_t *dev,
+        int verbose);
+
+/*!
+ * \brief Hand the server core off to dedicated receiver threads.
+ *
+ * A new axiom device is opened and bound to the port specified, so the
+ * netperf traffic does not go through the port of the caller.
+ *
+ * \param core          The server core to initialize
+ * \param port          Port where the netperf messages are received
+ * \param num_threads   Number of receiver threads
+ * \param verbose       Enable verbose output
+ *
+ * \return 0 on success, -1 otherwise
+ */
+int axnetperf_core_start(axnetperf_core_t *core, axiom_port_t port,
+        unsigned int num_threads, int verbose);
+
+/*!
+ * \brief Release the resources of a server core.
+ *
+ * The receiver threads started by axnetperf_core_start() are stopped and
+ * joined.
+ *
+ * \param core          The server core to release
+ */
+void axnetperf_core_release(axnetperf_core_t *core);
+
+/*!
+ * \brief Handle a netperf message received from a node.
+ *
+ * Sessions with different source nodes are independent and can be handled
+ * concurrently by several threads.
+ *
+ * \param core          The server core
+ * \param src           Source node of the message
+ * \param payload_size  Size of the payload
+ * \param payload       Payload of the message (axiom_netperf_payload_t)
+ */
+void axnetperf_core_handle(axnetperf_core_t *core, axiom_node_id_t src,
+        size_t payload_size, void *payload);
+
+/*!
+ * \brief Receiver thread: handle the messages received on the core device.
+ *
+ * The threads started by axnetperf_core_start() end when
+ * axnetperf_core_release() is called; the others never end.
+ *
+ * \param core          The server core (axnetperf_core_t *)
+ *
+ * \return AXIOM_RET_ERROR if a receive error occurs
+ */
+void *axnetperf_core_loop(void *core);
+
+#endif /* !AXIOM_NETPERF_SERVER_h */
@@ -123,3 +123,8 @@ AXIOM_APPS_INCLUDE_DIR := $(COMMKFILE_DIR)/include
 AXIOM_COMMON_CFLAGS := -I$(COMMKFILE_DIR)/axiom_common_library -I$(AXIOM_APPS_INCLUDE_DIR)
 AXIOM_COMMON_LDFLAGS := -L$(COMMKFILE_DIR)/axiom_common_library
 AXIOM_COMMON_LDLIBS := -laxiom_common
+
+# the netperf server core uses the common library: keep it after in LDLIBS
+AXIOM_NETPERF_CFLAGS := -I$(COMMKFILE_DIR)/axiom_netperf_library
+AXIOM_NETPERF_LDFLAGS := -L$(COMMKFILE_DIR)/axiom_netperf_library
+AXIOM_NETPERF_LDLIBS := -laxiom_netperf $(AXIOM_COMMON_LDLIBS)
@@ -23,6 +23,25 @@ extern "C" {
     /** Flag for axinit_execvpe: contact all axiom-init but not the self node axiom-init. */
 #define AXINIT_EXEC_NOSELF    0x02
 
+    /**
+     * Payload of the timed traceroute messages (AXIOM_CMD_TRACEROUTE and
+     * AXIOM_CMD_TRACEROUTE_REPLY).
+     * The first fields are the ones of axiom_traceroute_payload_t: a message
+     * of this size is a timed probe, axiom-init stamps its node id and its
+     * receive time in the reply and forwards the probe unchanged.
+     */
+    typedef struct {
+        uint8_t command;            /**< AXIOM_CMD_TRACEROUTE[_REPLY] */
+        axiom_node_id_t src_id;     /**< node that started the traceroute */
+        axiom_node_id_t dst_id;     /**< destination of the traceroute */
+        uint8_t step;               /**< hop index (1 for the first hop) */
+        uint16_t probe;             /**< probe id chosen by src_id */
+        axiom_if_id_t if_id;        /**< first hop interface of the probe */
+        axiom_node_id_t hop_id;     /**< node that sent the reply */
+        uint64_t send_ns;           /**< send time (src_id CLOCK_REALTIME) */
+        uint64_t hop_ns;            /**< receive time (hop_id CLOCK_REALTIME) */
+    } axinit_traceroute_payload_t;
+
     /**
      * Exec an application on a node.
      * The semantic of the filename, argv, envp parameters are the same of the system execvpe function.
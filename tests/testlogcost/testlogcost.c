@@ -0,0 +1,166 @@
+/*!
+ * \file testlogcost.c
+ *
+ * \version     v1.2
+ *
+ * Benchmark of the cost of the disabled log messages in a message dispatch
+ * loop like the one of the axiom-run receiver (master_receiver()).
+ * The Makefile builds it with all the log messages (testlogcost) and with
+ * the messages above LOG_INFO removed at compile time (testlogcost-info).
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "axiom_common.h"
+
+#define LOGZ_MASTER 0x02
+
+/* commands of the benchmark messages (as axiom-run) */
+#define CMD_EXIT           0x01
+#define CMD_SEND_TO_STDOUT 0x02
+#define CMD_SEND_TO_STDERR 0x03
+#define CMD_RPC            0x04
+
+#define CMD_TO_NAME(cmd) ((cmd)==CMD_EXIT?"CMD_EXIT":(cmd)==CMD_SEND_TO_STDOUT?"CMD_SEND_TO_STDOUT":\
+    (cmd)==CMD_SEND_TO_STDERR?"CMD_SEND_TO_STDERR":(cmd)==CMD_RPC?"CMD_RPC":"UNKNOWN")
+
+#define PAYLOAD_SIZE 120
+
+typedef struct {
+    uint8_t command;
+    uint8_t function;
+    int node;
+    size_t size;
+    char data[PAYLOAD_SIZE];
+} message_t;
+
+static struct option long_options[] = {
+    {"help", no_argument, 0, 'h'},
+    {"num", required_argument, 0, 'n'},
+    {"repeat", required_argument, 0, 'r'},
+    {0, 0, 0, 0}
+};
+
+static void usage(char *msg, ...) {
+    if (msg != NULL) {
+        va_list list;
+        va_start(list, msg);
+        vfprintf(stderr, msg, list);
+        va_end(list);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "usage: testlogcost [ -h ] [ -n NUM ] [ -r NUM ]\n");
+    fprintf(stderr, "Benchmark of the disabled log messages into a dispatch loop\n");
+    fprintf(stderr, "(the runtime level is set by AXIOM_LOG_LEVEL)\n");
+    fprintf(stderr, "-n, --num NUM      messages for every sample [default: 10000000]\n");
+    fprintf(stderr, "-r, --repeat NUM   samples [default: 5]\n");
+    fprintf(stderr, "-h, --help         this help\n");
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* output buffers of the nodes */
+static char out[16][PAYLOAD_SIZE * 4];
+static size_t outsz[16];
+
+/* the stdout/stderr redirection of master_receiver() */
+static void emit(message_t *msg) {
+    size_t *sz = &outsz[msg->node];
+    zlogmsg(LOG_TRACE, LOGZ_MASTER, "MASTER: emit %zu bytes from node %d", msg->size, msg->node);
+    if (*sz + msg->size > sizeof (out[0])) {
+        zlogmsg(LOG_DEBUG, LOGZ_MASTER, "MASTER: flush %zu bytes of node %d", *sz, msg->node);
+        *sz = 0;
+    }
+    memcpy(out[msg->node] + *sz, msg->data, msg->size);
+    *sz += msg->size;
+}
+
+/* one message of the receiver loop */
+static void dispatch(message_t *msg) {
+    if (logmsg_is_zenabled(LOG_TRACE, LOGZ_MASTER)) {
+        if (msg->command == CMD_RPC) {
+            zlogmsg(LOG_TRACE, LOGZ_MASTER, "MASTER: RECV_THREAD: received %zu bytes command 0x%02x '%s' function 0x%02x",
+                    msg->size, msg->command, CMD_TO_NAME(msg->command), msg->function);
+        } else {
+            zlogmsg(LOG_TRACE, LOGZ_MASTER, "MASTER: RECV_THREAD: received %zu bytes command 0x%02x '%s'",
+                    msg->size, msg->command, CMD_TO_NAME(msg->command));
+        }
+    }
+    switch (msg->command) {
+        case CMD_SEND_TO_STDOUT:
+        case CMD_SEND_TO_STDERR:
+            emit(msg);
+            break;
+        case CMD_RPC:
+            zlogmsg(LOG_DEBUG, LOGZ_MASTER, "MASTER: received CMD_RPC function 0x%02x", msg->function);
+            break;
+        default:
+            zlogmsg(LOG_INFO, LOGZ_MASTER, "MASTER: received command 0x%02x from %d", msg->command, msg->node);
+            break;
+    }
+}
+
+int main(int argc, char **argv) {
+    static message_t msgs[64];
+    uint64_t t0, t1, best = UINT64_MAX;
+    long num = 10000000, i;
+    int repeat = 5, r, opt;
+
+    while ((opt = getopt_long(argc, argv, "hn:r:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                num = atol(optarg);
+                if (num <= 0) {
+                    usage("bad number of messages");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                if (repeat <= 0) {
+                    usage("bad number of samples");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'h':
+            default:
+                usage(NULL);
+                return EXIT_FAILURE;
+        }
+    }
+
+    logmsg_init();
+    /* mostly output redirection, as the receiver of a running application */
+    for (i = 0; i < 64; i++) {
+        msgs[i].command = (i % 16 == 0) ? CMD_RPC : (i % 4 == 0) ? CMD_SEND_TO_STDERR : CMD_SEND_TO_STDOUT;
+        msgs[i].node = i % 16;
+        msgs[i].size = 16 + (i * 7) % (PAYLOAD_SIZE - 16);
+        memset(msgs[i].data, 'a' + i % 26, PAYLOAD_SIZE);
+    }
+
+    for (r = 0; r < repeat; r++) {
+        t0 = now_ns();
+        for (i = 0; i < num; i++) {
+            dispatch(&msgs[i & 63]);
+        }
+        t1 = now_ns();
+        if (t1 - t0 < best) best = t1 - t0;
+    }
+    printf("build level %d runtime level %d: %.2f ns/message\n",
+            (int) AXIOM_LOG_BUILD_LEVEL, logmsg_level, (double) best / num);
+    logmsg_flush();
+
+    return EXIT_SUCCESS;
+}
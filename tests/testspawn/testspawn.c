@@ -0,0 +1,142 @@
+/*!
+ * \file testspawn.c
+ *
+ * \version     v1.2
+ *
+ * Benchmark of the process creation of daemonize(): latency of fork() and of
+ * posix_spawn() as a function of the resident memory of the parent.
+ *
+ * Copyright (C) 2017, Evidence Srl.
+ * Terms of use are as specified in COPYING
+ */
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "axiom_common.h"
+
+static struct option long_options[] = {
+    {"help", no_argument, 0, 'h'},
+    {"num", required_argument, 0, 'n'},
+    {"sizes", required_argument, 0, 's'},
+    {"exec", required_argument, 0, 'e'},
+    {0, 0, 0, 0}
+};
+
+static void usage(char *msg, ...) {
+    if (msg != NULL) {
+        va_list list;
+        va_start(list, msg);
+        vfprintf(stderr, msg, list);
+        va_end(list);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "usage: testspawn [ -h ] [ -n NUM ] [ -s MB,... ] [ -e EXEC ]\n");
+    fprintf(stderr, "Benchmark of the process creation of daemonize() (fork and posix_spawn)\n");
+    fprintf(stderr, "as a function of the resident memory of the parent\n");
+    fprintf(stderr, "-n, --num NUM      processes created for every sample [default: 100]\n");
+    fprintf(stderr, "-s, --sizes MB,... memory allocated by the parent [default: 0,64,256,1024]\n");
+    fprintf(stderr, "-e, --exec EXEC    program executed [default: /bin/true]\n");
+    fprintf(stderr, "-h, --help         this help\n");
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static long rss_mb(void) {
+    long size, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%ld %ld", &size, &resident) != 2) resident = 0;
+        fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+/* time of daemonize() (the parent is blocked) and until the exit of the child */
+static int sample(char *mode, char *exec, int num, long rss) {
+    uint64_t t0, t1, t2, call = 0, call_min = UINT64_MAX, call_max = 0, total = 0;
+    char *args[] = {exec, NULL};
+    pid_t pid;
+    int i, status;
+
+    setenv("AXIOM_DAEMONIZE", mode, 1);
+    for (i = 0; i < num; i++) {
+        t0 = now_ns();
+        pid = daemonize(NULL, exec, args, NULL, NULL, 0, 0, NULL);
+        t1 = now_ns();
+        if (pid <= 0) {
+            fprintf(stderr, "daemonize() failure\n");
+            return -1;
+        }
+        waitpid(pid, &status, 0);
+        t2 = now_ns();
+        call += t1 - t0;
+        total += t2 - t0;
+        if (t1 - t0 < call_min) call_min = t1 - t0;
+        if (t1 - t0 > call_max) call_max = t1 - t0;
+    }
+    printf("%8ld %-6s %10.1f %10.1f %10.1f %10.1f\n", rss, mode,
+            call / 1000.0 / num, call_min / 1000.0, call_max / 1000.0, total / 1000.0 / num);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char *sizes = "0,64,256,1024", *exec = "/bin/true", *p, *mem;
+    int num = 100;
+    long mb;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "hn:s:e:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                num = atoi(optarg);
+                if (num <= 0) {
+                    usage("bad number of processes");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                sizes = optarg;
+                break;
+            case 'e':
+                exec = optarg;
+                break;
+            case 'h':
+            default:
+                usage(NULL);
+                return EXIT_FAILURE;
+        }
+    }
+
+    printf("%8s %-6s %10s %10s %10s %10s\n", "RSS(MB)", "MODE", "CALL(us)", "MIN", "MAX", "EXIT(us)");
+    for (p = sizes; p != NULL && *p != '\0'; p = strchr(p, ',') != NULL ? strchr(p, ',') + 1 : NULL) {
+        mb = atol(p);
+        mem = NULL;
+        if (mb > 0) {
+            /* touch the memory: it is resident and mapped in the page tables */
+            mem = malloc(mb * 1024 * 1024);
+            if (mem == NULL) {
+                fprintf(stderr, "malloc() of %ld MB failure\n", mb);
+                return EXIT_FAILURE;
+            }
+            memset(mem, 0xaa, mb * 1024 * 1024);
+        }
+        if (sample("fork", exec, num, rss_mb()) || sample("spawn", exec, num, rss_mb())) {
+            return EXIT_FAILURE;
+        }
+        free(mem);
+    }
+
+    return EXIT_SUCCESS;
+}